@@ -0,0 +1,312 @@
+/*
+
+Bias subtraction for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  bias subtracted, trimmed frames straight from the readout.  With a
+  Serial Post Scan each amplifier reads that many pixels past the end
+  of every line, which saw no light and so hold the line's bias, and
+  a Parallel Post Scan adds as many lines at the end of the frame.
+
+    si_calib_start()    before each frame, the plan and the overscan
+    si_calib_total()    input pixels in a frame, overscan and all
+    si_calib_execute()  as the input arrives, in order
+    si_calib_end()      each amp's mean bias over the frame
+    si_calib_free()
+
+  si_calib_camera() does the lot for a whole readout of a camera,
+  trimming only.
+
+  A line is done once its overscan is in.  Each amp's bias for it is
+  taken from its overscan pixels, the median and then the mean of
+  those within 4 median deviations of it, so a cosmic ray or a hot
+  column in the overscan is left out.  The line then goes through
+  si_dinter_execute_level(), which takes that off, adds pedestal back
+  so the noise is not cut off at 0, and writes the pixels where they
+  go in the same vector pass that deinterlaces them.  The overscan
+  itself, and the parallel overscan lines, are never written, so the
+  image comes out trimmed.  Lines are shared out over the worker pool.
+
+  With subtract 0, or no serial overscan to take the bias from, the
+  frame is only trimmed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "dinter.h"
+#include "pool.h"
+#include "calib.h"
+
+struct CALIB_JOB {
+  struct SI_CALIB *cal;
+  unsigned short *from;  /* input of line r0 */
+  unsigned short *to;
+  long r0;               /* first and number of lines */
+  long nrows;
+  int nbands;
+  struct SI_DINTER_STATS *stats;  /* one for each band, or NULL */
+};
+
+/* a frame of rows lines of p each followed by serpost groups of
+   overscan, then parpost lines of overscan.  0, or -1 if out of memory
+*/
+
+int si_calib_start( struct SI_CALIB *cal, struct SI_DINTER_PLAN *p,
+                    long rows, int serpost, int parpost )
+{
+  unsigned short *bias;
+  long n;
+
+  if( rows < 0 || serpost < 0 || parpost < 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  n = rows*p->nlanes;
+  if( n > cal->alloc ) {
+    if( !(bias = realloc( cal->bias, n*sizeof(short))))
+      return -1;
+    cal->bias = bias;
+    cal->alloc = n;
+  }
+  bzero( cal->bias, n*sizeof(short));
+  bzero( cal->mean, sizeof(cal->mean));
+  cal->p = p;
+  cal->rows = rows;
+  cal->serpost = serpost;
+  cal->parpost = parpost;
+  cal->done = 0;
+  return 0;
+}
+
+long si_calib_total( struct SI_CALIB *cal )
+{
+  return (cal->rows + cal->parpost) *
+         (cal->p->run + cal->serpost) * cal->p->nlanes;
+}
+
+static int calib_cmp( const void *a, const void *b )
+{
+  return *(unsigned short *)a - *(unsigned short *)b;
+}
+
+/* one amp's bias from n overscan pixels, stride apart.  Once they are
+   sorted the deviations from the median rise both ways from it, so
+   the median deviation is found by walking out from the middle, and
+   the pixels kept are a run of them
+*/
+
+static int calib_level( unsigned short *src, int stride, int n )
+{
+  unsigned short v[SI_CALIB_MAXSCAN], t;
+  unsigned long sum;
+  int i, j, k, c, m, mad, lim;
+
+  if( n < 1 )
+    return 0;
+  if( n > SI_CALIB_MAXSCAN )
+    n = SI_CALIB_MAXSCAN;
+  for( i=0; i<n; i++ )
+    v[i] = src[i*stride];
+  if( n > 64 )
+    qsort( v, n, sizeof(short), calib_cmp );
+  else {
+    for( i=1; i<n; i++ ) {  /* a few dozen, insertion is quicker */
+      t = v[i];
+      for( j=i; j>0 && v[j-1] > t; j-- )
+        v[j] = v[j-1];
+      v[j] = t;
+    }
+  }
+  k = (n - 1)/2;
+  m = v[k];
+
+  i = k;
+  j = k + 1;
+  mad = 0;
+  for( c=0; c<=k; c++ ) {
+    if( j >= n || m - v[i] <= v[j] - m )
+      mad = m - v[i--];
+    else
+      mad = v[j++] - m;
+  }
+  lim = mad ? 4*mad : 1;
+
+  for( i=k; i>0 && m - v[i-1] <= lim; i-- )
+    ;
+  for( j=k+1; j<n && v[j] - m <= lim; j++ )
+    ;
+  sum = 0;
+  for( c=i; c<j; c++ )
+    sum += v[c];
+  return (2*sum + (j - i))/(2*(j - i));
+}
+
+/* lines of band i, each bias first and then the pixels */
+
+static void calib_band( void *v, int i )
+{
+  struct CALIB_JOB *j = v;
+  struct SI_CALIB *cal = j->cal;
+  struct SI_DINTER_PLAN *p = cal->p;
+  unsigned short *src, *bias;
+  long a, b, r, line, row;
+  int level[SI_DINTER_MAXLANES], k, sub;
+
+  a = j->r0 + j->nrows*i/j->nbands;
+  b = j->r0 + j->nrows*(i+1)/j->nbands;
+  row = p->run * p->nlanes;
+  line = row + (long)cal->serpost * p->nlanes;
+  sub = cal->subtract && cal->serpost > 0;
+
+  for( r=a; r<b; r++ ) {
+    src = j->from + (r - j->r0)*line;
+    if( sub ) {
+      bias = cal->bias + r*p->nlanes;
+      for( k=0; k<p->nlanes; k++ ) {
+        bias[k] = calib_level( src + row + k, p->nlanes, cal->serpost );
+        level[k] = cal->pedestal - bias[k];
+      }
+    }
+    si_dinter_execute_level( p, src, j->to, r*row, row,
+                             j->stats ? &j->stats[i] : NULL,
+                             sub ? level : NULL );
+  }
+}
+
+/* the lines from, which holds the frame from input pixel start on,
+   completes, into to.  The input from the end of the last whole line
+   on must still be there before from, as it is in the dma buffers.
+   The image pixels are counted into s, started with
+   si_dinter_stats_start(), unless it is NULL
+*/
+
+void si_calib_execute( struct SI_CALIB *cal, unsigned short *from,
+                       unsigned short *to, long start, long len,
+                       struct SI_DINTER_STATS *s )
+{
+  struct SI_DINTER_PLAN *p = cal->p;
+  struct CALIB_JOB j;
+  long line, r1;
+  int i;
+
+  line = (p->run + cal->serpost) * p->nlanes;
+  r1 = (start + len) / line;
+  if( r1 > cal->rows )
+    r1 = cal->rows;  /* the parallel overscan is left out */
+
+  j.cal = cal;
+  j.from = from - (start - cal->done);
+  j.to = to;
+  j.r0 = cal->done / line;
+  j.nrows = r1 - j.r0;
+  if( j.nrows <= 0 )
+    return;
+  j.nbands = 4*si_pool_size();
+  if( j.nbands > j.nrows )
+    j.nbands = j.nrows;
+  if( p->overlap )  /* see si_dinter_execute_par */
+    j.nbands = 1;
+
+  j.stats = NULL;
+  if( s && j.nbands > 1 &&
+      !(j.stats = malloc( j.nbands*sizeof(*j.stats))))
+    j.nbands = 1;
+  for( i=0; j.stats && i<j.nbands; i++ )
+    si_dinter_stats_start( &j.stats[i], s->namps, s->saturation );
+  if( !j.stats && s ) {
+    j.stats = s;  /* one band counts straight into s */
+    j.nbands = 1;
+  }
+
+  if( j.nbands > 1 )
+    si_pool_run( calib_band, &j, j.nbands );
+  else
+    calib_band( &j, 0 );
+
+  for( i=0; j.stats != s && i<j.nbands; i++ )
+    si_dinter_stats_merge( s, &j.stats[i] );
+  if( j.stats != s )
+    free( j.stats );
+  cal->done = r1*line;
+}
+
+/* each amp's bias over the lines done, into cal->mean */
+
+void si_calib_end( struct SI_CALIB *cal )
+{
+  struct SI_DINTER_PLAN *p = cal->p;
+  double sum;
+  long r, rows;
+  int k;
+
+  rows = cal->done / ((p->run + cal->serpost) * p->nlanes);
+  bzero( cal->mean, sizeof(cal->mean));
+  if( !cal->subtract || cal->serpost == 0 || rows == 0 )
+    return;
+  for( k=0; k<p->nlanes; k++ ) {
+    sum = 0.0;
+    for( r=0; r<rows; r++ )
+      sum += cal->bias[r*p->nlanes + k];
+    cal->mean[k] = sum/rows;
+  }
+}
+
+void si_calib_free( struct SI_CALIB *cal )
+{
+  free( cal->bias );
+  cal->bias = NULL;
+  cal->alloc = 0;
+}
+
+/* a whole readout of c at from, overscan and all as
+   si_camera_frame_bytes() has it, into to by p from si_camera_plan().
+   The overscan is trimmed off and the bias left on, as it was read.
+   0, or -1 if out of memory
+*/
+
+int si_calib_camera( struct SI_CAMERA *c, struct SI_DINTER_PLAN *p,
+                     unsigned short *from, unsigned short *to )
+{
+  struct SI_CALIB cal;
+  int serlen, parlen, serpost, parpost;
+
+  serlen = c->readout[READOUT_SERLEN_IX];
+  parlen = c->readout[READOUT_PARLEN_IX];
+  serpost = c->readout[READOUT_SERPOST_IX];
+  parpost = c->readout[READOUT_PARPOST_IX];
+  if( !serpost && !parpost ) {
+    si_dinter_execute_par( p, from, to, 0, (long)p->nlanes*serlen*parlen );
+    return 0;
+  }
+
+  bzero( &cal, sizeof(cal));
+  if( si_calib_start( &cal, p, parlen, serpost, parpost ) < 0 )
+    return -1;
+  si_calib_execute( &cal, from, to, 0, si_calib_total( &cal ), NULL );
+  si_calib_free( &cal );
+  return 0;
+}
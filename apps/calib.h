@@ -0,0 +1,10 @@
+int si_calib_start( struct SI_CALIB *cal, struct SI_DINTER_PLAN *p,
+                    long rows, int serpost, int parpost );
+long si_calib_total( struct SI_CALIB *cal );
+void si_calib_execute( struct SI_CALIB *cal, unsigned short *from,
+                       unsigned short *to, long start, long len,
+                       struct SI_DINTER_STATS *s );
+void si_calib_end( struct SI_CALIB *cal );
+void si_calib_free( struct SI_CALIB *cal );
+int si_calib_camera( struct SI_CAMERA *c, struct SI_DINTER_PLAN *p,
+                     unsigned short *from, unsigned short *to );
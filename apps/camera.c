@@ -0,0 +1,898 @@
+/*
+
+Camera access library for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  open, configure and read frames from a camera through a backend
+  chosen by the spec string given to si_camera_open()
+
+    /dev/sicameraN         the driver, also device:/dev/sicameraN
+    replay:FILE[,RATE]     recording or raw dma stream read from FILE,
+                           looping at the end
+    synth:PATTERN[,RATE]   generated frames, PATTERN is ramp, flat or noise
+    emu:OPTIONS            camera emulator on a pty, see emu.c for OPTIONS,
+                           with synth:ramp for the dma
+    tty:PATH               camera, or si-emu, on a serial line, synth:ramp
+                           for the dma
+
+  RATE is MBytes/sec, or xN for N times the fiber rate, 0 for as fast
+  as possible.  The default is the fiber rate.  A recording made by
+  record.c plays back with its recorded timing, there RATE is a speed
+  factor, N or xN, and 0 is as fast as possible.
+
+  A frame is taken with si_camera_start() then si_camera_next_buffer()
+  until it returns 0.  Each call hands back the next completed piece
+  of the mapped image.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "lib.h"
+#include "camera.h"
+#include "record.h"
+#include "emu.h"
+
+#define SI_LINK_RATE 64.0         /* MBytes/sec on the fiber */
+#define SI_CAMERA_BUFLEN (1024*1024) /* power of 2 makes it easy to mmap */
+#define SI_CAMERA_MAXEVER (32*1024*1024)
+#define SI_CAMERA_TIMEOUT 10000
+
+/* state of the replay and synthetic backends */
+
+#define SYNTH_RAMP  0
+#define SYNTH_FLAT  1
+#define SYNTH_NOISE 2
+
+struct SI_STREAM {
+  double rate;           /* bytes per second, 0 for no delay */
+  double t0;             /* time the first pixel leaves the camera */
+  int armed;             /* image command received */
+  int pattern;           /* synth pattern */
+  unsigned short *frame; /* synth frame, generated at dma config */
+  FILE *fp;              /* replay source */
+  char *fname;
+
+  struct SI_RECORD_HEADER hdr;   /* replay of a recording */
+  struct SI_RECORD_ENTRY *index;
+  int nindex;
+  int cur;               /* next entry to play */
+  double speed;          /* 1 plays at recorded timing, 0 no delay */
+
+  struct SI_EMU emu;     /* the simulated camera, or a copy that
+                            follows the one on the uart */
+  int pid;               /* emulator process for emu: */
+};
+
+static int dev_open( struct SI_CAMERA *c, char *arg );
+static void dev_close( struct SI_CAMERA *c );
+static int dev_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv );
+static int dev_dma_init( struct SI_CAMERA *c );
+static void dev_dma_free( struct SI_CAMERA *c, int release );
+static int dev_dma_start( struct SI_CAMERA *c );
+static int dev_dma_next( struct SI_CAMERA *c );
+static int dev_dma_abort( struct SI_CAMERA *c );
+
+static int replay_open( struct SI_CAMERA *c, char *arg );
+static int synth_open( struct SI_CAMERA *c, char *arg );
+static void stream_close( struct SI_CAMERA *c );
+static int stream_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                          int nrecv, int *recv );
+static int emu_open( struct SI_CAMERA *c, char *arg );
+static int tty_open( struct SI_CAMERA *c, char *arg );
+static void tty_close( struct SI_CAMERA *c );
+static int tty_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv );
+static int stream_dma_init( struct SI_CAMERA *c );
+static void stream_dma_free( struct SI_CAMERA *c, int release );
+static int stream_dma_start( struct SI_CAMERA *c );
+static int stream_dma_next( struct SI_CAMERA *c );
+static int record_dma_next( struct SI_CAMERA *c );
+static int stream_dma_abort( struct SI_CAMERA *c );
+
+static struct SI_BACKEND backends[] = {
+  { "device", dev_open, dev_close, dev_serial, dev_dma_init, dev_dma_free,
+    dev_dma_start, dev_dma_next, dev_dma_abort },
+  { "replay", replay_open, stream_close, stream_serial, stream_dma_init,
+    stream_dma_free, stream_dma_start, stream_dma_next, stream_dma_abort },
+  { "synth", synth_open, stream_close, stream_serial, stream_dma_init,
+    stream_dma_free, stream_dma_start, stream_dma_next, stream_dma_abort },
+  { "emu", emu_open, tty_close, tty_serial, stream_dma_init,
+    stream_dma_free, stream_dma_start, stream_dma_next, stream_dma_abort },
+  { "tty", tty_open, tty_close, tty_serial, stream_dma_init,
+    stream_dma_free, stream_dma_start, stream_dma_next, stream_dma_abort },
+};
+
+#define NBACKENDS (sizeof(backends)/sizeof(backends[0]))
+
+/* monotonic time in seconds */
+
+double si_camera_time( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+/* sleep until monotonic time t */
+
+void si_camera_sleep_until( double t )
+{
+  double dt;
+  struct timespec ts;
+
+  dt = t - si_camera_time();
+  if( dt <= 0.0 )
+    return;
+  ts.tv_sec = (time_t)dt;
+  ts.tv_nsec = (long)((dt - (double)ts.tv_sec) * 1.0e9);
+  while( nanosleep( &ts, &ts ) < 0 && errno == EINTR )
+    ;
+}
+
+/* parse RATE of a spec, returns bytes per second */
+
+double si_camera_parse_rate( char *s )
+{
+  if( !s || !*s )
+    return SI_LINK_RATE * 1.0e6;
+  if( *s == 'x' || *s == 'X' )
+    return atof( s+1 ) * SI_LINK_RATE * 1.0e6;
+  return atof( s ) * 1.0e6;
+}
+
+/* open a camera, see the top of this file for spec */
+
+int si_camera_open( struct SI_CAMERA *c, char *spec )
+{
+  struct SI_BACKEND *be;
+  char *arg;
+  int i, len;
+
+  c->fd = -1;
+  be = &backends[0];
+  arg = spec;
+
+  for( i=0; i<NBACKENDS; i++ ) {
+    len = strlen( backends[i].name );
+    if( strncmp( spec, backends[i].name, len ) == 0 && spec[len] == ':' ) {
+      be = &backends[i];
+      arg = spec + len + 1;
+      break;
+    }
+  }
+
+  c->backend = be;
+  if( be->open( c, arg ) < 0 ) {
+    c->backend = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void si_camera_close( struct SI_CAMERA *c )
+{
+  if( !c->backend )
+    return;
+
+  si_camera_dma_free( c );
+  c->backend->close( c );
+  c->backend = NULL;
+}
+
+/* send a camera command over the uart,
+   nsend ints follow the command and nrecv ints are read back.
+   returns 1 for Y, 0 for N, -1 on error
+*/
+
+int si_camera_command( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv )
+{
+  return c->backend->serial( c, cmd, nsend, send, nrecv, recv );
+}
+
+/* true if camera command cmd answers Y/N */
+
+int si_camera_command_yn( int cmd )
+{
+  return strchr( "ST0PM", cmd ) == NULL;
+}
+
+int si_camera_send_readout( struct SI_CAMERA *c )
+{
+  if( si_camera_command( c, 'F', SI_READOUT_MAX, c->readout, 0, NULL ) != 1 )
+    return -1;
+  return 0;
+}
+
+int si_camera_load_readout( struct SI_CAMERA *c )
+{
+  if( si_camera_command( c, 'H', 0, NULL, SI_READOUT_MAX, c->readout ) != 1 )
+    return -1;
+  return 0;
+}
+
+int si_camera_load_config( struct SI_CAMERA *c )
+{
+  if( si_camera_command( c, 'L', 0, NULL, SI_CONFIG_MAX, c->config ) != 1 )
+    return -1;
+  return 0;
+}
+
+int si_camera_load_status( struct SI_CAMERA *c )
+{
+  if( si_camera_command( c, 'I', 0, NULL, SI_STATUS_MAX, c->status ) != 1 )
+    return -1;
+  return 0;
+}
+
+/* bytes in one image for the current readout parameters */
+
+int si_camera_frame_bytes( struct SI_CAMERA *c )
+{
+  int serlen, parlen;
+
+  /* each line runs on into the serial overscan, and the frame into
+     the parallel overscan
+  */
+  serlen = c->readout[READOUT_SERLEN_IX] + c->readout[READOUT_SERPOST_IX];
+  parlen = c->readout[READOUT_PARLEN_IX] + c->readout[READOUT_PARPOST_IX];
+
+  /* 2 bytes per short, 4 quadrants unless the cfg file's layout
+     says otherwise
+  */
+  return serlen*parlen*2*(c->namps ? c->namps : 4);
+}
+
+/* configure the dma and map the image.
+   0 for buflen, timeout or config picks the usual values
+*/
+
+int si_camera_dma_config( struct SI_CAMERA *c, int total, int buflen,
+                          int timeout, int config )
+{
+  int maxever, realloc;
+
+  if( total <= 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  if( buflen <= 0 )
+    buflen = SI_CAMERA_BUFLEN;
+  if( timeout <= 0 )
+    timeout = SI_CAMERA_TIMEOUT;
+  if( !config )
+    config = SI_DMA_CONFIG_WAKEUP_ONEND;
+
+  /* the driver keeps its memory until freed, reuse it if it fits */
+
+  maxever = c->dma_config.maxever;
+  realloc = total > maxever || buflen != c->dma_config.buflen;
+  if( c->ptr )
+    c->backend->dma_free( c, realloc );
+  if( realloc )
+    maxever = total > SI_CAMERA_MAXEVER ? total : SI_CAMERA_MAXEVER;
+
+  c->dma_config.total = total;
+  c->dma_config.buflen = buflen;
+  c->dma_config.timeout = timeout;
+  c->dma_config.maxever = maxever;
+  c->dma_config.config = config;
+  c->nbufs = (total + buflen - 1) / buflen;
+
+  if( c->backend->dma_init( c ) < 0 ) {
+    c->ptr = NULL;
+    return -1;
+  }
+  c->dma_configed = 1;
+  return 0;
+}
+
+/* unmap and give back the dma memory */
+
+void si_camera_dma_free( struct SI_CAMERA *c )
+{
+  if( c->ptr )
+    c->backend->dma_free( c, 1 );
+  c->ptr = NULL;
+  c->dma_active = 0;
+  c->dma_configed = 0;
+  bzero( &c->dma_config, sizeof(struct SI_DMA_CONFIG));
+}
+
+/* start the dma and send image command cmd, 0 for none */
+
+int si_camera_start( struct SI_CAMERA *c, int cmd )
+{
+  if( !c->dma_configed ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  bzero( &c->dma_status, sizeof(struct SI_DMA_STATUS));
+  c->consumed = 0;
+  c->frame++;
+  c->start_time = si_camera_time();
+  c->dma_time = c->start_time;
+
+  if( c->backend->dma_start( c ) < 0 )
+    return -1;
+  c->dma_active = 1;
+
+  if( cmd && si_camera_command( c, cmd, 0, NULL, 0, NULL ) != 1 ) {
+    si_camera_abort( c );
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+/* hand out the next completed buffer of the frame.
+   returns 1 with b filled in, 0 when the frame is complete,
+   -1 on error or timeout
+*/
+
+int si_camera_next_buffer( struct SI_CAMERA *c, struct SI_BUFFER *b )
+{
+  int len, left;
+
+  while( c->consumed >= c->dma_status.transferred ) {
+    if( c->dma_status.status & SI_DMA_STATUS_DONE ) {
+      c->dma_active = 0;
+      return 0;
+    }
+    if( c->backend->dma_next( c ) < 0 ) {
+      c->dma_active = 0;
+      return -1;
+    }
+    c->dma_time = si_camera_time();
+  }
+
+  len = c->dma_config.buflen - (c->consumed % c->dma_config.buflen);
+  left = c->dma_status.transferred - c->consumed;
+  if( len > left )
+    len = left;
+
+  b->data = c->ptr + c->consumed/sizeof(short);
+  b->offset = c->consumed;
+  b->len = len;
+  b->index = c->consumed / c->dma_config.buflen;
+  b->time = c->dma_time;
+  b->status = c->dma_status.status;
+
+  c->consumed += len;
+  b->last = (c->dma_status.status & SI_DMA_STATUS_DONE) &&
+            c->consumed >= c->dma_status.transferred;
+
+  if( c->record && si_record_buffer( c, b ) < 0 ) {
+    perror("record");
+    si_record_stop( c );
+  }
+  return 1;
+}
+
+/* start, then wait for the whole frame */
+
+int si_camera_acquire( struct SI_CAMERA *c, int cmd )
+{
+  struct SI_BUFFER b;
+  int ret;
+
+  if( si_camera_start( c, cmd ) < 0 )
+    return -1;
+
+  while( (ret = si_camera_next_buffer( c, &b )) > 0 )
+    ;
+  return ret;
+}
+
+int si_camera_abort( struct SI_CAMERA *c )
+{
+  int ret;
+
+  ret = c->backend->dma_abort( c );
+  c->dma_active = 0;
+  return ret;
+}
+
+/* device backend, the si3097 driver */
+
+static int dev_open( struct SI_CAMERA *c, char *arg )
+{
+  if( (c->fd = open( arg, O_RDWR, 0 )) < 0 )
+    return -1;
+
+  si_init_com( c->fd, 57600, 0, 8, 1, 9000 ); /* setup uart for camera */
+  return 0;
+}
+
+static void dev_close( struct SI_CAMERA *c )
+{
+  close( c->fd );
+  c->fd = -1;
+}
+
+static int dev_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv )
+{
+  if( si_send_command( c->fd, cmd ) < 0 )
+    return -1;
+  if( nsend && si_send_n_ints( c->fd, nsend, send ) < 0 )
+    return -1;
+  if( nrecv && si_receive_n_ints( c->fd, nrecv, recv ) < 0 )
+    return -1;
+  if( !si_camera_command_yn( cmd ) )
+    return 1;
+  return si_expect_yn( c->fd );
+}
+
+static int dev_dma_init( struct SI_CAMERA *c )
+{
+  void *p;
+
+  if( ioctl( c->fd, SI_IOCTL_DMA_INIT, &c->dma_config ) < 0 )
+    return -1;
+
+  p = mmap( 0, c->dma_config.maxever, PROT_READ, MAP_SHARED, c->fd, 0 );
+  if( p == MAP_FAILED )
+    return -1;
+
+  c->ptr = (unsigned short *)p;
+  return 0;
+}
+
+static void dev_dma_free( struct SI_CAMERA *c, int release )
+{
+  if( munmap( c->ptr, c->dma_config.maxever ) )
+    perror("munmap");
+  c->ptr = NULL;
+
+  if( release && ioctl( c->fd, SI_IOCTL_FREEMEM, NULL ) < 0 )
+    perror("freemem");
+}
+
+static int dev_dma_start( struct SI_CAMERA *c )
+{
+  return ioctl( c->fd, SI_IOCTL_DMA_START, &c->dma_status );
+}
+
+static int dev_dma_next( struct SI_CAMERA *c )
+{
+  return ioctl( c->fd, SI_IOCTL_DMA_NEXT, &c->dma_status );
+}
+
+static int dev_dma_abort( struct SI_CAMERA *c )
+{
+  return ioctl( c->fd, SI_IOCTL_DMA_ABORT, &c->dma_status );
+}
+
+/* replay and synthetic backends */
+
+static struct SI_STREAM *stream_new( char *arg, char **rest, char **rate )
+{
+  struct SI_STREAM *s;
+  char *comma;
+
+  if( !(s = calloc( 1, sizeof(*s))))
+    return NULL;
+
+  si_emu_init( &s->emu );
+
+  *rest = strdup( arg );
+  *rate = NULL;
+  if( (comma = strchr( *rest, ',' )) ) {
+    *comma++ = 0;
+    *rate = comma;
+  }
+  s->rate = si_camera_parse_rate( *rate );
+  return s;
+}
+
+static int replay_open( struct SI_CAMERA *c, char *arg )
+{
+  struct SI_STREAM *s;
+  char *fname, *rate;
+
+  if( !(s = stream_new( arg, &fname, &rate )))
+    return -1;
+
+  if( !(s->fp = fopen( fname, "r" ))) {
+    free( fname );
+    free( s );
+    return -1;
+  }
+  s->fname = fname;
+  c->backend_data = s;
+
+  /* a recording, otherwise raw data */
+
+  s->nindex = si_record_load( fileno( s->fp ), &s->hdr, &s->index );
+  if( s->nindex < 0 ) {
+    s->nindex = 0;
+    return 0;
+  }
+  if( s->nindex == 0 ) {
+    fprintf( stderr, "%s: recording is empty\n", fname );
+    stream_close( c );
+    errno = EINVAL;
+    return -1;
+  }
+  if( !rate )
+    s->speed = 1.0;
+  else if( *rate == 'x' || *rate == 'X' )
+    s->speed = atof( rate+1 );
+  else
+    s->speed = atof( rate );
+  memcpy( s->emu.readout, s->hdr.readout, sizeof(s->emu.readout));
+  return 0;
+}
+
+static int synth_open( struct SI_CAMERA *c, char *arg )
+{
+  struct SI_STREAM *s;
+  char *pattern, *rate;
+
+  if( !(s = stream_new( arg, &pattern, &rate )))
+    return -1;
+
+  if( !*pattern || strcmp( pattern, "ramp" ) == 0 )
+    s->pattern = SYNTH_RAMP;
+  else if( strcmp( pattern, "flat" ) == 0 )
+    s->pattern = SYNTH_FLAT;
+  else if( strcmp( pattern, "noise" ) == 0 )
+    s->pattern = SYNTH_NOISE;
+  else {
+    fprintf( stderr, "unknown synth pattern %s\n", pattern );
+    free( pattern );
+    free( s );
+    errno = EINVAL;
+    return -1;
+  }
+  free( pattern );
+  c->backend_data = s;
+  return 0;
+}
+
+static void stream_close( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+
+  if( s->fp )
+    fclose( s->fp );
+  free( s->fname );
+  free( s->index );
+  free( s );
+  c->backend_data = NULL;
+}
+
+/* the camera end of the uart is the emulator, the image commands
+   also arm the dma
+*/
+
+static int stream_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                          int nrecv, int *recv )
+{
+  struct SI_STREAM *s = c->backend_data;
+  int ret;
+
+  ret = si_emu_command( &s->emu, cmd, nsend, send, nrecv, recv );
+  if( ret != 1 )
+    return ret;
+
+  switch( cmd ) {
+    case 'D': /* exposed image */
+    case 'E': /* dark image */
+      s->armed = 1;
+      if( !s->index ) /* a recording keeps its own timing */
+        s->t0 = si_camera_time() + s->emu.readout[8] * 1.0e-3;
+      break;
+    case 'C': /* test image */
+    case 'Z': /* tdi image */
+      s->armed = 1;
+      if( !s->index )
+        s->t0 = si_camera_time();
+      break;
+    case '0': /* abort readout */
+      s->armed = 0;
+      break;
+  }
+  return 1;
+}
+
+/* emulator and tty backends, the uart goes through lib.c like the
+   device backend, the dma is synth:ramp
+*/
+
+static int emu_open( struct SI_CAMERA *c, char *arg )
+{
+  struct SI_STREAM *s;
+
+  if( !(s = calloc( 1, sizeof(*s))))
+    return -1;
+
+  si_emu_init( &s->emu );
+  if( si_emu_options( &s->emu, arg ) < 0 ) {
+    free( s );
+    return -1;
+  }
+  s->emu.e_readout = c->e_readout;
+  s->emu.e_config = c->e_config;
+  s->rate = si_camera_parse_rate( NULL );
+  s->pattern = SYNTH_RAMP;
+
+  if( (c->fd = si_emu_spawn( &s->emu, &s->pid )) < 0 ) {
+    free( s );
+    return -1;
+  }
+  c->backend_data = s;
+  return 0;
+}
+
+static int tty_open( struct SI_CAMERA *c, char *arg )
+{
+  struct SI_STREAM *s;
+
+  if( !(s = calloc( 1, sizeof(*s))))
+    return -1;
+
+  if( (c->fd = open( arg, O_RDWR|O_NOCTTY )) < 0 ) {
+    free( s );
+    return -1;
+  }
+  si_emu_init( &s->emu );
+  if( si_init_tty( c->fd, s->emu.timeout ) < 0 ) {
+    close( c->fd );
+    c->fd = -1;
+    free( s );
+    return -1;
+  }
+  s->rate = si_camera_parse_rate( NULL );
+  s->pattern = SYNTH_RAMP;
+  c->backend_data = s;
+  return 0;
+}
+
+static void tty_close( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+
+  close( c->fd ); /* the emulator sees a hangup and exits */
+  c->fd = -1;
+  if( s->pid > 0 && waitpid( s->pid, NULL, 0 ) < 0 )
+    perror("emulator");
+  stream_close( c );
+}
+
+static int tty_serial( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv )
+{
+  int ret;
+
+  /* the local copy of the camera follows along to drive the dma */
+
+  ret = dev_serial( c, cmd, nsend, send, nrecv, recv );
+  if( ret == 1 && !nrecv )
+    stream_serial( c, cmd, nsend, send, 0, NULL );
+  return ret;
+}
+
+/* make one frame of synthetic data,
+   ramp matches the pattern of the simulated card in the driver:
+   one pixel from each quadrant in turn, each a ramp along the
+   readout with the quadrant number in the top two bits
+*/
+
+static void synth_fill( struct SI_STREAM *s, unsigned short *d, int npix )
+{
+  unsigned int k, seed;
+
+  seed = 1;
+  for( k=0; k<npix; k++ ) {
+    switch( s->pattern ) {
+      case SYNTH_RAMP:
+        d[k] = ((k & 3) << 14) | ((k >> 2) & 0x3fff);
+        break;
+      case SYNTH_FLAT:
+        d[k] = 1000;
+        break;
+      case SYNTH_NOISE:
+        seed = seed * 1103515245 + 12345;
+        d[k] = 1000 + ((seed >> 16) & 0xff);
+        break;
+    }
+  }
+}
+
+static int stream_dma_init( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+  int len;
+
+  len = c->nbufs * c->dma_config.buflen;
+  if( !(c->ptr = (unsigned short *)calloc( 1, len )))
+    return -1;
+
+  if( !s->fp ) {
+    free( s->frame );
+    if( !(s->frame = (unsigned short *)malloc( c->dma_config.total ))) {
+      free( c->ptr );
+      c->ptr = NULL;
+      return -1;
+    }
+    synth_fill( s, s->frame, c->dma_config.total/sizeof(short) );
+  }
+  return 0;
+}
+
+static void stream_dma_free( struct SI_CAMERA *c, int release )
+{
+  struct SI_STREAM *s = c->backend_data;
+
+  free( c->ptr );
+  c->ptr = NULL;
+  free( s->frame );
+  s->frame = NULL;
+}
+
+static int stream_dma_start( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+
+  s->armed = 0;
+  s->t0 = si_camera_time();
+  c->dma_status.status = SI_DMA_STATUS_ENABLE;
+  return 0;
+}
+
+/* read len bytes of the recording into d, looping at EOF */
+
+static int replay_read( struct SI_STREAM *s, char *d, int len )
+{
+  int n, got;
+
+  got = 0;
+  while( got < len ) {
+    n = fread( d + got, 1, len - got, s->fp );
+    if( n <= 0 ) {
+      if( ferror( s->fp ) || ftell( s->fp ) == 0 ) /* empty file */
+        return -1;
+      rewind( s->fp );
+      continue;
+    }
+    got += n;
+  }
+  return 0;
+}
+
+/* wait for the next buffer to cross the simulated fiber */
+
+static int stream_dma_next( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+  struct SI_DMA_STATUS *st = &c->dma_status;
+  int len, off;
+
+  if( s->index )
+    return record_dma_next( c );
+
+  if( !s->armed ) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+
+  off = st->transferred;
+  if( c->dma_config.config & SI_DMA_CONFIG_WAKEUP_EACH )
+    len = c->dma_config.buflen - (off % c->dma_config.buflen);
+  else
+    len = c->dma_config.total - off;
+  if( len > c->dma_config.total - off )
+    len = c->dma_config.total - off;
+
+  if( s->fp ) {
+    if( replay_read( s, (char *)c->ptr + off, len ) < 0 )
+      return -1;
+  } else {
+    memcpy( (char *)c->ptr + off, (char *)s->frame + off, len );
+  }
+
+  if( s->rate > 0.0 )
+    si_camera_sleep_until( s->t0 + (double)(off + len) / s->rate );
+
+  st->transferred = off + len;
+  st->cur = (st->transferred + c->dma_config.buflen - 1) /
+            c->dma_config.buflen;
+  st->next = st->cur;
+  if( st->transferred >= c->dma_config.total ) {
+    st->status = SI_DMA_STATUS_DONE;
+    s->armed = 0;
+  }
+  return 0;
+}
+
+/* play the next entry of a recording at its recorded time */
+
+static int record_dma_next( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+  struct SI_DMA_STATUS *st = &c->dma_status;
+  struct SI_RECORD_ENTRY *e;
+  int len, size;
+
+  if( !s->armed ) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+
+  e = &s->index[s->cur];
+  size = c->nbufs * c->dma_config.buflen;
+  len = e->len;
+  if( e->offset < 0 || len < 0 || e->offset > size - len ) {
+    errno = EINVAL;         /* past the buffer this dma config maps */
+    return -1;
+  }
+  if( len > 0 && pread( fileno( s->fp ), (char *)c->ptr + e->offset, len,
+                        e->pos ) != len )
+    return -1;
+
+  if( s->speed > 0.0 )
+    si_camera_sleep_until( s->t0 + e->time / s->speed );
+
+  /* done goes on the last entry of a frame, even if the recording
+     was of a wakeup that already had it
+  */
+
+  st->transferred = e->offset + len;
+  st->status = e->status & ~SI_DMA_STATUS_DONE;
+  st->cur = (st->transferred + c->dma_config.buflen - 1) /
+            c->dma_config.buflen;
+  st->next = st->cur;
+
+  s->cur++;
+  if( s->cur == s->nindex || s->index[s->cur].frame != e->frame ) {
+    st->status |= SI_DMA_STATUS_DONE;
+    s->armed = 0;
+    if( s->cur == s->nindex )
+      s->cur = 0;
+  }
+  return 0;
+}
+
+static int stream_dma_abort( struct SI_CAMERA *c )
+{
+  struct SI_STREAM *s = c->backend_data;
+
+  s->armed = 0;
+  c->dma_status.status = SI_DMA_STATUS_DONE;
+  return 0;
+}
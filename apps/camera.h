@@ -0,0 +1,20 @@
+double si_camera_time( void );
+void si_camera_sleep_until( double t );
+double si_camera_parse_rate( char *s );
+int si_camera_open( struct SI_CAMERA *c, char *spec );
+void si_camera_close( struct SI_CAMERA *c );
+int si_camera_command( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                       int nrecv, int *recv );
+int si_camera_command_yn( int cmd );
+int si_camera_send_readout( struct SI_CAMERA *c );
+int si_camera_load_readout( struct SI_CAMERA *c );
+int si_camera_load_config( struct SI_CAMERA *c );
+int si_camera_load_status( struct SI_CAMERA *c );
+int si_camera_frame_bytes( struct SI_CAMERA *c );
+int si_camera_dma_config( struct SI_CAMERA *c, int total, int buflen,
+                          int timeout, int config );
+void si_camera_dma_free( struct SI_CAMERA *c );
+int si_camera_start( struct SI_CAMERA *c, int cmd );
+int si_camera_next_buffer( struct SI_CAMERA *c, struct SI_BUFFER *b );
+int si_camera_acquire( struct SI_CAMERA *c, int cmd );
+int si_camera_abort( struct SI_CAMERA *c );
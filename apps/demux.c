@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
+#include "si3097.h"
+#include "si_app.h"
 #include "demux.h"
+#include "dinter.h"
 
 /* demultiplex 4 quadrant camera data */
 /*
@@ -34,7 +38,9 @@ Whole image is size by size or 4096x4096
 
 /* size 2048 serlen 1023 parlen 1023 */
 
-void si_camera_demux_gen( unsigned short *out, unsigned short *in, int size,
+/* a pixel at a time, kept as the reference for si_camera_demux_gen() */
+
+void si_camera_demux_ref( unsigned short *out, unsigned short *in, int size,
                           int serlen, int parlen )
 {
   int so2, tot, row, col, irow, icol;
@@ -60,3 +66,100 @@ void si_camera_demux_gen( unsigned short *out, unsigned short *in, int size,
   }
 }
 
+
+/* the same demux as a deinterlace plan, so si_dinter_execute() can do
+   it with vectors, a dma buffer at a time or on many threads
+*/
+
+void si_camera_demux_plan( struct SI_DINTER_PLAN *p, int size,
+                           int serlen, int parlen )
+{
+  long so2, top, bot;
+
+  bzero( p, sizeof(*p));
+  so2 = size/2;
+  top = 2*(long)size;
+  bot = (parlen - 1 + so2)*(long)size;
+
+  p->n_cols = size;
+  p->n_rows = size;
+  p->nlanes = 4;
+  p->run = serlen;
+
+  p->base[0] = top + 1;
+  p->dx[0] = 1;
+  p->rs[0] = size;
+
+  p->base[1] = top + serlen - 1 + so2;
+  p->dx[1] = -1;
+  p->rs[1] = size;
+
+  p->base[2] = bot + 1;
+  p->dx[2] = 1;
+  p->rs[2] = -size;
+
+  p->base[3] = bot + serlen - 1 + so2;
+  p->dx[3] = -1;
+  p->rs[3] = -size;
+}
+
+/* the plan for c's readout, and the image it makes: the cfg file's
+   [Readout Layout] if it had one, each amplifier reading serlen
+   columns and its share of the section's rows, otherwise the four
+   quadrants of si_camera_demux_plan() on the smallest square that
+   holds them.  returns -1 with errno EINVAL if the layout cannot be
+   planned for this readout
+*/
+
+int si_camera_plan( struct SI_CAMERA *c, struct SI_DINTER_PLAN *p,
+                    int *n_cols, int *n_rows )
+{
+  struct SI_LAYOUT l;
+  int serlen, parlen, size;
+
+  serlen = c->readout[READOUT_SERLEN_IX];
+  parlen = c->readout[READOUT_PARLEN_IX];
+  if( !c->layout ) {
+    size = 2*((serlen > parlen ? serlen : parlen) + 1);
+    si_camera_demux_plan( p, size, serlen, parlen );
+    *n_cols = *n_rows = size;
+    return 0;
+  }
+
+  if( si_layout_get( c->layout, &l ) < 0 )
+    return -1;
+  *n_cols = l.across*serlen;
+  *n_rows = l.down*(parlen*l.namps/(l.across*l.down));
+  bzero( p, sizeof(*p));
+  if( si_layout_plan( &l, *n_cols, *n_rows, p ) < 0 )
+    return -1;
+  p->interlace_type = c->layout;
+  p->n_cols = *n_cols;
+  p->n_rows = *n_rows;
+  return 0;
+}
+
+/* each input row of quads becomes four output rows, two of them
+   written backwards.  si_dinter_execute() does a row at a time, so the
+   four rows are filled a vector at a time while they are in cache
+*/
+
+void si_camera_demux_gen( unsigned short *out, unsigned short *in, int size,
+                          int serlen, int parlen )
+{
+  struct SI_DINTER_PLAN p;
+
+  si_camera_demux_plan( &p, size, serlen, parlen );
+  si_dinter_execute( &p, in, out, 0, 4L*serlen*parlen );
+}
+
+/* si_camera_demux_gen() on all the worker threads */
+
+void si_camera_demux_par( unsigned short *out, unsigned short *in, int size,
+                          int serlen, int parlen )
+{
+  struct SI_DINTER_PLAN p;
+
+  si_camera_demux_plan( &p, size, serlen, parlen );
+  si_dinter_execute_par( &p, in, out, 0, 4L*serlen*parlen );
+}
@@ -1,2 +1,10 @@
 void si_camera_demux_gen( unsigned short *out, unsigned short *in, int size,
                           int serlen, int parlen );
+void si_camera_demux_ref( unsigned short *out, unsigned short *in, int size,
+                          int serlen, int parlen );
+void si_camera_demux_plan( struct SI_DINTER_PLAN *p, int size,
+                           int serlen, int parlen );
+int si_camera_plan( struct SI_CAMERA *c, struct SI_DINTER_PLAN *p,
+                    int *n_cols, int *n_rows );
+void si_camera_demux_par( unsigned short *out, unsigned short *in, int size,
+                          int serlen, int parlen );
@@ -23,10 +23,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "si3097.h"
 #include "si_app.h"
 #include "dinter.h"
+#include "pool.h"
 
 //int bSave = 0;
 //int dma_mode = 0;
@@ -36,44 +40,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 //unsigned short *dmabuf = NULL;
 //unsigned short *lpImage = NULL;
 
-//  write data to file code ( flip and unflip )
-//  unsigned char  nTempPix1;
-//  unsigned char  nTempPix2;
-//  unsigned char *  lpbImage;
-//    if (len_words)                    // and we have pixels
-//        {
-//
-//          lpbImage = (unsigned char *)from_ptr;
-//          for (k=0; k<len_words*2; k+=2)
-//          {
-//            nTempPix1 = *lpbImage;
-//            nTempPix2 = *(lpbImage+1);
-//            *lpbImage = nTempPix2;
-//            *(lpbImage+1) = nTempPix1;
-//            lpbImage += 2;
-//          }
-//          fwrite(from_ptr, sizeof(unsigned short), len_words, fFile);
-//          lpbImage = (unsigned char *)from_ptr;
-//          for (k=0; k<len_words*2; k+=2)
-//          {
-//            nTempPix1 = *lpbImage;
-//            nTempPix2 = *(lpbImage+1);
-//            *lpbImage = nTempPix2;
-//            *(lpbImage+1) = nTempPix1;
-//            lpbImage += 2;
-//          }
-//          //to_ptr += len_words;            // advance for next round
-//        }
-//
-
 /* based on the DINTERLACE configuration
    reorder the data from data buffer "from" to the
-   data buffer "to"
+   data buffer "to".  This is the pixel at a time original,
+   kept as the reference for the faster si_deinterlace()
 */
 
 
-void si_deinterlace( struct SI_DINTERLACE *cfg, unsigned short *from,
-                     unsigned short *to, int len_bytes )
+void si_deinterlace_ref( struct SI_DINTERLACE *cfg, unsigned short *from,
+                         unsigned short *to, int len_bytes )
 {
   unsigned int k;
   unsigned short *to_ptr;
@@ -656,3 +631,1465 @@ void si_deinterlace( struct SI_DINTERLACE *cfg, unsigned short *from,
 
   return;
 }
+
+/*
+  Every mode reads the input as groups of nlanes pixels, one from
+  each amplifier in turn.  Pixel k of group g lands at
+
+    base[k] + dx[k]*(g % run) + rs[k]*(g / run)
+
+  so each lane fills an output row with a run of pixels, forwards or
+  backwards.  These numbers are the SI_DINTER_PLAN, worked out once
+  for each interlace_type and size by si_dinter_plan() and kept.
+  si_dinter_execute() copies whole runs, a vector of groups at a time
+  when the cpu allows, and gives the same result as si_deinterlace_ref().
+
+  si_dinter_execute_stats() also counts what each amplifier read on
+  the way through.  A vector of input pixels holds whole groups, or
+  for 16 and 32 lanes the same lanes every 2 or 4 vectors, so each
+  vector loaded is added into a set of vector counts, min, max, sum,
+  sum of squares, saturated and one for each histogram edge, before it
+  is split.  Which lane each count is for is worked out only when the
+  sets are added into the SI_DINTER_STATS, every ACC_FOLD vectors and
+  at the end.  The single amp copy and the 9 and 18 way modes count
+  in a pass of their own over the input just done, still in cache,
+  with as many sets as it takes for the lanes to come round to the
+  start of a vector again, 9 for both.  The bands of
+  si_dinter_execute_par_stats() count apart and are merged after.
+
+  si_dinter_execute_level() adds a level to each lane, the bias taken
+  off less a pedestal for calib.c, with saturating adds on the vectors
+  after they are split, so it costs no pass of its own either.
+*/
+
+struct DINTER_ACC;
+
+typedef void (*dinter_run_fn)( unsigned short *to, unsigned short *src,
+                               struct SI_DINTER_PLAN *l, long x0, long y,
+                               long n, long avail, struct DINTER_ACC *acc,
+                               const int *level );
+typedef void (*dinter_acc_fn)( struct DINTER_ACC *acc, unsigned short *src,
+                               long n );
+
+#define ACC_SETS 9      /* 9 or 18 lanes in vectors of 8 or 16, more
+                           are counted a pixel at a time */
+#define ACC_FOLD 16384  /* vectors into a set between folds, a 16 bit
+                           count holds 65535 */
+
+struct DINTER_ACC {
+  unsigned short mn[ACC_SETS][16];  /* pixels xor 0x8000, in signed order */
+  unsigned short mx[ACC_SETS][16];
+  unsigned short sat[ACC_SETS][16];
+  unsigned short cum[ACC_SETS][SI_STATS_BINS-1][16]; /* at least 2^(b+1) */
+  unsigned int sum[ACC_SETS][2][8];
+  unsigned long long sq[ACC_SETS][4][4];
+  long vecs;                   /* into each set since the last fold */
+  int width;                   /* pixels in a vector, 0 before any */
+  int sets;
+  int nlanes;
+  struct SI_DINTER_STATS *st;
+} __attribute__((aligned(32)));
+
+/* only the sets in use, a line at a time clearing them all would
+   cost as much as the counting
+*/
+
+static void acc_reset( struct DINTER_ACC *a )
+{
+  int s, i;
+
+  for( s=0; s<a->sets; s++ ) {
+    memset( a->sat[s], 0, sizeof(a->sat[s]));
+    memset( a->cum[s], 0, sizeof(a->cum[s]));
+    memset( a->sum[s], 0, sizeof(a->sum[s]));
+    memset( a->sq[s], 0, sizeof(a->sq[s]));
+    for( i=0; i<16; i++ ) {
+      a->mn[s][i] = 0x7fff;
+      a->mx[s][i] = 0x8000;
+    }
+  }
+  a->vecs = 0;
+}
+
+static void acc_start( struct DINTER_ACC *a, struct SI_DINTER_STATS *st,
+                       int nlanes )
+{
+  a->st = st;
+  a->nlanes = nlanes;
+  a->width = 0;
+  a->sets = 0;
+  a->vecs = 0;
+}
+
+/* a 32 or 64 bit count's element e, of the half h of the vector it
+   was widened from, holds the pixel at this position.  The avx2
+   unpacks work within each 128 bit half
+*/
+
+static int acc_pos( int e, int h )
+{
+  return (e/4)*8 + h*4 + e%4;
+}
+
+/* the sets into the stats, lane by lane */
+
+static void acc_fold( struct DINTER_ACC *a )
+{
+  struct SI_AMP_STATS *amp;
+  long c, above;
+  int s, i, b, q, v, w;
+
+  w = a->width;
+  for( s=0; s<a->sets && w && a->vecs; s++ ) {
+    for( i=0; i<w; i++ ) {
+      amp = &a->st->amp[(s*w + i) % a->nlanes];
+      amp->n += a->vecs;
+      if( (v = a->mn[s][i] ^ 0x8000) < amp->min )
+        amp->min = v;
+      if( (v = a->mx[s][i] ^ 0x8000) > amp->max )
+        amp->max = v;
+      amp->saturated += a->sat[s][i];
+      c = a->vecs;
+      for( b=0; b<SI_STATS_BINS-1; b++ ) {
+        above = a->cum[s][b][i];
+        amp->hist[b] += c - above;
+        c = above;
+      }
+      amp->hist[b] += c;
+    }
+    for( i=0; i<w/2; i++ ) {
+      a->st->amp[(s*w + acc_pos( i, 0 )) % a->nlanes].sum += a->sum[s][0][i];
+      a->st->amp[(s*w + acc_pos( i, 1 )) % a->nlanes].sum += a->sum[s][1][i];
+    }
+    for( q=0; q<4; q++ )
+      for( i=0; i<w/4; i++ )
+        a->st->amp[(s*w + acc_pos( 2*i + (q & 1), q >> 1 )) % a->nlanes].sumsq
+          += a->sq[s][q][i];
+  }
+  acc_reset( a );
+}
+
+/* ready for vectors of width pixels in sets sets */
+
+static inline void acc_begin( struct DINTER_ACC *a, int width, int sets )
+{
+  if( a->width != width || a->sets != sets ) {
+    acc_fold( a );
+    a->width = width;
+    a->sets = sets;
+    acc_reset( a );
+  } else if( a->vecs > ACC_FOLD )
+    acc_fold( a );
+}
+
+static inline void amp_add( struct SI_AMP_STATS *a, unsigned short v,
+                            int saturation )
+{
+  a->n++;
+  if( v < a->min )
+    a->min = v;
+  if( v > a->max )
+    a->max = v;
+  a->sum += v;
+  a->sumsq += (unsigned long long)v*v;
+  a->saturated += v >= saturation;
+  a->hist[v ? 31 - __builtin_clz( v ) : 0]++;
+}
+
+/* v moved by d, held to what a pixel can be */
+
+static inline unsigned short dinter_level( unsigned short v, int d )
+{
+  int x = v + d;
+
+  return x < 0 ? 0 : x > 65535 ? 65535 : x;
+}
+
+/* sets of width pixel vectors for the lanes to repeat */
+
+static inline int acc_sets( int width, int nlanes )
+{
+  int a, b, t;
+
+  for( a=width, b=nlanes; b; t=a%b, a=b, b=t )
+    ;
+  return nlanes/a;
+}
+
+/* n pixels from the start of a group, one at a time */
+
+static void acc_pixels( struct DINTER_ACC *a, unsigned short *src, long n )
+{
+  long i;
+  int k;
+
+  for( i=0, k=0; i<n; i++ ) {
+    amp_add( &a->st->amp[k], src[i], a->st->saturation );
+    if( ++k == a->nlanes )
+      k = 0;
+  }
+}
+
+/*
+  The modes are SI_LAYOUTs: the image cut into across x down sections
+  of the same size, each amplifier reading one section from a corner
+  along the rows, in the order given.  An amplifier is "col,row,CORNER"
+  with CORNER one of TL, TR, BL, BR; a CORNER on its own means every
+  section in turn from that corner.  With trim the image is cut to a
+  whole number of sections, otherwise the right and bottom corners
+  are those of the image.
+*/
+
+static struct {
+  char *name;
+  int across;
+  int down;
+  int trim;
+  char *amps;
+} dinter_builtin[] = {
+  { "none", 1, 1, 0, "0,0,TL" },
+  { "four quadrant", 2, 2, 0, "0,0,TL 1,0,TR 0,1,BL 1,1,BR" },
+  { "serial split", 2, 1, 0, "0,0,TL 1,0,TR" },
+  { "parallel split", 1, 2, 0, "0,0,TL 0,1,BL" },
+  { "parallel split decrementing", 1, 2, 0, "0,0,TL 0,1,BR" },
+  { "9 CCD A", 3, 3, 1, "TL" },
+  { "9 CCD B", 3, 3, 1, "BR" },
+  { "9 CCD A+B", 3, 3, 1, "TL BR" },
+  { "16 CCD A", 4, 4, 1, "TL" },
+  { "16 CCD B", 4, 4, 1, "BR" },
+  { "16 CCD A+B", 4, 4, 1, "TL BR" },
+};
+
+#define NBUILTIN (sizeof(dinter_builtin)/sizeof(dinter_builtin[0]))
+#define MAXLAYOUTS 16
+
+/* dinter_lock covers the registered layouts and the plans, which any
+   thread may look up or add to
+*/
+
+static pthread_mutex_t dinter_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct SI_LAYOUT dinter_layouts[MAXLAYOUTS]; /* si_layout_register */
+static int dinter_nlayouts = 0;
+
+static int layout_corner( char *s )
+{
+  static char *corners[] = { "TL", "TR", "BL", "BR" };
+  int i;
+
+  for( i=0; i<4; i++ )
+    if( strcasecmp( s, corners[i] ) == 0 )
+      return i;
+  return -1;
+}
+
+/* add the amplifiers in s to l.  returns -1 with errno EINVAL if s
+   does not make sense for l
+*/
+
+int si_layout_amps( struct SI_LAYOUT *l, char *s )
+{
+  char buf[256], *tok, *save, *c;
+  int col, row, corner, i;
+
+  strncpy( buf, s, 255 );
+  buf[255] = 0;
+  for( tok = strtok_r( buf, " \t", &save ); tok;
+       tok = strtok_r( NULL, " \t", &save )) {
+    if( (corner = layout_corner( tok )) >= 0 ) {
+      for( i=0; i<l->across*l->down; i++ ) {
+        if( l->namps == SI_DINTER_MAXLANES )
+          goto bad;
+        l->amp[l->namps].col = i % l->across;
+        l->amp[l->namps].row = i / l->across;
+        l->amp[l->namps].corner = corner;
+        l->namps++;
+      }
+      continue;
+    }
+    if( !(c = strrchr( tok, ',' )) || sscanf( tok, "%d,%d", &col, &row ) != 2 ||
+        (corner = layout_corner( c+1 )) < 0 ||
+        col < 0 || col >= l->across || row < 0 || row >= l->down ||
+        l->namps == SI_DINTER_MAXLANES )
+      goto bad;
+    l->amp[l->namps].col = col;
+    l->amp[l->namps].row = row;
+    l->amp[l->namps].corner = corner;
+    l->namps++;
+  }
+  return 0;
+
+bad:
+  errno = EINVAL;
+  return -1;
+}
+
+/* the layout of an interlace_type, -1 if there is none */
+
+int si_layout_get( int type, struct SI_LAYOUT *l )
+{
+  if( type >= 0 && type < NBUILTIN ) {
+    bzero( l, sizeof(*l));
+    strncpy( l->name, dinter_builtin[type].name, sizeof(l->name)-1 );
+    l->across = dinter_builtin[type].across;
+    l->down = dinter_builtin[type].down;
+    l->trim = dinter_builtin[type].trim;
+    return si_layout_amps( l, dinter_builtin[type].amps );
+  }
+  type -= SI_LAYOUT_TYPE0;
+  pthread_mutex_lock( &dinter_lock );
+  if( type >= 0 && type < dinter_nlayouts ) {
+    *l = dinter_layouts[type];
+    pthread_mutex_unlock( &dinter_lock );
+    return 0;
+  }
+  pthread_mutex_unlock( &dinter_lock );
+  errno = EINVAL;
+  return -1;
+}
+
+/* read the [Readout Layout] section of a cfg file, eg.
+
+   [Readout Layout]
+   Name=16 Amp CCD
+   Sections=4,4
+   Trim=0
+   Amps=0,0,TL 1,0,TR ...
+
+   Amps may run over several lines.  returns 1 if there is a layout,
+   0 if not, -1 on error
+*/
+
+int si_load_layout( struct SI_LAYOUT *l, char *fname )
+{
+  FILE *fd;
+  char buf[256];
+  char *val, *end;
+  int insection, found;
+
+  if( !(fd = fopen( fname, "r" ))) {
+    return -1;
+  }
+
+  bzero( l, sizeof(*l));
+  insection = 0;
+  found = 0;
+  while( fgets( buf, 256, fd )) {
+    if( (end = strpbrk( buf, "\r\n" )))
+      *end = 0;
+    if( buf[0] == '[' ) {
+      insection = strncmp( buf, "[Readout Layout]", 16 ) == 0;
+      continue;
+    }
+    if( !insection || !(val = strchr( buf, '=' )))
+      continue;
+    *val++ = 0;
+    found = 1;
+
+    if( strcasecmp( buf, "Name" ) == 0 ) {
+      strncpy( l->name, val, sizeof(l->name)-1 );
+    } else if( strcasecmp( buf, "Sections" ) == 0 ) {
+      if( sscanf( val, "%d,%d", &l->across, &l->down ) != 2 ||
+          l->across < 1 || l->down < 1 )
+        goto bad;
+    } else if( strcasecmp( buf, "Trim" ) == 0 ) {
+      l->trim = atoi( val );
+    } else if( strcasecmp( buf, "Amps" ) == 0 ) {
+      if( l->across < 1 || si_layout_amps( l, val ) < 0 ) /* Sections first */
+        goto bad;
+    }
+  }
+  fclose(fd);
+
+  if( found && (l->across < 1 || l->namps < 1) ) {
+    errno = EINVAL;
+    return -1;
+  }
+  return found;
+
+bad:
+  fprintf( stderr, "%s: bad readout layout %s=%s\n", fname, buf, val );
+  fclose(fd);
+  errno = EINVAL;
+  return -1;
+}
+
+/* make l usable as an interlace_type.  returns the type, -1 if there
+   are too many or l is no good
+*/
+
+int si_layout_register( struct SI_LAYOUT *l )
+{
+  int i;
+
+  if( l->across < 1 || l->down < 1 || l->namps < 1 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock( &dinter_lock );
+  for( i=0; i<dinter_nlayouts; i++ )
+    if( memcmp( &dinter_layouts[i], l, sizeof(*l)) == 0 )
+      break;
+  if( i == dinter_nlayouts ) {
+    if( i == MAXLAYOUTS ) {
+      pthread_mutex_unlock( &dinter_lock );
+      errno = EINVAL;
+      return -1;
+    }
+    dinter_layouts[dinter_nlayouts++] = *l;
+  }
+  pthread_mutex_unlock( &dinter_lock );
+  return SI_LAYOUT_TYPE0 + i;
+}
+
+/* work out the plan for l on an n_cols x n_rows image */
+
+int si_layout_plan( struct SI_LAYOUT *l, int n_cols, int n_rows,
+                    struct SI_DINTER_PLAN *p )
+{
+  struct SI_LAYOUT_AMP *a;
+  long c1, r1, w, x, y;
+  int k, i;
+
+  c1 = n_cols / l->across;
+  r1 = n_rows / l->down;
+  if( c1 <= 0 || r1 <= 0 || l->namps > SI_DINTER_MAXLANES ) {
+    errno = EINVAL;
+    return -1;
+  }
+  w = l->trim ? l->across*c1 : n_cols;
+
+  p->nlanes = l->namps;
+  p->run = c1;
+  p->overlap = 0;
+  for( k=0; k<l->namps; k++ ) {
+    a = &l->amp[k];
+    if( a->corner & SI_CORNER_RIGHT )
+      x = (!l->trim && a->col == l->across-1) ? n_cols-1 : (a->col+1)*c1 - 1;
+    else
+      x = a->col*c1;
+    if( a->corner & SI_CORNER_BOTTOM )
+      y = (!l->trim && a->row == l->down-1) ? n_rows-1 : (a->row+1)*r1 - 1;
+    else
+      y = a->row*r1;
+
+    p->base[k] = x + y*w;
+    p->dx[k] = (a->corner & SI_CORNER_RIGHT) ? -1 : 1;
+    p->rs[k] = (a->corner & SI_CORNER_BOTTOM) ? -w : w;
+
+    /* two amplifiers on one section write the same pixels */
+
+    for( i=0; i<k; i++ )
+      if( l->amp[i].col == a->col && l->amp[i].row == a->row )
+        p->overlap = 1;
+  }
+  return 0;
+}
+
+/* lanes for cfg, -1 for a mode or geometry only the reference does */
+
+static int dinter_lanes( struct SI_DINTERLACE *cfg, struct SI_DINTER_PLAN *l )
+{
+  struct SI_LAYOUT lay;
+
+  if( si_layout_get( cfg->interlace_type, &lay ) < 0 )
+    return -1;
+  return si_layout_plan( &lay, cfg->n_cols, cfg->n_rows, l );
+}
+
+/* n groups of output row y starting at column x0, src is the first
+   pixel of the first group and avail the pixels readable from there
+*/
+
+static void run_scalar( unsigned short *to, unsigned short *src,
+                        struct SI_DINTER_PLAN *l, long x0, long y,
+                        long n, long avail, struct DINTER_ACC *acc,
+                        const int *level )
+{
+  unsigned short *d, *s;
+  long j;
+  int k, p;
+
+  p = l->nlanes;
+  for( k=0; k<p; k++ ) {
+    d = to + l->base[k] + l->rs[k]*y + l->dx[k]*x0;
+    s = src + k;
+    if( acc )
+      for( j=0; j<n; j++ )
+        amp_add( &acc->st->amp[k], s[j*p], acc->st->saturation );
+    if( level && l->dx[k] > 0 ) {
+      for( j=0; j<n; j++ )
+        d[j] = dinter_level( s[j*p], level[k] );
+    } else if( level ) {
+      for( j=0; j<n; j++ )
+        d[-j] = dinter_level( s[j*p], level[k] );
+    } else if( l->dx[k] > 0 ) {
+      for( j=0; j<n; j++ )
+        d[j] = s[j*p];
+    } else {
+      for( j=0; j<n; j++ )
+        d[-j] = s[j*p];
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* split two vectors of interleaved pixels into the even and odd ones,
+   by sign extending each half so the saturating pack keeps the bits
+*/
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_even( __m128i a, __m128i b )
+{
+  return _mm_packs_epi32( _mm_srai_epi32( _mm_slli_epi32( a, 16 ), 16 ),
+                          _mm_srai_epi32( _mm_slli_epi32( b, 16 ), 16 ));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_odd( __m128i a, __m128i b )
+{
+  return _mm_packs_epi32( _mm_srai_epi32( a, 16 ), _mm_srai_epi32( b, 16 ));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_reverse( __m128i v )
+{
+  v = _mm_shufflelo_epi16( v, 0x1b );
+  v = _mm_shufflehi_epi16( v, 0x1b );
+  return _mm_shuffle_epi32( v, 0x4e );
+}
+
+/* the counts of one set, r[0] min, r[1] max, r[2] saturated, r[3]
+   on the histogram edges, r[18] and r[19] the sums and r[20] on the
+   squares.  k[0] flips a pixel to signed order, k[1] is the
+   saturation level less one and k[2] on the edges, all flipped
+*/
+
+#define ACC_REGS 24
+#define ACC_CONSTS (SI_STATS_BINS + 1)
+
+__attribute__((target("sse2")))
+static void sse2_acc_load( struct DINTER_ACC *a, int s, __m128i *r )
+{
+  int b, q;
+
+  r[0] = _mm_loadu_si128( (__m128i *)a->mn[s] );
+  r[1] = _mm_loadu_si128( (__m128i *)a->mx[s] );
+  r[2] = _mm_loadu_si128( (__m128i *)a->sat[s] );
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    r[3+b] = _mm_loadu_si128( (__m128i *)a->cum[s][b] );
+  r[18] = _mm_loadu_si128( (__m128i *)a->sum[s][0] );
+  r[19] = _mm_loadu_si128( (__m128i *)a->sum[s][1] );
+  for( q=0; q<4; q++ )
+    r[20+q] = _mm_loadu_si128( (__m128i *)a->sq[s][q] );
+}
+
+__attribute__((target("sse2")))
+static void sse2_acc_store( struct DINTER_ACC *a, int s, __m128i *r )
+{
+  int b, q;
+
+  _mm_storeu_si128( (__m128i *)a->mn[s], r[0] );
+  _mm_storeu_si128( (__m128i *)a->mx[s], r[1] );
+  _mm_storeu_si128( (__m128i *)a->sat[s], r[2] );
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    _mm_storeu_si128( (__m128i *)a->cum[s][b], r[3+b] );
+  _mm_storeu_si128( (__m128i *)a->sum[s][0], r[18] );
+  _mm_storeu_si128( (__m128i *)a->sum[s][1], r[19] );
+  for( q=0; q<4; q++ )
+    _mm_storeu_si128( (__m128i *)a->sq[s][q], r[20+q] );
+}
+
+__attribute__((target("sse2")))
+static void sse2_acc_consts( __m128i *k, int saturation )
+{
+  int b;
+
+  k[0] = _mm_set1_epi16( (short)0x8000 );
+  k[1] = _mm_set1_epi16( (short)((saturation - 1) ^ 0x8000));
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    k[2+b] = _mm_set1_epi16( (short)(((2 << b) - 1) ^ 0x8000));
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline void sse2_acc( __m128i *r, __m128i v, const __m128i *k )
+{
+  __m128i s, lo, hi, zero;
+  int b;
+
+  zero = _mm_setzero_si128();
+  s = _mm_xor_si128( v, k[0] );
+  r[0] = _mm_min_epi16( r[0], s );
+  r[1] = _mm_max_epi16( r[1], s );
+  r[2] = _mm_sub_epi16( r[2], _mm_cmpgt_epi16( s, k[1] ));
+  #pragma GCC unroll 16
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    r[3+b] = _mm_sub_epi16( r[3+b], _mm_cmpgt_epi16( s, k[2+b] ));
+  lo = _mm_unpacklo_epi16( v, zero );
+  hi = _mm_unpackhi_epi16( v, zero );
+  r[18] = _mm_add_epi32( r[18], lo );
+  r[19] = _mm_add_epi32( r[19], hi );
+  r[20] = _mm_add_epi64( r[20], _mm_mul_epu32( lo, lo ));
+  lo = _mm_srli_epi64( lo, 32 );
+  r[21] = _mm_add_epi64( r[21], _mm_mul_epu32( lo, lo ));
+  r[22] = _mm_add_epi64( r[22], _mm_mul_epu32( hi, hi ));
+  hi = _mm_srli_epi64( hi, 32 );
+  r[23] = _mm_add_epi64( r[23], _mm_mul_epu32( hi, hi ));
+}
+
+/* the counting pass, n pixels from the start of a group */
+
+__attribute__((target("sse2")))
+static void acc_sse2( struct DINTER_ACC *acc, unsigned short *src, long n )
+{
+  __m128i r[ACC_SETS][ACC_REGS], kc[ACC_CONSTS];
+  long j, chunk;
+  int i, sets;
+
+  sets = acc_sets( 8, acc->nlanes );
+  if( sets > ACC_SETS ) {
+    acc_pixels( acc, src, n );
+    return;
+  }
+  chunk = (long)ACC_FOLD*sets*8;  /* a fold at most each */
+  for( ; n > chunk; n -= chunk, src += chunk )
+    acc_sse2( acc, src, chunk );
+  acc_begin( acc, 8, sets );
+  sse2_acc_consts( kc, acc->st->saturation );
+  for( i=0; i<sets; i++ )
+    sse2_acc_load( acc, i, r[i] );
+  for( j=0; j + sets*8 <= n; j += sets*8 )
+    for( i=0; i<sets; i++ )
+      sse2_acc( r[i], _mm_loadu_si128( (__m128i *)(src + j + i*8)), kc );
+  for( i=0; i<sets; i++ )
+    sse2_acc_store( acc, i, r[i] );
+  acc->vecs += j/(sets*8);
+  acc_pixels( acc, src + j, n - j );
+}
+
+/* nlanes a power of 2: nlanes vectors hold 8 groups, halving them
+   log2(nlanes) times leaves one vector per lane, in lane order.
+   Inlined with p a constant for the common lane counts so the
+   vectors stay in registers, and with stats set each vector is
+   counted as it is loaded
+*/
+
+__attribute__((target("sse2"), always_inline))
+static inline void sse2_pow2( unsigned short *to, unsigned short *src,
+                              struct SI_DINTER_PLAN *l, long x0, long y,
+                              long n, long avail, const int p,
+                              struct DINTER_ACC *acc, const int stats,
+                              const int *level, const int lv )
+{
+  __m128i v[SI_DINTER_MAXLANES], t[SI_DINTER_MAXLANES];
+  __m128i up[SI_DINTER_MAXLANES], dn[SI_DINTER_MAXLANES];
+  __m128i r[SI_DINTER_MAXLANES/8][ACC_REGS], kc[ACC_CONSTS];
+  unsigned short *d[SI_DINTER_MAXLANES];
+  const int sets = p > 8 ? p/8 : 1;
+  long j;
+  int h, i, k;
+
+  for( k=0; k<p; k++ )
+    d[k] = to + l->base[k] + l->rs[k]*y + l->dx[k]*x0;
+  if( stats ) {
+    acc_begin( acc, 8, sets );
+    sse2_acc_consts( kc, acc->st->saturation );
+    for( i=0; i<sets; i++ )
+      sse2_acc_load( acc, i, r[i] );
+  }
+  for( k=0; lv && k<p; k++ ) {
+    up[k] = _mm_set1_epi16( level[k] > 0 ? level[k] : 0 );
+    dn[k] = _mm_set1_epi16( level[k] < 0 ? -level[k] : 0 );
+  }
+
+  for( j=0; j+8 <= n; j+=8 ) {
+    #pragma GCC unroll 32
+    for( i=0; i<p; i++ )
+      v[i] = _mm_loadu_si128( (__m128i *)(src + j*p + i*8));
+    if( stats ) {
+      #pragma GCC unroll 32
+      for( i=0; i<p; i++ )
+        sse2_acc( r[i % sets], v[i], kc );
+    }
+    #pragma GCC unroll 32
+    for( h=p/2; h; h/=2 ) {
+      #pragma GCC unroll 32
+      for( i=0; i<p/2; i++ ) {
+        t[i] = sse2_even( v[2*i], v[2*i+1] );
+        t[i+p/2] = sse2_odd( v[2*i], v[2*i+1] );
+      }
+      memcpy( v, t, p*sizeof(__m128i));
+    }
+    #pragma GCC unroll 32
+    for( k=0; k<p; k++ ) {
+      if( lv )
+        v[k] = _mm_subs_epu16( _mm_adds_epu16( v[k], up[k] ), dn[k] );
+      if( l->dx[k] > 0 )
+        _mm_storeu_si128( (__m128i *)(d[k] + j), v[k] );
+      else
+        _mm_storeu_si128( (__m128i *)(d[k] - j - 7), sse2_reverse( v[k] ));
+    }
+  }
+  if( stats ) {
+    for( i=0; i<sets; i++ )
+      sse2_acc_store( acc, i, r[i] );
+    acc->vecs += j/8*(p/sets);
+  }
+  if( j < n )
+    run_scalar( to, src + j*p, l, x0 + j, y, n - j, avail - j*p, acc,
+                level );
+}
+
+#define SSE2_POW2( p ) \
+  if( acc && level ) \
+    sse2_pow2( to, src, l, x0, y, n, avail, p, acc, 1, level, 1 ); \
+  else if( acc ) \
+    sse2_pow2( to, src, l, x0, y, n, avail, p, acc, 1, NULL, 0 ); \
+  else if( level ) \
+    sse2_pow2( to, src, l, x0, y, n, avail, p, NULL, 0, level, 1 ); \
+  else \
+    sse2_pow2( to, src, l, x0, y, n, avail, p, NULL, 0, NULL, 0 );
+
+__attribute__((target("sse2")))
+static void run_sse2( unsigned short *to, unsigned short *src,
+                      struct SI_DINTER_PLAN *l, long x0, long y,
+                      long n, long avail, struct DINTER_ACC *acc,
+                      const int *level )
+{
+  switch( l->nlanes ) {
+    case 2:
+      SSE2_POW2( 2 );
+      break;
+    case 4:
+      SSE2_POW2( 4 );
+      break;
+    case 16:
+      SSE2_POW2( 16 );
+      break;
+    case 32:
+      SSE2_POW2( 32 );
+      break;
+    default:
+      run_scalar( to, src, l, x0, y, n, avail, NULL, level );
+      if( acc )
+        acc_sse2( acc, src, n*l->nlanes );
+      break;
+  }
+}
+
+/* the same 16 groups at a time, the packs work within each 128 bit
+   half so the quarters are put back in order after
+*/
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_even( __m256i a, __m256i b )
+{
+  a = _mm256_srai_epi32( _mm256_slli_epi32( a, 16 ), 16 );
+  b = _mm256_srai_epi32( _mm256_slli_epi32( b, 16 ), 16 );
+  return _mm256_permute4x64_epi64( _mm256_packs_epi32( a, b ), 0xd8 );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_odd( __m256i a, __m256i b )
+{
+  a = _mm256_srai_epi32( a, 16 );
+  b = _mm256_srai_epi32( b, 16 );
+  return _mm256_permute4x64_epi64( _mm256_packs_epi32( a, b ), 0xd8 );
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_reverse( __m256i v )
+{
+  const __m256i rev = _mm256_setr_epi8(
+    14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+    14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+  return _mm256_permute4x64_epi64( _mm256_shuffle_epi8( v, rev ), 0x4e );
+}
+
+/* the counts as for sse2, a set twice as wide */
+
+__attribute__((target("avx2")))
+static void avx2_acc_load( struct DINTER_ACC *a, int s, __m256i *r )
+{
+  int b, q;
+
+  r[0] = _mm256_loadu_si256( (__m256i *)a->mn[s] );
+  r[1] = _mm256_loadu_si256( (__m256i *)a->mx[s] );
+  r[2] = _mm256_loadu_si256( (__m256i *)a->sat[s] );
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    r[3+b] = _mm256_loadu_si256( (__m256i *)a->cum[s][b] );
+  r[18] = _mm256_loadu_si256( (__m256i *)a->sum[s][0] );
+  r[19] = _mm256_loadu_si256( (__m256i *)a->sum[s][1] );
+  for( q=0; q<4; q++ )
+    r[20+q] = _mm256_loadu_si256( (__m256i *)a->sq[s][q] );
+}
+
+__attribute__((target("avx2")))
+static void avx2_acc_store( struct DINTER_ACC *a, int s, __m256i *r )
+{
+  int b, q;
+
+  _mm256_storeu_si256( (__m256i *)a->mn[s], r[0] );
+  _mm256_storeu_si256( (__m256i *)a->mx[s], r[1] );
+  _mm256_storeu_si256( (__m256i *)a->sat[s], r[2] );
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    _mm256_storeu_si256( (__m256i *)a->cum[s][b], r[3+b] );
+  _mm256_storeu_si256( (__m256i *)a->sum[s][0], r[18] );
+  _mm256_storeu_si256( (__m256i *)a->sum[s][1], r[19] );
+  for( q=0; q<4; q++ )
+    _mm256_storeu_si256( (__m256i *)a->sq[s][q], r[20+q] );
+}
+
+__attribute__((target("avx2")))
+static void avx2_acc_consts( __m256i *k, int saturation )
+{
+  int b;
+
+  k[0] = _mm256_set1_epi16( (short)0x8000 );
+  k[1] = _mm256_set1_epi16( (short)((saturation - 1) ^ 0x8000));
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    k[2+b] = _mm256_set1_epi16( (short)(((2 << b) - 1) ^ 0x8000));
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void avx2_acc( __m256i *r, __m256i v, const __m256i *k )
+{
+  __m256i s, lo, hi, zero;
+  int b;
+
+  zero = _mm256_setzero_si256();
+  s = _mm256_xor_si256( v, k[0] );
+  r[0] = _mm256_min_epi16( r[0], s );
+  r[1] = _mm256_max_epi16( r[1], s );
+  r[2] = _mm256_sub_epi16( r[2], _mm256_cmpgt_epi16( s, k[1] ));
+  #pragma GCC unroll 16
+  for( b=0; b<SI_STATS_BINS-1; b++ )
+    r[3+b] = _mm256_sub_epi16( r[3+b], _mm256_cmpgt_epi16( s, k[2+b] ));
+  lo = _mm256_unpacklo_epi16( v, zero );
+  hi = _mm256_unpackhi_epi16( v, zero );
+  r[18] = _mm256_add_epi32( r[18], lo );
+  r[19] = _mm256_add_epi32( r[19], hi );
+  r[20] = _mm256_add_epi64( r[20], _mm256_mul_epu32( lo, lo ));
+  lo = _mm256_srli_epi64( lo, 32 );
+  r[21] = _mm256_add_epi64( r[21], _mm256_mul_epu32( lo, lo ));
+  r[22] = _mm256_add_epi64( r[22], _mm256_mul_epu32( hi, hi ));
+  hi = _mm256_srli_epi64( hi, 32 );
+  r[23] = _mm256_add_epi64( r[23], _mm256_mul_epu32( hi, hi ));
+}
+
+__attribute__((target("avx2")))
+static void acc_avx2( struct DINTER_ACC *acc, unsigned short *src, long n )
+{
+  __m256i r[ACC_SETS][ACC_REGS], kc[ACC_CONSTS];
+  long j, chunk;
+  int i, sets;
+
+  sets = acc_sets( 16, acc->nlanes );
+  if( sets > ACC_SETS ) {
+    acc_pixels( acc, src, n );
+    return;
+  }
+  chunk = (long)ACC_FOLD*sets*16;  /* a fold at most each */
+  for( ; n > chunk; n -= chunk, src += chunk )
+    acc_avx2( acc, src, chunk );
+  acc_begin( acc, 16, sets );
+  avx2_acc_consts( kc, acc->st->saturation );
+  for( i=0; i<sets; i++ )
+    avx2_acc_load( acc, i, r[i] );
+  for( j=0; j + sets*16 <= n; j += sets*16 )
+    for( i=0; i<sets; i++ )
+      avx2_acc( r[i], _mm256_loadu_si256( (__m256i *)(src + j + i*16)), kc );
+  for( i=0; i<sets; i++ )
+    avx2_acc_store( acc, i, r[i] );
+  acc->vecs += j/(sets*16);
+  acc_pixels( acc, src + j, n - j );
+}
+
+/* the 9 and 18 way modes gather each lane, a 32 bit load per pixel
+   so the last one needs a pixel of input after it.  Their counts are
+   taken after
+*/
+
+__attribute__((target("avx2")))
+static void avx2_gather( unsigned short *to, unsigned short *src,
+                         struct SI_DINTER_PLAN *l, long x0, long y,
+                         long n, long avail, struct DINTER_ACC *acc,
+                         const int *level )
+{
+  __m256i idx, lo, g0, g1, up, dn;
+  unsigned short *d[SI_DINTER_MAXLANES];
+  long j;
+  int p, k;
+
+  p = l->nlanes;
+  for( k=0; k<p; k++ )
+    d[k] = to + l->base[k] + l->rs[k]*y + l->dx[k]*x0;
+
+  idx = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ),
+                            _mm256_set1_epi32( 2*p ));
+  lo = _mm256_set1_epi32( 0xffff );
+  for( j=0; j+16 <= n && (j+16)*p < avail; j+=16 ) {
+    for( k=0; k<p; k++ ) {
+      g0 = _mm256_i32gather_epi32( (const int *)(src + j*p + k), idx, 1 );
+      g1 = _mm256_i32gather_epi32( (const int *)(src + (j+8)*p + k),
+                                   idx, 1 );
+      g0 = _mm256_packus_epi32( _mm256_and_si256( g0, lo ),
+                                _mm256_and_si256( g1, lo ));
+      g0 = _mm256_permute4x64_epi64( g0, 0xd8 );
+      if( level ) {
+        up = _mm256_set1_epi16( level[k] > 0 ? level[k] : 0 );
+        dn = _mm256_set1_epi16( level[k] < 0 ? -level[k] : 0 );
+        g0 = _mm256_subs_epu16( _mm256_adds_epu16( g0, up ), dn );
+      }
+      if( l->dx[k] > 0 )
+        _mm256_storeu_si256( (__m256i *)(d[k] + j), g0 );
+      else
+        _mm256_storeu_si256( (__m256i *)(d[k] - j - 15),
+                             avx2_reverse( g0 ));
+    }
+  }
+  if( acc )
+    acc_avx2( acc, src, j*p );
+  if( j < n )
+    run_scalar( to, src + j*p, l, x0 + j, y, n - j, avail - j*p, acc,
+                level );
+}
+
+/* the power of 2 modes as for sse2 */
+
+__attribute__((target("avx2"), always_inline))
+static inline void avx2_pow2( unsigned short *to, unsigned short *src,
+                              struct SI_DINTER_PLAN *l, long x0, long y,
+                              long n, long avail, const int p,
+                              struct DINTER_ACC *acc, const int stats,
+                              const int *level, const int lv )
+{
+  __m256i v[SI_DINTER_MAXLANES], t[SI_DINTER_MAXLANES];
+  __m256i up[SI_DINTER_MAXLANES], dn[SI_DINTER_MAXLANES];
+  __m256i r[SI_DINTER_MAXLANES/16][ACC_REGS], kc[ACC_CONSTS];
+  unsigned short *d[SI_DINTER_MAXLANES];
+  const int sets = p > 16 ? p/16 : 1;
+  long j;
+  int h, i, k;
+
+  for( k=0; k<p; k++ )
+    d[k] = to + l->base[k] + l->rs[k]*y + l->dx[k]*x0;
+  if( stats ) {
+    acc_begin( acc, 16, sets );
+    avx2_acc_consts( kc, acc->st->saturation );
+    for( i=0; i<sets; i++ )
+      avx2_acc_load( acc, i, r[i] );
+  }
+  for( k=0; lv && k<p; k++ ) {
+    up[k] = _mm256_set1_epi16( level[k] > 0 ? level[k] : 0 );
+    dn[k] = _mm256_set1_epi16( level[k] < 0 ? -level[k] : 0 );
+  }
+
+  for( j=0; j+16 <= n; j+=16 ) {
+    #pragma GCC unroll 32
+    for( i=0; i<p; i++ )
+      v[i] = _mm256_loadu_si256( (__m256i *)(src + j*p + i*16));
+    if( stats ) {
+      #pragma GCC unroll 32
+      for( i=0; i<p; i++ )
+        avx2_acc( r[i % sets], v[i], kc );
+    }
+    #pragma GCC unroll 32
+    for( h=p/2; h; h/=2 ) {
+      #pragma GCC unroll 32
+      for( i=0; i<p/2; i++ ) {
+        t[i] = avx2_even( v[2*i], v[2*i+1] );
+        t[i+p/2] = avx2_odd( v[2*i], v[2*i+1] );
+      }
+      memcpy( v, t, p*sizeof(__m256i));
+    }
+    #pragma GCC unroll 32
+    for( k=0; k<p; k++ ) {
+      if( lv )
+        v[k] = _mm256_subs_epu16( _mm256_adds_epu16( v[k], up[k] ), dn[k] );
+      if( l->dx[k] > 0 )
+        _mm256_storeu_si256( (__m256i *)(d[k] + j), v[k] );
+      else
+        _mm256_storeu_si256( (__m256i *)(d[k] - j - 15),
+                             avx2_reverse( v[k] ));
+    }
+  }
+  if( stats ) {
+    for( i=0; i<sets; i++ )
+      avx2_acc_store( acc, i, r[i] );
+    acc->vecs += j/16*(p/sets);
+  }
+  if( j < n )
+    run_scalar( to, src + j*p, l, x0 + j, y, n - j, avail - j*p, acc,
+                level );
+}
+
+#define AVX2_POW2( p ) \
+  if( acc && level ) \
+    avx2_pow2( to, src, l, x0, y, n, avail, p, acc, 1, level, 1 ); \
+  else if( acc ) \
+    avx2_pow2( to, src, l, x0, y, n, avail, p, acc, 1, NULL, 0 ); \
+  else if( level ) \
+    avx2_pow2( to, src, l, x0, y, n, avail, p, NULL, 0, level, 1 ); \
+  else \
+    avx2_pow2( to, src, l, x0, y, n, avail, p, NULL, 0, NULL, 0 );
+
+__attribute__((target("avx2")))
+static void run_avx2( unsigned short *to, unsigned short *src,
+                      struct SI_DINTER_PLAN *l, long x0, long y,
+                      long n, long avail, struct DINTER_ACC *acc,
+                      const int *level )
+{
+  switch( l->nlanes ) {
+    case 2:
+      AVX2_POW2( 2 );
+      break;
+    case 4:
+      AVX2_POW2( 4 );
+      break;
+    case 16:
+      AVX2_POW2( 16 );
+      break;
+    case 32:
+      AVX2_POW2( 32 );
+      break;
+    default:
+      avx2_gather( to, src, l, x0, y, n, avail, acc, level );
+      break;
+  }
+}
+#endif
+
+static struct {
+  char *name;
+  dinter_run_fn run;
+  dinter_acc_fn acc;
+} dinter_impls[] = {
+  { "scalar", run_scalar, acc_pixels },
+#if defined(__x86_64__) || defined(__i386__)
+  { "sse2", run_sse2, acc_sse2 },
+  { "avx2", run_avx2, acc_avx2 },
+#endif
+};
+
+#define NIMPLS (sizeof(dinter_impls)/sizeof(dinter_impls[0]))
+
+static dinter_run_fn dinter_run = NULL;
+static dinter_acc_fn dinter_acc = NULL;
+static char *dinter_name = NULL;
+static pthread_once_t dinter_once = PTHREAD_ONCE_INIT;
+
+static int impl_supported( char *name )
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if( strcmp( name, "sse2" ) == 0 )
+    return __builtin_cpu_supports( "sse2" );
+  if( strcmp( name, "avx2" ) == 0 )
+    return __builtin_cpu_supports( "avx2" );
+#endif
+  return 1;
+}
+
+/* pick the implementation by name, NULL or "auto" for the best this
+   cpu runs.  returns -1 if unknown or not supported here
+*/
+
+int si_deinterlace_select( char *name )
+{
+  int i;
+
+  if( !name || strcmp( name, "auto" ) == 0 ) {
+    for( i=NIMPLS-1; i>0 && !impl_supported( dinter_impls[i].name ); i-- )
+      ;
+  } else {
+    for( i=0; i<NIMPLS; i++ )
+      if( strcmp( name, dinter_impls[i].name ) == 0 )
+        break;
+    if( i == NIMPLS || !impl_supported( name ))
+      return -1;
+  }
+  dinter_run = dinter_impls[i].run;
+  dinter_acc = dinter_impls[i].acc;
+  dinter_name = dinter_impls[i].name;
+  return 0;
+}
+
+/* the best one, on first use unless one was picked already */
+
+static void dinter_default( void )
+{
+  if( !dinter_run )
+    si_deinterlace_select( NULL );
+}
+
+/* name of the implementation in use */
+
+char *si_deinterlace_impl( void )
+{
+  pthread_once( &dinter_once, dinter_default );
+  return dinter_name;
+}
+
+static struct SI_DINTER_PLAN *dinter_plans = NULL;
+
+static struct SI_DINTER_PLAN *plan_find( struct SI_DINTERLACE *cfg )
+{
+  struct SI_DINTER_PLAN *p;
+
+  for( p = dinter_plans; p; p = p->next )
+    if( p->interlace_type == cfg->interlace_type &&
+        p->n_cols == cfg->n_cols && p->n_rows == cfg->n_rows )
+      break;
+  return p;
+}
+
+/* the plan for the interlace_type and size of cfg, made on first use
+   and kept for the life of the program.  returns NULL with errno
+   EINVAL for a mode only si_deinterlace_ref() does.  The plan is made
+   without the lock held, so two threads may both make one; the first
+   in is kept and the other thrown away
+*/
+
+struct SI_DINTER_PLAN *si_dinter_plan( struct SI_DINTERLACE *cfg )
+{
+  struct SI_DINTER_PLAN *p, *q;
+
+  pthread_mutex_lock( &dinter_lock );
+  p = plan_find( cfg );
+  pthread_mutex_unlock( &dinter_lock );
+  if( p )
+    return p;
+
+  if( !(p = calloc( 1, sizeof(*p))))
+    return NULL;
+  p->interlace_type = cfg->interlace_type;
+  p->n_cols = cfg->n_cols;
+  p->n_rows = cfg->n_rows;
+  if( dinter_lanes( cfg, p ) < 0 ) {
+    free( p );
+    errno = EINVAL;
+    return NULL;
+  }
+
+  pthread_mutex_lock( &dinter_lock );
+  if( (q = plan_find( cfg ))) {
+    free( p );
+    p = q;
+  } else {
+    p->next = dinter_plans;
+    dinter_plans = p;
+  }
+  pthread_mutex_unlock( &dinter_lock );
+  return p;
+}
+
+/* input pixel i, one at a time */
+
+static void dinter_pixel( struct SI_DINTER_PLAN *p, unsigned short *to,
+                          long i, unsigned short v, struct DINTER_ACC *acc,
+                          const int *level )
+{
+  long g;
+  int k;
+
+  g = i / p->nlanes;
+  k = i % p->nlanes;
+  to[p->base[k] + p->rs[k]*(g / p->run) + p->dx[k]*(g % p->run)] =
+    level ? dinter_level( v, level[k] ) : v;
+  if( acc )
+    amp_add( &acc->st->amp[k], v, acc->st->saturation );
+}
+
+static long dinter_execute( struct SI_DINTER_PLAN *p, unsigned short *from,
+                            unsigned short *to, long start, long len,
+                            struct DINTER_ACC *acc, const int *level )
+{
+  long end, groups, g, i, x, y, n;
+
+  pthread_once( &dinter_once, dinter_default );
+
+  if( p->nlanes == 1 ) {
+    if( level )
+      for( i=0; i<len; i++ )
+        to[start + i] = dinter_level( from[i], level[0] );
+    else
+      memcpy( to + start, from, len*sizeof(short));
+    if( acc )
+      dinter_acc( acc, from, len );
+    return start + len;
+  }
+
+  /* the rest of a group the last piece cut short */
+
+  end = start + len;
+  for( i=start; i<end && i % p->nlanes; i++ )
+    dinter_pixel( p, to, i, from[i - start], acc, level );
+
+  groups = end / p->nlanes;
+  for( g = i / p->nlanes; g<groups; g+=n ) {
+    y = g / p->run;
+    x = g % p->run;
+    n = p->run - x;
+    if( n > groups - g )
+      n = groups - g;
+    dinter_run( to, from + g*p->nlanes - start, p, x, y, n,
+                end - g*p->nlanes, acc, level );
+  }
+
+  /* and a group this one cuts short */
+
+  if( i < groups*p->nlanes )
+    i = groups*p->nlanes;
+  for( ; i<end; i++ )
+    dinter_pixel( p, to, i, from[i - start], acc, level );
+
+  return (groups / p->run) * p->n_cols;
+}
+
+/* reorder len pixels of from into to following p.  from holds the
+   frame from input pixel start on, so a frame can be done a piece at
+   a time as the dma buffers fill.  returns the output words finished,
+   as n_ptr_pos
+*/
+
+long si_dinter_execute( struct SI_DINTER_PLAN *p, unsigned short *from,
+                        unsigned short *to, long start, long len )
+{
+  return dinter_execute( p, from, to, start, len, NULL, NULL );
+}
+
+/* empty stats for a frame from namps amplifiers, the plan's nlanes,
+   counting pixels at or above saturation as saturated, 0 for 65535
+*/
+
+void si_dinter_stats_start( struct SI_DINTER_STATS *s, int namps,
+                            int saturation )
+{
+  int k;
+
+  bzero( s, sizeof(*s));
+  if( namps < 1 || namps > SI_DINTER_MAXLANES )
+    namps = SI_DINTER_MAXLANES;
+  if( saturation < 1 || saturation > 65535 )
+    saturation = 65535;
+  s->namps = namps;
+  s->saturation = saturation;
+  for( k=0; k<namps; k++ )
+    s->amp[k].min = 65535;
+}
+
+/* the mean and variance of each amp from its sums, once the frame
+   is done
+*/
+
+void si_dinter_stats_end( struct SI_DINTER_STATS *s )
+{
+  struct SI_AMP_STATS *a;
+  int k;
+
+  for( k=0; k<s->namps; k++ ) {
+    a = &s->amp[k];
+    a->mean = a->var = 0.0;
+    if( a->n == 0 )
+      continue;
+    a->mean = (double)a->sum / a->n;
+    a->var = (double)a->sumsq / a->n - a->mean*a->mean;
+    if( a->var < 0.0 )
+      a->var = 0.0;
+  }
+}
+
+/* from, counted over another part of the frame, added into to */
+
+void si_dinter_stats_merge( struct SI_DINTER_STATS *to,
+                            struct SI_DINTER_STATS *from )
+{
+  struct SI_AMP_STATS *a, *b;
+  int k, i;
+
+  for( k=0; k<to->namps; k++ ) {
+    a = &to->amp[k];
+    b = &from->amp[k];
+    a->n += b->n;
+    if( b->min < a->min )
+      a->min = b->min;
+    if( b->max > a->max )
+      a->max = b->max;
+    a->saturated += b->saturated;
+    a->sum += b->sum;
+    a->sumsq += b->sumsq;
+    for( i=0; i<SI_STATS_BINS; i++ )
+      a->hist[i] += b->hist[i];
+  }
+}
+
+/* si_dinter_execute() adding each amplifier's pixels into s, begun
+   with si_dinter_stats_start(), as they go by.  NULL s counts nothing
+*/
+
+long si_dinter_execute_stats( struct SI_DINTER_PLAN *p, unsigned short *from,
+                              unsigned short *to, long start, long len,
+                              struct SI_DINTER_STATS *s )
+{
+  return si_dinter_execute_level( p, from, to, start, len, s, NULL );
+}
+
+/* and with level[k] added to each pixel of lane k as it is written,
+   held to 0 to 65535.  s counts the pixels as they came in.  NULL
+   level leaves them as they are
+*/
+
+long si_dinter_execute_level( struct SI_DINTER_PLAN *p, unsigned short *from,
+                              unsigned short *to, long start, long len,
+                              struct SI_DINTER_STATS *s, const int *level )
+{
+  struct DINTER_ACC acc;
+  long n;
+
+  if( !s )
+    return dinter_execute( p, from, to, start, len, NULL, level );
+  acc_start( &acc, s, p->nlanes );
+  n = dinter_execute( p, from, to, start, len, &acc, level );
+  acc_fold( &acc );
+  return n;
+}
+
+/* one band of whole output rows for each worker */
+
+struct DINTER_JOB {
+  struct SI_DINTER_PLAN *p;
+  unsigned short *from;
+  unsigned short *to;
+  long start;
+  long end;
+  long row;         /* input pixels in one output row */
+  long r0;          /* first and number of rows */
+  long nrows;
+  int nbands;
+  struct SI_DINTER_STATS *stats;  /* one for each band, or NULL */
+};
+
+static void dinter_band( void *v, int i )
+{
+  struct DINTER_JOB *j = v;
+  long a, b;
+
+  a = (j->r0 + j->nrows*i/j->nbands) * j->row;
+  b = (j->r0 + j->nrows*(i+1)/j->nbands) * j->row;
+  if( a < j->start )
+    a = j->start;
+  if( b > j->end )
+    b = j->end;
+  if( a < b )
+    si_dinter_execute_stats( j->p, j->from + (a - j->start), j->to, a, b - a,
+                             j->stats ? &j->stats[i] : NULL );
+}
+
+/* si_dinter_execute() shared out over the worker pool by rows.  Unless
+   two amplifiers read the same section every input pixel has its own
+   output pixel, so the bands never write the same place.  Those that
+   do are left to one thread, the last write has to win
+*/
+
+long si_dinter_execute_par( struct SI_DINTER_PLAN *p, unsigned short *from,
+                            unsigned short *to, long start, long len )
+{
+  return si_dinter_execute_par_stats( p, from, to, start, len, NULL );
+}
+
+/* and counting into s.  Each band has stats of its own, added into s
+   when all are done
+*/
+
+long si_dinter_execute_par_stats( struct SI_DINTER_PLAN *p,
+                                  unsigned short *from, unsigned short *to,
+                                  long start, long len,
+                                  struct SI_DINTER_STATS *s )
+{
+  struct DINTER_JOB j;
+  int i;
+
+  pthread_once( &dinter_once, dinter_default );
+
+  j.p = p;
+  j.from = from;
+  j.to = to;
+  j.start = start;
+  j.end = start + len;
+  j.row = p->run * p->nlanes;
+  j.r0 = start / j.row;
+  j.nrows = (j.end + j.row - 1) / j.row - j.r0;
+  j.nbands = 4*si_pool_size();
+  if( j.nbands > j.nrows )
+    j.nbands = j.nrows;
+
+  j.stats = NULL;
+  if( s && j.nbands > 1 && !p->overlap &&
+      !(j.stats = malloc( j.nbands*sizeof(*j.stats))))
+    j.nbands = 1;  /* no room for the bands' counts, do it here */
+  for( i=0; j.stats && i<j.nbands; i++ )
+    si_dinter_stats_start( &j.stats[i], s->namps, s->saturation );
+
+  if( j.nbands > 1 && !p->overlap )
+    si_pool_run( dinter_band, &j, j.nbands );
+  else if( len > 0 )
+    si_dinter_execute_stats( p, from, to, start, len, s );
+
+  for( i=0; j.stats && i<j.nbands; i++ )
+    si_dinter_stats_merge( s, &j.stats[i] );
+  free( j.stats );
+
+  if( p->nlanes == 1 )
+    return j.end;
+  return (j.end / p->nlanes / p->run) * p->n_cols;
+}
+
+/* reorder len_bytes of from into to, as si_deinterlace_ref() */
+
+void si_deinterlace( struct SI_DINTERLACE *cfg, unsigned short *from,
+                     unsigned short *to, int len_bytes )
+{
+  struct SI_DINTER_PLAN *p;
+
+  if( !(p = si_dinter_plan( cfg ))) {
+    si_deinterlace_ref( cfg, from, to, len_bytes );
+    return;
+  }
+  cfg->n_ptr_pos = si_dinter_execute( p, from, to, 0, len_bytes/2 );
+  cfg->n_in_pos = len_bytes/2;
+}
+
+/* si_deinterlace() on all the worker threads */
+
+void si_deinterlace_par( struct SI_DINTERLACE *cfg, unsigned short *from,
+                         unsigned short *to, int len_bytes )
+{
+  struct SI_DINTER_PLAN *p;
+
+  if( !(p = si_dinter_plan( cfg ))) {
+    si_deinterlace_ref( cfg, from, to, len_bytes );
+    return;
+  }
+  cfg->n_ptr_pos = si_dinter_execute_par( p, from, to, 0, len_bytes/2 );
+  cfg->n_in_pos = len_bytes/2;
+}
+
+/* carry on from n_in_pos, the input words already done, for an image
+   that arrives a dma buffer at a time.  Set n_in_pos to 0 for a new
+   frame.  Modes without a plan are left alone
+*/
+
+void si_deinterlace_more( struct SI_DINTERLACE *cfg, unsigned short *from,
+                          unsigned short *to, int len_bytes )
+{
+  struct SI_DINTER_PLAN *p;
+
+  if( !(p = si_dinter_plan( cfg )))
+    return;
+  cfg->n_ptr_pos = si_dinter_execute( p, from, to, cfg->n_in_pos,
+                                      len_bytes/2 );
+  cfg->n_in_pos += len_bytes/2;
+}
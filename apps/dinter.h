@@ -1,2 +1,47 @@
+/* Plans, layouts and the choice of implementation are shared by every
+   thread.  si_dinter_plan(), si_layout_get() and si_layout_register()
+   may be called from any thread at any time; a plan, once returned,
+   is never changed or freed and may be executed by any number of
+   threads at once, each writing its own part of the output.
+   si_deinterlace_select() is the exception: call it, if at all,
+   before any thread deinterlaces, otherwise the best implementation
+   is picked once on first use.  A SI_DINTERLACE, as passed to
+   si_deinterlace_more(), and a SI_DINTER_STATS belong to one thread.
+*/
+
 void si_deinterlace( struct SI_DINTERLACE *cfg, unsigned short *from,
                      unsigned short *to, int len_bytes );
+void si_deinterlace_par( struct SI_DINTERLACE *cfg, unsigned short *from,
+                         unsigned short *to, int len_bytes );
+void si_deinterlace_more( struct SI_DINTERLACE *cfg, unsigned short *from,
+                          unsigned short *to, int len_bytes );
+void si_deinterlace_ref( struct SI_DINTERLACE *cfg, unsigned short *from,
+                         unsigned short *to, int len_bytes );
+struct SI_DINTER_PLAN *si_dinter_plan( struct SI_DINTERLACE *cfg );
+long si_dinter_execute( struct SI_DINTER_PLAN *p, unsigned short *from,
+                        unsigned short *to, long start, long len );
+long si_dinter_execute_par( struct SI_DINTER_PLAN *p, unsigned short *from,
+                            unsigned short *to, long start, long len );
+int si_layout_amps( struct SI_LAYOUT *l, char *s );
+int si_load_layout( struct SI_LAYOUT *l, char *fname );
+int si_layout_get( int type, struct SI_LAYOUT *l );
+int si_layout_register( struct SI_LAYOUT *l );
+int si_layout_plan( struct SI_LAYOUT *l, int n_cols, int n_rows,
+                    struct SI_DINTER_PLAN *p );
+int si_deinterlace_select( char *name );
+char *si_deinterlace_impl( void );
+void si_dinter_stats_start( struct SI_DINTER_STATS *s, int namps,
+                            int saturation );
+void si_dinter_stats_end( struct SI_DINTER_STATS *s );
+void si_dinter_stats_merge( struct SI_DINTER_STATS *to,
+                            struct SI_DINTER_STATS *from );
+long si_dinter_execute_stats( struct SI_DINTER_PLAN *p, unsigned short *from,
+                              unsigned short *to, long start, long len,
+                              struct SI_DINTER_STATS *s );
+long si_dinter_execute_level( struct SI_DINTER_PLAN *p, unsigned short *from,
+                              unsigned short *to, long start, long len,
+                              struct SI_DINTER_STATS *s, const int *level );
+long si_dinter_execute_par_stats( struct SI_DINTER_PLAN *p,
+                                  unsigned short *from, unsigned short *to,
+                                  long start, long len,
+                                  struct SI_DINTER_STATS *s );
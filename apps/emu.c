@@ -0,0 +1,394 @@
+/*
+
+Camera emulator for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  the camera end of the serial protocol.  Every command byte is
+  echoed, F and J are followed by 32 big endian ints, G and K by an
+  index and a value, H and L answer 32 ints, I answers the status
+  ints, and all but S, T, 0, P and M end with Y or N.
+
+  si_emu_command() does the work on ints, the synth and replay
+  backends in camera.c call it directly.  si_emu_serve() speaks the
+  bytes over a file descriptor, so lib.c can be run against it on
+  a pseudo terminal, see si_emu_spawn() and si-emu.c.
+
+  Values sent to the camera are checked against the limits of the
+  cfg file when one is given.  Options, comma separated:
+
+    latency=MS     wait before answering each command
+    jitter=MS      wait up to this much longer, at random
+    baud=N         send replies at N baud, 10 bits a byte
+    timeout=MS     how long the far end waits for a byte
+    drop=P         chance 0..1 a command gets no answer at all
+    corrupt=P      chance the echo comes back wrong
+    cut=P          chance a reply stops part way through
+    nak=P          chance of N for a good command
+    seed=N         random seed
+*/
+
+#define _GNU_SOURCE /* posix_openpt and friends */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "lib.h"
+#include "camera.h"
+#include "emu.h"
+
+/* power on values, from 800-299x1.set */
+
+static int emu_readout[SI_READOUT_MAX] = {
+  2, 2047, 1, 0, 1, 2046, 1, 1, 200, 0, 19, 0, 200, 200, 201, 199,
+  10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32670, 32945, 32590, 32920
+};
+
+static int emu_config[SI_CONFIG_MAX] = {
+  804, 299, 0, 0, 1, 2049, 0, 1, 2047, 185, 3, 20, 60, 0, 2480, 10,
+  0, 300
+};
+
+static int emu_status[SI_STATUS_MAX] = { 1732, 2932, 266 };
+
+static int emu_check( struct CFG_ENTRY **e, int ix, int val );
+static double emu_random( struct SI_EMU *e );
+static int emu_read( int fd, void *buf, int len );
+static int emu_write( struct SI_EMU *e, int fd, void *buf, int len );
+
+void si_emu_init( struct SI_EMU *e )
+{
+  bzero( e, sizeof(*e));
+  memcpy( e->status, emu_status, sizeof(e->status));
+  memcpy( e->config, emu_config, sizeof(e->config));
+  memcpy( e->readout, emu_readout, sizeof(e->readout));
+  e->timeout = 1000; /* same as si_init_com */
+  e->seed = 1;
+}
+
+/* parse the comma separated options at the top of this file */
+
+int si_emu_options( struct SI_EMU *e, char *opts )
+{
+  char *buf, *s, *val, *save;
+  double v;
+
+  if( !opts || !*opts )
+    return 0;
+  if( !(buf = strdup( opts )))
+    return -1;
+
+  for( s = strtok_r( buf, ",", &save ); s; s = strtok_r( NULL, ",", &save )) {
+    if( !(val = strchr( s, '=' )))
+      goto bad;
+    *val++ = 0;
+    v = atof( val );
+
+    if( strcmp( s, "latency" ) == 0 )
+      e->latency = v * 1.0e-3;
+    else if( strcmp( s, "jitter" ) == 0 )
+      e->jitter = v * 1.0e-3;
+    else if( strcmp( s, "baud" ) == 0 )
+      e->baud = v;
+    else if( strcmp( s, "timeout" ) == 0 )
+      e->timeout = (int)v;
+    else if( strcmp( s, "drop" ) == 0 )
+      e->drop = v;
+    else if( strcmp( s, "corrupt" ) == 0 )
+      e->corrupt = v;
+    else if( strcmp( s, "cut" ) == 0 )
+      e->cut = v;
+    else if( strcmp( s, "nak" ) == 0 )
+      e->nak = v;
+    else if( strcmp( s, "seed" ) == 0 )
+      e->seed = (unsigned int)strtoul( val, NULL, 0 );
+    else
+      goto bad;
+  }
+  free( buf );
+  return 0;
+
+bad:
+  fprintf( stderr, "bad emulator option %s\n", s );
+  free( buf );
+  errno = EINVAL;
+  return -1;
+}
+
+/* run one command.
+   returns 1 for Y, 0 for N, -1 if the reply would not fit in recv
+*/
+
+int si_emu_command( struct SI_EMU *e, int cmd, int nsend, int *send,
+                    int nrecv, int *recv )
+{
+  struct CFG_ENTRY **ent;
+  int *dat, i, n;
+
+  switch( cmd ) {
+    case 'F': /* send readout */
+    case 'J': /* send config */
+      dat = cmd == 'F' ? e->readout : e->config;
+      ent = cmd == 'F' ? e->e_readout : e->e_config;
+      if( nsend != 32 )
+        return 0;
+      for( i=0; i<32; i++ )
+        if( !emu_check( ent, i, send[i] )) {
+          e->nrejected++;
+          return 0;
+        }
+      memcpy( dat, send, 32*sizeof(int));
+      return 1;
+    case 'G': /* set one readout */
+    case 'K': /* set one config */
+      dat = cmd == 'G' ? e->readout : e->config;
+      ent = cmd == 'G' ? e->e_readout : e->e_config;
+      if( nsend != 2 || send[0] < 0 || send[0] >= 32 )
+        return 0;
+      if( !emu_check( ent, send[0], send[1] )) {
+        e->nrejected++;
+        return 0;
+      }
+      dat[send[0]] = send[1];
+      return 1;
+    case 'H':
+    case 'L':
+    case 'I':
+      dat = cmd == 'H' ? e->readout : cmd == 'L' ? e->config : e->status;
+      n = cmd == 'I' ? SI_STATUS_MAX : 32;
+      if( nrecv > n )
+        return -1;
+      memcpy( recv, dat, nrecv*sizeof(int));
+      return 1;
+    case 'A': /* open shutter */
+    case 'B': /* close shutter */
+      e->status[8] = (cmd == 'A');
+      return 1;
+    case 'C': /* test image */
+    case 'D': /* exposed image */
+    case 'E': /* dark image */
+    case 'Z': /* tdi image */
+    case '0': /* abort readout */
+      return 1;
+    default:
+      return si_camera_command_yn( cmd ) ? 0 : 1;
+  }
+}
+
+/* answer commands arriving on fd until the far end goes away.
+   returns 0 at end of file or when interrupted by a signal,
+   -1 on error
+*/
+
+int si_emu_serve( struct SI_EMU *e, int fd )
+{
+  unsigned char cmd, echo, yn;
+  int dat[32];
+  int nsend, nrecv, ret, n, i;
+  double r;
+
+  for(;;) {
+    if( (n = read( fd, &cmd, 1 )) <= 0 ) {
+      if( n == 0 || errno == EINTR || errno == EIO ) /* EIO, pty hangup */
+        return 0;
+      return -1;
+    }
+    e->ncommands++;
+
+    if( e->latency > 0.0 || e->jitter > 0.0 )
+      si_camera_sleep_until( si_camera_time() + e->latency +
+                             e->jitter * emu_random( e ));
+
+    /* one draw picks at most one error */
+
+    r = emu_random( e );
+    if( r < e->drop ) {
+      e->ndropped++;
+      continue;
+    }
+    r -= e->drop;
+
+    echo = cmd;
+    if( r < e->corrupt ) {
+      echo ^= 0x40;
+      e->ncorrupted++;
+    }
+    r -= e->corrupt;
+
+    if( emu_write( e, fd, &echo, 1 ) < 0 )
+      return -1;
+    if( echo != cmd ) /* the far end gives up on a bad echo */
+      continue;
+
+    nsend = (cmd == 'F' || cmd == 'J') ? 32 : (cmd == 'G' || cmd == 'K') ? 2 : 0;
+    nrecv = (cmd == 'H' || cmd == 'L') ? 32 : cmd == 'I' ? SI_STATUS_MAX : 0;
+
+    if( nsend ) {
+      if( emu_read( fd, dat, nsend*sizeof(int)) < 0 )
+        return errno == EINTR || errno == EIO ? 0 : -1;
+      for( i=0; i<nsend; i++ )
+        si_swapl( &dat[i] );
+    }
+
+    ret = si_emu_command( e, cmd, nsend, dat, nrecv, dat );
+
+    if( r < e->cut ) {
+      e->ncut++;
+      if( nrecv && emu_write( e, fd, dat, nrecv*sizeof(int)/2 ) < 0 )
+        return -1;
+      continue;
+    }
+    r -= e->cut;
+
+    if( r < e->nak && ret == 1 && si_camera_command_yn( cmd )) {
+      e->nnaked++;
+      ret = 0;
+    }
+
+    if( nrecv ) {
+      for( i=0; i<nrecv; i++ )
+        si_swapl( &dat[i] );
+      if( emu_write( e, fd, dat, nrecv*sizeof(int)) < 0 )
+        return -1;
+    }
+    if( si_camera_command_yn( cmd )) {
+      yn = ret == 1 ? 'Y' : 'N';
+      if( emu_write( e, fd, &yn, 1 ) < 0 )
+        return -1;
+    }
+  }
+}
+
+/* start an emulator in a child process on a pseudo terminal.
+   returns the open terminal for the camera's uart, -1 on error
+*/
+
+int si_emu_spawn( struct SI_EMU *e, int *pid )
+{
+  int master, fd;
+
+  if( (master = posix_openpt( O_RDWR|O_NOCTTY )) < 0 )
+    return -1;
+  if( grantpt( master ) < 0 || unlockpt( master ) < 0 ||
+      (fd = open( ptsname( master ), O_RDWR|O_NOCTTY )) < 0 ) {
+    close( master );
+    return -1;
+  }
+  if( si_init_tty( fd, e->timeout ) < 0 ) {
+    close( fd );
+    close( master );
+    return -1;
+  }
+
+  switch( (*pid = fork()) ) {
+    case -1:
+      close( fd );
+      close( master );
+      return -1;
+    case 0:
+      close( fd );
+      _exit( si_emu_serve( e, master ) < 0 );
+  }
+
+  close( master );
+  return fd;
+}
+
+/* true if val is inside the cfg file limits for slot ix */
+
+static int emu_check( struct CFG_ENTRY **e, int ix, int val )
+{
+  struct CFG_ENTRY *cfg;
+
+  if( !e || !(cfg = e[ix]) )
+    return 1;
+
+  switch( cfg->type ) {
+    case CFG_TYPE_INPUTD:
+      if( cfg->u.iobox.min > cfg->u.iobox.max ) /* no usable limits */
+        return 1;
+      return val >= cfg->u.iobox.min && val <= cfg->u.iobox.max;
+    case CFG_TYPE_DROPD:
+      return val >= cfg->u.drop.min && val <= cfg->u.drop.max;
+    case CFG_TYPE_BITF:
+      return (val & ~cfg->u.bitf.mask) == 0;
+  }
+  return 1;
+}
+
+/* uniform 0..1 */
+
+static double emu_random( struct SI_EMU *e )
+{
+  return (double)rand_r( &e->seed ) / ((double)RAND_MAX + 1.0);
+}
+
+static int emu_read( int fd, void *buf, int len )
+{
+  char *p;
+  int n;
+
+  p = (char *)buf;
+  while( len > 0 ) {
+    if( (n = read( fd, p, len )) <= 0 ) {
+      if( n == 0 )
+        errno = EIO;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* write len bytes, a byte at a time at the line rate if there is one */
+
+static int emu_write( struct SI_EMU *e, int fd, void *buf, int len )
+{
+  char *p;
+  double t;
+  int n, chunk;
+
+  p = (char *)buf;
+  t = si_camera_time();
+  while( len > 0 ) {
+    chunk = len;
+    if( e->baud > 0.0 ) {
+      chunk = 1;
+      t += 10.0 / e->baud;
+      si_camera_sleep_until( t );
+    }
+    if( (n = write( fd, p, chunk )) < 0 ) {
+      if( errno == EINTR )
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
@@ -0,0 +1,6 @@
+void si_emu_init( struct SI_EMU *e );
+int si_emu_options( struct SI_EMU *e, char *opts );
+int si_emu_command( struct SI_EMU *e, int cmd, int nsend, int *send,
+                    int nrecv, int *recv );
+int si_emu_serve( struct SI_EMU *e, int fd );
+int si_emu_spawn( struct SI_EMU *e, int *pid );
@@ -0,0 +1,708 @@
+/*
+
+FITS files of images from the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  write an image as a FITS file that says how it was taken.  The
+  header has a card for every readout, status and configuration value
+  the cfg file names, READn, STATn and CONFn for slot n with the name
+  and what the value means as the comment.
+
+    si_fits_open()   the header, for an image of n_cols by n_rows
+    si_fits_write()  pixels, in order, as many at a time as there are
+    si_fits_close()  pad the file out and close it
+
+  si_fits_save() does all three for a finished image, and
+  si_fits_image() makes the whole file in memory, to be written later
+  or elsewhere.
+
+  si_fits_rice_save() and si_fits_rice_image() write the image tile
+  compressed instead, as fpack does: an empty primary HDU then a
+  binary table with a row of Rice code, see rice.c, for each image
+  row.  Rows are coded on the worker pool, each band of them into its
+  own part of the buffer, and then closed up.  Sky frames come out
+  at a third to a half of the size.  Names ending .fz are the
+  compressed ones, si_fits_compressed() says which.
+
+  FITS has no unsigned 16 bit type, so pixels are stored less 32768
+  with BZERO saying so, big endian.  Both are done together with
+  vectors on the way into a buffer that goes to the file
+  SI_FITS_CHUNK bytes at a time.  The chunk is a whole number of
+  2880 byte FITS blocks and of pages, so every write starts on a
+  page and the last one ends the file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "lib.h"
+#include "dinter.h"
+#include "pool.h"
+#include "rice.h"
+#include "fits.h"
+
+#define FITS_HEADER_MAX (4*SI_FITS_BLOCK) /* all the cards there can be */
+
+static int write_all( int fd, void *buf, long len )
+{
+  char *p;
+  long n;
+
+  p = (char *)buf;
+  while( len > 0 ) {
+    if( (n = write( fd, p, len )) < 0 ) {
+      if( errno == EINTR )
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* pixels xor flip, byte swapped.  0x8000 makes them FITS, less 32768
+   and big endian, and 0x0080 turns them back
+*/
+
+static void swap_scalar( unsigned short *to, unsigned short *from, long n,
+                         unsigned short flip )
+{
+  unsigned short v;
+  long x;
+
+  for( x=0; x<n; x++ ) {
+    v = from[x] ^ flip;
+    to[x] = (v << 8) | (v >> 8);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FITS_X86
+#endif
+
+#ifdef FITS_X86
+
+__attribute__((target("sse2")))
+static void swap_sse2( unsigned short *to, unsigned short *from, long n,
+                       unsigned short flip )
+{
+  __m128i v, bias;
+  long x;
+
+  bias = _mm_set1_epi16( (short)flip );
+  for( x=0; x+8<=n; x+=8 ) {
+    v = _mm_xor_si128( _mm_loadu_si128( (__m128i *)(from + x)), bias );
+    v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ));
+    _mm_storeu_si128( (__m128i *)(to + x), v );
+  }
+  swap_scalar( to + x, from + x, n - x, flip );
+}
+
+__attribute__((target("avx2")))
+static void swap_avx2( unsigned short *to, unsigned short *from, long n,
+                       unsigned short flip )
+{
+  __m256i v, bias;
+  long x;
+
+  bias = _mm256_set1_epi16( (short)flip );
+  for( x=0; x+16<=n; x+=16 ) {
+    v = _mm256_xor_si256( _mm256_loadu_si256( (__m256i *)(from + x)), bias );
+    v = _mm256_or_si256( _mm256_slli_epi16( v, 8 ), _mm256_srli_epi16( v, 8 ));
+    _mm256_storeu_si256( (__m256i *)(to + x), v );
+  }
+  swap_scalar( to + x, from + x, n - x, flip );
+}
+#endif
+
+static void fits_swap( unsigned short *to, unsigned short *from, long n,
+                       unsigned short flip )
+{
+#ifdef FITS_X86
+  char *impl;
+
+  impl = si_deinterlace_impl();
+  if( strcmp( impl, "avx2" ) == 0 ) {
+    swap_avx2( to, from, n, flip );
+    return;
+  }
+  if( strcmp( impl, "sse2" ) == 0 ) {
+    swap_sse2( to, from, n, flip );
+    return;
+  }
+#endif
+  swap_scalar( to, from, n, flip );
+}
+
+/* n pixels from to the FITS order at to, with the code
+   si_deinterlace_select() picked
+*/
+
+void si_fits_swap( unsigned short *to, unsigned short *from, long n )
+{
+  fits_swap( to, from, n, 0x8000 );
+}
+
+/* and n FITS pixels back, BZERO 32768 */
+
+void si_fits_unswap( unsigned short *to, unsigned short *from, long n )
+{
+  fits_swap( to, from, n, 0x0080 );
+}
+
+/* the buffer to the file, if full or at the end.  A file made in
+   memory has nowhere to go
+*/
+
+static int fits_flush( struct SI_FITS *f )
+{
+  if( f->fd < 0 && f->len > 0 ) {
+    errno = ENOSPC;
+    return -1;
+  }
+  if( f->len > 0 && write_all( f->fd, f->buf, f->len ) < 0 )
+    return -1;
+  f->len = 0;
+  return 0;
+}
+
+/* one 80 character header card.  value is put as it is, quoted by
+   the caller if a string, comment is cut to fit
+*/
+
+static void fits_card( struct SI_FITS *f, char *key, char *value,
+                       char *comment )
+{
+  char card[81];
+  int n;
+
+  if( f->len + SI_FITS_CARD > f->size && fits_flush( f ) < 0 ) {
+    f->error = errno;
+    return;
+  }
+
+  if( value && value[0] == '\'' )  /* strings start in column 11 */
+    n = snprintf( card, sizeof(card), "%-8.8s= %-20s", key, value );
+  else if( value )
+    n = snprintf( card, sizeof(card), "%-8.8s= %20s", key, value );
+  else
+    n = snprintf( card, sizeof(card), "%-8.8s", key );
+  if( comment && n < SI_FITS_CARD - 3 )
+    n += snprintf( card + n, sizeof(card) - n, " / %s", comment );
+  if( n > SI_FITS_CARD )
+    n = SI_FITS_CARD;
+  memset( card + n, ' ', SI_FITS_CARD - n );
+  memcpy( f->buf + f->len, card, SI_FITS_CARD );
+  f->len += SI_FITS_CARD;
+}
+
+static void fits_int( struct SI_FITS *f, char *key, long v, char *comment )
+{
+  char buf[32];
+
+  sprintf( buf, "%ld", v );
+  fits_card( f, key, buf, comment );
+}
+
+/* FITS strings are at least 8 characters between the quotes */
+
+static void fits_string( struct SI_FITS *f, char *key, char *s,
+                         char *comment )
+{
+  char buf[72];
+
+  snprintf( buf, sizeof(buf), "'%-8.60s'", s );
+  fits_card( f, key, buf, comment );
+}
+
+/* a card for each value the cfg file names, the comment saying what
+   it is as si-test prints it
+*/
+
+static void fits_cfg( struct SI_FITS *f, char *prefix,
+                      struct CFG_ENTRY **e, int *val, int n )
+{
+  struct CFG_ENTRY *cfg;
+  char key[16], buf[128], *what, comment[256];
+  int i;
+
+  for( i=0; i<n; i++ ) {
+    if( !(cfg = e[i]) || !cfg->name || cfg->type == CFG_TYPE_NOTUSED )
+      continue;
+
+    buf[0] = 0;
+    if( cfg->type != CFG_TYPE_BITF || (cfg->u.bitf.mask & val[i]))
+      si_sprint_cfg_val_only( buf, cfg, val[i] );
+    for( what = buf; *what == ' '; what++ )
+      ;
+    if( cfg->type == CFG_TYPE_INPUTD && cfg->u.iobox.units &&
+        (cfg->u.iobox.mult != 1.0 || cfg->u.iobox.offset != 0.0))
+      snprintf( comment, sizeof(comment), "%s %s %s", cfg->name, what,
+                cfg->u.iobox.units );
+    else if( cfg->type == CFG_TYPE_INPUTD )
+      snprintf( comment, sizeof(comment), "%s", cfg->name );
+    else
+      snprintf( comment, sizeof(comment), "%s %s", cfg->name, what );
+
+    sprintf( key, "%s%d", prefix, i );
+    fits_int( f, key, val[i], comment );
+  }
+}
+
+/* the data starts on a block */
+
+static void fits_end( struct SI_FITS *f )
+{
+  fits_card( f, "END", NULL, NULL );
+  while( f->len % SI_FITS_BLOCK && !f->error )
+    fits_card( f, "", NULL, NULL );
+}
+
+/* how the image was taken, by c if not NULL, and the end of the
+   header.  The values are those fr was taken with, or c's as they
+   are now if fr is NULL; a frame not from the camera has none
+*/
+
+static void fits_camera( struct SI_FITS *f, struct SI_CAMERA *c,
+                         struct SI_FRAME *fr )
+{
+  struct CFG_ENTRY *cfg;
+  char date[32], val[32];
+  time_t now;
+  struct tm tm;
+  int *readout, *status, *config, frame;
+
+  time( &now );
+  gmtime_r( &now, &tm );
+  strftime( date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm );
+
+  fits_string( f, "DATE", date, "UTC file written" );
+  fits_string( f, "INSTRUME", "SI 3097", NULL );
+
+  if( fr && !fr->taken )
+    c = NULL;
+  if( c ) {
+    readout = fr ? fr->readout : c->readout;
+    status = fr ? fr->status : c->status;
+    config = fr ? fr->config : c->config;
+    frame = fr ? fr->frame : c->frame;
+    if( (cfg = si_find_readout( c, "Exposure Time" ))) {
+      sprintf( val, "%.3f", readout[cfg->index]/1000.0 );
+      fits_card( f, "EXPTIME", val, "seconds" );
+    }
+    fits_int( f, "FRAME", frame, "since the camera was opened" );
+    fits_cfg( f, "READ", c->e_readout, readout, SI_READOUT_MAX );
+    fits_cfg( f, "STAT", c->e_status, status, SI_STATUS_MAX );
+    fits_cfg( f, "CONF", c->e_config, config, SI_CONFIG_MAX );
+  }
+  fits_end( f );
+}
+
+/* the cards for an n_cols by n_rows image taken by c, which may be
+   NULL, as fr says, ending on a block
+*/
+
+static void fits_header( struct SI_FITS *f, struct SI_CAMERA *c,
+                         struct SI_FRAME *fr, int n_cols, int n_rows )
+{
+  fits_card( f, "SIMPLE", "T", "conforms to FITS" );
+  fits_int( f, "BITPIX", 16, NULL );
+  fits_int( f, "NAXIS", 2, NULL );
+  fits_int( f, "NAXIS1", n_cols, NULL );
+  fits_int( f, "NAXIS2", n_rows, NULL );
+  fits_int( f, "BZERO", 32768, "pixels are unsigned" );
+  fits_int( f, "BSCALE", 1, NULL );
+  fits_camera( f, c, fr );
+}
+
+/* start a FITS file of an n_cols by n_rows image taken by c, which may
+   be NULL, with the settings of fr, or c's now if fr is NULL.  0 or -1
+   with errno set
+*/
+
+int si_fits_open( struct SI_FITS *f, struct SI_CAMERA *c,
+                  struct SI_FRAME *fr, char *fname, int n_cols, int n_rows )
+{
+  void *buf;
+
+  bzero( f, sizeof(*f));
+  if( posix_memalign( &buf, 4096, SI_FITS_CHUNK ) != 0 ) {
+    errno = ENOMEM;
+    return -1;
+  }
+  f->buf = buf;
+  f->size = SI_FITS_CHUNK;
+  if( (f->fd = open( fname, O_WRONLY|O_CREAT|O_TRUNC, 0666 )) < 0 ) {
+    free( f->buf );
+    f->buf = NULL;
+    return -1;
+  }
+  f->total = (long)n_cols*n_rows;
+  fits_header( f, c, fr, n_cols, n_rows );
+
+  if( f->error ) {
+    errno = f->error;
+    si_fits_close( f );
+    return -1;
+  }
+  return 0;
+}
+
+/* the next n pixels of the image, 0 or -1 */
+
+int si_fits_write( struct SI_FITS *f, unsigned short *data, long n )
+{
+  long room;
+
+  if( f->npix + n > f->total )
+    n = f->total - f->npix;
+  while( n > 0 && !f->error ) {
+    room = (f->size - f->len)/sizeof(short);
+    if( room > n )
+      room = n;
+    si_fits_swap( (unsigned short *)(f->buf + f->len), data, room );
+    f->len += room*sizeof(short);
+    f->npix += room;
+    data += room;
+    n -= room;
+    if( f->len == f->size && fits_flush( f ) < 0 )
+      f->error = errno;
+  }
+  if( f->error ) {
+    errno = f->error;
+    return -1;
+  }
+  return 0;
+}
+
+/* pixels not written as 0, and the last block padded */
+
+static void fits_finish( struct SI_FITS *f )
+{
+  unsigned short zero[1024];
+  long n;
+
+  bzero( zero, sizeof(zero));
+  while( f->npix < f->total && !f->error ) {
+    n = f->total - f->npix;
+    if( n > 1024 )
+      n = 1024;
+    si_fits_write( f, zero, n );
+  }
+
+  n = (SI_FITS_BLOCK - f->len % SI_FITS_BLOCK) % SI_FITS_BLOCK;
+  bzero( f->buf + f->len, n );
+  f->len += n;
+}
+
+/* finish the file and close it.  0 or -1 if anything went wrong
+   since si_fits_open()
+*/
+
+int si_fits_close( struct SI_FITS *f )
+{
+  if( f->fd < 0 )
+    return -1;
+
+  fits_finish( f );
+  if( !f->error && fits_flush( f ) < 0 )
+    f->error = errno;
+  if( close( f->fd ) < 0 && !f->error )
+    f->error = errno;
+  f->fd = -1;
+  free( f->buf );
+  f->buf = NULL;
+
+  if( f->error ) {
+    errno = f->error;
+    return -1;
+  }
+  return 0;
+}
+
+/* a whole n_cols by n_rows image to fname, 0 or -1 */
+
+int si_fits_save( struct SI_CAMERA *c, struct SI_FRAME *fr, char *fname,
+                  unsigned short *data, int n_cols, int n_rows )
+{
+  struct SI_FITS f;
+
+  if( si_fits_open( &f, c, fr, fname, n_cols, n_rows ) < 0 )
+    return -1;
+  si_fits_write( &f, data, (long)n_cols*n_rows );
+  return si_fits_close( &f );
+}
+
+/* bytes si_fits_image() may need for an n_cols by n_rows image */
+
+long si_fits_bound( int n_cols, int n_rows )
+{
+  long n;
+
+  n = FITS_HEADER_MAX + 2L*n_cols*n_rows;
+  return ((n + SI_FITS_BLOCK - 1)/SI_FITS_BLOCK)*SI_FITS_BLOCK;
+}
+
+/* the whole file for an n_cols by n_rows image made in the size bytes
+   at buf, for writing later.  Returns its length or -1
+*/
+
+long si_fits_image( struct SI_CAMERA *c, struct SI_FRAME *fr, char *buf,
+                    long size, unsigned short *data, int n_cols, int n_rows )
+{
+  struct SI_FITS f;
+
+  bzero( &f, sizeof(f));
+  f.fd = -1;
+  f.buf = buf;
+  f.size = size;
+  f.total = (long)n_cols*n_rows;
+  fits_header( &f, c, fr, n_cols, n_rows );
+  si_fits_write( &f, data, f.total );
+  fits_finish( &f );
+  if( f.error ) {
+    errno = f.error;
+    return -1;
+  }
+  return f.len;
+}
+
+/* fpack's names for compressed files */
+
+int si_fits_compressed( char *fname )
+{
+  int n;
+
+  n = strlen( fname );
+  return n > 3 && strcmp( fname + n - 3, ".fz" ) == 0;
+}
+
+/* the primary HDU, with nothing in it, and the table header of a
+   tile compressed image of n_cols by n_rows, one tile a row.  heap
+   bytes of code follow the table, no row more than maxlen.  The
+   length is the same whatever heap and maxlen are
+*/
+
+static void fits_rice_header( struct SI_FITS *f, struct SI_CAMERA *c,
+                              struct SI_FRAME *fr, int n_cols, int n_rows,
+                              long heap, int maxlen )
+{
+  char val[32];
+
+  fits_card( f, "SIMPLE", "T", "conforms to FITS" );
+  fits_int( f, "BITPIX", 16, NULL );
+  fits_int( f, "NAXIS", 0, NULL );
+  fits_card( f, "EXTEND", "T", "tile compressed image follows" );
+  fits_end( f );
+
+  fits_string( f, "XTENSION", "BINTABLE", "tile compressed image" );
+  fits_int( f, "BITPIX", 8, NULL );
+  fits_int( f, "NAXIS", 2, NULL );
+  fits_int( f, "NAXIS1", 8, "bytes in a tile descriptor" );
+  fits_int( f, "NAXIS2", n_rows, "tiles" );
+  fits_int( f, "PCOUNT", heap, "bytes of compressed tiles" );
+  fits_int( f, "GCOUNT", 1, NULL );
+  fits_int( f, "TFIELDS", 1, NULL );
+  fits_string( f, "TTYPE1", "COMPRESSED_DATA", NULL );
+  sprintf( val, "1PB(%d)", maxlen );
+  fits_string( f, "TFORM1", val, NULL );
+  fits_card( f, "ZIMAGE", "T", "this is a compressed image" );
+  fits_int( f, "ZBITPIX", 16, NULL );
+  fits_int( f, "ZNAXIS", 2, NULL );
+  fits_int( f, "ZNAXIS1", n_cols, NULL );
+  fits_int( f, "ZNAXIS2", n_rows, NULL );
+  fits_int( f, "ZTILE1", n_cols, "a tile is a row" );
+  fits_int( f, "ZTILE2", 1, NULL );
+  fits_string( f, "ZCMPTYPE", "RICE_1", NULL );
+  fits_string( f, "ZNAME1", "BLOCKSIZE", NULL );
+  fits_int( f, "ZVAL1", SI_RICE_BLOCK, NULL );
+  fits_string( f, "ZNAME2", "BYTEPIX", NULL );
+  fits_int( f, "ZVAL2", 2, NULL );
+  fits_int( f, "BZERO", 32768, "pixels are unsigned" );
+  fits_int( f, "BSCALE", 1, NULL );
+  fits_camera( f, c, fr );
+}
+
+struct FITS_TILES {
+  unsigned short *data;
+  int n_cols;
+  int n_rows;
+  int nbands;
+  unsigned char *table;        /* a descriptor for each row */
+  unsigned char *heap;         /* si_rice_bound() for each row */
+  long row_bound;
+};
+
+/* rows of band i, coded one after another from the first row's place
+   in the heap, the length of each kept in its descriptor for now
+*/
+
+static void fits_rice_band( void *v, int i )
+{
+  struct FITS_TILES *t;
+  unsigned char *p;
+  int row, last, n;
+
+  t = (struct FITS_TILES *)v;
+  row = (long)t->n_rows*i/t->nbands;
+  last = (long)t->n_rows*(i+1)/t->nbands;
+  p = t->heap + row*t->row_bound;
+  for( ; row<last; row++ ) {
+    n = si_rice_encode( p, t->row_bound, t->data + (long)row*t->n_cols,
+                        t->n_cols, 0x8000 );
+    memcpy( t->table + 8L*row, &n, sizeof(n));
+    if( n > 0 )
+      p += n;
+  }
+}
+
+static void fits_be32( unsigned char *p, long v )
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/* bytes si_fits_rice_image() may need for an n_cols by n_rows image */
+
+long si_fits_rice_bound( int n_cols, int n_rows )
+{
+  long n;
+
+  n = SI_FITS_BLOCK + FITS_HEADER_MAX + 8L*n_rows +
+      n_rows*si_rice_bound( n_cols );
+  return ((n + SI_FITS_BLOCK - 1)/SI_FITS_BLOCK)*SI_FITS_BLOCK;
+}
+
+/* the whole tile compressed file for an n_cols by n_rows image made in
+   the size bytes at buf.  Returns its length or -1
+*/
+
+long si_fits_rice_image( struct SI_CAMERA *c, struct SI_FRAME *fr, char *buf,
+                         long size, unsigned short *data, int n_cols,
+                         int n_rows )
+{
+  struct SI_FITS f;
+  struct FITS_TILES t;
+  unsigned char *from;
+  long hdr, heap, band;
+  int i, row, last, n, maxlen;
+
+  /* the header with the sizes still to come */
+
+  bzero( &f, sizeof(f));
+  f.fd = -1;
+  f.buf = buf;
+  f.size = size;
+  fits_rice_header( &f, c, fr, n_cols, n_rows, 0, 0 );
+  hdr = f.len;
+  if( f.error || size < hdr + 8L*n_rows + n_rows*si_rice_bound( n_cols )) {
+    errno = f.error ? f.error : ENOSPC;
+    return -1;
+  }
+
+  t.data = data;
+  t.n_cols = n_cols;
+  t.n_rows = n_rows;
+  t.nbands = 4*si_pool_size();
+  if( t.nbands > n_rows )
+    t.nbands = n_rows;
+  t.table = (unsigned char *)buf + hdr;
+  t.heap = t.table + 8L*n_rows;
+  t.row_bound = si_rice_bound( n_cols );
+  si_pool_run( fits_rice_band, &t, t.nbands );
+
+  /* close up the bands and fill in the descriptors */
+
+  heap = 0;
+  maxlen = 0;
+  for( i=0; i<t.nbands; i++ ) {
+    row = (long)n_rows*i/t.nbands;
+    last = (long)n_rows*(i+1)/t.nbands;
+    from = t.heap + row*t.row_bound;
+    band = 0;
+    for( ; row<last; row++ ) {
+      memcpy( &n, t.table + 8L*row, sizeof(n));
+      if( n < 0 ) {
+        errno = ENOSPC;
+        return -1;
+      }
+      fits_be32( t.table + 8L*row, n );
+      fits_be32( t.table + 8L*row + 4, heap + band );
+      band += n;
+      if( n > maxlen )
+        maxlen = n;
+    }
+    memmove( t.heap + heap, from, band );
+    heap += band;
+  }
+
+  f.len = 0;
+  fits_rice_header( &f, c, fr, n_cols, n_rows, heap, maxlen );
+
+  n = (SI_FITS_BLOCK - (hdr + 8L*n_rows + heap) % SI_FITS_BLOCK) %
+      SI_FITS_BLOCK;
+  bzero( t.heap + heap, n );
+  return hdr + 8L*n_rows + heap + n;
+}
+
+/* a whole n_cols by n_rows image to fname tile compressed, 0 or -1 */
+
+int si_fits_rice_save( struct SI_CAMERA *c, struct SI_FRAME *fr, char *fname,
+                       unsigned short *data, int n_cols, int n_rows )
+{
+  char *buf;
+  long len;
+  int fd, err;
+
+  if( !(buf = malloc( si_fits_rice_bound( n_cols, n_rows ))))
+    return -1;
+  len = si_fits_rice_image( c, fr, buf,
+                            si_fits_rice_bound( n_cols, n_rows ),
+                            data, n_cols, n_rows );
+  if( len < 0 || (fd = open( fname, O_WRONLY|O_CREAT|O_TRUNC, 0666 )) < 0 ) {
+    err = errno;
+    free( buf );
+    errno = err;
+    return -1;
+  }
+  if( write_all( fd, buf, len ) < 0 ) {
+    err = errno;
+    close( fd );
+    free( buf );
+    errno = err;
+    return -1;
+  }
+  free( buf );
+  return close( fd );
+}
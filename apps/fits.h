@@ -0,0 +1,18 @@
+void si_fits_swap( unsigned short *to, unsigned short *from, long n );
+void si_fits_unswap( unsigned short *to, unsigned short *from, long n );
+int si_fits_open( struct SI_FITS *f, struct SI_CAMERA *c,
+                  struct SI_FRAME *fr, char *fname, int n_cols, int n_rows );
+int si_fits_write( struct SI_FITS *f, unsigned short *data, long n );
+int si_fits_close( struct SI_FITS *f );
+int si_fits_save( struct SI_CAMERA *c, struct SI_FRAME *fr, char *fname,
+                  unsigned short *data, int n_cols, int n_rows );
+long si_fits_bound( int n_cols, int n_rows );
+long si_fits_image( struct SI_CAMERA *c, struct SI_FRAME *fr, char *buf,
+                    long size, unsigned short *data, int n_cols, int n_rows );
+int si_fits_compressed( char *fname );
+long si_fits_rice_bound( int n_cols, int n_rows );
+long si_fits_rice_image( struct SI_CAMERA *c, struct SI_FRAME *fr, char *buf,
+                         long size, unsigned short *data, int n_cols,
+                         int n_rows );
+int si_fits_rice_save( struct SI_CAMERA *c, struct SI_FRAME *fr, char *fname,
+                       unsigned short *data, int n_cols, int n_rows );
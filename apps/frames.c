@@ -0,0 +1,253 @@
+/*
+
+Frame buffers for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  a few whole frame buffers made once and handed round, so a frame
+  can be demuxed into one while the last is still being shown or
+  saved from another, and nothing the size of a frame is allocated
+  or paged in again while frames keep coming.
+
+    si_frames_new()   nframes buffers of bytes each
+    si_frame_get()    a free one, holding one reference
+    si_frame_ref()    another user of it
+    si_frame_put()    done with it, free again when no one is using it
+    si_frames_hold()  another user of the pool, as si_frames_new() is
+    si_frames_free()  one user fewer, the pool goes when it has none
+                      and its last frame comes back
+
+  The buffers are one mapping, in 2MB huge pages if the system has
+  any set aside, else asking for transparent huge pages, and touched
+  before they are used so the page faults happen here rather than in
+  the middle of a readout.  A 32MB frame is 16 TLB entries rather than
+  8192.
+*/
+
+#define _GNU_SOURCE /* MAP_HUGETLB */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "frames.h"
+
+#define FRAMES_HUGE (2L*1024*1024)
+
+struct SI_FRAMES {
+  char *mem;                   /* all the buffers */
+  long mem_size;
+  struct SI_FRAME *frame;      /* nframes of them */
+  struct SI_FRAME *free;
+  int users;                   /* made or held and not yet freed */
+  pthread_mutex_t lock;
+  pthread_cond_t freed;
+  struct SI_FRAMES_STATS stats;
+};
+
+/* len bytes in huge pages, or at least on a huge page boundary so
+   the kernel may use them later.  NULL on failure
+*/
+
+static char *frames_map( long len, int *huge )
+{
+  char *p, *q;
+
+  p = mmap( NULL, len, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0 );
+  if( p != MAP_FAILED ) {
+    *huge = 2;
+    return p;
+  }
+
+  p = mmap( NULL, len + FRAMES_HUGE, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+  if( p == MAP_FAILED )
+    return NULL;
+  q = (char *)(((unsigned long)p + FRAMES_HUGE - 1) & ~(FRAMES_HUGE - 1));
+  if( q > p )
+    munmap( p, q - p );
+  munmap( q + len, p + FRAMES_HUGE - q );
+  *huge = madvise( q, len, MADV_HUGEPAGE ) == 0;
+  memset( q, 0, len );
+  return q;
+}
+
+/* nframes buffers of at least bytes each.  NULL on failure */
+
+struct SI_FRAMES *si_frames_new( int nframes, long bytes )
+{
+  struct SI_FRAMES *p;
+  struct SI_FRAME *f;
+  long each;
+  int i;
+
+  if( nframes < 1 || bytes < 1 ) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if( !(p = calloc( 1, sizeof(*p))))
+    return NULL;
+  if( !(p->frame = calloc( nframes, sizeof(struct SI_FRAME)))) {
+    free( p );
+    return NULL;
+  }
+
+  each = (bytes + FRAMES_HUGE - 1)/FRAMES_HUGE*FRAMES_HUGE;
+  p->mem_size = each*nframes;
+  if( !(p->mem = frames_map( p->mem_size, &p->stats.huge ))) {
+    free( p->frame );
+    free( p );
+    return NULL;
+  }
+
+  for( i=nframes-1; i>=0; i-- ) {
+    f = &p->frame[i];
+    f->data = (unsigned short *)(p->mem + each*i);
+    f->bytes = each;
+    f->pool = p;
+    f->next = p->free;
+    p->free = f;
+  }
+  p->stats.nframes = nframes;
+  p->stats.bytes = each;
+  p->users = 1;
+  pthread_mutex_init( &p->lock, NULL );
+  pthread_cond_init( &p->freed, NULL );
+  return p;
+}
+
+/* bytes each frame holds */
+
+long si_frames_bytes( struct SI_FRAMES *p )
+{
+  return p->stats.bytes;
+}
+
+/* a frame no one is using, with one reference for the caller.  If
+   all are in use, wait for one or return NULL with EAGAIN
+*/
+
+struct SI_FRAME *si_frame_get( struct SI_FRAMES *p, int wait )
+{
+  struct SI_FRAME *f;
+
+  pthread_mutex_lock( &p->lock );
+  p->stats.gets++;
+  if( !p->free && wait )
+    p->stats.waits++;
+  while( !p->free && wait )
+    pthread_cond_wait( &p->freed, &p->lock );
+  if( (f = p->free)) {
+    p->free = f->next;
+    f->next = NULL;
+    f->refs = 1;
+    f->n_cols = f->n_rows = 0;
+    f->amps.namps = 0;
+    f->taken = 0;
+    if( ++p->stats.in_use > p->stats.max_in_use )
+      p->stats.max_in_use = p->stats.in_use;
+  }
+  pthread_mutex_unlock( &p->lock );
+  if( !f )
+    errno = EAGAIN;
+  return f;
+}
+
+void si_frame_ref( struct SI_FRAME *f )
+{
+  pthread_mutex_lock( &f->pool->lock );
+  f->refs++;
+  pthread_mutex_unlock( &f->pool->lock );
+}
+
+static void frames_destroy( struct SI_FRAMES *p )
+{
+  munmap( p->mem, p->mem_size );
+  pthread_mutex_destroy( &p->lock );
+  pthread_cond_destroy( &p->freed );
+  free( p->frame );
+  free( p );
+}
+
+/* one user fewer, NULL is ignored */
+
+void si_frame_put( struct SI_FRAME *f )
+{
+  struct SI_FRAMES *p;
+  int last;
+
+  if( !f )
+    return;
+  p = f->pool;
+  last = 0;
+  pthread_mutex_lock( &p->lock );
+  if( --f->refs == 0 ) {
+    f->next = p->free;
+    p->free = f;
+    p->stats.in_use--;
+    last = p->users == 0 && p->stats.in_use == 0;
+    pthread_cond_signal( &p->freed );
+  }
+  pthread_mutex_unlock( &p->lock );
+  if( last )
+    frames_destroy( p );
+}
+
+void si_frames_stats( struct SI_FRAMES *p, struct SI_FRAMES_STATS *s )
+{
+  pthread_mutex_lock( &p->lock );
+  *s = p->stats;
+  pthread_mutex_unlock( &p->lock );
+}
+
+/* the pool stays, even once its maker has freed it, until this
+   user frees it too
+*/
+
+void si_frames_hold( struct SI_FRAMES *p )
+{
+  pthread_mutex_lock( &p->lock );
+  p->users++;
+  pthread_mutex_unlock( &p->lock );
+}
+
+/* one user fewer.  The last frees the pool now, or when the frames
+   still in use are put
+*/
+
+void si_frames_free( struct SI_FRAMES *p )
+{
+  int now;
+
+  if( !p )
+    return;
+  pthread_mutex_lock( &p->lock );
+  now = --p->users == 0 && p->stats.in_use == 0;
+  pthread_mutex_unlock( &p->lock );
+  if( now )
+    frames_destroy( p );
+}
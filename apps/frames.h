@@ -0,0 +1,8 @@
+struct SI_FRAMES *si_frames_new( int nframes, long bytes );
+long si_frames_bytes( struct SI_FRAMES *p );
+struct SI_FRAME *si_frame_get( struct SI_FRAMES *p, int wait );
+void si_frame_ref( struct SI_FRAME *f );
+void si_frame_put( struct SI_FRAME *f );
+void si_frames_stats( struct SI_FRAMES *p, struct SI_FRAMES_STATS *s );
+void si_frames_hold( struct SI_FRAMES *p );
+void si_frames_free( struct SI_FRAMES *p );
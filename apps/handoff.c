@@ -0,0 +1,423 @@
+/*
+
+Frames handed over a socket by the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+
+/*
+  finished frames passed to other processes over a unix socket, each
+  as a memfd of its own that the receiver maps, so a 32MB frame costs
+  it one mmap rather than 32MB through a pipe.  For readers that
+  cannot map the si_shm ring, or want to keep a frame as long as they
+  like.
+
+    si_handoff_listen()   the writer's socket, frames up to bytes
+    si_handoff_accept()   take on anyone who has connected since
+    si_handoff_begin()    a new memfd to put the next frame in
+    si_handoff_publish()  sealed and sent to every reader
+    si_handoff_close()
+    si_handoff_connect()  a reader connects
+    si_handoff_recv()     the next frame, mapped read only
+    si_handoff_release()  done with it
+
+  The socket is SOCK_SEQPACKET, one SI_SHM_FRAME and one descriptor a
+  message.  Before it is sent the memfd is unmapped by the writer and
+  sealed against writes and resizing, so what a reader maps cannot
+  change under it, and the writer's copy is closed; the pages go once
+  every reader has unmapped them.  Each release sends a byte back, and
+  a reader already holding HANDOFF_DEPTH frames simply misses the next
+  rather than have frames of memory pile up in its socket or hold up
+  the camera.
+
+  Every frame is new memory, to be zeroed by the kernel and faulted
+  in, so the memfds are made of 2MB huge pages while the system has
+  any set aside.
+*/
+
+#define _GNU_SOURCE /* memfd_create, F_ADD_SEALS, accept4 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "handoff.h"
+
+#define HANDOFF_CLIENTS 16
+#define HANDOFF_DEPTH   2     /* frames a reader may hold at once */
+#define HANDOFF_SEALS   (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL)
+#define HANDOFF_HUGE    (2L*1024*1024)
+
+struct HANDOFF_CLIENT {
+  int fd;
+  int held;                    /* sent and not yet released */
+};
+
+struct SI_HANDOFF {
+  int sock;
+  char *path;                  /* unlinked by close */
+  long bytes;
+  int huge;                    /* 0 once there are no huge pages */
+  int memfd;                   /* the frame begun, -1 none */
+  unsigned short *mem;
+  long size;                   /* of the memfd, bytes or more */
+  unsigned long seq;
+  int nclients;
+  struct HANDOFF_CLIENT client[HANDOFF_CLIENTS];
+};
+
+static int handoff_addr( struct sockaddr_un *a, char *path )
+{
+  bzero( a, sizeof(*a));
+  a->sun_family = AF_UNIX;
+  if( strlen( path ) >= sizeof(a->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy( a->sun_path, path );
+  return 0;
+}
+
+/* a socket at path, "/tmp/si3097.sock" say, for frames of up to bytes,
+   replacing any left by a writer that died.  NULL on failure
+*/
+
+struct SI_HANDOFF *si_handoff_listen( char *path, long bytes )
+{
+  struct SI_HANDOFF *h;
+  struct sockaddr_un a;
+  int err;
+
+  if( bytes < 1 ) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if( handoff_addr( &a, path ) < 0 )
+    return NULL;
+  if( !(h = calloc( 1, sizeof(*h))) || !(h->path = strdup( path ))) {
+    free( h );
+    errno = ENOMEM;
+    return NULL;
+  }
+  h->bytes = bytes;
+  h->huge = 1;
+  h->memfd = -1;
+
+  unlink( path );
+  if( (h->sock = socket( AF_UNIX, SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC,
+                         0 )) < 0 )
+    goto fail;
+  if( bind( h->sock, (struct sockaddr *)&a, sizeof(a)) < 0 ||
+      listen( h->sock, HANDOFF_CLIENTS ) < 0 ) {
+    err = errno;
+    close( h->sock );
+    unlink( path );
+    errno = err;
+    goto fail;
+  }
+  return h;
+
+fail:
+  free( h->path );
+  free( h );
+  return NULL;
+}
+
+static void handoff_drop( struct SI_HANDOFF *h, int i )
+{
+  close( h->client[i].fd );
+  h->client[i] = h->client[--h->nclients];
+}
+
+/* the readers there are now, after taking on new ones and counting
+   the frames the others have released
+*/
+
+int si_handoff_accept( struct SI_HANDOFF *h )
+{
+  char buf[64];
+  int fd, i, n;
+
+  while( (fd = accept4( h->sock, NULL, NULL,
+                        SOCK_NONBLOCK|SOCK_CLOEXEC )) >= 0 ) {
+    if( h->nclients == HANDOFF_CLIENTS ) {
+      close( fd );
+      continue;
+    }
+    h->client[h->nclients].fd = fd;
+    h->client[h->nclients].held = 0;
+    h->nclients++;
+  }
+
+  for( i=0; i<h->nclients; ) {
+    while( (n = recv( h->client[i].fd, buf, sizeof(buf), 0 )) > 0 )
+      if( h->client[i].held > 0 )
+        h->client[i].held--;
+    if( n == 0 || errno != EAGAIN )
+      handoff_drop( h, i );  /* gone */
+    else
+      i++;
+  }
+  return h->nclients;
+}
+
+static void *handoff_memfd( struct SI_HANDOFF *h, int huge )
+{
+  void *p;
+  int err;
+
+  h->size = huge ? (h->bytes + HANDOFF_HUGE - 1)/HANDOFF_HUGE*HANDOFF_HUGE :
+    h->bytes;
+  if( (h->memfd = memfd_create( "si3097", MFD_CLOEXEC|MFD_ALLOW_SEALING|
+                                (huge ? MFD_HUGETLB : 0))) < 0 )
+    return NULL;
+  if( ftruncate( h->memfd, h->size ) < 0 ||
+      (p = mmap( NULL, h->size, PROT_READ|PROT_WRITE, MAP_SHARED,
+                 h->memfd, 0 )) == MAP_FAILED ) {
+    err = errno;
+    close( h->memfd );
+    h->memfd = -1;
+    errno = err;
+    return NULL;
+  }
+  return p;
+}
+
+/* where the next frame goes, a new memfd of the size given to
+   si_handoff_listen().  NULL on failure
+*/
+
+unsigned short *si_handoff_begin( struct SI_HANDOFF *h )
+{
+  void *p;
+
+  if( h->memfd >= 0 ) {  /* begun and never published */
+    munmap( h->mem, h->size );
+    close( h->memfd );
+    h->memfd = -1;
+  }
+  p = NULL;
+  if( h->huge && !(p = handoff_memfd( h, 1 )))
+    h->huge = 0;
+  if( !p && !(p = handoff_memfd( h, 0 )))
+    return NULL;
+  h->mem = p;
+  return h->mem;
+}
+
+/* the frame begun is done, with meta for what is known of it.  It is
+   sealed and sent to every reader with room for it, and the number
+   it was sent to returned, or -1 on failure
+*/
+
+int si_handoff_publish( struct SI_HANDOFF *h, struct SI_SHM_FRAME *meta )
+{
+  struct SI_SHM_FRAME m;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  char ctl[CMSG_SPACE(sizeof(int))];
+  int sent, err, i;
+
+  if( h->memfd < 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  munmap( h->mem, h->size );  /* no seal while a writable map is left */
+  if( fcntl( h->memfd, F_ADD_SEALS, HANDOFF_SEALS ) < 0 ) {
+    err = errno;
+    close( h->memfd );
+    h->memfd = -1;
+    errno = err;
+    return -1;
+  }
+
+  m = *meta;
+  m.seq = ++h->seq;
+  m.offset = 0;
+  iov.iov_base = &m;
+  iov.iov_len = sizeof(m);
+  bzero( &msg, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+  cm = CMSG_FIRSTHDR( &msg );
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy( CMSG_DATA(cm), &h->memfd, sizeof(int));
+
+  si_handoff_accept( h );
+  sent = 0;
+  for( i=0; i<h->nclients; ) {
+    if( h->client[i].held >= HANDOFF_DEPTH ) {
+      i++;
+      continue;
+    }
+    if( sendmsg( h->client[i].fd, &msg, MSG_DONTWAIT|MSG_NOSIGNAL ) < 0 ) {
+      if( errno != EAGAIN ) {
+        handoff_drop( h, i );
+        continue;
+      }
+    } else {
+      h->client[i].held++;
+      sent++;
+    }
+    i++;
+  }
+
+  close( h->memfd );
+  h->memfd = -1;
+  return sent;
+}
+
+/* readers still connected see the socket close after whatever
+   frames they were already sent
+*/
+
+void si_handoff_close( struct SI_HANDOFF *h )
+{
+  if( !h )
+    return;
+  si_handoff_accept( h );  /* releases left unread reset the reader */
+  while( h->nclients > 0 )
+    handoff_drop( h, 0 );
+  if( h->memfd >= 0 ) {
+    munmap( h->mem, h->size );
+    close( h->memfd );
+  }
+  close( h->sock );
+  unlink( h->path );
+  free( h->path );
+  free( h );
+}
+
+/* a reader's connection to the writer at path, -1 on failure */
+
+int si_handoff_connect( char *path )
+{
+  struct sockaddr_un a;
+  int fd, err;
+
+  if( handoff_addr( &a, path ) < 0 )
+    return -1;
+  if( (fd = socket( AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0 )) < 0 )
+    return -1;
+  if( connect( fd, (struct sockaddr *)&a, sizeof(a)) < 0 ) {
+    err = errno;
+    close( fd );
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+/* wait for the next frame on fd, its header into meta and its pixels
+   mapped read only at *data, *bytes long, until si_handoff_release().
+   0, or -1 with EPIPE once the writer has gone and EPROTO if what
+   came was not a sealed frame
+*/
+
+int si_handoff_recv( int fd, struct SI_SHM_FRAME *meta, unsigned short **data,
+                     long *bytes )
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  struct stat st;
+  char ctl[CMSG_SPACE(sizeof(int))];
+  void *p;
+  int memfd, seals, err;
+  ssize_t n;
+
+  iov.iov_base = meta;
+  iov.iov_len = sizeof(*meta);
+  bzero( &msg, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl;
+  msg.msg_controllen = sizeof(ctl);
+  while( (n = recvmsg( fd, &msg, MSG_CMSG_CLOEXEC )) < 0 )
+    if( errno != EINTR ) {
+      if( errno == ECONNRESET )
+        errno = EPIPE;
+      return -1;
+    }
+  if( n == 0 ) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  memfd = -1;
+  if( (cm = CMSG_FIRSTHDR( &msg )) && cm->cmsg_level == SOL_SOCKET &&
+      cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(int)))
+    memcpy( &memfd, CMSG_DATA(cm), sizeof(int));
+  if( memfd < 0 || n != sizeof(*meta) || (msg.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) )
+    goto bad;
+
+  /* sealed, so neither the pixels nor the size can change from here */
+
+  seals = fcntl( memfd, F_GET_SEALS );
+  if( seals < 0 || (seals & HANDOFF_SEALS) != HANDOFF_SEALS ||
+      fstat( memfd, &st ) < 0 || meta->n_cols < 0 || meta->n_rows < 0 ||
+      (long)meta->n_cols*meta->n_rows*sizeof(short) > st.st_size )
+    goto bad;
+  if( (p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, memfd, 0 )) ==
+      MAP_FAILED ) {
+    err = errno;
+    close( memfd );
+    errno = err;
+    return -1;
+  }
+  close( memfd );
+  *data = p;
+  *bytes = st.st_size;
+  return 0;
+
+bad:
+  if( memfd >= 0 )
+    close( memfd );
+  errno = EPROTO;
+  return -1;
+}
+
+/* a frame si_handoff_recv() gave is done with, which lets the writer
+   send another.  0, or -1 if the writer has gone
+*/
+
+int si_handoff_release( int fd, unsigned short *data, long bytes )
+{
+  char done = 1;
+
+  munmap( data, bytes );
+  if( send( fd, &done, 1, MSG_NOSIGNAL ) != 1 )
+    return -1;
+  return 0;
+}
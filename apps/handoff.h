@@ -0,0 +1,9 @@
+struct SI_HANDOFF *si_handoff_listen( char *path, long bytes );
+int si_handoff_accept( struct SI_HANDOFF *h );
+unsigned short *si_handoff_begin( struct SI_HANDOFF *h );
+int si_handoff_publish( struct SI_HANDOFF *h, struct SI_SHM_FRAME *meta );
+void si_handoff_close( struct SI_HANDOFF *h );
+int si_handoff_connect( char *path );
+int si_handoff_recv( int fd, struct SI_SHM_FRAME *meta, unsigned short **data,
+                     long *bytes );
+int si_handoff_release( int fd, unsigned short *data, long bytes );
@@ -28,15 +28,18 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <sys/mman.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <termios.h>
 #include <errno.h>
 
 #include "si3097.h"
 #include "si_app.h"
 #include "lib.h"
+#include "dinter.h"
 
 
 #define CHUNK 100         //Not sure how big this should be, but 100 seems safe
 #define ABUF_SIZE 10000
+#define SEND_MAX SI_CONFIG_MAX /* ints si_send_n_ints sends at once */
 
 /* send a file to the UART */
 
@@ -113,7 +116,6 @@ int si_sendfile( int fd, int breaktime, char *filename )
 
     if( write( fd, bbuffer, chunk ) != chunk ) { //send and wait
       perror("UART write\n");
-      fclose(inpointer);
       fclose(dbgptr);
       return -1;
     }
@@ -123,13 +125,11 @@ int si_sendfile( int fd, int breaktime, char *filename )
 
     if( ioctl(fd, SI_IOCTL_SERIAL_IN_STATUS, &rxcnt) <0 ) {
       perror( "serial in status\n");
-      fclose(inpointer);
       fclose(dbgptr);
       return -1;
     }
 
     if(!rxcnt)  {
-      fclose(inpointer);
       fclose(dbgptr);
       return(2);
     }
@@ -203,7 +203,6 @@ int si_sendfile( int fd, int breaktime, char *filename )
   free(bbuffer);
 
   fclose(dbgptr);
-  fclose(inpointer);
 
 //  printf ("Returning with %d as retries\n", tries);
 
@@ -237,6 +236,30 @@ void si_init_com( int fd, int baud, int parity, int bits,
 }
 
 
+/* setup a plain tty, such as the pty of the camera emulator,
+   to carry the camera protocol.  Reads give up after timeout ms
+*/
+
+int si_init_tty( int fd, int timeout )
+{
+  struct termios t;
+  int ds;
+
+  if( tcgetattr( fd, &t ) < 0 )
+    return -1;
+
+  cfmakeraw( &t );
+  ds = (timeout + 99) / 100; /* VTIME is in tenths */
+  if( ds < 1 )
+    ds = 1;
+  if( ds > 255 )
+    ds = 255;
+  t.c_cc[VMIN] = 0;
+  t.c_cc[VTIME] = ds;
+
+  return tcsetattr( fd, TCSANOW, &t );
+}
+
 int si_send_command( int fd, int cmd )
 {
   int  ret;
@@ -252,10 +275,11 @@ int si_send_command( int fd, int cmd )
 
 int si_clear_buffer( int fd )
 {
-  if( ioctl( fd, SI_IOCTL_SERIAL_CLEAR, 0 ))
-    return -1;
-  else
+  if( ioctl( fd, SI_IOCTL_SERIAL_CLEAR, 0 ) == 0 )
     return 0;
+  if( errno == ENOTTY ) /* a plain tty */
+    return tcflush( fd, TCIFLUSH );
+  return -1;
 }
 
 int si_send_char( int fd, int data )
@@ -304,7 +328,7 @@ int si_receive_char( int fd )
 
 int si_receive_n_ints( int fd, int n, int *data )
 {
-  int len, i;
+  int len, i, got;
   int ret;
 
   len = n * sizeof(int);
@@ -314,8 +338,11 @@ int si_receive_n_ints( int fd, int n, int *data )
     return 0;
   }
 
-  if( (ret = read( fd, data, len )) != len )
-    return -1;
+  /* a tty hands back whatever has arrived so far */
+
+  for( got = 0; got < len; got += ret )
+    if( (ret = read( fd, (char *)data + got, len - got )) <= 0 )
+      return -1;
 
   for( i=0; i<n; i++ )
     si_swapl(&data[i]);
@@ -325,16 +352,20 @@ int si_receive_n_ints( int fd, int n, int *data )
 int si_send_n_ints( int fd, int n, int *data )
 {
   int len, i;
-  int *d;
+  int d[SEND_MAX];
 
+  if( n > SEND_MAX ) {
+    errno = EINVAL;
+    return -1;
+  }
   len = n * sizeof(int);
-  d = (int *)malloc( len );
   memcpy( d, data, len );
   for( i=0; i<n; i++ )
     si_swapl(&d[i]);
 
-  if( (i = write( fd, d, len )) != len )
+  if( (i = write( fd, d, len )) != len ) {
     return -1;
+  }
 
 //  memset( d, 0, len );
 //  if( receive_n_ints( fd, len, d ) < 0 )
@@ -342,7 +373,6 @@ int si_send_n_ints( int fd, int n, int *data )
 
 //  if( memcmp( d, data, len ) != 0 )
 //    return -1;
-  free(d);
 
   return len;
 }
@@ -394,6 +424,7 @@ void si_send_break( int fd, int ms )
 
 int si_load_camera_cfg( struct SI_CAMERA *c, char *fname )
 {
+  struct SI_LAYOUT l;
 
   if (si_load_cfg( c->e_status, fname, "SP" ) < 0)
     return -1;
@@ -401,6 +432,21 @@ int si_load_camera_cfg( struct SI_CAMERA *c, char *fname )
     return -1;
   if (si_load_cfg( c->e_config, fname, "CP" ) < 0)
     return -1;
+
+  /* a camera whose amplifiers are not the four quadrants says how
+     they read out, and its images are demuxed that way
+  */
+  c->layout = 0;
+  c->namps = 0;
+  switch( si_load_layout( &l, fname )) {
+    case -1:
+      return -1;
+    case 1:
+      if( (c->layout = si_layout_register( &l )) < 0 )
+        return -1;
+      c->namps = l.namps;
+      break;
+  }
   return 0;
 }
 
@@ -442,7 +488,7 @@ int si_load_cfg( struct CFG_ENTRY **e, char *fname, char *var )
        if (!(entry = calloc( 1, sizeof(*entry))))
          return -1;
        entry->index = index;
-       entry->cfg_string = (char *)malloc( len );
+       entry->cfg_string = (char *)malloc( len+1 );
        strcpy( entry->cfg_string, buf );
        si_parse_cfg_string( entry );
        if( pindex >= 32 ) {
@@ -577,7 +623,8 @@ char *si_name_cfg( char *cfg )
   char *delim = ",\n";
   char *s, *ret;
 
-  strncpy( buf, cfg, 256 );
+  strncpy( buf, cfg, 255 );
+  buf[255] = 0;
   strtok( buf, delim );
   strtok( NULL, delim );
   s = strtok( NULL, delim );
@@ -635,6 +682,45 @@ int si_setfile_readout( struct SI_CAMERA *c, char *file )
   return 0;
 }
 
+/* load the [Configuration] section of a setfile, names must match
+   the cfg file exactly
+*/
+
+int si_setfile_config( struct SI_CAMERA *c, char *file )
+{
+  FILE *fd;
+  char buf[256];
+  char *val;
+  struct CFG_ENTRY *cfg;
+  int i, insection;
+
+  if( !(fd = fopen( file, "r" ))) {
+    return -1;
+  }
+
+  insection = 0;
+  while( fgets( buf, 256, fd )) {
+    if( buf[0] == '[' ) {
+      insection = strncmp( buf, "[Configuration]", 15 ) == 0;
+      continue;
+    }
+    if( !insection || !(val = strchr( buf, '=' )))
+      continue;
+    *val++ = 0;
+
+    for( i=0; i<SI_CONFIG_MAX; i++ ) {
+      cfg = c->e_config[i];
+      if( cfg && cfg->name && strcasecmp( cfg->name, buf ) == 0 ) {
+        c->config[ cfg->index ] = atoi(val);
+        break;
+      }
+    }
+  }
+
+  fclose(fd);
+  return 0;
+}
+
 
 struct CFG_ENTRY *si_find_readout( struct SI_CAMERA *c, char *name )
 {
@@ -1,6 +1,7 @@
 int si_sendfile( int fd, int breaktime, char *filename );
 void si_init_com( int fd, int baud, int parity, int bits,
                   int stopbits, int buffersize );
+int si_init_tty( int fd, int timeout );
 int si_send_command( int fd, int cmd );
 int si_clear_buffer( int fd );
 int si_send_char( int fd, int data );
@@ -16,5 +17,6 @@ int si_parse_cfg_string( struct CFG_ENTRY *entry );
 char *si_name_cfg( char *cfg );
 void si_send_command_yn( int fd, int data );
 int si_setfile_readout( struct SI_CAMERA *c, char *file );
+int si_setfile_config( struct SI_CAMERA *c, char *file );
 struct CFG_ENTRY *si_find_readout( struct SI_CAMERA *c, char *name );
 void si_sprint_cfg_val_only( char *buf, struct CFG_ENTRY *cfg, int val );
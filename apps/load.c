@@ -0,0 +1,463 @@
+/*
+
+Image files read back for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+
+/*
+  read an image back from a file without reading the file: it is
+  mapped and only the pages of the rows asked for are ever touched.
+
+    si_load_open()     map a file and find the image in it
+    si_load_preview()  every step'th pixel of every step'th row
+    si_load_rows()     rows of it as they would be in memory
+    si_load_close()
+
+  A file starting with a FITS header is read as one, a 16 bit image
+  of any size, or the tile compressed image of a .fz file with a row
+  to a tile, as si_fits_rice_image() and fpack -r write.  Anything
+  else is taken to be raw pixels, a square or n_cols wide.
+
+  The preview of a browser stepping through a night's frames reads
+  only its rows, an eighth of the file for a step of 8, and nothing
+  more need be read if the next file is picked before the rest is
+  wanted.  The rest is converted a band of rows at a time on the
+  worker pool, FITS pixels turned back by si_fits_unswap() and Rice
+  rows decoded by si_rice_decode().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "pool.h"
+#include "fits.h"
+#include "rice.h"
+#include "load.h"
+
+/* what a header says, as far as images go */
+
+struct LOAD_HDU {
+  long len;                    /* of the header, whole blocks */
+  int simple;
+  int extend;
+  int bintable;
+  int zimage;
+  long bitpix;
+  long naxis;
+  long naxis1;
+  long naxis2;
+  long pcount;
+  long theap;
+  double bzero;
+  double bscale;
+  long zbitpix;
+  long znaxis;
+  long znaxis1;
+  long znaxis2;
+  long ztile1;
+  long ztile2;
+  long blocksize;
+  char tform1[20];
+  char zcmptype[20];
+  char zname[10][20];          /* ZNAMEn, for ZVALn */
+};
+
+/* the quoted value of a card, trailing blanks gone */
+
+static void load_string( char *to, int size, char *card )
+{
+  char *p, *end;
+  int n;
+
+  to[0] = 0;
+  if( !(p = memchr( card + 10, '\'', SI_FITS_CARD - 10 )))
+    return;
+  p++;
+  if( !(end = memchr( p, '\'', card + SI_FITS_CARD - p )))
+    return;
+  while( end > p && end[-1] == ' ' )
+    end--;
+  n = end - p < size - 1 ? end - p : size - 1;
+  memcpy( to, p, n );
+  to[n] = 0;
+}
+
+static int load_true( char *v )
+{
+  while( *v == ' ' )
+    v++;
+  return *v == 'T';
+}
+
+/* the header at off, up to END.  0 or -1 with EPROTO */
+
+static int load_hdu( struct SI_LOAD *l, long off, struct LOAD_HDU *h )
+{
+  char card[SI_FITS_CARD + 1], key[9];
+  char *p, *v;
+  long i, n;
+
+  bzero( h, sizeof(*h));
+  h->bscale = 1.0;
+  h->ztile2 = 1;
+  h->blocksize = SI_RICE_BLOCK;
+  card[SI_FITS_CARD] = 0;
+
+  for( p = (char *)l->map + off; p + SI_FITS_CARD <= (char *)l->map + l->size;
+       p += SI_FITS_CARD ) {
+    memcpy( card, p, SI_FITS_CARD );
+    memcpy( key, card, 8 );
+    for( i=8; i>0 && key[i-1] == ' '; i-- )
+      ;
+    key[i] = 0;
+    if( strcmp( key, "END" ) == 0 ) {
+      n = p + SI_FITS_CARD - ((char *)l->map + off);
+      h->len = (n + SI_FITS_BLOCK - 1)/SI_FITS_BLOCK*SI_FITS_BLOCK;
+      return 0;
+    }
+    if( card[8] != '=' )
+      continue;
+    v = card + 10;
+    n = strtol( v, NULL, 10 );
+
+    if( strcmp( key, "SIMPLE" ) == 0 )
+      h->simple = load_true( v );
+    else if( strcmp( key, "EXTEND" ) == 0 )
+      h->extend = load_true( v );
+    else if( strcmp( key, "XTENSION" ) == 0 ) {
+      load_string( h->tform1, sizeof(h->tform1), card );
+      h->bintable = strcmp( h->tform1, "BINTABLE" ) == 0;
+      h->tform1[0] = 0;
+    } else if( strcmp( key, "ZIMAGE" ) == 0 )
+      h->zimage = load_true( v );
+    else if( strcmp( key, "BITPIX" ) == 0 )
+      h->bitpix = n;
+    else if( strcmp( key, "NAXIS" ) == 0 )
+      h->naxis = n;
+    else if( strcmp( key, "NAXIS1" ) == 0 )
+      h->naxis1 = n;
+    else if( strcmp( key, "NAXIS2" ) == 0 )
+      h->naxis2 = n;
+    else if( strcmp( key, "PCOUNT" ) == 0 )
+      h->pcount = n;
+    else if( strcmp( key, "THEAP" ) == 0 )
+      h->theap = n;
+    else if( strcmp( key, "BZERO" ) == 0 )
+      h->bzero = strtod( v, NULL );
+    else if( strcmp( key, "BSCALE" ) == 0 )
+      h->bscale = strtod( v, NULL );
+    else if( strcmp( key, "ZBITPIX" ) == 0 )
+      h->zbitpix = n;
+    else if( strcmp( key, "ZNAXIS" ) == 0 )
+      h->znaxis = n;
+    else if( strcmp( key, "ZNAXIS1" ) == 0 )
+      h->znaxis1 = n;
+    else if( strcmp( key, "ZNAXIS2" ) == 0 )
+      h->znaxis2 = n;
+    else if( strcmp( key, "ZTILE1" ) == 0 )
+      h->ztile1 = n;
+    else if( strcmp( key, "ZTILE2" ) == 0 )
+      h->ztile2 = n;
+    else if( strcmp( key, "TFORM1" ) == 0 )
+      load_string( h->tform1, sizeof(h->tform1), card );
+    else if( strcmp( key, "ZCMPTYPE" ) == 0 )
+      load_string( h->zcmptype, sizeof(h->zcmptype), card );
+    else if( strncmp( key, "ZNAME", 5 ) == 0 && key[5] >= '1' &&
+             key[5] <= '9' && !key[6] )
+      load_string( h->zname[key[5]-'0'], sizeof(h->zname[0]), card );
+    else if( strncmp( key, "ZVAL", 4 ) == 0 && key[4] >= '1' &&
+             key[4] <= '9' && !key[5] &&
+             strcmp( h->zname[key[4]-'0'], "BLOCKSIZE" ) == 0 )
+      h->blocksize = n;
+  }
+  errno = EPROTO;
+  return -1;
+}
+
+/* the image of the primary header, or the tile compressed one in the
+   table after it
+*/
+
+static int load_fits( struct SI_LOAD *l )
+{
+  struct LOAD_HDU h, x;
+
+  if( load_hdu( l, 0, &h ) < 0 || !h.simple )
+    goto bad;
+  if( h.naxis == 0 && h.extend ) {
+    if( load_hdu( l, h.len, &x ) < 0 || !x.bintable || !x.zimage ||
+        strcmp( x.zcmptype, "RICE_1" ) != 0 || x.zbitpix != 16 ||
+        x.znaxis != 2 || (x.ztile1 && x.ztile1 != x.znaxis1) ||
+        x.ztile2 != 1 || x.blocksize != SI_RICE_BLOCK ||
+        strncmp( x.tform1, "1P", 2 ) != 0 || x.naxis1 != 8 ||
+        x.naxis2 != x.znaxis2 || x.bscale != 1.0 )
+      goto bad;
+    l->type = SI_LOAD_RICE;
+    l->n_cols = x.znaxis1;
+    l->n_rows = x.znaxis2;
+    l->data = h.len + x.len;
+    l->heap = l->data + (x.theap ? x.theap : x.naxis1*x.naxis2);
+    l->bzero = x.bzero;
+    if( l->data + x.naxis1*x.naxis2 > l->size || l->heap > l->size )
+      goto bad;
+  } else {
+    if( h.bitpix != 16 || h.naxis != 2 || h.bscale != 1.0 )
+      goto bad;
+    l->type = SI_LOAD_FITS;
+    l->n_cols = h.naxis1;
+    l->n_rows = h.naxis2;
+    l->data = h.len;
+    l->bzero = h.bzero;
+    if( l->data + 2L*l->n_cols*l->n_rows > l->size )
+      goto bad;
+  }
+  if( l->n_cols < 1 || l->n_rows < 1 )
+    goto bad;
+  return 0;
+
+bad:
+  errno = EPROTO;
+  return -1;
+}
+
+/* pixels and nothing else, square or n_cols wide */
+
+static int load_raw( struct SI_LOAD *l, int n_cols )
+{
+  long n, side;
+
+  n = l->size/2;
+  for( side=1; side*side<n; side++ )
+    ;
+  l->type = SI_LOAD_RAW;
+  l->bzero = 32768;
+  if( side*side == n ) {
+    l->n_cols = side;
+    l->n_rows = side;
+  } else if( n_cols > 0 && n % n_cols == 0 ) {
+    l->n_cols = n_cols;
+    l->n_rows = n/n_cols;
+  } else {
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
+/* the image in fname mapped into l, a raw one being n_cols wide if it
+   is not square.  0, or -1 with EPROTO if it is no image read here
+*/
+
+int si_load_open( struct SI_LOAD *l, char *fname, int n_cols )
+{
+  struct stat st;
+  void *p;
+  int fd, err;
+
+  bzero( l, sizeof(*l));
+  if( (fd = open( fname, O_RDONLY )) < 0 )
+    return -1;
+  if( fstat( fd, &st ) < 0 ) {
+    err = errno;
+    close( fd );
+    errno = err;
+    return -1;
+  }
+  if( st.st_size < 2 || st.st_size % 2 ) {
+    close( fd );
+    errno = EPROTO;
+    return -1;
+  }
+  p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  err = errno;
+  close( fd );
+  if( p == MAP_FAILED ) {
+    errno = err;
+    return -1;
+  }
+  l->map = p;
+  l->size = st.st_size;
+
+  if( l->size >= SI_FITS_BLOCK && memcmp( l->map, "SIMPLE  =", 9 ) == 0 )
+    err = load_fits( l );
+  else
+    err = load_raw( l, n_cols );
+  if( err < 0 ) {
+    err = errno;
+    munmap( l->map, l->size );
+    l->map = NULL;
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/* pixels stored signed with some other BZERO, given as they would be
+   with 32768, to what they are clipped to 16 bits
+*/
+
+static void load_bias( unsigned short *to, long n, int bzero )
+{
+  long i;
+  int v;
+
+  for( i=0; i<n; i++ ) {
+    v = to[i] + bzero - 32768;
+    to[i] = v < 0 ? 0 : v > 65535 ? 65535 : v;
+  }
+}
+
+static unsigned long load_be32( unsigned char *p )
+{
+  return (unsigned long)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* row of the image into to.  0 or -1 if a tile is bad */
+
+static int load_row( struct SI_LOAD *l, unsigned short *to, int row )
+{
+  unsigned char *d;
+  unsigned long len, off;
+
+  switch( l->type ) {
+  case SI_LOAD_RAW:
+    memcpy( to, l->map + 2L*row*l->n_cols, 2L*l->n_cols );
+    return 0;
+  case SI_LOAD_FITS:
+    si_fits_unswap( to, (unsigned short *)(l->map + l->data) +
+                    (long)row*l->n_cols, l->n_cols );
+    break;
+  case SI_LOAD_RICE:
+    d = l->map + l->data + 8L*row;
+    len = load_be32( d );
+    off = load_be32( d + 4 );
+    if( l->heap + off + len > l->size ||
+        si_rice_decode( to, l->n_cols, l->map + l->heap + off, len,
+                        0x8000 ) < 0 )
+      return -1;
+    break;
+  }
+  if( l->bzero != 32768 )
+    load_bias( to, l->n_cols, l->bzero );
+  return 0;
+}
+
+struct LOAD_BANDS {
+  struct SI_LOAD *l;
+  unsigned short *to;
+  int row;
+  int n;
+  int nbands;
+  int bad;
+};
+
+static void load_band( void *v, int i )
+{
+  struct LOAD_BANDS *b;
+  int row, last;
+
+  b = (struct LOAD_BANDS *)v;
+  row = b->row + (long)b->n*i/b->nbands;
+  last = b->row + (long)b->n*(i+1)/b->nbands;
+  for( ; row<last; row++ )
+    if( load_row( b->l, b->to + (long)(row - b->row)*b->l->n_cols, row ) < 0 )
+      b->bad = 1;
+}
+
+/* rows row to row+n-1 into to, n_cols apart, in bands on the worker
+   pool.  0, or -1 with EPROTO if a compressed row is bad
+*/
+
+int si_load_rows( struct SI_LOAD *l, unsigned short *to, int row, int n )
+{
+  struct LOAD_BANDS b;
+
+  if( row < 0 || n < 0 || row + n > l->n_rows ) {
+    errno = EINVAL;
+    return -1;
+  }
+  if( !l->seq ) { /* read ahead from here on */
+    madvise( l->map, l->size, MADV_SEQUENTIAL );
+    l->seq = 1;
+  }
+  b.l = l;
+  b.to = to;
+  b.row = row;
+  b.n = n;
+  b.nbands = 4*si_pool_size();
+  if( b.nbands > n )
+    b.nbands = n;
+  b.bad = 0;
+  if( n > 0 )
+    si_pool_run( load_band, &b, b.nbands );
+  if( b.bad ) {
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
+/* every step'th pixel of every step'th row into to, an image
+   (n_cols+step-1)/step by (n_rows+step-1)/step.  Only those rows are
+   read.  0 or -1
+*/
+
+int si_load_preview( struct SI_LOAD *l, unsigned short *to, int step )
+{
+  int row, col, w;
+
+  if( step < 1 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  if( !l->row && !(l->row = malloc( 2L*l->n_cols )))
+    return -1;
+  madvise( l->map, l->size, MADV_RANDOM );  /* no read ahead past the rows */
+  l->seq = 0;
+
+  w = (l->n_cols + step - 1)/step;
+  for( row=0; row<l->n_rows; row+=step ) {
+    if( load_row( l, l->row, row ) < 0 ) {
+      errno = EPROTO;
+      return -1;
+    }
+    for( col=0; col<w; col++ )
+      to[col] = l->row[col*step];
+    to += w;
+  }
+  return 0;
+}
+
+void si_load_close( struct SI_LOAD *l )
+{
+  if( l->map )
+    munmap( l->map, l->size );
+  free( l->row );
+  bzero( l, sizeof(*l));
+}
@@ -0,0 +1,4 @@
+int si_load_open( struct SI_LOAD *l, char *fname, int n_cols );
+int si_load_rows( struct SI_LOAD *l, unsigned short *to, int row, int n );
+int si_load_preview( struct SI_LOAD *l, unsigned short *to, int step );
+void si_load_close( struct SI_LOAD *l );
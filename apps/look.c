@@ -0,0 +1,627 @@
+/*
+
+Quick look display of images from the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  the min, max and histogram of an image and its rgb display, done a
+  row at a time as soon as each row is finished.  si_look_execute()
+  runs a deinterlace or demux plan a band at a time on the worker
+  pool, and every output row the band completes is looked at while it
+  is still in cache, so the frame is touched once rather than once to
+  demux, once to scale and once to display.
+
+    si_look_start()    before each frame
+    si_look_execute()  as the input arrives, in order
+    si_look_end()      rows nothing wrote, and any left unfinished
+
+  l->stats holds the totals after si_look_end(), and l->amps what each
+  amplifier read, counted by si_dinter_execute_stats() as it demuxes.
+
+  si_look_pyramid() bins the finished image down to 1/16 a side, and
+  si_look_tile() makes display pixels for part of any level, so only
+  what is on the screen need be drawn, whatever the size of the image.
+  The display bytes are the top 8 bits of each pixel, or from a table
+  made by si_scale_lut().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "dinter.h"
+#include "pool.h"
+#include "look.h"
+
+#define LOOK_CHUNK 8 /* group rows run before they are looked at */
+
+struct LOOK_JOB {
+  struct SI_LOOK *l;
+  unsigned short *from;
+  unsigned short *to;
+  long start;
+  long end;
+  long row;         /* input pixels in one group row */
+  long r0;          /* first and number of group rows */
+  long nrows;
+  int nbands;
+};
+
+/* what one band found */
+
+struct SI_LOOK_PART {
+  unsigned short min;
+  unsigned short max;
+  unsigned int hist[4][SI_LOOK_BINS];
+  struct SI_DINTER_STATS amps;
+};
+
+static void look_clear( struct SI_LOOK *l, struct SI_LOOK_PART *s )
+{
+  bzero( s, sizeof(*s));
+  s->min = 0xffff;
+  si_dinter_stats_start( &s->amps, l->p->nlanes, l->amps.saturation );
+}
+
+static void look_merge( struct SI_LOOK *l, struct SI_LOOK_PART *s )
+{
+  struct SI_LOOK_STATS *to = &l->stats;
+  int i;
+
+  si_dinter_stats_merge( &l->amps, &s->amps );
+  if( s->min < to->min )
+    to->min = s->min;
+  if( s->max > to->max )
+    to->max = s->max;
+  for( i=0; i<SI_LOOK_BINS; i++ )
+    to->hist[i] += s->hist[0][i] + s->hist[1][i] + s->hist[2][i] +
+                   s->hist[3][i];
+}
+
+/* grey display pixels, the top 8 bits of each or lut[] of it */
+
+static void rgb_scalar( unsigned char *d, unsigned short *src, long n,
+                        int nchan, unsigned char *lut )
+{
+  long x;
+
+  if( lut ) {
+    for( x=0; x<n; x++, d += nchan )
+      d[0] = d[1] = d[2] = lut[src[x]];
+    return;
+  }
+  for( x=0; x<n; x++, d += nchan )
+    d[0] = d[1] = d[2] = src[x]>>8;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LOOK_X86
+#endif
+
+#ifdef LOOK_X86
+
+/* sixteen pixels make sixteen bytes, spread to 48 by three shuffles */
+
+__attribute__((target("ssse3")))
+static void rgb_ssse3( unsigned char *d, unsigned short *src, long n,
+                       int nchan, unsigned char *lut )
+{
+  __m128i a, b, m0, m1, m2;
+  unsigned char g[16] __attribute__((aligned(16)));
+  long x;
+  int k;
+
+  m0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 );
+  m1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10 );
+  m2 = _mm_setr_epi8( 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14,
+                      15, 15, 15 );
+  for( x=0; x+16<=n; x+=16, d+=48 ) {
+    if( lut ) {  /* no byte gather, look them up and spread them */
+      for( k=0; k<16; k++ )
+        g[k] = lut[src[x+k]];
+      a = _mm_load_si128( (__m128i *)g );
+    } else {
+      a = _mm_srli_epi16( _mm_loadu_si128( (__m128i *)(src + x)), 8 );
+      b = _mm_srli_epi16( _mm_loadu_si128( (__m128i *)(src + x + 8)), 8 );
+      a = _mm_packus_epi16( a, b );
+    }
+    _mm_storeu_si128( (__m128i *)d, _mm_shuffle_epi8( a, m0 ));
+    _mm_storeu_si128( (__m128i *)(d + 16), _mm_shuffle_epi8( a, m1 ));
+    _mm_storeu_si128( (__m128i *)(d + 32), _mm_shuffle_epi8( a, m2 ));
+  }
+  rgb_scalar( d, src + x, n - x, nchan, lut );
+}
+#endif
+
+/* n pixels of src to the display at d, nchan bytes apart, through
+   lut if not NULL, see si_scale_lut().  The shuffles are used unless
+   si_deinterlace_select() asked for scalar code
+*/
+
+void si_look_rgb( unsigned char *d, unsigned short *src, long n, int nchan,
+                  unsigned char *lut )
+{
+#ifdef LOOK_X86
+  static int ssse3 = -1;  /* found once, by whichever thread is first */
+  int has;
+
+  if( (has = __atomic_load_n( &ssse3, __ATOMIC_RELAXED )) < 0 ) {
+    __builtin_cpu_init();
+    has = __builtin_cpu_supports( "ssse3" ) != 0;
+    __atomic_store_n( &ssse3, has, __ATOMIC_RELAXED );
+  }
+  if( nchan == 3 && has && strcmp( si_deinterlace_impl(), "scalar" )) {
+    rgb_ssse3( d, src, n, nchan, lut );
+    return;
+  }
+#endif
+  rgb_scalar( d, src, n, nchan, lut );
+}
+
+/* image row y of to into s and the display */
+
+static void look_row( struct SI_LOOK *l, unsigned short *to, long y,
+                      struct SI_LOOK_PART *s )
+{
+  unsigned short *src, min[16], max[16];
+  long x, n;
+  int k;
+
+  src = to + y*l->n_cols;
+  n = l->n_cols;
+
+  /* sixteen at a time, which the compiler does with vectors */
+
+  for( k=0; k<16; k++ ) {
+    min[k] = s->min;
+    max[k] = s->max;
+  }
+  for( x=0; x+16<=n; x+=16 ) {
+    for( k=0; k<16; k++ ) {
+      min[k] = src[x+k] < min[k] ? src[x+k] : min[k];
+      max[k] = src[x+k] > max[k] ? src[x+k] : max[k];
+    }
+  }
+  for( ; x<n; x++ ) {
+    min[0] = src[x] < min[0] ? src[x] : min[0];
+    max[0] = src[x] > max[0] ? src[x] : max[0];
+  }
+  for( k=0; k<16; k++ ) {
+    s->min = min[k] < s->min ? min[k] : s->min;
+    s->max = max[k] > s->max ? max[k] : s->max;
+  }
+
+  /* a dark frame is mostly one bin, spread the counts over four
+     tables so each add need not wait for the last
+  */
+
+  for( x=0; x+4<=n; x+=4 ) {
+    s->hist[0][src[x]>>8]++;
+    s->hist[1][src[x+1]>>8]++;
+    s->hist[2][src[x+2]>>8]++;
+    s->hist[3][src[x+3]>>8]++;
+  }
+  for( ; x<n; x++ )
+    s->hist[0][src[x]>>8]++;
+
+  if( l->pixels )
+    si_look_rgb( l->pixels + y*l->stride, src, n, l->nchan, NULL );
+}
+
+/* image row of n_cols written by lane k of p for group row gr */
+
+static inline long look_y( struct SI_DINTER_PLAN *p, long n_cols, int k,
+                           long gr )
+{
+  return (p->base[k] + p->rs[k]*gr) / n_cols;
+}
+
+/* true if an earlier lane of group row gr wrote the same image row */
+
+static inline int look_seen( struct SI_DINTER_PLAN *p, long n_cols, int k,
+                             long gr, long y )
+{
+  int i;
+
+  for( i=0; i<k; i++ )
+    if( look_y( p, n_cols, i, gr ) == y )
+      return 1;
+  return 0;
+}
+
+/* get ready for a frame of total input pixels through plan p into an
+   image of n_cols by n_rows.  pixels, if not NULL, gets the rgb
+   display, nchan bytes a pixel and stride bytes a row.  0 or -1,
+   when l->p is left NULL
+*/
+
+int si_look_start( struct SI_LOOK *l, struct SI_DINTER_PLAN *p, long total,
+                   int n_cols, int n_rows, unsigned char *pixels,
+                   int stride, int nchan )
+{
+  struct SI_LOOK_PART *part;
+  unsigned short *left;
+  long gr, ngr, y;
+  int k, n;
+
+  l->p = NULL;
+  if( n_rows > l->alloc_rows ) {
+    if( !(left = realloc( l->left, n_rows*sizeof(short))))
+      return -1;
+    l->left = left;
+    l->alloc_rows = n_rows;
+  }
+
+  n = 4*si_pool_size(); /* bands, as si_dinter_execute_par */
+  if( n > l->npart ) {
+    if( !(part = realloc( l->part, n*sizeof(*part))))
+      return -1;
+    l->part = part;
+    l->npart = n;
+  }
+
+  l->total = total;
+  l->n_cols = n_cols;
+  l->n_rows = n_rows;
+  l->pixels = pixels;
+  l->stride = stride;
+  l->nchan = nchan;
+  bzero( &l->stats, sizeof(l->stats));
+  l->stats.min = 0xffff;
+  si_dinter_stats_start( &l->amps, p->nlanes, l->saturation );
+
+  /* count the lanes each row waits for, a row no lane writes
+     waits for si_look_end()
+  */
+
+  bzero( l->left, n_rows*sizeof(short));
+  ngr = total / (p->run * p->nlanes);
+  for( gr=0; gr<ngr; gr++ ) {
+    for( k=0; k<p->nlanes; k++ ) {
+      y = look_y( p, n_cols, k, gr );
+      if( y < 0 || y >= n_rows ) {
+        errno = EINVAL;
+        return -1;
+      }
+      if( !look_seen( p, n_cols, k, gr, y ))
+        l->left[y]++;
+    }
+  }
+  for( y=0; y<n_rows; y++ )
+    if( l->left[y] == 0 )
+      l->left[y] = 1;
+  l->p = p;
+  return 0;
+}
+
+/* the group rows band i completed, then the image rows they finish */
+
+static void look_band( void *v, int i )
+{
+  struct LOOK_JOB *j = v;
+  struct SI_LOOK *l = j->l;
+  struct SI_DINTER_PLAN *p = l->p;
+  struct SI_LOOK_PART *s = &l->part[i];
+  long a, b, c, e, gr, g1, y;
+  int k;
+
+  a = (j->r0 + j->nrows*i/j->nbands) * j->row;
+  b = (j->r0 + j->nrows*(i+1)/j->nbands) * j->row;
+  if( a < j->start )
+    a = j->start;
+  if( b > j->end )
+    b = j->end;
+
+  /* a few group rows at a time, so what they wrote is still in
+     cache when it is looked at
+  */
+
+  for( c = a; c < b; c = e ) {
+    e = (c / j->row + LOOK_CHUNK) * j->row;
+    if( e > b )
+      e = b;
+    si_dinter_execute_stats( p, j->from + (c - j->start), j->to, c, e - c,
+                             &s->amps );
+
+    /* a group row is done once its last pixel is in */
+
+    g1 = e / j->row;
+    for( gr = c / j->row; gr < g1; gr++ ) {
+      for( k=0; k<p->nlanes; k++ ) {
+        y = look_y( p, l->n_cols, k, gr );
+        if( look_seen( p, l->n_cols, k, gr, y ))
+          continue;
+        if( __atomic_sub_fetch( &l->left[y], 1, __ATOMIC_ACQ_REL ) == 0 )
+          look_row( l, j->to, y, s );
+      }
+    }
+  }
+}
+
+/* run the plan over len input pixels of from, which start at pixel
+   start of the frame, and look at every image row that finishes
+*/
+
+void si_look_execute( struct SI_LOOK *l, unsigned short *from,
+                      unsigned short *to, long start, long len )
+{
+  struct LOOK_JOB j;
+  int i;
+
+  if( start + len > l->total )
+    len = l->total - start;
+  if( len <= 0 )
+    return;
+
+  j.l = l;
+  j.from = from;
+  j.to = to;
+  j.start = start;
+  j.end = start + len;
+  j.row = l->p->run * l->p->nlanes;
+  j.r0 = start / j.row;
+  j.nrows = (j.end + j.row - 1) / j.row - j.r0;
+  j.nbands = l->npart;
+  if( j.nbands > j.nrows )
+    j.nbands = j.nrows;
+  if( j.nbands < 1 || l->p->overlap ) /* see si_dinter_execute_par */
+    j.nbands = 1;
+
+  for( i=0; i<j.nbands; i++ )
+    look_clear( l, &l->part[i] );
+
+  if( j.nbands > 1 )
+    si_pool_run( look_band, &j, j.nbands );
+  else
+    look_band( &j, 0 );
+
+  for( i=0; i<j.nbands; i++ )
+    look_merge( l, &l->part[i] );
+}
+
+/* look at the rows still waiting, those nothing writes and any the
+   frame stopped short of
+*/
+
+void si_look_end( struct SI_LOOK *l, unsigned short *to )
+{
+  long y;
+
+  look_clear( l, &l->part[0] );
+  for( y=0; y<l->n_rows; y++ ) {
+    if( l->left[y] ) {
+      look_row( l, to, y, &l->part[0] );
+      l->left[y] = 0;
+    }
+  }
+  look_merge( l, &l->part[0] );
+  si_dinter_stats_end( &l->amps );
+}
+
+void si_look_free( struct SI_LOOK *l )
+{
+  free( l->left );
+  free( l->part );
+  bzero( l, sizeof(*l));
+}
+
+/* 2x2 bins of from, n_cols by n_rows, into to, n_cols/2 by n_rows/2.
+   A mean is rounded up a pair at a time, down the columns and then
+   along the row, as the vector average does it
+*/
+
+static void bin_scalar( unsigned short *to, unsigned short *r0,
+                        unsigned short *r1, long n, int mode )
+{
+  unsigned int a, b;
+  long x;
+
+  for( x=0; x<n; x++ ) {
+    if( mode == SI_BIN_MAX ) {
+      a = r0[2*x] > r1[2*x] ? r0[2*x] : r1[2*x];
+      b = r0[2*x+1] > r1[2*x+1] ? r0[2*x+1] : r1[2*x+1];
+      to[x] = a > b ? a : b;
+    } else {
+      a = (r0[2*x] + r1[2*x] + 1) >> 1;
+      b = (r0[2*x+1] + r1[2*x+1] + 1) >> 1;
+      to[x] = (a + b + 1) >> 1;
+    }
+  }
+}
+
+#ifdef LOOK_X86
+
+/* the even and odd pixels of two vectors, as in dinter.c */
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_even( __m128i a, __m128i b )
+{
+  return _mm_packs_epi32( _mm_srai_epi32( _mm_slli_epi32( a, 16 ), 16 ),
+                          _mm_srai_epi32( _mm_slli_epi32( b, 16 ), 16 ));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_odd( __m128i a, __m128i b )
+{
+  return _mm_packs_epi32( _mm_srai_epi32( a, 16 ), _mm_srai_epi32( b, 16 ));
+}
+
+/* unsigned max without SSE4.1 */
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_max( __m128i a, __m128i b )
+{
+  return _mm_adds_epu16( _mm_subs_epu16( a, b ), b );
+}
+
+/* eight bins from 16 pixels of each row */
+
+__attribute__((target("sse2")))
+static void bin_sse2( unsigned short *to, unsigned short *r0,
+                      unsigned short *r1, long n, int mode )
+{
+  __m128i a, b;
+  long x;
+
+  for( x=0; x+8<=n; x+=8 ) {
+    a = _mm_loadu_si128( (__m128i *)(r0 + 2*x));
+    b = _mm_loadu_si128( (__m128i *)(r1 + 2*x));
+    if( mode == SI_BIN_MAX ) {
+      a = sse2_max( a, b );
+      b = sse2_max( _mm_loadu_si128( (__m128i *)(r0 + 2*x + 8)),
+                    _mm_loadu_si128( (__m128i *)(r1 + 2*x + 8)));
+      a = sse2_max( sse2_even( a, b ), sse2_odd( a, b ));
+    } else {
+      a = _mm_avg_epu16( a, b );
+      b = _mm_avg_epu16( _mm_loadu_si128( (__m128i *)(r0 + 2*x + 8)),
+                         _mm_loadu_si128( (__m128i *)(r1 + 2*x + 8)));
+      a = _mm_avg_epu16( sse2_even( a, b ), sse2_odd( a, b ));
+    }
+    _mm_storeu_si128( (__m128i *)(to + x), a );
+  }
+  bin_scalar( to + x, r0 + 2*x, r1 + 2*x, n - x, mode );
+}
+#endif
+
+struct BIN_JOB {
+  unsigned short *to;
+  unsigned short *from;
+  long n_cols;
+  long rows;         /* output rows */
+  int mode;
+  int nbands;
+};
+
+static void look_bin_band( void *v, int i )
+{
+  struct BIN_JOB *j = v;
+  unsigned short *r0;
+  long y, y1, n;
+
+  n = j->n_cols/2;
+  y1 = j->rows*(i+1)/j->nbands;
+  for( y = j->rows*i/j->nbands; y < y1; y++ ) {
+    r0 = j->from + 2*y*j->n_cols;
+#ifdef LOOK_X86
+    if( strcmp( si_deinterlace_impl(), "scalar" )) {
+      bin_sse2( j->to + y*n, r0, r0 + j->n_cols, n, j->mode );
+      continue;
+    }
+#endif
+    bin_scalar( j->to + y*n, r0, r0 + j->n_cols, n, j->mode );
+  }
+}
+
+/* one level of the pyramid from the one above, on the worker pool */
+
+void si_look_bin( unsigned short *to, unsigned short *from, int n_cols,
+                  int n_rows, int mode )
+{
+  struct BIN_JOB j;
+
+  j.to = to;
+  j.from = from;
+  j.n_cols = n_cols;
+  j.rows = n_rows/2;
+  j.mode = mode;
+  j.nbands = 4*si_pool_size();
+  if( j.nbands > j.rows )
+    j.nbands = j.rows;
+  if( j.nbands > 1 )
+    si_pool_run( look_bin_band, &j, j.nbands );
+  else if( j.nbands == 1 )
+    look_bin_band( &j, 0 );
+}
+
+/* the pyramid of image, mode SI_BIN_MEAN or SI_BIN_MAX.  The image is
+   not copied and has to stay put while the pyramid is used.  0 or -1
+*/
+
+int si_look_pyramid( struct SI_PYRAMID *py, unsigned short *image,
+                     int n_cols, int n_rows, int mode )
+{
+  unsigned short *buf;
+  long need;
+  int i;
+
+  need = 0;
+  for( i=1; i<SI_PYRAMID_LEVELS; i++ )
+    need += (long)(n_cols >> i) * (n_rows >> i);
+  if( need > py->alloc ) {
+    if( !(buf = realloc( py->buf, need*sizeof(short))))
+      return -1;
+    py->buf = buf;
+    py->alloc = need;
+  }
+
+  py->mode = mode;
+  py->level[0] = image;
+  py->n_cols[0] = n_cols;
+  py->n_rows[0] = n_rows;
+  buf = py->buf;
+  for( i=1; i<SI_PYRAMID_LEVELS; i++ ) {
+    py->level[i] = buf;
+    py->n_cols[i] = n_cols >> i;
+    py->n_rows[i] = n_rows >> i;
+    si_look_bin( buf, py->level[i-1], py->n_cols[i-1], py->n_rows[i-1],
+                 mode );
+    buf += (long)py->n_cols[i] * py->n_rows[i];
+  }
+  return 0;
+}
+
+/* display pixels for w by h of level at x, y, trimmed to the level,
+   through lut if not NULL.  returns the pixels made
+*/
+
+long si_look_tile( struct SI_PYRAMID *py, int level, int x, int y, int w,
+                   int h, unsigned char *pixels, int stride, int nchan,
+                   unsigned char *lut )
+{
+  unsigned short *src;
+  int row;
+
+  if( level < 0 || level >= SI_PYRAMID_LEVELS || !py->level[level] ||
+      x < 0 || y < 0 )
+    return 0;
+  if( x + w > py->n_cols[level] )
+    w = py->n_cols[level] - x;
+  if( y + h > py->n_rows[level] )
+    h = py->n_rows[level] - y;
+  if( w <= 0 || h <= 0 )
+    return 0;
+
+  src = py->level[level] + (long)y*py->n_cols[level] + x;
+  for( row=0; row<h; row++ )
+    si_look_rgb( pixels + (long)row*stride, src + (long)row*py->n_cols[level],
+                 w, nchan, lut );
+  return (long)w*h;
+}
+
+void si_look_pyramid_free( struct SI_PYRAMID *py )
+{
+  free( py->buf );
+  bzero( py, sizeof(*py));
+}
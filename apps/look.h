@@ -0,0 +1,17 @@
+int si_look_start( struct SI_LOOK *l, struct SI_DINTER_PLAN *p, long total,
+                   int n_cols, int n_rows, unsigned char *pixels,
+                   int stride, int nchan );
+void si_look_execute( struct SI_LOOK *l, unsigned short *from,
+                      unsigned short *to, long start, long len );
+void si_look_end( struct SI_LOOK *l, unsigned short *to );
+void si_look_free( struct SI_LOOK *l );
+void si_look_rgb( unsigned char *d, unsigned short *src, long n, int nchan,
+                  unsigned char *lut );
+void si_look_bin( unsigned short *to, unsigned short *from, int n_cols,
+                  int n_rows, int mode );
+int si_look_pyramid( struct SI_PYRAMID *py, unsigned short *image,
+                     int n_cols, int n_rows, int mode );
+long si_look_tile( struct SI_PYRAMID *py, int level, int x, int y, int w,
+                   int h, unsigned char *pixels, int stride, int nchan,
+                   unsigned char *lut );
+void si_look_pyramid_free( struct SI_PYRAMID *py );
@@ -0,0 +1,219 @@
+/*
+
+Worker threads for the image routines of the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  a fixed set of threads, started once and kept, that share out the
+  pieces of one job at a time.  si_pool_run() hands fn the numbers
+  0..n-1 in any order on any thread, the caller's included, and
+  returns when all are done.  Jobs from different threads take turns.
+
+  The first job or si_pool_size() starts one thread per cpu unless
+  si_pool_init() has been called, whichever thread gets there first,
+  the rest waiting for it.  si_pool_init() and si_pool_stop() must
+  not be called while a job is running.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* held while the workers are started or stopped */
+static pthread_mutex_t pool_start = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_turn = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t *pool_threads = NULL;
+static int pool_nthreads = 0;   /* workers, not counting the caller */
+static int pool_started = 0;    /* set once the workers are running */
+static int pool_quit = 0;
+
+static void (*pool_fn)( void *arg, int i );
+static void *pool_arg;
+static int pool_next;           /* next piece to hand out */
+static int pool_npieces;
+static int pool_busy;           /* pieces being worked on */
+static unsigned int pool_gen;   /* bumped for every job */
+
+/* take pieces until there are none left, called locked */
+
+static void pool_take( void )
+{
+  int i;
+
+  while( pool_next < pool_npieces ) {
+    i = pool_next++;
+    pool_busy++;
+    pthread_mutex_unlock( &pool_lock );
+    pool_fn( pool_arg, i );
+    pthread_mutex_lock( &pool_lock );
+    pool_busy--;
+  }
+  if( pool_busy == 0 )
+    pthread_cond_broadcast( &pool_done );
+}
+
+static void *pool_worker( void *v )
+{
+  unsigned int seen;
+
+  pthread_mutex_lock( &pool_lock );
+  seen = pool_gen;
+  for(;;) {
+    while( seen == pool_gen && !pool_quit )
+      pthread_cond_wait( &pool_work, &pool_lock );
+    if( pool_quit )
+      break;
+    seen = pool_gen;
+    pool_take();
+  }
+  pthread_mutex_unlock( &pool_lock );
+  return NULL;
+}
+
+/* end the workers, called with pool_start held */
+
+static void pool_stop( void )
+{
+  int i;
+
+  if( pool_nthreads > 0 ) {
+    pthread_mutex_lock( &pool_lock );
+    pool_quit = 1;
+    pthread_cond_broadcast( &pool_work );
+    pthread_mutex_unlock( &pool_lock );
+    for( i=0; i<pool_nthreads; i++ )
+      pthread_join( pool_threads[i], NULL );
+  }
+  free( pool_threads );
+  pool_threads = NULL;
+  pool_nthreads = 0;
+  __atomic_store_n( &pool_started, 0, __ATOMIC_RELEASE );
+  pool_quit = 0;
+}
+
+/* as si_pool_init(), called with pool_start held */
+
+static int pool_begin( int nthreads )
+{
+  int i;
+
+  pool_stop();
+
+  if( nthreads <= 0 )
+    nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+  if( nthreads < 1 )
+    nthreads = 1;
+
+  i = 0;
+  if( nthreads > 1 &&
+      (pool_threads = calloc( nthreads - 1, sizeof(pthread_t)))) {
+    for( ; i<nthreads-1; i++ ) {
+      if( pthread_create( &pool_threads[i], NULL, pool_worker, NULL ) != 0 ) {
+        perror("pool");
+        break;
+      }
+    }
+  }
+  pool_nthreads = i;
+  __atomic_store_n( &pool_started, 1, __ATOMIC_RELEASE );
+  return pool_nthreads + 1;
+}
+
+/* the workers started, by this thread or another */
+
+static void pool_check( void )
+{
+  if( __atomic_load_n( &pool_started, __ATOMIC_ACQUIRE ))
+    return;
+  pthread_mutex_lock( &pool_start );
+  if( !pool_started )
+    pool_begin( 0 );
+  pthread_mutex_unlock( &pool_start );
+}
+
+/* start nthreads workers in all, the caller being one of them.
+   0 for one per cpu.  returns the number in use
+*/
+
+int si_pool_init( int nthreads )
+{
+  int n;
+
+  pthread_mutex_lock( &pool_start );
+  n = pool_begin( nthreads );
+  pthread_mutex_unlock( &pool_start );
+  return n;
+}
+
+/* threads a job is shared between */
+
+int si_pool_size( void )
+{
+  pool_check();
+  return pool_nthreads + 1;
+}
+
+/* run fn( arg, i ) for i from 0 to n-1 and wait for them all */
+
+void si_pool_run( void (*fn)( void *arg, int i ), void *arg, int n )
+{
+  int i;
+
+  pool_check();
+
+  if( pool_nthreads == 0 || n <= 1 ) {
+    for( i=0; i<n; i++ )
+      fn( arg, i );
+    return;
+  }
+
+  pthread_mutex_lock( &pool_turn );
+  pthread_mutex_lock( &pool_lock );
+  pool_fn = fn;
+  pool_arg = arg;
+  pool_next = 0;
+  pool_npieces = n;
+  pool_gen++;
+  pthread_cond_broadcast( &pool_work );
+
+  pool_take();
+  while( pool_busy > 0 )
+    pthread_cond_wait( &pool_done, &pool_lock );
+
+  pthread_mutex_unlock( &pool_lock );
+  pthread_mutex_unlock( &pool_turn );
+}
+
+/* end the workers */
+
+void si_pool_stop( void )
+{
+  pthread_mutex_lock( &pool_start );
+  pool_stop();
+  pthread_mutex_unlock( &pool_start );
+}
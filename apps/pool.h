@@ -0,0 +1,4 @@
+int si_pool_init( int nthreads );
+int si_pool_size( void );
+void si_pool_run( void (*fn)( void *arg, int i ), void *arg, int n );
+void si_pool_stop( void );
@@ -0,0 +1,257 @@
+/*
+
+DMA stream recorder for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  record every completed dma buffer with its completion time and
+  dma status, for replay:FILE in camera.c to play back later.
+
+  The file is a SI_RECORD_HEADER, then for each buffer a
+  SI_RECORD_ENTRY followed by the data, then a copy of all the
+  entries and a SI_RECORD_TRAILER.  A recording that was cut short
+  has no trailer, the inline entries are enough to rebuild the index.
+  Everything is in host byte order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "record.h"
+
+struct SI_RECORD {
+  int fd;
+  long long pos;       /* file offset of next entry */
+  int nentries;
+  int maxentries;
+  int nframes;
+  int lastframe;
+  struct SI_RECORD_ENTRY *index;
+};
+
+static int write_all( int fd, void *buf, int len )
+{
+  char *p;
+  int n;
+
+  p = (char *)buf;
+  while( len > 0 ) {
+    if( (n = write( fd, p, len )) < 0 ) {
+      if( errno == EINTR )
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* start recording everything si_camera_next_buffer hands out */
+
+int si_record_start( struct SI_CAMERA *c, char *fname )
+{
+  struct SI_RECORD *r;
+  struct SI_RECORD_HEADER h;
+
+  if( c->record )
+    si_record_stop( c );
+
+  if( !(r = calloc( 1, sizeof(*r))))
+    return -1;
+
+  if( (r->fd = open( fname, O_WRONLY|O_CREAT|O_TRUNC, 0666 )) < 0 ) {
+    free( r );
+    return -1;
+  }
+
+  bzero( &h, sizeof(h));
+  memcpy( h.magic, SI_RECORD_MAGIC, sizeof(h.magic));
+  h.version = SI_RECORD_VERSION;
+  h.total = c->dma_config.total;
+  h.buflen = c->dma_config.buflen;
+  h.config = c->dma_config.config;
+  memcpy( h.readout, c->readout, sizeof(h.readout));
+
+  if( write_all( r->fd, &h, sizeof(h)) < 0 ) {
+    close( r->fd );
+    free( r );
+    return -1;
+  }
+  r->pos = sizeof(h);
+  r->lastframe = -1;
+  c->record = r;
+  return 0;
+}
+
+/* append one buffer */
+
+int si_record_buffer( struct SI_CAMERA *c, struct SI_BUFFER *b )
+{
+  struct SI_RECORD *r = c->record;
+  struct SI_RECORD_ENTRY *e;
+  int max;
+
+  if( r->nentries == r->maxentries ) {
+    max = r->maxentries ? r->maxentries*2 : 256;
+    if( !(e = realloc( r->index, max*sizeof(*e))))
+      return -1;
+    r->index = e;
+    r->maxentries = max;
+  }
+
+  e = &r->index[r->nentries];
+  bzero( e, sizeof(*e));
+  e->pos = r->pos + sizeof(*e);
+  e->frame = c->frame;
+  e->offset = b->offset;
+  e->len = b->len;
+  e->status = b->status;
+  e->time = b->time - c->start_time;
+
+  if( write_all( r->fd, e, sizeof(*e)) < 0 ||
+      write_all( r->fd, b->data, b->len ) < 0 )
+    return -1;
+
+  r->pos = e->pos + e->len;
+  r->nentries++;
+  if( e->frame != r->lastframe ) {
+    r->nframes++;
+    r->lastframe = e->frame;
+  }
+  return 0;
+}
+
+/* write the index and close */
+
+int si_record_stop( struct SI_CAMERA *c )
+{
+  struct SI_RECORD *r = c->record;
+  struct SI_RECORD_TRAILER t;
+  int ret;
+
+  if( !r )
+    return 0;
+
+  bzero( &t, sizeof(t));
+  t.index = r->pos;
+  t.nentries = r->nentries;
+  t.nframes = r->nframes;
+  memcpy( t.magic, SI_RECORD_IMAGIC, sizeof(t.magic));
+
+  ret = 0;
+  if( write_all( r->fd, r->index, r->nentries*sizeof(*r->index)) < 0 ||
+      write_all( r->fd, &t, sizeof(t)) < 0 )
+    ret = -1;
+  if( close( r->fd ) < 0 )
+    ret = -1;
+
+  free( r->index );
+  free( r );
+  c->record = NULL;
+  return ret;
+}
+
+/* read the header and index of a recording.
+   returns the number of entries, -1 with errno EINVAL if fd is not
+   a recording.  a trailer that does not fit the file, an index that
+   cannot be read, or an entry in it outside the data, is ignored and
+   the inline entries walked instead.  Offsets are compared signed, a
+   negative one must not pass as huge
+*/
+
+static int record_entry_ok( struct SI_RECORD_ENTRY *e, long long end )
+{
+  return e->pos >= (long long)(sizeof(struct SI_RECORD_HEADER) +
+                               sizeof(*e)) &&
+         e->len >= 0 && e->offset >= 0 && e->pos + e->len <= end &&
+         (long long)e->offset + e->len <= 0x7fffffffLL;
+}
+
+int si_record_load( int fd, struct SI_RECORD_HEADER *h,
+                    struct SI_RECORD_ENTRY **ep )
+{
+  struct SI_RECORD_TRAILER t;
+  struct SI_RECORD_ENTRY e, *index, *grow;
+  long long end, pos;
+  size_t len;
+  int i, n, max;
+
+  *ep = NULL;
+  if( pread( fd, h, sizeof(*h), 0 ) != sizeof(*h) ||
+      memcmp( h->magic, SI_RECORD_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != SI_RECORD_VERSION ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  end = lseek( fd, 0, SEEK_END );
+  if( end >= (long long)(sizeof(*h) + sizeof(t)) &&
+      pread( fd, &t, sizeof(t), end - sizeof(t)) == sizeof(t) &&
+      memcmp( t.magic, SI_RECORD_IMAGIC, sizeof(t.magic)) == 0 &&
+      t.nentries > 0 && t.index >= (long long)sizeof(*h) &&
+      t.index <= end - (long long)sizeof(t) &&
+      t.nentries <= (end - (long long)sizeof(t) - t.index) /
+                    (long long)sizeof(*index) ) {
+    len = (size_t)t.nentries * sizeof(*index);
+    if( !(index = malloc( len )))
+      return -1;
+    i = 0;
+    if( pread( fd, index, len, t.index ) == (ssize_t)len )
+      for( ; i<t.nentries; i++ )
+        if( !record_entry_ok( &index[i], t.index ))
+          break;
+    if( i == t.nentries ) {
+      *ep = index;
+      return t.nentries;
+    }
+    free( index );
+  }
+
+  /* no trailer, walk the inline entries */
+
+  n = max = 0;
+  index = NULL;
+  pos = sizeof(*h);
+  while( pos + (long long)sizeof(e) <= end ) {
+    if( pread( fd, &e, sizeof(e), pos ) != sizeof(e) ||
+        e.pos != pos + sizeof(e) || !record_entry_ok( &e, end ))
+      break;
+    if( n == max ) {
+      max = max ? max*2 : 256;
+      if( !(grow = realloc( index, max*sizeof(e)))) {
+        free( index );
+        return -1;
+      }
+      index = grow;
+    }
+    index[n++] = e;
+    pos = e.pos + e.len;
+  }
+  *ep = index;
+  return n;
+}
@@ -0,0 +1,5 @@
+int si_record_start( struct SI_CAMERA *c, char *fname );
+int si_record_buffer( struct SI_CAMERA *c, struct SI_BUFFER *b );
+int si_record_stop( struct SI_CAMERA *c );
+int si_record_load( int fd, struct SI_RECORD_HEADER *h,
+                    struct SI_RECORD_ENTRY **ep );
@@ -0,0 +1,353 @@
+/*
+
+Rice coding of images from the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  lossless Rice coding of 16 bit pixels, as RICE_1 in tile compressed
+  FITS and fpack, so what comes out can be read by anything that reads
+  those.
+
+    si_rice_encode()  n pixels into bytes
+    si_rice_decode()  and back
+
+  The first pixel is stored as it is, then the difference of each
+  from the one before, folded so small either way is small, in blocks
+  of SI_RICE_BLOCK.  Each block starts with 4 bits saying how many low
+  bits of each difference are sent as they are, the rest going in
+  unary.  Sky and bias are noise about a level, so most differences
+  need only a few bits.  A block all the same is just the 4 bits, and
+  one that would not shrink is sent as 16 bits a pixel, so nothing
+  grows by more than a bit in 128.
+
+  The values coded are the pixels xor flip; 0x8000 gives the signed
+  pixels a FITS file with BZERO 32768 holds.  Only the first pixel
+  differs, a difference is the same either way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "dinter.h"
+#include "rice.h"
+
+#define RICE_FSBITS 4
+#define RICE_FSMAX  14   /* 15 means 16 bits as they are */
+#define RICE_BBITS  16
+
+struct RICE_BITS {
+  unsigned char *p;
+  unsigned long long acc;
+  int n;                 /* bits in acc not yet out */
+};
+
+/* the low nbits of v, nbits up to 32, out four bytes at a time */
+
+static inline void rice_put( struct RICE_BITS *b, unsigned int v, int nbits )
+{
+  unsigned int w;
+
+  b->acc = (b->acc << nbits) | v;
+  b->n += nbits;
+  if( b->n >= 32 ) {
+    b->n -= 32;
+    w = b->acc >> b->n;
+    b->p[0] = w >> 24;
+    b->p[1] = w >> 16;
+    b->p[2] = w >> 8;
+    b->p[3] = w;
+    b->p += 4;
+  }
+}
+
+/* what is left, padded to a byte */
+
+static inline void rice_flush( struct RICE_BITS *b )
+{
+  if( b->n % 8 )
+    rice_put( b, 0, 8 - b->n % 8 );
+  while( b->n > 0 ) {
+    b->n -= 8;
+    *b->p++ = b->acc >> b->n;
+  }
+}
+
+/* top zero bits, a one, then the low fs bits of v */
+
+static inline void rice_code( struct RICE_BITS *b, unsigned int top,
+                              unsigned int v, int fs )
+{
+  if( top + 1 + fs <= 32 ) {
+    rice_put( b, (1 << fs) | (v & ((1 << fs) - 1)), top + 1 + fs );
+    return;
+  }
+  while( top >= 32 ) {
+    rice_put( b, 0, 32 );
+    top -= 32;
+  }
+  rice_put( b, 1, top + 1 );
+  if( fs )
+    rice_put( b, v & ((1 << fs) - 1), fs );
+}
+
+/* folded differences of n pixels, p[-1] being the one before */
+
+static unsigned int diff_scalar( unsigned short *d, unsigned short *p, int n )
+{
+  unsigned int sum;
+  short v;
+  int i;
+
+  sum = 0;
+  for( i=0; i<n; i++ ) {
+    v = p[i] - p[i-1];
+    d[i] = ((unsigned int)v << 1) ^ (v >> 15);
+    sum += d[i];
+  }
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RICE_X86
+#endif
+
+#ifdef RICE_X86
+
+/* a whole block, eight at a time, summed in 32 bit lanes */
+
+__attribute__((target("sse2")))
+static unsigned int diff_sse2( unsigned short *d, unsigned short *p )
+{
+  __m128i v, sum, zero;
+  int i;
+
+  zero = _mm_setzero_si128();
+  sum = zero;
+  for( i=0; i<SI_RICE_BLOCK; i+=8 ) {
+    v = _mm_sub_epi16( _mm_loadu_si128( (__m128i *)(p + i)),
+                       _mm_loadu_si128( (__m128i *)(p + i - 1)));
+    v = _mm_xor_si128( _mm_slli_epi16( v, 1 ), _mm_srai_epi16( v, 15 ));
+    _mm_storeu_si128( (__m128i *)(d + i), v );
+    sum = _mm_add_epi32( sum, _mm_add_epi32( _mm_unpacklo_epi16( v, zero ),
+                                             _mm_unpackhi_epi16( v, zero )));
+  }
+  sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0x4e ));
+  sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0xb1 ));
+  return _mm_cvtsi128_si32( sum );
+}
+#endif
+
+/* bytes si_rice_encode() may need for n pixels */
+
+long si_rice_bound( int n )
+{
+  return 2 + ((long)n + SI_RICE_BLOCK - 1)/SI_RICE_BLOCK*
+         (1 + SI_RICE_BLOCK*RICE_BBITS/8) + 8;
+}
+
+/* the n pixels at in xor flip, Rice coded into the size bytes at out.
+   Returns the bytes used or -1
+*/
+
+int si_rice_encode( unsigned char *out, int size, unsigned short *in, int n,
+                    unsigned short flip )
+{
+  struct RICE_BITS b;
+  unsigned short d[SI_RICE_BLOCK], first;
+  unsigned int sum, psum;
+  long bits;
+  int i, j, k, fs;
+#ifdef RICE_X86
+  int vec;
+
+  vec = strcmp( si_deinterlace_impl(), "scalar" ) != 0;
+#endif
+
+  if( n < 1 || size < si_rice_bound( n )) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  b.p = out;
+  b.acc = 0;
+  b.n = 0;
+  first = in[0] ^ flip;
+  rice_put( &b, first, RICE_BBITS );
+
+  for( i=0; i<n; i+=k ) {
+    k = n - i < SI_RICE_BLOCK ? n - i : SI_RICE_BLOCK;
+
+    /* the first pixel has nothing before it, so differs by 0 */
+
+    if( i == 0 ) {
+      d[0] = 0;
+      sum = diff_scalar( d + 1, in + 1, k - 1 );
+    }
+#ifdef RICE_X86
+    else if( vec && k == SI_RICE_BLOCK )
+      sum = diff_sse2( d, in + i );
+#endif
+    else
+      sum = diff_scalar( d, in + i, k );
+
+    /* low bits sent as they are, about the log of the mean */
+
+    if( sum == 0 ) {
+      rice_put( &b, 0, RICE_FSBITS );
+      continue;
+    }
+    psum = sum > (unsigned)k/2 + 1 ? (sum - k/2 - 1)/k >> 1 : 0;
+    for( fs=0; psum>0; fs++ )
+      psum >>= 1;
+
+    if( fs < RICE_FSMAX ) {
+      bits = (long)k*(fs + 1);
+      for( j=0; j<k; j++ )
+        bits += d[j] >> fs;
+      if( bits < (long)k*RICE_BBITS ) {
+        rice_put( &b, fs + 1, RICE_FSBITS );
+        for( j=0; j<k; j++ )
+          rice_code( &b, d[j] >> fs, d[j], fs );
+        continue;
+      }
+    }
+
+    /* as they are */
+
+    rice_put( &b, RICE_FSMAX + 1, RICE_FSBITS );
+    for( j=0; j<k; j++ )
+      rice_put( &b, d[j], RICE_BBITS );
+  }
+
+  rice_flush( &b );
+  return b.p - out;
+}
+
+struct RICE_READ {
+  unsigned char *p;
+  unsigned char *end;
+  unsigned long long acc;
+  int n;
+};
+
+/* at least nbits in acc, 0 or -1 if the input ran out */
+
+static inline int rice_fill( struct RICE_READ *r, int nbits )
+{
+  while( r->n < nbits ) {
+    if( r->p >= r->end )
+      return -1;
+    r->acc = (r->acc << 8) | *r->p++;
+    r->n += 8;
+  }
+  return 0;
+}
+
+static inline int rice_get( struct RICE_READ *r, int nbits, unsigned int *v )
+{
+  if( rice_fill( r, nbits ) < 0 )
+    return -1;
+  r->n -= nbits;
+  *v = (r->acc >> r->n) & ((1ULL << nbits) - 1);
+  return 0;
+}
+
+/* zeros up to the next one, which is taken too */
+
+static inline int rice_zeros( struct RICE_READ *r, unsigned int *v )
+{
+  unsigned long long w;
+  unsigned int n;
+  int k;
+
+  n = 0;
+  for(;;) {
+    if( r->n == 0 && rice_fill( r, 8 ) < 0 )
+      return -1;
+    w = r->acc & ((1ULL << r->n) - 1);
+    if( w ) {
+      k = 63 - __builtin_clzll( w );  /* where the one is */
+      n += r->n - 1 - k;
+      r->n = k;
+      break;
+    }
+    n += r->n;
+    r->n = 0;
+    if( n > 65536 )
+      return -1;
+  }
+  *v = n;
+  return 0;
+}
+
+/* len bytes at in to n pixels at out, xor flip.  0 or -1 if in is not
+   n pixels of Rice code
+*/
+
+int si_rice_decode( unsigned short *out, int n, unsigned char *in, int len,
+                    unsigned short flip )
+{
+  struct RICE_READ r;
+  unsigned int v, fs, top, low;
+  unsigned short last;
+  int i, j, k;
+
+  r.p = in;
+  r.end = in + len;
+  r.acc = 0;
+  r.n = 0;
+  if( rice_get( &r, RICE_BBITS, &v ) < 0 )
+    goto bad;
+  last = v;
+
+  for( i=0; i<n; i+=k ) {
+    k = n - i < SI_RICE_BLOCK ? n - i : SI_RICE_BLOCK;
+    if( rice_get( &r, RICE_FSBITS, &fs ) < 0 )
+      goto bad;
+    for( j=0; j<k; j++ ) {
+      if( fs == 0 )
+        v = 0;
+      else if( fs == RICE_FSMAX + 1 ) {
+        if( rice_get( &r, RICE_BBITS, &v ) < 0 )
+          goto bad;
+      } else {
+        if( rice_zeros( &r, &top ) < 0 )
+          goto bad;
+        low = 0;
+        if( fs > 1 && rice_get( &r, fs - 1, &low ) < 0 )
+          goto bad;
+        v = (top << (fs - 1)) | low;
+      }
+      last += (v & 1) ? ~(v >> 1) : v >> 1;
+      out[i+j] = last ^ flip;
+    }
+  }
+  return 0;
+
+bad:
+  errno = EINVAL;
+  return -1;
+}
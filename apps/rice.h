@@ -0,0 +1,5 @@
+long si_rice_bound( int n );
+int si_rice_encode( unsigned char *out, int size, unsigned short *in, int n,
+                    unsigned short flip );
+int si_rice_decode( unsigned short *out, int n, unsigned char *in, int len,
+                    unsigned short flip );
@@ -0,0 +1,165 @@
+/*
+
+Queues between threads for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  a fixed number of pointers passed from thread to thread in the
+  order they were put in, for the stages of a pipeline.
+
+    si_ring_new()   room for size of them
+    si_ring_push()  one in, waiting for room or not
+    si_ring_pop()   the oldest out, waiting for one or not
+    si_ring_free()
+
+  Any thread may push and pop.  Each takes its slot with one atomic
+  add and hands it over with a store, there is no lock, and two
+  semaphores count the slots full and empty so a stage with nothing
+  to do sleeps rather than spins.  A full ring is the stage after
+  falling behind; pushing without waiting gives the caller the choice
+  of what to drop, popping the oldest itself if it likes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "ring.h"
+
+struct SI_RING_SLOT {
+  unsigned long seq;           /* pos+1 full, pos+size empty for pos */
+  void *p;
+};
+
+struct SI_RING {
+  unsigned long mask;          /* size-1, size a power of 2 */
+  struct SI_RING_SLOT *slot;
+  sem_t full;
+  sem_t empty;
+  unsigned long head __attribute__((aligned(64)));  /* next push */
+  unsigned long tail __attribute__((aligned(64)));  /* next pop */
+};
+
+/* a ring of at least size pointers.  NULL on failure */
+
+struct SI_RING *si_ring_new( int size )
+{
+  struct SI_RING *r;
+  unsigned long n, i;
+
+  if( size < 1 ) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for( n=1; n<size; n<<=1 )
+    ;
+
+  if( posix_memalign( (void **)&r, 64, sizeof(*r)) != 0 ) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if( !(r->slot = calloc( n, sizeof(struct SI_RING_SLOT)))) {
+    free( r );
+    return NULL;
+  }
+  for( i=0; i<n; i++ )
+    r->slot[i].seq = i;
+  r->mask = n - 1;
+  r->head = 0;
+  r->tail = 0;
+  sem_init( &r->full, 0, 0 );
+  sem_init( &r->empty, 0, n );
+  return r;
+}
+
+static int ring_take( sem_t *s, int wait )
+{
+  if( !wait )
+    return sem_trywait( s );
+  while( sem_wait( s ) < 0 )
+    if( errno != EINTR )
+      return -1;
+  return 0;
+}
+
+/* p in at the end.  0, or -1 with EAGAIN if the ring is full and
+   wait is 0
+*/
+
+int si_ring_push( struct SI_RING *r, void *p, int wait )
+{
+  struct SI_RING_SLOT *s;
+  unsigned long pos;
+
+  if( ring_take( &r->empty, wait ) < 0 )
+    return -1;
+
+  /* the semaphore says there is room, but the slot may still be
+     being emptied by a pop that started before the one that made it
+  */
+
+  pos = __atomic_fetch_add( &r->head, 1, __ATOMIC_RELAXED );
+  s = &r->slot[pos & r->mask];
+  while( __atomic_load_n( &s->seq, __ATOMIC_ACQUIRE ) != pos )
+    sched_yield();
+  s->p = p;
+  __atomic_store_n( &s->seq, pos + 1, __ATOMIC_RELEASE );
+  sem_post( &r->full );
+  return 0;
+}
+
+/* the oldest into *p.  0, or -1 with EAGAIN if the ring is empty and
+   wait is 0
+*/
+
+int si_ring_pop( struct SI_RING *r, void **p, int wait )
+{
+  struct SI_RING_SLOT *s;
+  unsigned long pos;
+
+  if( ring_take( &r->full, wait ) < 0 )
+    return -1;
+
+  pos = __atomic_fetch_add( &r->tail, 1, __ATOMIC_RELAXED );
+  s = &r->slot[pos & r->mask];
+  while( __atomic_load_n( &s->seq, __ATOMIC_ACQUIRE ) != pos + 1 )
+    sched_yield();
+  *p = s->p;
+  __atomic_store_n( &s->seq, pos + r->mask + 1, __ATOMIC_RELEASE );
+  sem_post( &r->empty );
+  return 0;
+}
+
+/* what is still in it is the caller's to pop first */
+
+void si_ring_free( struct SI_RING *r )
+{
+  if( !r )
+    return;
+  sem_destroy( &r->full );
+  sem_destroy( &r->empty );
+  free( r->slot );
+  free( r );
+}
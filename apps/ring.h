@@ -0,0 +1,4 @@
+struct SI_RING *si_ring_new( int size );
+int si_ring_push( struct SI_RING *r, void *p, int wait );
+int si_ring_pop( struct SI_RING *r, void **p, int wait );
+void si_ring_free( struct SI_RING *r );
@@ -0,0 +1,417 @@
+/*
+
+Display scaling of images from the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  what display byte each image value gets.  A histogram of every
+  value is taken in one pass, the black and white levels found from
+  it, and a table of all 65536 values made, so showing an image is a
+  lookup a pixel, whatever the stretch.
+
+    si_scale_hist()    count the image, on the worker pool
+    si_scale_levels()  s->lo and s->hi for s->mode
+    si_scale_lut()     s->lut from them
+
+  si_scale_image() does all three.  Changing the mode needs only the
+  last two, the histogram is kept.
+
+  linear, log and asinh cut s->clip percent from each end of the
+  histogram.  zscale is the IRAF one: a line is fitted to the middle
+  of the sorted values and its slope sets the range about the median,
+  which shows the sky and faint things on it rather than the stars.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "dinter.h"
+#include "pool.h"
+#include "scale.h"
+
+#define SCALE_LOG_A     1000.0 /* log( 1 + a*t ) */
+#define SCALE_ASINH_B   10.0   /* asinh( b*t ) */
+#define SCALE_ZSAMPLES  1000   /* sorted values the line is fitted to */
+#define SCALE_ZCONTRAST 0.25
+#define SCALE_ZREJECT   2.5    /* sigmas from the line a value is dropped */
+#define SCALE_ZITER     5
+
+static char *scale_names[SI_SCALE_MODES] = {
+  "linear", "log", "asinh", "zscale"
+};
+
+struct SCALE_JOB {
+  struct SI_SCALE *s;
+  unsigned short *data;
+  long n;
+  int nparts;
+};
+
+char *si_scale_name( int mode )
+{
+  if( mode < 0 || mode >= SI_SCALE_MODES )
+    return "unknown";
+  return scale_names[mode];
+}
+
+/* SI_SCALE_ for a name, or -1 */
+
+int si_scale_mode( char *name )
+{
+  int i;
+
+  for( i=0; i<SI_SCALE_MODES; i++ )
+    if( strcasecmp( name, scale_names[i] ) == 0 )
+      return i;
+  return -1;
+}
+
+/* count n values at p into h.  Four are fetched before any is
+   counted so the loads run ahead of the adds
+*/
+
+static void hist_scalar( unsigned int *h, unsigned short *p, long n )
+{
+  unsigned short a, b, c, d;
+  long x;
+
+  for( x=0; x+4<=n; x+=4 ) {
+    a = p[x];
+    b = p[x+1];
+    c = p[x+2];
+    d = p[x+3];
+    h[a]++;
+    h[b]++;
+    h[c]++;
+    h[d]++;
+  }
+  for( ; x<n; x++ )
+    h[p[x]]++;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALE_X86
+#endif
+
+#ifdef SCALE_X86
+
+/* there is no scatter to count with, but a dark or saturated patch is
+   one value over and over, each add waiting on the one before.  Eight
+   the same are found with one compare and counted with one add
+*/
+
+__attribute__((target("sse2")))
+static void hist_sse2( unsigned int *h, unsigned short *p, long n )
+{
+  __m128i v;
+  unsigned short a, b, c, d;
+  long x;
+  int k;
+
+  for( x=0; x+8<=n; x+=8 ) {
+    v = _mm_loadu_si128( (__m128i *)(p + x));
+    a = p[x];
+    if( _mm_movemask_epi8( _mm_cmpeq_epi16( v,
+          _mm_set1_epi16( a ))) == 0xffff ) {
+      h[a] += 8;
+      continue;
+    }
+    for( k=0; k<8; k+=4 ) {
+      a = p[x+k];
+      b = p[x+k+1];
+      c = p[x+k+2];
+      d = p[x+k+3];
+      h[a]++;
+      h[b]++;
+      h[c]++;
+      h[d]++;
+    }
+  }
+  hist_scalar( h, p + x, n - x );
+}
+#endif
+
+/* count one piece of the image into its own table, with vectors
+   unless si_deinterlace_select() asked for scalar code
+*/
+
+static void scale_hist_band( void *v, int i )
+{
+  struct SCALE_JOB *j;
+  unsigned int *h;
+  unsigned short *p;
+  long n;
+
+  j = (struct SCALE_JOB *)v;
+  h = j->s->part + (long)i*SI_SCALE_BINS;
+  p = j->data + j->n*i/j->nparts;
+  n = j->n*(i+1)/j->nparts - j->n*i/j->nparts;
+
+  bzero( h, SI_SCALE_BINS*sizeof(int));
+#ifdef SCALE_X86
+  if( strcmp( si_deinterlace_impl(), "scalar" )) {
+    hist_sse2( h, p, n );
+    return;
+  }
+#endif
+  hist_scalar( h, p, n );
+}
+
+/* s->hist of the n values at data, one table a thread then summed.
+   0 or -1
+*/
+
+int si_scale_hist( struct SI_SCALE *s, unsigned short *data, long n )
+{
+  struct SCALE_JOB j;
+  unsigned int *h, *p;
+  long x;
+  int i;
+
+  j.nparts = si_pool_size();
+  if( n < (long)j.nparts*SI_SCALE_BINS )  /* not worth the summing */
+    j.nparts = 1;
+
+  if( !s->hist && !(s->hist = malloc( SI_SCALE_BINS*sizeof(int))))
+    return -1;
+  if( j.nparts > s->nparts ) {
+    if( !(p = realloc( s->part, (long)j.nparts*SI_SCALE_BINS*sizeof(int))))
+      return -1;
+    s->part = p;
+    s->nparts = j.nparts;
+  }
+
+  j.s = s;
+  j.data = data;
+  j.n = n;
+  si_pool_run( scale_hist_band, &j, j.nparts );
+
+  h = s->hist;
+  memcpy( h, s->part, SI_SCALE_BINS*sizeof(int));
+  for( i=1; i<j.nparts; i++ ) {
+    p = s->part + (long)i*SI_SCALE_BINS;
+    for( x=0; x<SI_SCALE_BINS; x++ )
+      h[x] += p[x];
+  }
+  s->npix = n;
+  return 0;
+}
+
+/* value at each of ns ranks spread evenly over the histogram, that is
+   the sorted image sampled ns times
+*/
+
+static void scale_sample( struct SI_SCALE *s, double *v, int ns )
+{
+  long sum, rank;
+  int i, x;
+
+  sum = 0;
+  x = 0;
+  for( i=0; i<ns; i++ ) {
+    rank = ns > 1 ? (long)((double)(s->npix - 1)*i/(ns - 1)) : 0;
+    while( x < SI_SCALE_BINS-1 && sum + s->hist[x] <= rank )
+      sum += s->hist[x++];
+    v[i] = x;
+  }
+}
+
+/* value with frac of the image below it */
+
+static unsigned short scale_rank( struct SI_SCALE *s, double frac )
+{
+  long sum, rank;
+  int x;
+
+  rank = (long)(frac*(s->npix - 1));
+  sum = 0;
+  for( x=0; x<SI_SCALE_BINS-1; x++ ) {
+    sum += s->hist[x];
+    if( sum > rank )
+      break;
+  }
+  return x;
+}
+
+static void scale_zscale( struct SI_SCALE *s )
+{
+  double v[SCALE_ZSAMPLES], sx, sy, sxx, sxy, a, b, r, sigma, zmin, zmax;
+  double median, slope;
+  char good[SCALE_ZSAMPLES];
+  int i, ns, ngood, nrej, iter, center, minpix;
+
+  ns = s->npix < SCALE_ZSAMPLES ? s->npix : SCALE_ZSAMPLES;
+  if( ns < 1 )
+    return;
+  scale_sample( s, v, ns );
+  zmin = v[0];
+  zmax = v[ns-1];
+  center = (ns - 1)/2;
+  median = v[center];
+
+  /* least squares line through the samples still good, dropping those
+     far from it until none are
+  */
+
+  minpix = ns/2 > 5 ? ns/2 : 5;
+  memset( good, 1, ns );
+  ngood = ns;
+  a = b = 0.0;
+  for( iter=0; iter<SCALE_ZITER && ngood >= minpix; iter++ ) {
+    sx = sy = sxx = sxy = 0.0;
+    for( i=0; i<ns; i++ ) {
+      if( !good[i] )
+        continue;
+      sx += i - center;
+      sy += v[i];
+      sxx += (double)(i - center)*(i - center);
+      sxy += (i - center)*v[i];
+    }
+    r = ngood*sxx - sx*sx;
+    b = r > 0.0 ? (ngood*sxy - sx*sy)/r : 0.0;
+    a = (sy - b*sx)/ngood;
+
+    sigma = 0.0;
+    for( i=0; i<ns; i++ ) {
+      if( good[i] ) {
+        r = v[i] - (a + b*(i - center));
+        sigma += r*r;
+      }
+    }
+    sigma = sqrt( sigma/ngood );
+
+    nrej = 0;
+    for( i=0; i<ns; i++ ) {
+      r = v[i] - (a + b*(i - center));
+      if( good[i] && fabs( r ) > SCALE_ZREJECT*sigma ) {
+        good[i] = 0;
+        nrej++;
+      }
+    }
+    ngood -= nrej;
+    if( nrej == 0 )
+      break;
+  }
+
+  if( ngood < minpix ) {
+    s->lo = zmin;
+    s->hi = zmax;
+    return;
+  }
+  slope = b/SCALE_ZCONTRAST;
+  s->lo = fmax( zmin, median - center*slope );
+  s->hi = fmin( zmax, median + (ns - 1 - center)*slope );
+}
+
+/* black and white levels from the histogram for s->mode */
+
+void si_scale_levels( struct SI_SCALE *s )
+{
+  double clip;
+
+  if( !s->hist || s->npix <= 0 ) {
+    s->lo = 0;
+    s->hi = SI_SCALE_BINS-1;
+    return;
+  }
+
+  if( s->mode == SI_SCALE_ZSCALE ) {
+    scale_zscale( s );
+  } else {
+    clip = s->clip/100.0;
+    s->lo = scale_rank( s, clip );
+    s->hi = scale_rank( s, 1.0 - clip );
+  }
+  if( s->hi <= s->lo ) {  /* a flat image, keep the table in order */
+    if( s->lo > SI_SCALE_BINS-3 )
+      s->lo = SI_SCALE_BINS-3;
+    else if( s->lo > 0 )
+      s->lo--;
+    s->hi = s->lo + 2;
+  }
+}
+
+/* where along lo to hi the stretch reaches y of white */
+
+static double scale_inverse( int mode, double y )
+{
+  if( mode == SI_SCALE_LOG )
+    return expm1( y*log1p( SCALE_LOG_A ))/SCALE_LOG_A;
+  if( mode == SI_SCALE_ASINH )
+    return sinh( y*asinh( SCALE_ASINH_B ))/SCALE_ASINH_B;
+  return y;
+}
+
+/* s->lut from s->lo to s->hi by s->mode, 0 or -1.  There are only 256
+   display bytes and every stretch goes up, so rather than work out
+   each value the first value of each byte is found and the run up to
+   it filled
+*/
+
+int si_scale_lut( struct SI_SCALE *s )
+{
+  long v, prev;
+  int k;
+
+  if( !s->lut && !(s->lut = malloc( SI_SCALE_BINS )))
+    return -1;
+
+  memset( s->lut, 0, s->lo + 1 );
+  prev = s->lo + 1;
+  for( k=1; k<256; k++ ) {
+    v = ceil( s->lo + (s->hi - s->lo)*scale_inverse( s->mode, (k - 0.5)/255.0 ));
+    if( v < prev )
+      v = prev;
+    if( v > s->hi )
+      v = s->hi;
+    memset( s->lut + prev, k - 1, v - prev );
+    prev = v;
+  }
+  memset( s->lut + prev, 255, SI_SCALE_BINS - prev );
+  return 0;
+}
+
+/* histogram, levels and table for the n values at data, 0 or -1 */
+
+int si_scale_image( struct SI_SCALE *s, unsigned short *data, long n )
+{
+  if( si_scale_hist( s, data, n ) < 0 )
+    return -1;
+  si_scale_levels( s );
+  return si_scale_lut( s );
+}
+
+void si_scale_free( struct SI_SCALE *s )
+{
+  free( s->hist );
+  free( s->part );
+  free( s->lut );
+  s->hist = s->part = NULL;
+  s->lut = NULL;
+  s->nparts = 0;
+  s->npix = 0;
+}
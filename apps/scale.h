@@ -0,0 +1,7 @@
+char *si_scale_name( int mode );
+int si_scale_mode( char *name );
+int si_scale_hist( struct SI_SCALE *s, unsigned short *data, long n );
+void si_scale_levels( struct SI_SCALE *s );
+int si_scale_lut( struct SI_SCALE *s );
+int si_scale_image( struct SI_SCALE *s, unsigned short *data, long n );
+void si_scale_free( struct SI_SCALE *s );
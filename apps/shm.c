@@ -0,0 +1,339 @@
+/*
+
+Frames in shared memory from the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  a ring of finished frames in a POSIX shared memory object, written
+  by one process, si-daemon, and read in place by any number of
+  others.
+
+    si_shm_create()   the writer makes the ring, nslots frames
+    si_shm_begin()    where the next frame goes
+    si_shm_publish()  it is finished, with what is known of it
+    si_shm_attach()   a reader maps the ring, read only
+    si_shm_wait()     for a frame newer than the last one seen
+    si_shm_get()      the pixels of frame seq, where they lie
+    si_shm_check()    were they left alone while being read
+    si_shm_close()
+
+  The writer never waits for a reader, it just goes round the ring.
+  Every slot starts with an SI_SHM_FRAME whose seq is 0 while the
+  slot is being written and the frame's number once it is done, so a
+  reader takes seq before looking and checks it is unchanged after.
+  A reader that falls more than nslots behind finds its frame gone,
+  with ESTALE, and carries on from the newest.
+
+  The writer counts every frame in the head's wake word and wakes
+  whoever is waiting on it with a futex, one system call a frame
+  whether anyone is or not, since a reader with the ring mapped read
+  only has no way to say it is there.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "shm.h"
+
+#define SHM_PAGE 4096
+#define SHM_META shm_round( sizeof(struct SI_SHM_FRAME))  /* pixels after */
+
+struct SI_SHM {
+  char *mem;
+  long size;
+  struct SI_SHM_HEAD *head;
+  int writer;
+  char *name;                  /* unlinked by the writer's close */
+};
+
+static long shm_round( long n )
+{
+  return (n + SHM_PAGE - 1)/SHM_PAGE*SHM_PAGE;
+}
+
+static struct SI_SHM_FRAME *shm_slot( struct SI_SHM *s, unsigned long seq )
+{
+  return (struct SI_SHM_FRAME *)(s->mem + SHM_PAGE +
+    (seq % s->head->nslots)*s->head->slot_bytes);
+}
+
+/* a ring of nslots frames of up to bytes each under name, "/si3097"
+   say, replacing any left by a writer that died.  NULL on failure
+*/
+
+struct SI_SHM *si_shm_create( char *name, int nslots, long bytes )
+{
+  struct SI_SHM *s;
+  struct SI_SHM_HEAD *h;
+  long slot;
+  int fd, err;
+
+  if( nslots < 2 || bytes < 1 ) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if( !(s = calloc( 1, sizeof(*s))) || !(s->name = strdup( name ))) {
+    free( s );
+    errno = ENOMEM;
+    return NULL;
+  }
+  slot = SHM_META + shm_round( bytes );  /* pixels on pages of their own */
+  s->size = SHM_PAGE + slot*nslots;
+  s->writer = 1;
+
+  shm_unlink( name );
+  if( (fd = shm_open( name, O_RDWR|O_CREAT|O_EXCL, 0644 )) < 0 )
+    goto fail;
+  if( ftruncate( fd, s->size ) < 0 ) {
+    err = errno;
+    close( fd );
+    shm_unlink( name );
+    errno = err;
+    goto fail;
+  }
+  s->mem = mmap( NULL, s->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+  err = errno;
+  close( fd );
+  if( s->mem == MAP_FAILED ) {
+    shm_unlink( name );
+    errno = err;
+    goto fail;
+  }
+
+  /* the rest is already zero, every slot empty */
+
+  h = s->head = (struct SI_SHM_HEAD *)s->mem;
+  h->version = SI_SHM_VERSION;
+  h->nslots = nslots;
+  h->slot_bytes = slot;
+  h->data_bytes = shm_round( bytes );
+  h->pid = getpid();
+  __atomic_store_n( &h->magic, SI_SHM_MAGIC, __ATOMIC_RELEASE );
+  return s;
+
+fail:
+  free( s->name );
+  free( s );
+  return NULL;
+}
+
+/* the pixels of the next frame, which readers are told not to use
+   until it is published
+*/
+
+unsigned short *si_shm_begin( struct SI_SHM *s )
+{
+  struct SI_SHM_FRAME *f;
+
+  f = shm_slot( s, s->head->seq + 1 );
+  __atomic_store_n( &f->seq, 0, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  return (unsigned short *)((char *)f + SHM_META);
+}
+
+/* the frame begun is done, with meta for what is known of it.  Its
+   number is returned, the first being 1
+*/
+
+unsigned long si_shm_publish( struct SI_SHM *s, struct SI_SHM_FRAME *meta )
+{
+  struct SI_SHM_HEAD *h;
+  struct SI_SHM_FRAME *f;
+  unsigned long seq;
+
+  h = s->head;
+  seq = h->seq + 1;
+  f = shm_slot( s, seq );
+  memcpy( (char *)f + sizeof(f->seq), (char *)meta + sizeof(meta->seq),
+          sizeof(*f) - sizeof(f->seq));
+  f->offset = (char *)f + SHM_META - s->mem;
+  __atomic_store_n( &f->seq, seq, __ATOMIC_RELEASE );
+  __atomic_store_n( &h->seq, seq, __ATOMIC_RELEASE );
+
+  __atomic_add_fetch( &h->wake, 1, __ATOMIC_RELEASE );
+  syscall( SYS_futex, &h->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+  return seq;
+}
+
+/* the ring the writer made under name.  NULL on failure, with ENOENT
+   if there is none and EPROTO if it is not one this code reads
+*/
+
+struct SI_SHM *si_shm_attach( char *name )
+{
+  struct SI_SHM *s;
+  struct stat st;
+  int fd, err;
+
+  if( !(s = calloc( 1, sizeof(*s))))
+    return NULL;
+  errno = 0;
+  if( (fd = shm_open( name, O_RDONLY, 0 )) < 0 ) {
+    free( s );
+    return NULL;
+  }
+  if( fstat( fd, &st ) < 0 || st.st_size < SHM_PAGE ) {
+    err = errno;
+    if( err == 0 || st.st_size < SHM_PAGE )
+      err = EPROTO;
+    close( fd );
+    free( s );
+    errno = err;
+    return NULL;
+  }
+  s->size = st.st_size;
+  s->mem = mmap( NULL, s->size, PROT_READ, MAP_SHARED, fd, 0 );
+  err = errno;
+  close( fd );
+  if( s->mem == MAP_FAILED ) {
+    free( s );
+    errno = err;
+    return NULL;
+  }
+  s->head = (struct SI_SHM_HEAD *)s->mem;
+  if( __atomic_load_n( &s->head->magic, __ATOMIC_ACQUIRE ) != SI_SHM_MAGIC ||
+      s->head->version != SI_SHM_VERSION ||
+      SHM_PAGE + s->head->slot_bytes*s->head->nslots > s->size ) {
+    munmap( s->mem, s->size );
+    free( s );
+    errno = EPROTO;
+    return NULL;
+  }
+  return s;
+}
+
+/* the newest frame published, 0 if none yet */
+
+unsigned long si_shm_latest( struct SI_SHM *s )
+{
+  return __atomic_load_n( &s->head->seq, __ATOMIC_ACQUIRE );
+}
+
+/* the newest frame once there is one after seq, or 0 if ms
+   milliseconds go by first, -1 for ever
+*/
+
+unsigned long si_shm_wait( struct SI_SHM *s, unsigned long seq, int ms )
+{
+  struct SI_SHM_HEAD *h;
+  struct timespec ts, *tp;
+  unsigned long now;
+  unsigned int wake;
+  double end, left;
+
+  h = s->head;
+  tp = NULL;
+  end = 0.0;
+  if( ms >= 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    end = ts.tv_sec + ts.tv_nsec*1e-9 + ms*1e-3;
+  }
+
+  for(;;) {
+    wake = __atomic_load_n( &h->wake, __ATOMIC_ACQUIRE );
+    if( (now = si_shm_latest( s )) > seq )
+      return now;
+    if( ms >= 0 ) {
+      clock_gettime( CLOCK_MONOTONIC, &ts );
+      if( (left = end - (ts.tv_sec + ts.tv_nsec*1e-9)) <= 0.0 )
+        return 0;
+      ts.tv_sec = left;
+      ts.tv_nsec = (left - ts.tv_sec)*1e9;
+      tp = &ts;
+    }
+    syscall( SYS_futex, &h->wake, FUTEX_WAIT, wake, tp, NULL, 0 );
+  }
+}
+
+/* the header of frame seq into meta and where its pixels are into
+   *data, still in the ring.  0, or -1 with ENOENT if it is not done
+   yet or ESTALE if it has already been written over
+*/
+
+int si_shm_get( struct SI_SHM *s, unsigned long seq, struct SI_SHM_FRAME *meta,
+                unsigned short **data )
+{
+  struct SI_SHM_FRAME *f;
+
+  if( seq == 0 || seq > si_shm_latest( s )) {
+    errno = ENOENT;
+    return -1;
+  }
+  f = shm_slot( s, seq );
+  if( __atomic_load_n( &f->seq, __ATOMIC_ACQUIRE ) != seq ) {
+    errno = ESTALE;
+    return -1;
+  }
+  memcpy( meta, f, sizeof(*meta));
+  meta->seq = seq;
+  if( si_shm_check( s, meta ) < 0 )
+    return -1;  /* written over as it was copied */
+  if( meta->offset != (char *)f + SHM_META - s->mem || meta->n_cols < 0 ||
+      meta->n_rows < 0 || (long)meta->n_cols*meta->n_rows*sizeof(short) >
+      s->head->data_bytes ) {
+    errno = EPROTO;
+    return -1;
+  }
+  *data = (unsigned short *)(s->mem + meta->offset);
+  return 0;
+}
+
+/* 0 if the frame meta came from is still in the ring, so whatever was
+   read from it is good, else -1 with ESTALE
+*/
+
+int si_shm_check( struct SI_SHM *s, struct SI_SHM_FRAME *meta )
+{
+  __atomic_thread_fence( __ATOMIC_ACQUIRE );
+  if( __atomic_load_n( &shm_slot( s, meta->seq )->seq, __ATOMIC_RELAXED ) !=
+      meta->seq ) {
+    errno = ESTALE;
+    return -1;
+  }
+  return 0;
+}
+
+/* unmap, and for the writer remove the name so no new reader finds a
+   ring no one is writing.  Readers already attached keep theirs
+*/
+
+void si_shm_close( struct SI_SHM *s )
+{
+  if( !s )
+    return;
+  munmap( s->mem, s->size );
+  if( s->writer )
+    shm_unlink( s->name );
+  free( s->name );
+  free( s );
+}
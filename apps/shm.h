@@ -0,0 +1,10 @@
+struct SI_SHM *si_shm_create( char *name, int nslots, long bytes );
+unsigned short *si_shm_begin( struct SI_SHM *s );
+unsigned long si_shm_publish( struct SI_SHM *s, struct SI_SHM_FRAME *meta );
+struct SI_SHM *si_shm_attach( char *name );
+unsigned long si_shm_latest( struct SI_SHM *s );
+unsigned long si_shm_wait( struct SI_SHM *s, unsigned long seq, int ms );
+int si_shm_get( struct SI_SHM *s, unsigned long seq, struct SI_SHM_FRAME *meta,
+                unsigned short **data );
+int si_shm_check( struct SI_SHM *s, struct SI_SHM_FRAME *meta );
+void si_shm_close( struct SI_SHM *s );
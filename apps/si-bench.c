@@ -0,0 +1,2824 @@
+/*
+
+Acquisition benchmark for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "demux.h"
+#include "dinter.h"
+#include "pool.h"
+#include "look.h"
+#include "calib.h"
+#include "scale.h"
+#include "fits.h"
+#include "writer.h"
+#include "rice.h"
+#include "frames.h"
+#include "ring.h"
+#include "shm.h"
+#include "handoff.h"
+#include "load.h"
+#include "lib.h"
+#include "camera.h"
+
+/*
+  time the acquisition path end to end and print the results as
+  JSON on stdout, so runs against different drivers and library
+  versions can be compared.  Any camera spec works, synth:ramp
+  needs no hardware.
+
+  mmap     first and second touch of every page of a fresh mapping
+  uart     round trip of the status command
+  dma      sustained throughput, one wakeup per frame
+  wakeup   time between DMA_NEXT wakeups, one wakeup per buffer
+  first    DMA_START to first buffer, includes sending the image command
+  stream   last buffer to finished demux, each buffer demuxed as it
+           lands against the whole frame once the dma is done
+  kernels  MB/s of si_deinterlace and si_camera_demux_gen per geometry,
+           against si_deinterlace_ref and on all threads as well
+  look     demux, min, max and histogram, and rgb display one pass
+           after another, against si_look_execute() doing them together
+  pyramid  MB/s of si_look_pyramid(), mean and max
+  scale    MB/s of the si_scale_hist() histogram, and the levels and
+           table made from it for each stretch
+  fits     MB/s of the FITS byte order conversion, and of whole
+           si_fits_save() files in $TMPDIR, cache and disk included
+  rice     MB/s of si_fits_rice_image() on a frame of sky noise, and
+           how much smaller it comes out
+  load     a sky frame saved raw, as FITS and tile compressed, read
+           whole as si-image once did, against si_load_preview() of
+           every 8th row and si_load_rows() of the lot, files cached
+  frames   a frame buffer written through, malloc()ed and freed each
+           time against taken from and given back to si_frames_new()
+  stages   a frame handed to a new thread and joined, as si-image once
+           did, against one kept waiting on an si_ring_new() ring, and
+           how many a second go through a ring, checked for order
+  shm      frames published to an si_shm_create() ring as fast as they
+           can be written, with another process reading the newest
+           each time; how long it waited, how many it missed and that
+           none it kept had been written over
+  handoff  frames filled and passed to another process as sealed
+           memfds by si_handoff_publish(), and the same frames
+           written down a pipe, the copy the memfd saves
+  writer   frames handed to si_writer_queue() as fast as it takes
+           them, through the page cache and O_DIRECT, with how often
+           and how long it had to wait for the disk
+  fill     rgb display of a whole image down the columns, as si-image
+           did, along the rows, and along the rows through a table
+*/
+
+#define BENCH_VERSION 1
+#define BENCH_MAXGEOM 16
+#define BENCH_MINTIME 0.25 /* seconds each kernel runs for */
+#define BENCH_MINREP 3
+
+struct STATS {
+  int n;
+  int max;
+  double *v;
+};
+
+struct GEOM {
+  int serlen;
+  int parlen;
+};
+
+/* how a case went, bench_run() times each pass */
+
+struct BENCH {
+  int passes;
+  double time;          /* seconds for all of them */
+  double busy;          /* in the case, summed over the passes */
+  double best;          /* the fastest pass */
+};
+
+/* what a case of bench_kernels() runs on: kernel k of its section
+   on geometry g, and whatever else that section needs
+*/
+
+struct CASE {
+  int k;
+  int size;             /* side of the demuxed image */
+  long len;             /* what one pass reads */
+  struct GEOM *g;
+  unsigned short *in, *out;
+  unsigned short *raw, *trim; /* calib's frame with and without overscan */
+  unsigned char *pix, *lut;
+  struct SI_DINTERLACE *cfg;
+  struct SI_DINTER_PLAN *plan;
+  struct SI_DINTER_STATS *ds;
+  struct SI_CALIB *cal;
+  long total;           /* calib's input pixels */
+  struct SI_LOOK *look;
+  struct SI_PYRAMID *py;
+  struct SI_SCALE *sc;
+  struct SI_FRAMES *fp;
+  struct SI_WRITER *w;
+  char *fname;
+  char *file;           /* rice's output */
+  long bound, flen;
+};
+
+void bench_mmap( struct SI_CAMERA *c );
+void bench_uart( struct SI_CAMERA *c, int count );
+void bench_dma( struct SI_CAMERA *c, int frames );
+void bench_wakeup( struct SI_CAMERA *c, int frames );
+void bench_stream( struct SI_CAMERA *c, int frames );
+void bench_kernels( struct GEOM *g, int ngeom );
+void bench_run( struct BENCH *b, int minrep, void (*fn)( void *, int ),
+                void *arg );
+void bench_print( int *first, struct BENCH *b, double bytes,
+                  const char *fmt, ... );
+int verify_kernels( struct GEOM *g, int ngeom );
+int verify_look( struct GEOM *g, unsigned short *in, unsigned short *out,
+                 unsigned short *ref );
+int verify_pyramid( struct GEOM *g, unsigned short *in, int mode );
+int verify_scale( struct GEOM *g, unsigned short *in );
+int verify_fits( struct GEOM *g, unsigned short *in );
+int verify_rice( struct GEOM *g, unsigned short *in );
+int verify_load( struct GEOM *g, unsigned short *in );
+int verify_stats( struct GEOM *g, unsigned short *in, unsigned short *out );
+int verify_calib( struct GEOM *g );
+int verify_camera( struct GEOM *g );
+int verify_overlap( struct GEOM *g, unsigned short *in, unsigned short *out,
+                    unsigned short *ref );
+long calib_frame( struct GEOM *g, unsigned short *raw, unsigned short *trim );
+void load_file( int type, char *fname, unsigned short *data, int n_cols,
+                int n_rows );
+void sky_frame( unsigned short *p, long n );
+int fits_tmpfile( char *buf, int len );
+int verify_print( int first, char *kernel, int k, int a, int b,
+                  unsigned short *out, unsigned short *ref, int len );
+void dinter_kernel( int k, struct SI_DINTERLACE *cfg, unsigned short *in,
+                    unsigned short *out, int len );
+void demux_kernel( int k, unsigned short *out, unsigned short *in,
+                   int size, struct GEOM *g );
+void dinter_fit( int type, struct GEOM *g, int *cols, int *rows );
+void look_kernel( int k, struct SI_LOOK *l, unsigned short *out,
+                  unsigned short *in, int size, struct GEOM *g,
+                  unsigned char *pix, long chunk );
+void fill_kernel( int k, unsigned char *pix, unsigned short *data,
+                  int side, unsigned char *lut );
+void bench_stages( void );
+void bench_shm( int size );
+void bench_handoff( int size );
+void *stage_kernel( void *v );
+int demux_size( struct GEOM *g );
+int parse_geom( struct GEOM *g, char *s );
+void stats_add( struct STATS *s, double v );
+void stats_print( char *name, struct STATS *s, double scale );
+void stats_free( struct STATS *s );
+char *xstrdup (const char *s);
+void usage ( void );
+void die ( const char *fmt, ... );
+
+const char *default_device = "/dev/sicamera0";
+const char *default_setfile = NULL;
+const char *default_cfgfile = "Test.cfg";
+
+/* the two cameras si_camera_demux_gen was written for */
+
+static struct GEOM default_geom[] = {
+  { 1023, 1023 },
+  { 2047, 2046 },
+};
+
+#define OPTIONS "f:c:s:n:u:g:b:kd:t:v"
+static const struct option longopts[] = {
+  {"file",       required_argument,   0, 'f'},
+  {"cfgfile",    required_argument,   0, 'c'},
+  {"setfile",    required_argument,   0, 's'},
+  {"frames",     required_argument,   0, 'n'},
+  {"uart",       required_argument,   0, 'u'},
+  {"geometry",   required_argument,   0, 'g'},
+  {"buflen",     required_argument,   0, 'b'},
+  {"kernels",    no_argument,         0, 'k'},
+  {"dinter",     required_argument,   0, 'd'},
+  {"threads",    required_argument,   0, 't'},
+  {"verify",     no_argument,         0, 'v'},
+  {0, 0, 0, 0},
+};
+
+static int buflen = 0;
+volatile unsigned short bench_sink; /* so a buffer's writes are kept */
+static int layout_type = -1;  /* from the cfg file */
+
+int main(int argc, char *argv[] )
+{
+  struct SI_CAMERA *c;
+  struct GEOM geom[BENCH_MAXGEOM];
+  struct SI_LAYOUT layout;
+  char *device = xstrdup (default_device);
+  char *cfgfile = xstrdup (default_cfgfile);
+  char *setfile = xstrdup (default_setfile);
+  int frames = 20;
+  int uart = 200;
+  int kernels_only = 0;
+  int verify = 0;
+  int ngeom = 0;
+  int ch, i;
+
+  if (!(c = calloc(1, sizeof(*c))))
+    die ("out of memory\n");
+
+  while ((ch = getopt_long (argc, argv, OPTIONS, longopts, NULL)) != -1) {
+    switch (ch) {
+      case 'f': /* --file DEVICE or a camera.c spec */
+        free (device);
+        device = xstrdup (optarg);
+        break;
+      case 'c': /* --cfgfile FILE */
+        free (cfgfile);
+        cfgfile = xstrdup (optarg);
+        break;
+      case 's': /* --setfile FILE */
+        free (setfile);
+        setfile = xstrdup (optarg);
+        break;
+      case 'n': /* --frames N */
+        if ((frames = atoi (optarg)) < 1)
+          usage ();
+        break;
+      case 'u': /* --uart N */
+        if ((uart = atoi (optarg)) < 1)
+          usage ();
+        break;
+      case 'g': /* --geometry SERLENxPARLEN */
+        if (ngeom == BENCH_MAXGEOM || parse_geom (&geom[ngeom], optarg) < 0)
+          usage ();
+        ngeom++;
+        break;
+      case 'b': /* --buflen BYTES */
+        if ((buflen = atoi (optarg)) < 0)
+          usage ();
+        break;
+      case 'k': /* --kernels */
+        kernels_only = 1;
+        break;
+      case 'd': /* --dinter IMPL */
+        if (si_deinterlace_select (optarg) < 0)
+          die ("deinterlace %s is not available\n", optarg);
+        break;
+      case 't': /* --threads N */
+        if ((i = atoi (optarg)) < 1)
+          usage ();
+        si_pool_init (i);
+        break;
+      case 'v': /* --verify */
+        verify = 1;
+        break;
+      case 'h':
+      default:
+        usage ();
+    }
+  }
+
+  if (ngeom == 0) {
+    for (i = 0; i < sizeof(default_geom)/sizeof(default_geom[0]); i++)
+      geom[ngeom++] = default_geom[i];
+  }
+
+  printf ("{\n");
+  printf ("  \"version\": %d,\n", BENCH_VERSION);
+  printf ("  \"time\": %ld,\n", (long)time (NULL));
+
+  /* a cfg file may describe a readout the builtin modes don't
+   */
+  if ((i = si_load_layout (&layout, cfgfile)) < 0 && errno != ENOENT)
+    die ("%s: %s\n", cfgfile, strerror (errno));
+  if (i > 0 && (layout_type = si_layout_register (&layout)) < 0)
+    die ("%s: %s\n", cfgfile, strerror (errno));
+
+  if (verify) {
+    i = verify_kernels (geom, ngeom);
+    printf ("}\n");
+    exit (i != 0);
+  }
+
+  if (!kernels_only) {
+    if (si_load_camera_cfg( c, cfgfile ) < 0)
+      die ("%s: %s\n", cfgfile, strerror (errno));
+    if (!setfile)
+      die ("Please indicate camera settings file with --setfile FILE\n");
+    if (si_setfile_readout( c, setfile ) < 0)
+      die ("%s: %s\n", setfile, strerror (errno));
+    if (si_camera_open( c, device ) < 0)
+      die ("%s: %s\n", device, strerror (errno));
+    if (si_camera_send_readout( c ) < 0)
+      die ("error sending readout params to camera: %s\n", strerror (errno));
+    if (si_camera_load_readout( c ) < 0)
+      die ("error receiving readout params from camera: %s\n",
+           strerror (errno));
+
+    printf ("  \"device\": \"%s\",\n", device);
+    printf ("  \"backend\": \"%s\",\n", c->backend->name);
+    printf ("  \"frame\": { \"serlen\": %d, \"parlen\": %d, \"bytes\": %d },\n",
+            c->readout[READOUT_SERLEN_IX], c->readout[READOUT_PARLEN_IX],
+            si_camera_frame_bytes( c ));
+
+    bench_mmap( c );
+    bench_uart( c, uart );
+    bench_dma( c, frames );
+    bench_wakeup( c, frames );
+    bench_stream( c, frames );
+
+    /* the camera's own geometry goes first */
+
+    for (i = 0; i < ngeom; i++)
+      if (geom[i].serlen == c->readout[READOUT_SERLEN_IX] &&
+          geom[i].parlen == c->readout[READOUT_PARLEN_IX])
+        break;
+    if (i == ngeom && ngeom < BENCH_MAXGEOM) {
+      memmove (&geom[1], &geom[0], ngeom*sizeof(geom[0]));
+      geom[0].serlen = c->readout[READOUT_SERLEN_IX];
+      geom[0].parlen = c->readout[READOUT_PARLEN_IX];
+      ngeom++;
+    }
+    si_camera_close( c );
+  }
+
+  bench_kernels( geom, ngeom );
+
+  printf ("}\n");
+
+  free (device);
+  free (cfgfile);
+  free (setfile);
+  free (c);
+  exit (0);
+}
+
+void die (const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    vfprintf (stderr, fmt, ap);
+    va_end (ap);
+    exit (1);
+}
+
+
+void usage ( void )
+{
+  fprintf (stderr,
+"Usage: si-bench OPTIONS\n"
+"    -f,--file=FILE      override default device file [%s]\n"
+"                        or replay:FILE[,RATE] or synth:PATTERN[,RATE]\n"
+"                        or emu:OPTIONS or tty:PATH\n"
+"    -c,--cfgfile=FILE   camera config names [%s]\n"
+"    -s,--setfile=FILE   camera settings file\n"
+"    -n,--frames=N       frames for the dma tests [20]\n"
+"    -u,--uart=N         uart round trips [200]\n"
+"    -b,--buflen=BYTES   dma buffer length [driver default]\n"
+"    -g,--geometry=SxP   serlen x parlen for the kernel tests, repeatable\n"
+"                        [1023x1023 and 2047x2046, after the camera's own]\n"
+"    -k,--kernels        only run the deinterlace and demux tests\n"
+"    -d,--dinter=IMPL    deinterlace with scalar, sse2 or avx2 [best]\n"
+"    -t,--threads=N      threads for the parallel kernels [one per cpu]\n"
+"    -v,--verify         check every deinterlace and demux against the\n"
+"                        original code on random data, exit 1 if any differ\n",
+           default_device, default_cfgfile);
+  exit (1);
+}
+
+char *xstrdup (const char *s)
+{
+  char *cpy = NULL;
+  if (s) {
+    if (!(cpy = strdup (s))) {
+      fprintf (stderr, "out of memory\n");
+      exit (1);
+    }
+  }
+  return cpy;
+}
+
+int parse_geom( struct GEOM *g, char *s )
+{
+  if( sscanf( s, "%dx%d", &g->serlen, &g->parlen ) != 2 ||
+      g->serlen < 1 || g->parlen < 1 )
+    return -1;
+  return 0;
+}
+
+void stats_add( struct STATS *s, double v )
+{
+  if( s->n == s->max ) {
+    s->max = s->max ? s->max*2 : 256;
+    if( !(s->v = realloc( s->v, s->max*sizeof(double))))
+      die("out of memory\n");
+  }
+  s->v[s->n++] = v;
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+  double x = *(double *)a, y = *(double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* print "name": {...} with the distribution of s, each value
+   multiplied by scale
+*/
+
+void stats_print( char *name, struct STATS *s, double scale )
+{
+  double sum;
+  int i;
+
+  printf("    \"%s\": { \"n\": %d", name, s->n );
+  if( s->n > 0 ) {
+    qsort( s->v, s->n, sizeof(double), cmp_double );
+    sum = 0.0;
+    for( i=0; i<s->n; i++ )
+      sum += s->v[i];
+    printf(", \"min\": %.3f, \"median\": %.3f, \"p90\": %.3f"
+           ", \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f",
+           s->v[0]*scale, s->v[s->n/2]*scale, s->v[(s->n*90)/100]*scale,
+           s->v[(s->n*99)/100]*scale, s->v[s->n-1]*scale,
+           sum/s->n*scale );
+  }
+  printf(" }");
+}
+
+void stats_free( struct STATS *s )
+{
+  free( s->v );
+  bzero( s, sizeof(*s));
+}
+
+/* fault in a fresh mapping one page at a time, then walk it again */
+
+void bench_mmap( struct SI_CAMERA *c )
+{
+  volatile unsigned short *p;
+  double t, config, first, second;
+  int total, step, npages, i;
+
+  total = si_camera_frame_bytes( c );
+  si_camera_dma_free( c );
+  t = si_camera_time();
+  if( si_camera_dma_config( c, total, buflen, 0, 0 ) < 0 )
+    die("dma config: %s\n", strerror(errno));
+  config = si_camera_time() - t;
+
+  step = getpagesize() / sizeof(short);
+  npages = (total/sizeof(short) + step - 1) / step;
+  p = c->ptr;
+
+  t = si_camera_time();
+  for( i=0; i<npages; i++ )
+    p[i*step];
+  first = si_camera_time() - t;
+
+  t = si_camera_time();
+  for( i=0; i<npages; i++ )
+    p[i*step];
+  second = si_camera_time() - t;
+
+  printf("  \"mmap\": { \"bytes\": %d, \"pages\": %d, \"config_us\": %.3f"
+         ", \"first_touch_ns_per_page\": %.1f"
+         ", \"second_touch_ns_per_page\": %.1f },\n",
+         total, npages, config*1.0e6, first*1.0e9/npages,
+         second*1.0e9/npages );
+}
+
+/* round trip of the status command */
+
+void bench_uart( struct SI_CAMERA *c, int count )
+{
+  struct STATS s;
+  double t;
+  int i, errors;
+
+  bzero( &s, sizeof(s));
+  errors = 0;
+  for( i=0; i<count; i++ ) {
+    t = si_camera_time();
+    if( si_camera_load_status( c ) < 0 ) {
+      errors++;
+      continue;
+    }
+    stats_add( &s, si_camera_time() - t );
+  }
+
+  printf("  \"uart\": {\n");
+  printf("    \"command\": \"I\",\n");
+  printf("    \"errors\": %d,\n", errors );
+  stats_print( "round_trip_us", &s, 1.0e6 );
+  printf("\n  },\n");
+  stats_free( &s );
+}
+
+/* back to back test images, one wakeup each */
+
+void bench_dma( struct SI_CAMERA *c, int frames )
+{
+  struct STATS s;
+  double t0, t;
+  int total, i, errors;
+  long long bytes;
+
+  total = si_camera_frame_bytes( c );
+  if( si_camera_dma_config( c, total, buflen, 0,
+                            SI_DMA_CONFIG_WAKEUP_ONEND ) < 0 )
+    die("dma config: %s\n", strerror(errno));
+
+  bzero( &s, sizeof(s));
+  bytes = 0;
+  errors = 0;
+  t0 = si_camera_time();
+  for( i=0; i<frames; i++ ) {
+    t = si_camera_time();
+    if( si_camera_acquire( c, 'C' ) < 0 ) {
+      errors++;
+      si_camera_abort( c );
+      continue;
+    }
+    stats_add( &s, si_camera_time() - t );
+    bytes += c->dma_status.transferred;
+  }
+  t0 = si_camera_time() - t0;
+
+  printf("  \"dma\": {\n");
+  printf("    \"frames\": %d,\n", frames );
+  printf("    \"errors\": %d,\n", errors );
+  printf("    \"bytes\": %lld,\n", bytes );
+  printf("    \"buflen\": %d,\n", c->dma_config.buflen );
+  printf("    \"seconds\": %.6f,\n", t0 );
+  printf("    \"mbps\": %.3f,\n", t0 > 0.0 ? bytes/t0*1.0e-6 : 0.0 );
+  stats_print( "frame_ms", &s, 1.0e3 );
+  printf("\n  },\n");
+  stats_free( &s );
+}
+
+/* one wakeup per buffer, time the gaps between them */
+
+void bench_wakeup( struct SI_CAMERA *c, int frames )
+{
+  struct SI_BUFFER b;
+  struct STATS first, gap;
+  double last;
+  int total, i, ret, errors;
+
+  total = si_camera_frame_bytes( c );
+  if( si_camera_dma_config( c, total, buflen, 0,
+                            SI_DMA_CONFIG_WAKEUP_EACH ) < 0 )
+    die("dma config: %s\n", strerror(errno));
+
+  bzero( &first, sizeof(first));
+  bzero( &gap, sizeof(gap));
+  errors = 0;
+  for( i=0; i<frames; i++ ) {
+    if( si_camera_start( c, 'C' ) < 0 ) {
+      errors++;
+      continue;
+    }
+    last = 0.0;
+    while( (ret = si_camera_next_buffer( c, &b )) > 0 ) {
+      if( last == 0.0 )
+        stats_add( &first, b.time - c->start_time );
+      else if( b.time != last )
+        stats_add( &gap, b.time - last );
+      last = b.time;
+    }
+    if( ret < 0 ) {
+      errors++;
+      si_camera_abort( c );
+    }
+  }
+
+  printf("  \"wakeup\": {\n");
+  printf("    \"frames\": %d,\n", frames );
+  printf("    \"errors\": %d,\n", errors );
+  printf("    \"buffers\": %d,\n", c->nbufs );
+  stats_print( "first_buffer_us", &first, 1.0e6 );
+  printf(",\n");
+  stats_print( "dma_next_us", &gap, 1.0e6 );
+  printf("\n  },\n");
+  stats_free( &first );
+  stats_free( &gap );
+}
+
+/* one wakeup per buffer, frames taken in turn demuxed at the end and
+   a buffer at a time with si_dinter_execute()
+*/
+
+void bench_stream( struct SI_CAMERA *c, int frames )
+{
+  struct SI_BUFFER b;
+  struct SI_DINTER_PLAN plan;
+  struct STATS batch, stream;
+  struct GEOM g;
+  unsigned short *out, *ref;
+  double last;
+  int total, size, npix, n, i, ret, errors, match;
+
+  g.serlen = c->readout[READOUT_SERLEN_IX];
+  g.parlen = c->readout[READOUT_PARLEN_IX];
+  size = demux_size( &g );
+  npix = 4*g.serlen*g.parlen;
+  si_camera_demux_plan( &plan, size, g.serlen, g.parlen );
+
+  total = si_camera_frame_bytes( c );
+  if( si_camera_dma_config( c, total, buflen, 0,
+                            SI_DMA_CONFIG_WAKEUP_EACH ) < 0 )
+    die("dma config: %s\n", strerror(errno));
+
+  if( !(out = calloc( size*size, sizeof(short))) ||
+      !(ref = calloc( size*size, sizeof(short))))
+    die("out of memory\n");
+
+  bzero( &batch, sizeof(batch));
+  bzero( &stream, sizeof(stream));
+  errors = 0;
+  match = 1;
+  for( i=0; i<2*frames; i++ ) {
+    if( si_camera_start( c, 'C' ) < 0 ) {
+      errors++;
+      continue;
+    }
+    last = 0.0;
+    while( (ret = si_camera_next_buffer( c, &b )) > 0 ) {
+      if( b.last )
+        last = si_camera_time();
+      if( i % 2 == 0 || b.offset/2 >= npix )
+        continue;
+      n = b.len/2;
+      if( n > npix - b.offset/2 )
+        n = npix - b.offset/2;
+      si_dinter_execute( &plan, b.data, out, b.offset/2, n );
+    }
+    if( ret < 0 || last == 0.0 ) {
+      errors++;
+      si_camera_abort( c );
+      continue;
+    }
+    if( i % 2 == 0 ) {
+      si_camera_demux_gen( ref, c->ptr, size, g.serlen, g.parlen );
+      stats_add( &batch, si_camera_time() - last );
+    } else {
+      stats_add( &stream, si_camera_time() - last );
+      si_camera_demux_ref( ref, c->ptr, size, g.serlen, g.parlen );
+      if( memcmp( out, ref, size*size*sizeof(short)) != 0 )
+        match = 0;
+    }
+  }
+
+  printf("  \"stream\": {\n");
+  printf("    \"frames\": %d,\n", frames );
+  printf("    \"errors\": %d,\n", errors );
+  printf("    \"size\": %d,\n", size );
+  printf("    \"match\": %s,\n", match ? "true" : "false" );
+  stats_print( "batch_ms", &batch, 1.0e3 );
+  printf(",\n");
+  stats_print( "stream_ms", &stream, 1.0e3 );
+  printf("\n  },\n");
+  stats_free( &batch );
+  stats_free( &stream );
+  free( out );
+  free( ref );
+}
+
+/* every implementation on random data against the reference routines.
+   returns the number that differ
+*/
+
+int verify_kernels( struct GEOM *g, int ngeom )
+{
+  static char *impls[] = { "scalar", "sse2", "avx2" };
+  struct SI_DINTERLACE cfg;
+  unsigned short *in, *out, *ref;
+  char *keep;
+  int i, k, m, n, type, size, len, maxlen, first, bad;
+
+  maxlen = 0;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    if( size*size > maxlen )
+      maxlen = size*size;
+  }
+
+  if( !(in = malloc( maxlen*sizeof(short))) ||
+      !(out = malloc( maxlen*sizeof(short))) ||
+      !(ref = malloc( maxlen*sizeof(short))))
+    die("out of memory\n");
+  srand( 1 );
+  for( k=0; k<maxlen; k++ )
+    in[k] = rand();
+
+  keep = si_deinterlace_impl();
+  bad = 0;
+  first = 1;
+  printf("  \"verify\": [");
+  for( m=0; m<sizeof(impls)/sizeof(impls[0]); m++ ) {
+    if( si_deinterlace_select( impls[m] ) < 0 )
+      continue;
+    for( i=0; i<ngeom; i++ ) {
+      size = demux_size( &g[i] );
+      len = size*size*sizeof(short);
+
+      bzero( ref, len );
+      si_camera_demux_ref( ref, in, size, g[i].serlen, g[i].parlen );
+      for( k=1; k<3; k++ ) {
+        bzero( out, len );
+        demux_kernel( k, out, in, size, &g[i] );
+        bad += verify_print( first, "demux", k, size, size, out, ref, len );
+        first = 0;
+      }
+      bad += verify_look( &g[i], in, out, ref );
+      bad += verify_pyramid( &g[i], in, SI_BIN_MEAN );
+      bad += verify_pyramid( &g[i], in, SI_BIN_MAX );
+      bad += verify_scale( &g[i], in );
+      bad += verify_fits( &g[i], in );
+      bad += verify_rice( &g[i], in );
+      bad += verify_load( &g[i], in );
+      bad += verify_stats( &g[i], in, out );
+      bad += verify_calib( &g[i] );
+      bad += verify_camera( &g[i] );
+      bad += verify_overlap( &g[i], in, out, ref );
+
+      for( type=0; type<=10; type++ ) {
+        cfg.interlace_type = type;
+        dinter_fit( type, &g[i], &cfg.n_cols, &cfg.n_rows );
+        n = cfg.n_cols*cfg.n_rows*sizeof(short);
+
+        bzero( ref, n );
+        si_deinterlace_ref( &cfg, in, ref, n );
+        for( k=1; k<3; k++ ) {
+          bzero( out, n );
+          dinter_kernel( k, &cfg, in, out, n );
+          bad += verify_print( first, "deinterlace", k, type, cfg.n_cols,
+                               out, ref, n );
+        }
+      }
+    }
+  }
+  printf("\n  ],\n");
+  printf("  \"failures\": %d\n", bad );
+
+  si_deinterlace_select( keep );
+  free( in );
+  free( out );
+  free( ref );
+  return bad;
+}
+
+/* si_look_execute() in uneven pieces against the demux and a plain
+   pass over the result.  Prints its entry, returns 1 if they differ
+*/
+
+int verify_look( struct GEOM *g, unsigned short *in, unsigned short *out,
+                 unsigned short *ref )
+{
+  struct SI_LOOK look;
+  struct SI_LOOK_STATS st;
+  unsigned char *pix, *rpix;
+  long i, n;
+  int size, bad;
+
+  size = demux_size( g );
+  n = (long)size*size;
+  if( !(pix = malloc( 3*n )) || !(rpix = malloc( 3*n )))
+    die("out of memory\n");
+
+  bzero( ref, n*sizeof(short));
+  si_camera_demux_ref( ref, in, size, g->serlen, g->parlen );
+  bzero( &st, sizeof(st));
+  st.min = 0xffff;
+  for( i=0; i<n; i++ ) {
+    if( ref[i] < st.min )
+      st.min = ref[i];
+    if( ref[i] > st.max )
+      st.max = ref[i];
+    st.hist[ref[i]>>8]++;
+    rpix[3*i] = rpix[3*i+1] = rpix[3*i+2] = ref[i]>>8;
+  }
+
+  bzero( &look, sizeof(look));
+  bzero( out, n*sizeof(short));
+  memset( pix, 0x55, 3*n );
+  look_kernel( 1, &look, out, in, size, g, pix, 12345 );
+  bad = memcmp( out, ref, n*sizeof(short)) != 0 ||
+        memcmp( pix, rpix, 3*n ) != 0 ||
+        memcmp( &look.stats, &st, sizeof(st)) != 0;
+  si_look_free( &look );
+
+  printf(",\n    { \"kernel\": \"look\", \"impl\": \"%s\", \"threads\": %d"
+         ", \"size\": %d, \"cols\": %d, \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), size, size,
+         bad ? "false" : "true" );
+  free( pix );
+  free( rpix );
+  return bad;
+}
+
+/* a layout of 15 amps, 5 across and 3 down, as a cfg file may give.
+   Vectors of 8 or 16 pixels come back to the first amp only every
+   15 of them, more than the builtin modes ever need
+*/
+
+static int odd_layout( void )
+{
+  struct SI_LAYOUT l;
+  int type;
+
+  bzero( &l, sizeof(l));
+  strcpy( l.name, "15 Amp" );
+  l.across = 5;
+  l.down = 3;
+  l.trim = 1;
+  if( si_layout_amps( &l, "TL" ) < 0 || (type = si_layout_register( &l )) < 0 )
+    die("15 amp layout: %s\n", strerror(errno));
+  return type;
+}
+
+/* si_dinter_execute_stats() in uneven pieces and on the worker pool
+   against counts made a pixel at a time, for every mode with a plan
+   and a layout of an odd number of amps.  Prints its entry, returns
+   1 if any differ
+*/
+
+#define VERIFY_SATURATION 60000
+
+int verify_stats( struct GEOM *g, unsigned short *in, unsigned short *out )
+{
+  struct SI_DINTERLACE cfg;
+  struct SI_DINTER_PLAN *p;
+  struct SI_DINTER_STATS ref, one, par;
+  struct SI_AMP_STATS *a;
+  unsigned short v;
+  long i, n, c;
+  int k, type, bad;
+
+  bad = 0;
+  for( k=0; k<=11; k++ ) {
+    type = k < 11 ? k : odd_layout();
+    cfg.interlace_type = type;
+    dinter_fit( type, g, &cfg.n_cols, &cfg.n_rows );
+    if( !(p = si_dinter_plan( &cfg )))
+      continue;
+    n = (long)cfg.n_cols*cfg.n_rows;
+
+    si_dinter_stats_start( &ref, p->nlanes, VERIFY_SATURATION );
+    for( i=0; i<n; i++ ) {
+      a = &ref.amp[i % p->nlanes];
+      v = in[i];
+      a->n++;
+      if( v < a->min )
+        a->min = v;
+      if( v > a->max )
+        a->max = v;
+      a->saturated += v >= VERIFY_SATURATION;
+      a->sum += v;
+      a->sumsq += (unsigned long long)v*v;
+      for( c=0; c<SI_STATS_BINS-1 && v >= (2 << c); c++ )
+        ;
+      a->hist[c]++;
+    }
+    si_dinter_stats_end( &ref );
+
+    si_dinter_stats_start( &one, p->nlanes, VERIFY_SATURATION );
+    for( i=0; i<n; i+=c ) {
+      c = n - i < 12345 ? n - i : 12345;
+      si_dinter_execute_stats( p, in + i, out, i, c, &one );
+    }
+    si_dinter_stats_end( &one );
+
+    si_dinter_stats_start( &par, p->nlanes, VERIFY_SATURATION );
+    si_dinter_execute_par_stats( p, in, out, 0, n, &par );
+    si_dinter_stats_end( &par );
+
+    bad |= memcmp( &one, &ref, sizeof(ref)) != 0 ||
+           memcmp( &par, &ref, sizeof(ref)) != 0;
+  }
+
+  printf(",\n    { \"kernel\": \"stats\", \"impl\": \"%s\", \"threads\": %d"
+         ", \"size\": %d, \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), demux_size( g ),
+         bad ? "false" : "true" );
+  return bad;
+}
+
+/* si_look_pyramid() on the demux sized image in against 2x2 bins
+   done a pixel at a time.  Prints its entry, returns 1 if they differ
+*/
+
+int verify_pyramid( struct GEOM *g, unsigned short *in, int mode )
+{
+  struct SI_PYRAMID py;
+  unsigned short *up, *ref, *p;
+  unsigned int v[4], a, b;
+  int size, i, x, y, n, bad;
+
+  size = demux_size( g );
+  bzero( &py, sizeof(py));
+  if( si_look_pyramid( &py, in, size, size, mode ) < 0 ||
+      !(ref = malloc( (size/2)*(size/2)*sizeof(short))))
+    die("out of memory\n");
+
+  bad = 0;
+  up = in;
+  n = size;
+  for( i=1; i<SI_PYRAMID_LEVELS; i++ ) {
+    for( y=0; y<n/2; y++ ) {
+      for( x=0; x<n/2; x++ ) {
+        p = up + 2*y*n + 2*x;
+        v[0] = p[0];
+        v[1] = p[1];
+        v[2] = p[n];
+        v[3] = p[n+1];
+        if( mode == SI_BIN_MAX ) {
+          a = v[0] > v[2] ? v[0] : v[2];
+          b = v[1] > v[3] ? v[1] : v[3];
+          ref[y*(n/2) + x] = a > b ? a : b;
+        } else {
+          a = (v[0] + v[2] + 1)/2;
+          b = (v[1] + v[3] + 1)/2;
+          ref[y*(n/2) + x] = (a + b + 1)/2;
+        }
+      }
+    }
+    n /= 2;
+    if( py.n_cols[i] != n || py.n_rows[i] != n ||
+        memcmp( py.level[i], ref, n*n*sizeof(short)) != 0 )
+      bad = 1;
+    up = py.level[i];  /* the next from this one, already checked */
+  }
+
+  printf(",\n    { \"kernel\": \"pyramid\", \"impl\": \"%s\""
+         ", \"threads\": %d, \"mode\": \"%s\", \"size\": %d"
+         ", \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(),
+         mode == SI_BIN_MAX ? "max" : "mean", size, bad ? "false" : "true" );
+  si_look_pyramid_free( &py );
+  free( ref );
+  return bad;
+}
+
+static int cmp_ushort( const void *a, const void *b )
+{
+  return *(unsigned short *)a - *(unsigned short *)b;
+}
+
+/* the overscan verify_calib() and the benchmark give each frame */
+
+#define CALIB_SERPOST 32
+#define CALIB_PARPOST 3
+
+/* a frame of g as the camera reads it with overscan into raw, the
+   image random and each amp's bias wandering from line to line, with
+   noise and the odd hot pixel in the overscan.  The image part alone
+   goes to trim, as a camera without overscan would have read it.
+   Returns the pixels in raw
+*/
+
+long calib_frame( struct GEOM *g, unsigned short *raw, unsigned short *trim )
+{
+  long r, j, row, line;
+  int k, bias[4];
+
+  row = 4L*g->serlen;
+  line = 4L*(g->serlen + CALIB_SERPOST);
+  for( r=0; r<g->parlen + CALIB_PARPOST; r++ ) {
+    for( k=0; k<4; k++ )
+      bias[k] = 1000 + 100*k + (r*7 + k*5) % 23;
+    for( j=0; j<row; j++ )
+      raw[r*line + j] = rand();
+    for( ; j<line; j++ ) {
+      raw[r*line + j] = bias[j % 4] + rand() % 9 - 4;
+      if( rand() % 50 == 0 )
+        raw[r*line + j] = 60000;
+    }
+    if( r < g->parlen )
+      memcpy( trim + r*row, raw + r*line, row*sizeof(short));
+  }
+  return line*(g->parlen + CALIB_PARPOST);
+}
+
+/* the bias of n overscan pixels stride apart as calib.c takes it,
+   sorting rather than selecting
+*/
+
+static int calib_ref_level( unsigned short *src, int stride, int n )
+{
+  unsigned short v[CALIB_SERPOST], d[CALIB_SERPOST];
+  unsigned long sum;
+  int i, m, mad, lim, cnt;
+
+  for( i=0; i<n; i++ )
+    v[i] = src[i*stride];
+  qsort( v, n, sizeof(short), cmp_ushort );
+  m = v[(n - 1)/2];
+  for( i=0; i<n; i++ )
+    d[i] = v[i] > m ? v[i] - m : m - v[i];
+  qsort( d, n, sizeof(short), cmp_ushort );
+  mad = d[(n - 1)/2];
+  lim = mad ? 4*mad : 1;
+
+  sum = 0;
+  cnt = 0;
+  for( i=0; i<n; i++ ) {
+    if( (v[i] > m ? v[i] - m : m - v[i]) <= lim ) {
+      sum += v[i];
+      cnt++;
+    }
+  }
+  return (2*sum + cnt)/(2*cnt);
+}
+
+/* si_calib_execute() in uneven pieces and on the worker pool against
+   the trimmed frame with each line's bias taken off a pixel at a time
+   and then demuxed by the original, raw, and leaving the bias on.
+   The counts must be those of the trimmed frame.  Prints its entry,
+   returns 1 if any differ
+*/
+
+int verify_calib( struct GEOM *g )
+{
+  static const int pedestal[3] = { -1, SI_CALIB_PEDESTAL, 3000 };
+  struct SI_DINTER_PLAN p;
+  struct SI_DINTER_STATS rs, one, par;
+  struct SI_CALIB cal;
+  unsigned short *raw, *trim, *clean, *out, *ref;
+  double mean[4];
+  long i, c, r, j, n, total, row, line;
+  int m, k, v, b[4], size, bad;
+
+  size = demux_size( g );
+  n = 4L*g->serlen*g->parlen;
+  row = 4L*g->serlen;
+  line = 4L*(g->serlen + CALIB_SERPOST);
+  if( !(raw = malloc( line*(g->parlen + CALIB_PARPOST)*sizeof(short))) ||
+      !(trim = malloc( n*sizeof(short))) ||
+      !(clean = malloc( n*sizeof(short))) ||
+      !(out = malloc( (long)size*size*sizeof(short))) ||
+      !(ref = malloc( (long)size*size*sizeof(short))))
+    die("out of memory\n");
+  total = calib_frame( g, raw, trim );
+
+  si_camera_demux_plan( &p, size, g->serlen, g->parlen );
+  si_dinter_stats_start( &rs, p.nlanes, VERIFY_SATURATION );
+  si_dinter_execute_stats( &p, trim, out, 0, n, &rs );
+  si_dinter_stats_end( &rs );
+
+  bzero( &cal, sizeof(cal));
+  bad = 0;
+  for( m=0; m<3; m++ ) {
+    cal.subtract = pedestal[m] >= 0;
+    cal.pedestal = pedestal[m];
+
+    bzero( mean, sizeof(mean));
+    for( r=0; r<g->parlen; r++ ) {
+      for( k=0; k<4; k++ ) {
+        b[k] = 0;
+        if( cal.subtract ) {
+          b[k] = calib_ref_level( raw + r*line + row + k, 4, CALIB_SERPOST );
+          mean[k] += b[k];
+        }
+      }
+      for( j=0; j<row; j++ ) {
+        v = trim[r*row + j];
+        if( cal.subtract ) {
+          v += cal.pedestal - b[j % 4];
+          v = v < 0 ? 0 : v > 65535 ? 65535 : v;
+        }
+        clean[r*row + j] = v;
+      }
+    }
+    for( k=0; k<4 && cal.subtract; k++ )
+      mean[k] /= g->parlen;
+    bzero( ref, (long)size*size*sizeof(short));
+    si_camera_demux_ref( ref, clean, size, g->serlen, g->parlen );
+
+    if( si_calib_start( &cal, &p, g->parlen, CALIB_SERPOST,
+                        CALIB_PARPOST ) < 0 ||
+        si_calib_total( &cal ) != total )
+      die("calib: %s\n", strerror(errno));
+    bzero( out, (long)size*size*sizeof(short));
+    si_dinter_stats_start( &one, p.nlanes, VERIFY_SATURATION );
+    for( i=0; i<total; i+=c ) {
+      c = total - i < 12345 ? total - i : 12345;
+      si_calib_execute( &cal, raw + i, out, i, c, &one );
+    }
+    si_dinter_stats_end( &one );
+    si_calib_end( &cal );
+    bad |= memcmp( out, ref, (long)size*size*sizeof(short)) != 0 ||
+           memcmp( &one, &rs, sizeof(rs)) != 0 ||
+           memcmp( cal.mean, mean, sizeof(mean)) != 0;
+
+    si_calib_start( &cal, &p, g->parlen, CALIB_SERPOST, CALIB_PARPOST );
+    bzero( out, (long)size*size*sizeof(short));
+    si_dinter_stats_start( &par, p.nlanes, VERIFY_SATURATION );
+    si_calib_execute( &cal, raw, out, 0, total, &par );
+    si_dinter_stats_end( &par );
+    bad |= memcmp( out, ref, (long)size*size*sizeof(short)) != 0 ||
+           memcmp( &par, &rs, sizeof(rs)) != 0;
+  }
+
+  printf(",\n    { \"kernel\": \"calib\", \"impl\": \"%s\", \"threads\": %d"
+         ", \"size\": %d, \"serpost\": %d, \"parpost\": %d"
+         ", \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), size, CALIB_SERPOST,
+         CALIB_PARPOST, bad ? "false" : "true" );
+  si_calib_free( &cal );
+  free( raw );
+  free( trim );
+  free( clean );
+  free( out );
+  free( ref );
+  return bad;
+}
+
+/* si_calib_camera(), which si-test saves its images with, on a
+   camera whose readout has overscan and on one without, against the
+   original demux of the image part alone.  The dma must be as long as
+   the frame it is given.  Prints its entry, returns 1 if any differ
+*/
+
+int verify_camera( struct GEOM *g )
+{
+  struct SI_CAMERA *c;
+  struct SI_DINTER_PLAN p;
+  unsigned short *raw, *trim, *out, *ref;
+  long total, n;
+  int m, size, n_cols, n_rows, bad;
+
+  size = demux_size( g );
+  n = (long)size*size;
+  if( !(c = calloc( 1, sizeof(*c))) ||
+      !(raw = malloc( 4L*(g->serlen + CALIB_SERPOST)*
+                      (g->parlen + CALIB_PARPOST)*sizeof(short))) ||
+      !(trim = malloc( 4L*g->serlen*g->parlen*sizeof(short))) ||
+      !(out = malloc( n*sizeof(short))) ||
+      !(ref = calloc( n, sizeof(short))))
+    die("out of memory\n");
+  total = calib_frame( g, raw, trim );
+  si_camera_demux_ref( ref, trim, size, g->serlen, g->parlen );
+
+  c->readout[READOUT_SERLEN_IX] = g->serlen;
+  c->readout[READOUT_PARLEN_IX] = g->parlen;
+  bad = 0;
+  for( m=0; m<2; m++ ) {
+    c->readout[READOUT_SERPOST_IX] = m ? CALIB_SERPOST : 0;
+    c->readout[READOUT_PARPOST_IX] = m ? CALIB_PARPOST : 0;
+    if( si_camera_plan( c, &p, &n_cols, &n_rows ) < 0 )
+      die("camera plan: %s\n", strerror(errno));
+    bad |= n_cols != size || n_rows != size ||
+           si_camera_frame_bytes( c ) !=
+             (m ? total : 4L*g->serlen*g->parlen)*(long)sizeof(short);
+    bzero( out, n*sizeof(short));
+    if( si_calib_camera( c, &p, m ? raw : trim, out ) < 0 )
+      die("calib: %s\n", strerror(errno));
+    bad |= memcmp( out, ref, n*sizeof(short)) != 0;
+  }
+
+  printf(",\n    { \"kernel\": \"camera\", \"impl\": \"%s\", \"threads\": %d"
+         ", \"size\": %d, \"serpost\": %d, \"parpost\": %d"
+         ", \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), size, CALIB_SERPOST,
+         CALIB_PARPOST, bad ? "false" : "true" );
+  free( c );
+  free( raw );
+  free( trim );
+  free( out );
+  free( ref );
+  return bad;
+}
+
+/* si_scale_hist() against a plain count, the linear levels against
+   the sorted image, and the display through the table against a
+   lookup a pixel.  Prints its entry, returns 1 if any differ
+*/
+
+int verify_scale( struct GEOM *g, unsigned short *in )
+{
+  struct SI_SCALE sc;
+  unsigned int *hist;
+  unsigned short *sorted;
+  unsigned char *pix, *rpix;
+  long i, n;
+  int size, bad;
+
+  size = demux_size( g );
+  n = (long)size*size;
+  if( !(hist = calloc( SI_SCALE_BINS, sizeof(int))) ||
+      !(sorted = malloc( n*sizeof(short))) ||
+      !(pix = malloc( 3*size )) || !(rpix = malloc( 3*size )))
+    die("out of memory\n");
+
+  bzero( &sc, sizeof(sc));
+  sc.mode = SI_SCALE_LINEAR;
+  sc.clip = 0.25;
+  if( si_scale_image( &sc, in, n ) < 0 )
+    die("out of memory\n");
+
+  for( i=0; i<n; i++ )
+    hist[in[i]]++;
+  memcpy( sorted, in, n*sizeof(short));
+  qsort( sorted, n, sizeof(short), cmp_ushort );
+  bad = memcmp( hist, sc.hist, SI_SCALE_BINS*sizeof(int)) != 0 ||
+        sc.lo != sorted[(long)(sc.clip/100.0*(n - 1))] ||
+        sc.hi != sorted[(long)((1.0 - sc.clip/100.0)*(n - 1))] ||
+        sc.lut[sc.lo] != 0 || sc.lut[sc.hi] != 255;
+  for( i=1; i<SI_SCALE_BINS; i++ )
+    if( sc.lut[i] < sc.lut[i-1] )
+      bad = 1;
+
+  for( i=0; i<size; i++ )
+    rpix[3*i] = rpix[3*i+1] = rpix[3*i+2] = sc.lut[in[i]];
+  memset( pix, 0x55, 3*size );
+  si_look_rgb( pix, in, size, 3, sc.lut );
+  if( memcmp( pix, rpix, 3*size ) != 0 )
+    bad = 1;
+
+  printf(",\n    { \"kernel\": \"scale\", \"impl\": \"%s\""
+         ", \"threads\": %d, \"size\": %d, \"lo\": %d, \"hi\": %d"
+         ", \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), size, sc.lo, sc.hi,
+         bad ? "false" : "true" );
+  si_scale_free( &sc );
+  free( hist );
+  free( sorted );
+  free( pix );
+  free( rpix );
+  return bad;
+}
+
+/* a name for a FITS file in $TMPDIR, returns its fd */
+
+int fits_tmpfile( char *buf, int len )
+{
+  char *dir;
+  int fd;
+
+  if( !(dir = getenv( "TMPDIR" )))
+    dir = "/tmp";
+  snprintf( buf, len, "%s/si-bench-XXXXXX", dir );
+  if( (fd = mkstemp( buf )) < 0 )
+    die("%s: %s\n", buf, strerror(errno));
+  return fd;
+}
+
+/* si_fits_save() of the demux sized image in, read back and undone
+   a pixel at a time.  Prints its entry, returns 1 if they differ
+*/
+
+int verify_fits( struct GEOM *g, unsigned short *in )
+{
+  char fname[256];
+  struct SI_WRITER *w;
+  unsigned char *file, *copy, *p;
+  long i, n, len, hdr;
+  int fd, size, bad;
+
+  size = demux_size( g );
+  n = (long)size*size;
+  fd = fits_tmpfile( fname, sizeof(fname));
+  if( si_fits_save( NULL, NULL, fname, in, size, size ) < 0 )
+    die("%s: %s\n", fname, strerror(errno));
+
+  /* one block of header holds the cards without a camera */
+
+  hdr = SI_FITS_BLOCK;
+  len = ((hdr + 2*n + SI_FITS_BLOCK - 1)/SI_FITS_BLOCK)*SI_FITS_BLOCK;
+  if( !(file = malloc( len + 1 )))
+    die("out of memory\n");
+  bad = read( fd, file, len + 1 ) != len ||
+        memcmp( file, "SIMPLE  =                    T", 30 ) != 0;
+  for( i=0; i<n && !bad; i++ ) {
+    p = file + hdr + 2*i;
+    if( (((p[0] << 8) | p[1]) ^ 0x8000) != in[i] )
+      bad = 1;
+  }
+  close( fd );
+
+  /* the background writer makes the same file, O_DIRECT or not */
+
+  if( !(w = si_writer_start( 1, 0, SI_WRITER_DIRECT )))
+    die("writer: %s\n", strerror(errno));
+  if( si_writer_queue( w, NULL, NULL, fname, 0, in, size, size ) < 0 )
+    die("%s: %s\n", fname, strerror(errno));
+  si_writer_stop( w );
+  if( !(copy = malloc( len + 1 )))
+    die("out of memory\n");
+  if( (fd = open( fname, O_RDONLY )) < 0 )
+    die("%s: %s\n", fname, strerror(errno));
+  if( read( fd, copy, len + 1 ) != len ||   /* DATE may have ticked */
+      memcmp( copy + hdr, file + hdr, len - hdr ) != 0 )
+    bad = 1;
+  close( fd );
+  unlink( fname );
+  free( copy );
+  free( file );
+
+  printf(",\n    { \"kernel\": \"fits\", \"impl\": \"%s\""
+         ", \"size\": %d, \"match\": %s }",
+         si_deinterlace_impl(), size, bad ? "false" : "true" );
+  return bad;
+}
+
+/* the image data as a file of type SI_LOAD_ */
+
+void load_file( int type, char *fname, unsigned short *data, int n_cols,
+                int n_rows )
+{
+  long len;
+  int fd, err;
+
+  err = 0;
+  if( type == SI_LOAD_RAW ) {
+    len = 2L*n_cols*n_rows;
+    if( (fd = open( fname, O_WRONLY|O_TRUNC )) < 0 ||
+        write( fd, data, len ) != len || close( fd ) < 0 )
+      err = -1;
+  } else if( type == SI_LOAD_FITS )
+    err = si_fits_save( NULL, NULL, fname, data, n_cols, n_rows );
+  else
+    err = si_fits_rice_save( NULL, NULL, fname, data, n_cols, n_rows );
+  if( err < 0 )
+    die("%s: %s\n", fname, strerror(errno));
+}
+
+/* in saved raw, as FITS and compressed, square and as an odd sized
+   image, and loaded back whole and as a preview.  Prints an entry for
+   each file type, returns how many differ
+*/
+
+int verify_load( struct GEOM *g, unsigned short *in )
+{
+  static char *names[] = { "raw", "fits", "fz" };
+  struct SI_LOAD l;
+  unsigned short *out;
+  char fname[256];
+  long i;
+  int type, size, cols, rows, k, bad, fails, row, col, w;
+
+  size = demux_size( g );
+  if( !(out = malloc( 2L*size*size )))
+    die("out of memory\n");
+  fails = 0;
+  for( type=SI_LOAD_RAW; type<=SI_LOAD_RICE; type++ ) {
+    bad = 0;
+    for( k=0; k<2; k++ ) {
+      cols = k ? size - 3 : size;  /* raw given its width */
+      rows = k ? size/2 + 1 : size;
+      close( fits_tmpfile( fname, sizeof(fname)));
+      load_file( type, fname, in, cols, rows );
+      if( si_load_open( &l, fname, cols ) < 0 ) {
+        unlink( fname );
+        bad = 1;
+        continue;
+      }
+      if( l.type != type || l.n_cols != cols || l.n_rows != rows ||
+          si_load_rows( &l, out, 0, rows ) < 0 ||
+          memcmp( out, in, 2L*cols*rows ) != 0 )
+        bad = 1;
+
+      w = (cols + 7)/8;
+      if( si_load_preview( &l, out, 8 ) < 0 )
+        bad = 1;
+      for( row=0; row<rows && !bad; row+=8 )
+        for( col=0; col<cols; col+=8 )
+          if( out[(row/8)*w + col/8] != in[(long)row*cols + col] )
+            bad = 1;
+      si_load_close( &l );
+      unlink( fname );
+    }
+
+    /* a signed image, BZERO 0, clipped at 0 */
+
+    if( type == SI_LOAD_FITS ) {
+      unsigned char *hdr;
+      int fd;
+
+      close( fits_tmpfile( fname, sizeof(fname)));
+      load_file( type, fname, in, 64, 64 );
+      if( (fd = open( fname, O_RDWR )) < 0 ||
+          !(hdr = malloc( SI_FITS_BLOCK )) ||
+          read( fd, hdr, SI_FITS_BLOCK ) != SI_FITS_BLOCK )
+        die("%s: %s\n", fname, strerror(errno));
+      for( i=0; i<SI_FITS_BLOCK; i+=SI_FITS_CARD )
+        if( memcmp( hdr + i, "BZERO   =", 9 ) == 0 )
+          memcpy( hdr + i + 10, "                   0", 20 );
+      if( pwrite( fd, hdr, SI_FITS_BLOCK, 0 ) != SI_FITS_BLOCK )
+        die("%s: %s\n", fname, strerror(errno));
+      close( fd );
+      free( hdr );
+      if( si_load_open( &l, fname, 0 ) < 0 ||
+          si_load_rows( &l, out, 0, 64 ) < 0 )
+        bad = 1;
+      for( i=0; i<64*64 && !bad; i++ )
+        if( out[i] != (in[i] < 32768 ? 0 : in[i] - 32768) )
+          bad = 1;
+      si_load_close( &l );
+      unlink( fname );
+    }
+
+    printf(",\n    { \"kernel\": \"load\", \"file\": \"%s\""
+           ", \"size\": %d, \"match\": %s }",
+           names[type], size, bad ? "false" : "true" );
+    fails += bad;
+  }
+  free( out );
+  return fails;
+}
+
+/* a flat bias with a few counts of noise, as most of a sky frame is */
+
+void sky_frame( unsigned short *p, long n )
+{
+  long i;
+
+  for( i=0; i<n; i++ )
+    p[i] = 1000 + (rand() & 15) + (rand() & 15) + (rand() & 15);
+}
+
+/* si_fits_rice_image() of in, and of sky, with the tiles decoded
+   again.  An odd width as well, so blocks end part way.  Prints its
+   entry, returns 1 if any differ
+*/
+
+int verify_rice( struct GEOM *g, unsigned short *in )
+{
+  unsigned short *sky, *data, *row;
+  unsigned char *file, *d;
+  long i, n, len, hdr, heap, bound;
+  int k, r, size, cols, bad, ends, nbytes, off;
+
+  size = demux_size( g );
+  n = (long)size*size;
+  bound = si_fits_rice_bound( size, size );
+  if( !(sky = malloc( n*sizeof(short))) ||
+      !(row = malloc( size*sizeof(short))) ||
+      !(file = malloc( bound )))
+    die("out of memory\n");
+  sky_frame( sky, n );
+
+  bad = 0;
+  for( k=0; k<4 && !bad; k++ ) {
+    data = k & 1 ? sky : in;
+    cols = k & 2 ? size - 3 : size;
+    len = si_fits_rice_image( NULL, NULL, (char *)file, bound, data, cols,
+                              size );
+    if( len < 0 || len % SI_FITS_BLOCK ) {
+      bad = 1;
+      break;
+    }
+
+    /* the table follows the second END */
+
+    ends = 0;
+    for( hdr=0; hdr<len && ends<2; hdr+=SI_FITS_CARD )
+      if( memcmp( file + hdr, "END     ", 8 ) == 0 )
+        ends++;
+    hdr = (hdr + SI_FITS_BLOCK - 1)/SI_FITS_BLOCK*SI_FITS_BLOCK;
+    heap = hdr + 8L*size;
+    for( r=0; r<size && !bad; r++ ) {
+      d = file + hdr + 8L*r;
+      nbytes = (d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+      off = (d[4] << 24) | (d[5] << 16) | (d[6] << 8) | d[7];
+      if( heap + off + nbytes > len ||
+          si_rice_decode( row, cols, file + heap + off, nbytes, 0x8000 ) < 0 )
+        bad = 1;
+      for( i=0; i<cols && !bad; i++ )
+        if( row[i] != data[(long)r*cols + i] )
+          bad = 1;
+    }
+  }
+
+  printf(",\n    { \"kernel\": \"rice\", \"impl\": \"%s\""
+         ", \"size\": %d, \"match\": %s }",
+         si_deinterlace_impl(), size, bad ? "false" : "true" );
+  free( sky );
+  free( row );
+  free( file );
+  return bad;
+}
+
+/* the modes with two amplifiers on each section, 7 and 10, through
+   si_dinter_execute_par() on several threads whatever -t says, against
+   si_dinter_execute().  Each amplifier is given its whole section, on
+   an image half as high so the input fits, so theirs meet in the
+   middle and write the same pixels, the last write having to win; they
+   must not be shared out.  As one cpu runs the bands in order anyway,
+   every mode is also run a band at a time backwards: that changes the
+   image exactly when the plan says its lanes overlap.  Prints its
+   entry, returns 1 if anything is wrong
+*/
+
+#define VERIFY_THREADS 4
+#define VERIFY_BANDS 16
+
+int verify_overlap( struct GEOM *g, unsigned short *in, unsigned short *out,
+                    unsigned short *ref )
+{
+  struct SI_DINTERLACE cfg;
+  struct SI_DINTER_PLAN *p;
+  struct SI_LAYOUT lay;
+  long row, nrows, len, a, b;
+  int i, n, type, keep, bad, differ;
+
+  keep = si_pool_size();
+  si_pool_init( VERIFY_THREADS );
+  bad = 0;
+  for( type=0; type<=10; type++ ) {
+    cfg.interlace_type = type;
+    dinter_fit( type, g, &cfg.n_cols, &cfg.n_rows );
+    cfg.n_rows /= 2;
+    if( si_layout_get( type, &lay ) < 0 || !(p = si_dinter_plan( &cfg ))) {
+      bad = 1;
+      continue;
+    }
+    n = cfg.n_cols*cfg.n_rows;
+    row = p->run * p->nlanes;
+    nrows = cfg.n_rows / lay.down;
+    len = row*nrows;
+    bzero( ref, n*sizeof(short));
+    si_dinter_execute( p, in, ref, 0, len );
+
+    bzero( out, n*sizeof(short));
+    for( i=VERIFY_BANDS-1; i>=0; i-- ) {
+      a = nrows*i/VERIFY_BANDS * row;
+      b = nrows*(i+1)/VERIFY_BANDS * row;
+      if( a < b )
+        si_dinter_execute( p, in + a, out, a, b - a );
+    }
+    differ = memcmp( out, ref, n*sizeof(short)) != 0;
+    bad |= differ != p->overlap || ((type == 7 || type == 10) && !differ);
+
+    bzero( out, n*sizeof(short));
+    si_dinter_execute_par( p, in, out, 0, len );
+    bad |= memcmp( out, ref, n*sizeof(short)) != 0;
+  }
+
+  printf(",\n    { \"kernel\": \"overlap\", \"impl\": \"%s\""
+         ", \"threads\": %d, \"size\": %d, \"match\": %s }",
+         si_deinterlace_impl(), si_pool_size(), demux_size( g ),
+         bad ? "false" : "true" );
+  si_pool_init( keep );
+  return bad;
+}
+
+/* one "verify" entry, returns 1 if out and ref differ */
+
+int verify_print( int first, char *kernel, int k, int a, int b,
+                  unsigned short *out, unsigned short *ref, int len )
+{
+  int bad;
+
+  bad = memcmp( out, ref, len ) != 0;
+  printf("%s\n    { \"kernel\": \"%s\", \"impl\": \"%s\", \"threads\": %d"
+         ", \"%s\": %d, \"cols\": %d, \"match\": %s }",
+         first ? "" : ",", kernel, si_deinterlace_impl(),
+         k == 2 ? si_pool_size() : 1,
+         strcmp( kernel, "demux" ) == 0 ? "size" : "type", a, b,
+         bad ? "false" : "true" );
+  return bad;
+}
+
+/* kernel k of the deinterlace table, the reference, the fastest
+   single thread and all threads
+*/
+
+void dinter_kernel( int k, struct SI_DINTERLACE *cfg, unsigned short *in,
+                    unsigned short *out, int len )
+{
+  if( k == 0 )
+    si_deinterlace_ref( cfg, in, out, len );
+  else if( k == 1 )
+    si_deinterlace( cfg, in, out, len );
+  else
+    si_deinterlace_par( cfg, in, out, len );
+}
+
+/* and of the demux */
+
+void demux_kernel( int k, unsigned short *out, unsigned short *in,
+                   int size, struct GEOM *g )
+{
+  if( k == 0 )
+    si_camera_demux_ref( out, in, size, g->serlen, g->parlen );
+  else if( k == 1 )
+    si_camera_demux_gen( out, in, size, g->serlen, g->parlen );
+  else
+    si_camera_demux_par( out, in, size, g->serlen, g->parlen );
+}
+
+/* k 0 the demux, the stats and the display a pass each, k 1 them
+   all at once in pieces of chunk input pixels, or in one if 0
+*/
+
+void look_kernel( int k, struct SI_LOOK *l, unsigned short *out,
+                  unsigned short *in, int size, struct GEOM *g,
+                  unsigned char *pix, long chunk )
+{
+  struct SI_DINTER_PLAN p;
+  struct SI_LOOK_STATS *st;
+  long i, n, total;
+
+  if( k == 0 ) {
+    si_camera_demux_par( out, in, size, g->serlen, g->parlen );
+    n = (long)size*size;
+    st = &l->stats;
+    bzero( st, sizeof(*st));
+    st->min = 0xffff;
+    for( i=0; i<n; i++ ) {
+      st->min = out[i] < st->min ? out[i] : st->min;
+      st->max = out[i] > st->max ? out[i] : st->max;
+      st->hist[out[i]>>8]++;
+    }
+    for( i=0; i<n; i++ )
+      pix[3*i] = pix[3*i+1] = pix[3*i+2] = out[i]>>8;
+    return;
+  }
+
+  total = 4L*g->serlen*g->parlen;
+  if( chunk <= 0 )
+    chunk = total;
+  si_camera_demux_plan( &p, size, g->serlen, g->parlen );
+  if( si_look_start( l, &p, total, size, size, pix, 3*size, 3 ) < 0 )
+    die("look: %s\n", strerror(errno));
+  for( i=0; i<total; i+=n ) {
+    n = total - i < chunk ? total - i : chunk;
+    si_look_execute( l, in + i, out, i, n );
+  }
+  si_look_end( l, out );
+}
+
+/* k 0 the display a column at a time, as fill_pix_with_data() in
+   si-image went, k 1 a row at a time with si_look_rgb(), k 2 the same
+   through lut
+*/
+
+void fill_kernel( int k, unsigned char *pix, unsigned short *data,
+                  int side, unsigned char *lut )
+{
+  unsigned char *p;
+  int row, col;
+
+  if( k == 0 ) {
+    for( row=0; row<side; row++ ) {
+      for( col=0; col<side; col++ ) {
+        p = pix + col*3*side + row*3;
+        p[0] = p[1] = p[2] = data[col*side + row]>>8;
+      }
+    }
+    return;
+  }
+  for( row=0; row<side; row++ )
+    si_look_rgb( pix + row*3*side, data + row*side, side, 3,
+                 k == 2 ? lut : NULL );
+}
+
+/* a stage: what comes in from ring[0] goes out on ring[1], or with
+   no rings the one thing in v is handed back
+*/
+
+struct STAGE {
+  struct SI_RING *ring[2];
+  long n;
+  long sent;            /* pushed by stage_stream() */
+  long bad;             /* came back out of order */
+};
+
+void *stage_kernel( void *v )
+{
+  struct STAGE *st;
+  void *p;
+
+  st = (struct STAGE *)v;
+  if( !st->ring[0] ) {
+    st->n++;
+    return NULL;
+  }
+  while( si_ring_pop( st->ring[0], &p, 1 ) == 0 && p ) {
+    st->n++;
+    si_ring_push( st->ring[1], p, 1 );
+  }
+  si_ring_push( st->ring[1], NULL, 1 );
+  return NULL;
+}
+
+/* one frame through the stage, to a new thread or round the rings */
+
+static void stage_pass( void *v, int pass )
+{
+  struct STAGE *st = v;
+  pthread_t th;
+  void *p;
+
+  if( st->ring[0] ) {
+    si_ring_push( st->ring[0], (void *)(long)(pass + 1), 1 );
+    si_ring_pop( st->ring[1], &p, 1 );
+  } else {
+    if( pthread_create( &th, NULL, stage_kernel, st ) != 0 )
+      die("stages: cant start a thread\n");
+    pthread_join( th, NULL );
+  }
+}
+
+/* as many as will go through, keeping the first ring full and
+   waiting on the second
+*/
+
+static void stage_stream( void *v, int pass )
+{
+  struct STAGE *st = v;
+  void *p;
+
+  while( st->sent - pass <= 2 &&
+         si_ring_push( st->ring[0], (void *)st->sent, 0 ) == 0 )
+    st->sent++;
+  si_ring_pop( st->ring[1], &p, 1 );
+  if( (long)p != pass + 1 )
+    st->bad++;
+}
+
+void bench_stages( void )
+{
+  struct STAGE st;
+  struct BENCH b;
+  pthread_t th;
+  double t;
+  void *p;
+  long n;
+  int k;
+
+  printf("  \"stages\": [");
+  for( k=0; k<2; k++ ) {
+    memset( &st, 0, sizeof(st));
+    if( k && (!(st.ring[0] = si_ring_new( 2 )) ||
+              !(st.ring[1] = si_ring_new( 2 ))))
+      die("ring: %s\n", strerror(errno));
+    if( k && pthread_create( &th, NULL, stage_kernel, &st ) != 0 )
+      die("stages: cant start a thread\n");
+
+    bench_run( &b, BENCH_MINREP, stage_pass, &st );
+    printf("%s\n    { \"kernel\": \"%s\", \"frames\": %d"
+           ", \"us\": %.3f }", k ? "," : "", k ? "ring" : "thread",
+           b.passes, b.time/b.passes*1.0e6 );
+    if( !k )
+      continue;
+
+    st.sent = 1;
+    bench_run( &b, 1000, stage_stream, &st );
+    t = si_camera_time();
+    n = b.passes;
+    si_ring_push( st.ring[0], NULL, 1 );
+    while( si_ring_pop( st.ring[1], &p, 1 ) == 0 && p )
+      if( (long)p != ++n )
+        st.bad++;
+    b.time += si_camera_time() - t;
+    pthread_join( th, NULL );
+    si_ring_free( st.ring[0] );
+    si_ring_free( st.ring[1] );
+
+    printf(",\n    { \"kernel\": \"ring_stream\", \"frames\": %ld"
+           ", \"per_sec\": %.0f, \"out_of_order\": %ld }",
+           n, n/b.time, st.bad );
+    if( st.bad )
+      die("stages: %ld out of order\n", st.bad );
+  }
+  printf("\n  ],\n");
+}
+
+/* what the reader process of bench_shm() saw */
+
+struct SHM_SEEN {
+  long frames;
+  long stale;                  /* written over before it was read */
+  long torn;                   /* passed si_shm_check() but was wrong */
+  long woke;
+  double wait;                 /* publish to reader awake, summed */
+};
+
+static void shm_reader( char *name, int fd )
+{
+  struct SI_SHM *s;
+  struct SI_SHM_FRAME meta;
+  struct SHM_SEEN seen;
+  struct timespec ts;
+  unsigned short *p, want;
+  unsigned long seq;
+  long i, n;
+
+  bzero( &seen, sizeof(seen));
+  if( !(s = si_shm_attach( name )))
+    _exit( 1 );
+  seq = 0;
+  while( (seq = si_shm_wait( s, seq, 2000 )) != (unsigned long)-1 && seq ) {
+    if( si_shm_get( s, seq, &meta, &p ) < 0 ) {
+      seen.stale++;
+      continue;
+    }
+    clock_gettime( CLOCK_REALTIME, &ts );
+    seen.wait += ts.tv_sec + ts.tv_nsec*1e-9 - meta.time;
+    seen.woke++;
+    if( meta.frame < 0 ) /* the last */
+      break;
+
+    /* every pixel is the frame number, unless it was being written */
+
+    want = meta.frame;
+    n = (long)meta.n_cols*meta.n_rows;
+    for( i=0; i<n && p[i] == want; i++ )
+      ;
+    if( si_shm_check( s, &meta ) < 0 )
+      seen.stale++;
+    else if( i < n )
+      seen.torn++;
+    else
+      seen.frames++;
+  }
+  si_shm_close( s );
+  if( write( fd, &seen, sizeof(seen)) != sizeof(seen))
+    _exit( 1 );
+  _exit( 0 );
+}
+
+/* frames filled with their number and published, to an shm ring or
+   a handoff socket
+*/
+
+struct PUBLISH {
+  struct SI_SHM *s;
+  struct SI_HANDOFF *h;
+  struct SI_SHM_FRAME meta;
+  long npix;
+  double pub;           /* in the publish call, summed */
+  int sent;             /* to a reader */
+};
+
+static void shm_pass( void *v, int n )
+{
+  struct PUBLISH *pb = v;
+  struct timespec ts;
+  unsigned short *p;
+  double t;
+  long i;
+
+  p = si_shm_begin( pb->s );
+  for( i=0; i<pb->npix; i++ )
+    p[i] = n;
+  clock_gettime( CLOCK_REALTIME, &ts );
+  pb->meta.time = ts.tv_sec + ts.tv_nsec*1e-9;
+  pb->meta.frame = n;
+  t = si_camera_time();
+  si_shm_publish( pb->s, &pb->meta );
+  pb->pub += si_camera_time() - t;
+}
+
+static void handoff_pass( void *v, int n )
+{
+  struct PUBLISH *pb = v;
+  unsigned short *p;
+  double t;
+  long i;
+  int ret;
+
+  if( !(p = si_handoff_begin( pb->h )))
+    die("memfd: %s\n", strerror(errno));
+  for( i=0; i<pb->npix; i++ )
+    p[i] = n;
+  pb->meta.frame = n;
+  t = si_camera_time();
+  if( (ret = si_handoff_publish( pb->h, &pb->meta )) < 0 )
+    die("handoff: %s\n", strerror(errno));
+  pb->pub += si_camera_time() - t;
+  pb->sent += ret;
+}
+
+void bench_shm( int size )
+{
+  struct SI_SHM *s;
+  struct PUBLISH pb;
+  struct SHM_SEEN seen;
+  struct BENCH b;
+  char name[64];
+  long npix;
+  int fd[2], n, status;
+  pid_t pid;
+
+  snprintf( name, sizeof(name), "/si-bench-%d", (int)getpid());
+  npix = (long)size*size;
+  if( !(s = si_shm_create( name, 4, npix*sizeof(short))))
+    die("%s: %s\n", name, strerror(errno));
+  if( pipe( fd ) < 0 || (pid = fork()) < 0 )
+    die("shm: %s\n", strerror(errno));
+  if( pid == 0 ) {
+    close( fd[0] );
+    shm_reader( name, fd[1] );
+  }
+  close( fd[1] );
+
+  bzero( &pb, sizeof(pb));
+  pb.s = s;
+  pb.npix = npix;
+  pb.meta.n_cols = pb.meta.n_rows = size;
+  bench_run( &b, BENCH_MINREP, shm_pass, &pb );
+  n = b.passes;
+  si_shm_begin( s );
+  pb.meta.frame = -1;
+  pb.meta.n_cols = pb.meta.n_rows = 0;
+  si_shm_publish( s, &pb.meta );
+
+  bzero( &seen, sizeof(seen));
+  if( read( fd[0], &seen, sizeof(seen)) != sizeof(seen) ||
+      waitpid( pid, &status, 0 ) < 0 || status != 0 )
+    die("shm: the reader failed\n");
+  close( fd[0] );
+  si_shm_close( s );
+
+  printf("  \"shm\": {\n");
+  printf("    \"size\": %d,\n", size );
+  printf("    \"frames\": %d,\n", n );
+  printf("    \"mbps\": %.1f,\n", npix*sizeof(short)*n/b.time*1.0e-6 );
+  printf("    \"publish_us\": %.3f,\n", pb.pub/n*1.0e6 );
+  printf("    \"read\": %ld,\n", seen.frames );
+  printf("    \"stale\": %ld,\n", seen.stale );
+  printf("    \"torn\": %ld,\n", seen.torn );
+  printf("    \"wake_us\": %.1f\n",
+         seen.woke ? seen.wait/seen.woke*1.0e6 : 0.0 );
+  printf("  },\n");
+  if( seen.torn )
+    die("shm: %ld frames were torn\n", seen.torn );
+}
+
+/* the reader process of bench_handoff(): frames from the socket at
+   path, checked and released, then frames down the pipe in until it
+   closes.  How many of each came and how many were wrong go back on
+   out
+*/
+
+static void handoff_reader( char *path, int in, int out, long bytes )
+{
+  struct SI_SHM_FRAME meta;
+  unsigned short *p;
+  unsigned short want;
+  long got[4], n, i;
+  char *buf;
+  int fd;
+
+  bzero( got, sizeof(got));
+  if( (fd = si_handoff_connect( path )) < 0 || !(buf = malloc( bytes )))
+    _exit( 1 );
+  while( si_handoff_recv( fd, &meta, &p, &n ) == 0 ) {
+    want = meta.frame;
+    for( i=0; i<(long)meta.n_cols*meta.n_rows && p[i] == want; i++ )
+      ;
+    if( i < (long)meta.n_cols*meta.n_rows )
+      got[1]++;
+    got[0]++;
+    si_handoff_release( fd, p, n );
+  }
+  close( fd );
+
+  for(;;) {
+    for( n=0; n<bytes; n+=i )
+      if( (i = read( in, buf + n, bytes - n )) <= 0 )
+        break;
+    if( n < bytes )
+      break;
+    p = (unsigned short *)buf;
+    want = p[0];
+    for( i=0; i<bytes/2 && p[i] == want; i++ )
+      ;
+    if( i < bytes/2 )
+      got[3]++;
+    got[2]++;
+  }
+  if( write( out, got, sizeof(got)) != sizeof(got))
+    _exit( 1 );
+  _exit( 0 );
+}
+
+void bench_handoff( int size )
+{
+  struct SI_HANDOFF *h;
+  struct PUBLISH pb;
+  struct BENCH b;
+  unsigned short *p;
+  char path[64];
+  double t0, thand, tpipe;
+  long got[4], i, npix, bytes, off;
+  int data[2], res[2], n, status, ret;
+  pid_t pid;
+
+  snprintf( path, sizeof(path), "/tmp/si-bench-%d.sock", (int)getpid());
+  npix = (long)size*size;
+  bytes = npix*sizeof(short);
+  if( !(h = si_handoff_listen( path, bytes )))
+    die("%s: %s\n", path, strerror(errno));
+  if( pipe( data ) < 0 || pipe( res ) < 0 || (pid = fork()) < 0 )
+    die("handoff: %s\n", strerror(errno));
+  if( pid == 0 ) {
+    close( data[1] );
+    close( res[0] );
+    handoff_reader( path, data[0], res[1], bytes );
+  }
+  close( data[0] );
+  close( res[1] );
+
+  t0 = si_camera_time();
+  while( si_handoff_accept( h ) < 1 )
+    if( si_camera_time() - t0 > 5.0 )
+      die("handoff: the reader never connected\n");
+    else
+      usleep( 1000 );
+
+  bzero( &pb, sizeof(pb));
+  pb.h = h;
+  pb.npix = npix;
+  pb.meta.n_cols = pb.meta.n_rows = size;
+  bench_run( &b, BENCH_MINREP, handoff_pass, &pb );
+  n = b.passes;
+  thand = b.time/n;
+  si_handoff_close( h );
+
+  /* the same through a pipe, the reader copying each out */
+
+  if( !(p = malloc( bytes )))
+    die("out of memory\n");
+  t0 = si_camera_time();
+  for( i=0; i<n; i++ ) {
+    for( off=0; off<npix; off++ )
+      p[off] = i;
+    for( off=0; off<bytes; off+=ret )
+      if( (ret = write( data[1], (char *)p + off, bytes - off )) < 0 )
+        die("pipe: %s\n", strerror(errno));
+  }
+  close( data[1] );
+  if( read( res[0], got, sizeof(got)) != sizeof(got) ||
+      waitpid( pid, &status, 0 ) < 0 || status != 0 )
+    die("handoff: the reader failed\n");
+  tpipe = (si_camera_time() - t0)/n;
+  close( res[0] );
+  free( p );
+
+  printf("  \"handoff\": {\n");
+  printf("    \"size\": %d,\n", size );
+  printf("    \"frames\": %d,\n", n );
+  printf("    \"received\": %ld,\n", got[0] );
+  printf("    \"publish_us\": %.1f,\n", pb.pub/n*1.0e6 );
+  printf("    \"memfd_ms\": %.3f,\n", thand*1.0e3 );
+  printf("    \"pipe_ms\": %.3f\n", tpipe*1.0e3 );
+  printf("  },\n");
+  if( got[0] != pb.sent || got[1] || got[2] != n || got[3] )
+    die("handoff: frames lost or wrong\n");
+}
+
+/* trim the image to whole sections of the layout, as the
+   original code expects
+*/
+
+void dinter_fit( int type, struct GEOM *g, int *cols, int *rows )
+{
+  struct SI_LAYOUT l;
+
+  if( si_layout_get( type, &l ) < 0 )
+    die("no layout for type %d\n", type );
+  *cols = (2*g->serlen/l.across)*l.across;
+  *rows = (2*g->parlen/l.down)*l.down;
+}
+
+/* smallest square si_camera_demux_gen fits serlen x parlen into,
+   2048 for 1023x1023 and 4096 for 2047x2046
+*/
+
+int demux_size( struct GEOM *g )
+{
+  return 2*((g->serlen > g->parlen ? g->serlen : g->parlen) + 1);
+}
+
+/* run fn until BENCH_MINTIME has gone by, and at least minrep times,
+   timing each pass
+*/
+
+void bench_run( struct BENCH *b, int minrep, void (*fn)( void *, int ),
+                void *arg )
+{
+  double t0, t, now, dt;
+
+  bzero( b, sizeof(*b));
+  t0 = t = si_camera_time();
+  do {
+    fn( arg, b->passes );
+    now = si_camera_time();
+    dt = now - t;
+    t = now;
+    b->busy += dt;
+    if( b->best == 0.0 || dt < b->best )
+      b->best = dt;
+    b->passes++;
+  } while( b->passes < minrep || now - t0 < BENCH_MINTIME );
+  b->time = now - t0;
+}
+
+/* a case as one JSON object: the fields fmt gives, then the overall
+   and best pass rate over bytes, or the times of a pass if bytes is 0
+*/
+
+void bench_print( int *first, struct BENCH *b, double bytes,
+                  const char *fmt, ... )
+{
+  va_list ap;
+
+  printf("%s\n    { ", *first ? "" : "," );
+  va_start( ap, fmt );
+  vprintf( fmt, ap );
+  va_end( ap );
+  if( bytes > 0 )
+    printf(", \"passes\": %d, \"mbps\": %.1f, \"best_mbps\": %.1f }",
+           b->passes, bytes*b->passes/b->time*1.0e-6, bytes/b->best*1.0e-6 );
+  else
+    printf(", \"passes\": %d, \"ms\": %.3f, \"best_ms\": %.3f }",
+           b->passes, b->time/b->passes*1.0e3, b->best*1.0e3 );
+  *first = 0;
+}
+
+/* the cases of bench_kernels(), one pass each */
+
+static void case_dinter( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  dinter_kernel( c->k, c->cfg, c->in, c->out, c->len );
+}
+
+static void case_dstats( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  si_dinter_stats_start( c->ds, c->plan->nlanes, 0 );
+  si_dinter_execute_stats( c->plan, c->in, c->out, 0, c->len,
+                           c->k ? c->ds : NULL );
+}
+
+static void case_calib( void *v, int pass )
+{
+  struct CASE *c = v;
+  long x;
+
+  if( c->k < 2 )
+    si_dinter_execute_par( c->plan, c->trim, c->out, 0, c->len );
+  if( c->k == 1 ) {
+    for( x=0; x<(long)c->size*c->size; x++ )
+      c->out[x] = c->out[x] > 1000 ? c->out[x] - 1000 : 0;
+  }
+  if( c->k >= 2 ) {
+    if( si_calib_start( c->cal, c->plan, c->g->parlen, CALIB_SERPOST,
+                        CALIB_PARPOST ) < 0 )
+      die("calib: %s\n", strerror(errno));
+    si_calib_execute( c->cal, c->raw, c->out, 0, c->total, NULL );
+  }
+}
+
+static void case_demux( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  demux_kernel( c->k, c->out, c->in, c->size, c->g );
+}
+
+static void case_look( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  look_kernel( c->k, c->look, c->out, c->in, c->size, c->g, c->pix, 0 );
+}
+
+static void case_pyramid( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  if( si_look_pyramid( c->py, c->in, c->size, c->size, c->k ) < 0 )
+    die("out of memory\n");
+}
+
+static void case_hist( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  if( si_scale_hist( c->sc, c->in, (long)c->size*c->size ) < 0 )
+    die("out of memory\n");
+}
+
+static void case_levels( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  si_scale_levels( c->sc );
+  if( si_scale_lut( c->sc ) < 0 )
+    die("out of memory\n");
+}
+
+static void case_fits( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  if( c->k == 0 )
+    si_fits_swap( c->out, c->in, (long)c->size*c->size );
+  else if( si_fits_save( NULL, NULL, c->fname, c->in, c->size,
+                         c->size ) < 0 )
+    die("%s: %s\n", c->fname, strerror(errno));
+}
+
+static void case_rice( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  if( (c->flen = si_fits_rice_image( NULL, NULL, c->file, c->bound, c->out,
+                                     c->size, c->size )) < 0 )
+    die("rice: %s\n", strerror(errno));
+}
+
+static void case_load( void *v, int pass )
+{
+  struct CASE *c = v;
+  struct SI_LOAD l;
+  char *file;
+  int fd;
+
+  if( c->k == 0 ) {
+    if( !(file = malloc( c->len + SI_FITS_BLOCK )) ||
+        (fd = open( c->fname, O_RDONLY )) < 0 ||
+        read( fd, file, c->len + SI_FITS_BLOCK ) < 0 )
+      die("%s: %s\n", c->fname, strerror(errno));
+    close( fd );
+    bench_sink = file[pass % c->len];
+    free( file );
+  } else {
+    if( si_load_open( &l, c->fname, 0 ) < 0 ||
+        (c->k == 1 && si_load_preview( &l, c->out, 8 ) < 0) ||
+        (c->k == 2 && si_load_rows( &l, c->out, 0, c->size ) < 0))
+      die("%s: %s\n", c->fname, strerror(errno));
+    si_load_close( &l );
+  }
+}
+
+static void case_frames( void *v, int pass )
+{
+  struct CASE *c = v;
+  struct SI_FRAME *f;
+  unsigned short *buf;
+
+  if( c->k == 0 ) {
+    if( !(buf = malloc( c->len )))
+      die("out of memory\n");
+    memset( buf, pass, c->len );
+    bench_sink = buf[pass % (c->size*c->size)];
+    free( buf );
+  } else {
+    if( !(f = si_frame_get( c->fp, 0 )))
+      die("frames: %s\n", strerror(errno));
+    memset( f->data, pass, c->len );
+    bench_sink = f->data[pass % (c->size*c->size)];
+    si_frame_put( f );
+  }
+}
+
+/* the files go round eight names so the disk sees new files rather
+   than overwrites
+*/
+
+static void case_writer( void *v, int pass )
+{
+  struct CASE *c = v;
+  char fname[300];
+
+  snprintf( fname, sizeof(fname), "%s-%d.fits", c->fname, pass % 8 );
+  if( si_writer_queue( c->w, NULL, NULL, fname, 0, c->in, c->size,
+                       c->size ) < 0 )
+    die("%s: %s\n", fname, strerror(errno));
+}
+
+static void case_fill( void *v, int pass )
+{
+  struct CASE *c = v;
+
+  fill_kernel( c->k, c->pix, c->in, c->size, c->lut );
+}
+
+/* run each kernel until BENCH_MINTIME has gone by, report
+   the overall and best pass rate over the input bytes
+*/
+
+void bench_kernels( struct GEOM *g, int ngeom )
+{
+  struct SI_DINTERLACE cfg;
+  struct SI_LAYOUT layout;
+  struct SI_LOOK look;
+  struct SI_LOOK_STATS st;
+  struct SI_PYRAMID py;
+  struct SI_SCALE sc;
+  struct BENCH b;
+  struct CASE c;
+  unsigned short *in, *out, *ref;
+  unsigned char *pix, *rpix, *lut;
+  double t;
+  int i, j, k, n, type, cols, rows, size, len, maxlen, first, match;
+
+  maxlen = 0;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    n = size*size;
+    if( n > maxlen )
+      maxlen = n;
+  }
+
+  if( !(in = malloc( maxlen*sizeof(short))) ||
+      !(out = calloc( maxlen, sizeof(short))) ||
+      !(ref = calloc( maxlen, sizeof(short))))
+    die("out of memory\n");
+  for( k=0; k<maxlen; k++ )
+    in[k] = k;
+
+  bzero( &c, sizeof(c));
+  c.in = in;
+  c.out = out;
+
+  printf("  \"deinterlace\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    for( type=0; type<=11; type++ ) {
+
+      /* the cfg file's own layout, if it has one, goes last */
+
+      if( type == 11 && (type = layout_type) < 0 )
+        break;
+      dinter_fit( type, &g[i], &cols, &rows );
+      si_layout_get( type, &layout );
+      len = cols*rows*sizeof(short);
+
+      cfg.interlace_type = type;
+      cfg.n_cols = cols;
+      cfg.n_rows = rows;
+
+      /* the new code has to match the original, a layout from the
+         cfg file has no original so the threaded code matches the
+         single one
+      */
+
+      bzero( ref, len );
+      if( type < SI_LAYOUT_TYPE0 )
+        si_deinterlace_ref( &cfg, in, ref, len );
+      else
+        dinter_kernel( 1, &cfg, in, ref, len );
+
+      c.cfg = &cfg;
+      c.len = len;
+      for( k = type < SI_LAYOUT_TYPE0 ? 0 : 1; k<3; k++ ) {
+        bzero( out, len );
+        dinter_kernel( k, &cfg, in, out, len );
+        match = memcmp( out, ref, len ) == 0;
+
+        c.k = k;
+        bench_run( &b, BENCH_MINREP, case_dinter, &c );
+        bench_print( &first, &b, len, "\"type\": %d, \"layout\": \"%s\""
+                     ", \"impl\": \"%s\", \"threads\": %d"
+                     ", \"cols\": %d, \"rows\": %d, \"match\": %s",
+                     type, layout.name, k ? si_deinterlace_impl() : "ref",
+                     k == 2 ? si_pool_size() : 1, cols, rows,
+                     match ? "true" : "false" );
+      }
+    }
+  }
+  printf("\n  ],\n");
+
+  /* the same with each amplifier's counts taken on the way */
+
+  printf("  \"dstats\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    struct SI_DINTER_PLAN *p;
+    struct SI_DINTER_STATS ds;
+    double mbps[2];
+
+    for( type=0; type<=10; type++ ) {
+      cfg.interlace_type = type;
+      dinter_fit( type, &g[i], &cfg.n_cols, &cfg.n_rows );
+      if( !(p = si_dinter_plan( &cfg )))
+        continue;
+      len = cfg.n_cols*cfg.n_rows;
+
+      c.plan = p;
+      c.ds = &ds;
+      c.len = len;
+      for( k=0; k<2; k++ ) {
+        c.k = k;
+        bench_run( &b, BENCH_MINREP, case_dstats, &c );
+        mbps[k] = len*sizeof(short)/b.best*1.0e-6;
+      }
+
+      printf("%s\n    { \"type\": %d, \"amps\": %d, \"impl\": \"%s\""
+             ", \"cols\": %d, \"rows\": %d, \"best_mbps\": %.1f"
+             ", \"stats_best_mbps\": %.1f }",
+             first ? "" : ",", type, p->nlanes, si_deinterlace_impl(),
+             cfg.n_cols, cfg.n_rows, mbps[0], mbps[1] );
+      first = 0;
+    }
+  }
+  printf("\n  ],\n");
+
+  /* a frame with overscan: the demux alone on the image part, the
+     same followed by a pass taking a level off, which is less than a
+     separate bias pass would cost as it finds no bias, and calib.c
+     trimming and then taking the bias off as it demuxes.  The rate is
+     of the image bytes
+  */
+
+  printf("  \"calib\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    struct SI_DINTER_PLAN p;
+    struct SI_CALIB cal;
+    unsigned short *raw, *trim;
+    double mbps[4];
+
+    size = demux_size( &g[i] );
+    len = 4*g[i].serlen*g[i].parlen;
+    if( !(raw = malloc( 4L*(g[i].serlen + CALIB_SERPOST)*
+                        (g[i].parlen + CALIB_PARPOST)*sizeof(short))) ||
+        !(trim = malloc( len*sizeof(short))))
+      die("out of memory\n");
+    si_camera_demux_plan( &p, size, g[i].serlen, g[i].parlen );
+    bzero( &cal, sizeof(cal));
+    cal.pedestal = SI_CALIB_PEDESTAL;
+
+    c.g = &g[i];
+    c.size = size;
+    c.len = len;
+    c.raw = raw;
+    c.trim = trim;
+    c.total = calib_frame( &g[i], raw, trim );
+    c.plan = &p;
+    c.cal = &cal;
+    for( k=0; k<4; k++ ) {
+      cal.subtract = k == 3;
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_calib, &c );
+      mbps[k] = len*sizeof(short)/b.best*1.0e-6;
+    }
+
+    printf("%s\n    { \"size\": %d, \"serlen\": %d, \"parlen\": %d"
+           ", \"serpost\": %d, \"parpost\": %d, \"impl\": \"%s\""
+           ", \"threads\": %d, \"demux_best_mbps\": %.1f"
+           ", \"two_pass_best_mbps\": %.1f, \"trim_best_mbps\": %.1f"
+           ", \"calib_best_mbps\": %.1f }",
+           first ? "" : ",", size, g[i].serlen, g[i].parlen, CALIB_SERPOST,
+           CALIB_PARPOST, si_deinterlace_impl(), si_pool_size(),
+           mbps[0], mbps[1], mbps[2], mbps[3] );
+    first = 0;
+    si_calib_free( &cal );
+    free( raw );
+    free( trim );
+  }
+  printf("\n  ],\n");
+
+  printf("  \"demux\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = g[i].serlen*g[i].parlen*4*sizeof(short);
+
+    bzero( ref, size*size*sizeof(short));
+    si_camera_demux_ref( ref, in, size, g[i].serlen, g[i].parlen );
+
+    c.g = &g[i];
+    c.size = size;
+    for( k=0; k<3; k++ ) {
+      bzero( out, size*size*sizeof(short));
+      demux_kernel( k, out, in, size, &g[i] );
+      match = memcmp( out, ref, size*size*sizeof(short)) == 0;
+
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_demux, &c );
+      bench_print( &first, &b, len, "\"size\": %d, \"serlen\": %d"
+                   ", \"parlen\": %d, \"impl\": \"%s\", \"threads\": %d"
+                   ", \"match\": %s", size, g[i].serlen, g[i].parlen,
+                   k == 0 ? "ref" : k == 1 ? "gen" : "par",
+                   k == 2 ? si_pool_size() : 1, match ? "true" : "false" );
+    }
+  }
+  printf("\n  ],\n");
+
+  /* the display is 3 bytes a pixel, as the GdkPixbuf in si-image */
+
+  if( !(pix = malloc( 3L*maxlen )) || !(rpix = malloc( 3L*maxlen )))
+    die("out of memory\n");
+  bzero( &look, sizeof(look));
+
+  printf("  \"look\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = g[i].serlen*g[i].parlen*4*sizeof(short);
+
+    bzero( ref, size*size*sizeof(short));
+    bzero( out, size*size*sizeof(short));
+    look_kernel( 0, &look, ref, in, size, &g[i], rpix, 0 );
+    st = look.stats;
+
+    c.g = &g[i];
+    c.size = size;
+    c.look = &look;
+    c.pix = pix;
+    for( k=0; k<2; k++ ) {
+      look_kernel( k, &look, out, in, size, &g[i], pix, 0 );
+      match = memcmp( pix, rpix, 3L*size*size ) == 0 &&
+              memcmp( &look.stats, &st, sizeof(st)) == 0;
+
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_look, &c );
+      bench_print( &first, &b, len, "\"size\": %d, \"serlen\": %d"
+                   ", \"parlen\": %d, \"impl\": \"%s\", \"threads\": %d"
+                   ", \"match\": %s", size, g[i].serlen, g[i].parlen,
+                   k == 0 ? "passes" : "fused", si_pool_size(),
+                   match ? "true" : "false" );
+    }
+  }
+  printf("\n  ],\n");
+
+  printf("  \"pyramid\": [");
+  first = 1;
+  bzero( &py, sizeof(py));
+  c.py = &py;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+
+    c.size = size;
+    for( k=SI_BIN_MEAN; k<=SI_BIN_MAX; k++ ) {
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_pyramid, &c );
+      bench_print( &first, &b, len, "\"size\": %d, \"mode\": \"%s\""
+                   ", \"impl\": \"%s\", \"threads\": %d",
+                   size, k == SI_BIN_MAX ? "max" : "mean",
+                   si_deinterlace_impl(), si_pool_size() );
+    }
+  }
+  si_look_pyramid_free( &py );
+  printf("\n  ],\n");
+
+  /* the ramp in makes every stretch the same shape, only the time
+     matters
+  */
+
+  printf("  \"scale\": [");
+  first = 1;
+  bzero( &sc, sizeof(sc));
+  sc.clip = 0.25;
+  c.sc = &sc;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+
+    c.size = size;
+    bench_run( &b, BENCH_MINREP, case_hist, &c );
+    bench_print( &first, &b, len, "\"size\": %d, \"kernel\": \"hist\""
+                 ", \"threads\": %d", size, si_pool_size() );
+
+    for( k=0; k<SI_SCALE_MODES; k++ ) {
+      sc.mode = k;
+      bench_run( &b, BENCH_MINREP, case_levels, &c );
+      bench_print( &first, &b, 0, "\"size\": %d, \"kernel\": \"%s\""
+                   ", \"lo\": %d, \"hi\": %d",
+                   size, si_scale_name( k ), sc.lo, sc.hi );
+    }
+  }
+  si_scale_free( &sc );
+  printf("\n  ],\n");
+
+  printf("  \"fits\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+
+    for( k=0; k<2; k++ ) {
+      char fname[256];
+      int fd;
+
+      fd = fits_tmpfile( fname, sizeof(fname));
+      c.size = size;
+      c.fname = fname;
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_fits, &c );
+      close( fd );
+      unlink( fname );
+
+      bench_print( &first, &b, len, "\"size\": %d, \"kernel\": \"%s\""
+                   ", \"impl\": \"%s\"", size, k == 0 ? "swap" : "save",
+                   si_deinterlace_impl() );
+    }
+  }
+  printf("\n  ],\n");
+
+  /* the sky frame compressed as the archive would */
+
+  printf("  \"rice\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+    c.size = size;
+    c.bound = si_fits_rice_bound( size, size );
+    if( !(c.file = malloc( c.bound )))
+      die("out of memory\n");
+    sky_frame( out, (long)size*size );
+
+    bench_run( &b, BENCH_MINREP, case_rice, &c );
+    free( c.file );
+
+    bench_print( &first, &b, len, "\"size\": %d, \"kernel\": \"compress\""
+                 ", \"impl\": \"%s\", \"threads\": %d, \"ratio\": %.2f",
+                 size, si_deinterlace_impl(), si_pool_size(),
+                 (double)len/c.flen );
+  }
+  printf("\n  ],\n");
+
+  /* the file read whole, against the rows of a preview and the lot
+     through the map
+  */
+
+  printf("  \"load\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    static char *names[] = { "raw", "fits", "fz" };
+    char fname[256];
+
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+    sky_frame( in, (long)size*size );
+    c.size = size;
+    c.len = len;
+    c.fname = fname;
+    for( type=SI_LOAD_RAW; type<=SI_LOAD_RICE; type++ ) {
+      close( fits_tmpfile( fname, sizeof(fname)));
+      load_file( type, fname, in, size, size );
+
+      for( k=0; k<3; k++ ) {
+        c.k = k;
+        bench_run( &b, BENCH_MINREP, case_load, &c );
+        bench_print( &first, &b, 0, "\"size\": %d, \"file\": \"%s\""
+                     ", \"kernel\": \"%s\"", size, names[type],
+                     k == 0 ? "read" : k == 1 ? "preview" : "rows" );
+      }
+      unlink( fname );
+    }
+  }
+  printf("\n  ],\n");
+
+  /* the page faults of a fresh buffer, against none */
+
+  printf("  \"frames\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    struct SI_FRAMES_STATS fs;
+
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+    if( !(c.fp = si_frames_new( 2, len )))
+      die("frames: %s\n", strerror(errno));
+    si_frames_stats( c.fp, &fs );
+
+    c.size = size;
+    c.len = len;
+    for( k=0; k<2; k++ ) {
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_frames, &c );
+      bench_print( &first, &b, 0, "\"size\": %d, \"kernel\": \"%s\""
+                   ", \"huge\": %d", size, k ? "pool" : "malloc",
+                   k ? fs.huge : 0 );
+    }
+    si_frames_free( c.fp );
+  }
+  printf("\n  ],\n");
+
+  bench_stages();
+  bench_shm( demux_size( &g[0] ));
+  bench_handoff( demux_size( &g[0] ));
+
+  /* two writers and room for four frames, the time taken includes
+     draining what is left at the end
+  */
+
+  printf("  \"writer\": [");
+  first = 1;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+
+    for( k=0; k<2; k++ ) {
+      struct SI_WRITER_STATS ws;
+      char base[256], fname[300];
+      int fd;
+
+      fd = fits_tmpfile( base, sizeof(base));
+      close( fd );
+      unlink( base );
+      if( !(c.w = si_writer_start( 2, 4*si_fits_bound( size, size ) +
+                                   4*4096L, k ? SI_WRITER_DIRECT : 0 )))
+        die("writer: %s\n", strerror(errno));
+
+      c.size = size;
+      c.fname = base;
+      bench_run( &b, BENCH_MINREP, case_writer, &c );
+      t = si_camera_time();
+      si_writer_drain( c.w );
+      b.time += si_camera_time() - t;
+      si_writer_stats( c.w, &ws );
+      si_writer_stop( c.w );
+      n = b.passes;
+      for( j=0; j<8 && j<n; j++ ) {
+        snprintf( fname, sizeof(fname), "%s-%d.fits", base, j );
+        unlink( fname );
+      }
+
+      printf("%s\n    { \"size\": %d, \"kernel\": \"%s\""
+             ", \"frames\": %d, \"mbps\": %.1f, \"queue_mbps\": %.1f"
+             ", \"waits\": %ld, \"wait_ms\": %.3f, \"max_frames\": %d"
+             ", \"write_ms\": %.3f, \"failed\": %ld }",
+             first ? "" : ",", size, k ? "direct" : "buffered", n,
+             (double)len*n/b.time*1.0e-6, (double)len*n/b.busy*1.0e-6,
+             ws.waits, ws.wait_time*1.0e3, ws.max_frames,
+             ws.written ? ws.write_time/ws.written*1.0e3 : 0.0, ws.failed );
+      first = 0;
+    }
+  }
+  printf("\n  ],\n");
+
+  /* a table giving the top 8 bits, to match the other two */
+
+  if( !(lut = malloc( SI_SCALE_BINS )))
+    die("out of memory\n");
+  for( k=0; k<SI_SCALE_BINS; k++ )
+    lut[k] = k>>8;
+
+  printf("  \"fill\": [");
+  first = 1;
+  c.pix = pix;
+  c.lut = lut;
+  for( i=0; i<ngeom; i++ ) {
+    size = demux_size( &g[i] );
+    len = size*size*sizeof(short);
+
+    fill_kernel( 0, rpix, in, size, lut );
+    c.size = size;
+    for( k=0; k<3; k++ ) {
+      bzero( pix, 3L*size*size );
+      fill_kernel( k, pix, in, size, lut );
+      match = memcmp( pix, rpix, 3L*size*size ) == 0;
+
+      c.k = k;
+      bench_run( &b, BENCH_MINREP, case_fill, &c );
+      bench_print( &first, &b, len, "\"size\": %d, \"impl\": \"%s\""
+                   ", \"match\": %s", size,
+                   k == 0 ? "columns" : k == 1 ? "rows" : "rows_lut",
+                   match ? "true" : "false" );
+    }
+  }
+  printf("\n  ]\n");
+
+  si_look_free( &look );
+  free( lut );
+  free( pix );
+  free( rpix );
+  free( in );
+  free( out );
+  free( ref );
+}
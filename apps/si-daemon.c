@@ -0,0 +1,375 @@
+/*
+
+Acquisition daemon for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "lib.h"
+#include "camera.h"
+#include "demux.h"
+#include "dinter.h"
+#include "pool.h"
+#include "calib.h"
+#include "shm.h"
+#include "handoff.h"
+
+/*
+  own the camera and take frames one after another until killed,
+  demuxing each buffer as it lands straight into a slot of a shared
+  memory ring (shm.c) and publishing the frame there when it is done.
+  Any number of programs may read the ring at once without a copy and
+  without ever holding up the camera; see si_shm_attach().  Any
+  camera.c spec works, synth:ramp needs no hardware.
+
+  Each frame's header has the min, max, mean, variance, saturated
+  count and a log2 histogram of every amplifier, counted as it was
+  demuxed (si_dinter_execute_stats()).
+
+  A readout with a Serial Post Scan has each line's bias taken off as
+  it is demuxed (calib.c), less SI_CALIB_PEDESTAL, and the overscan
+  trimmed, so the frames in the ring are ready to use.  --raw leaves
+  the bias on.
+
+  With --socket each frame is also, or with no --name instead, handed
+  to whoever has connected there as a sealed memfd (handoff.c).  The
+  frame is demuxed into the ring and copied to a memfd only when
+  someone is connected to take it.
+*/
+
+#define DAEMON_MAXERR 10  /* readouts failing in a row before giving up */
+
+char *xstrdup (const char *s);
+void usage ( void );
+void die ( const char *fmt, ... );
+static void stop ( int sig );
+
+const char *default_device = "/dev/sicamera0";
+const char *default_cfgfile = "Test.cfg";
+const char *default_name = SI_SHM_NAME;
+
+#define OPTIONS "f:c:s:n:r:i:x:t:u:S:RP:"
+static const struct option longopts[] = {
+  {"file",       required_argument,   0, 'f'},
+  {"cfgfile",    required_argument,   0, 'c'},
+  {"setfile",    required_argument,   0, 's'},
+  {"name",       required_argument,   0, 'n'},
+  {"slots",      required_argument,   0, 'r'},
+  {"command",    required_argument,   0, 'i'},
+  {"count",      required_argument,   0, 'x'},
+  {"threads",    required_argument,   0, 't'},
+  {"socket",     required_argument,   0, 'u'},
+  {"saturation", required_argument,   0, 'S'},
+  {"raw",        no_argument,         0, 'R'},
+  {"pedestal",   required_argument,   0, 'P'},
+  {0, 0, 0, 0},
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+int main(int argc, char *argv[] )
+{
+  struct SI_CAMERA *c;
+  struct SI_SHM *shm = NULL;
+  struct SI_HANDOFF *hand = NULL;
+  struct SI_SHM_FRAME meta;
+  struct SI_DINTER_PLAN plan;
+  struct SI_CALIB cal;
+  struct SI_BUFFER b;
+  struct sigaction sa;
+  struct timespec ts;
+  char *device = xstrdup (default_device);
+  char *cfgfile = xstrdup (default_cfgfile);
+  char *setfile = NULL;
+  char *name = NULL;
+  char *sockpath = NULL;
+  unsigned short *out, *mem;
+  unsigned long seq;
+  long handed;
+  double last, t0;
+  long npix, n;
+  int nslots = 4;
+  int saturation = 0;
+  int raw = 0;
+  int pedestal = SI_CALIB_PEDESTAL;
+  int cmd = 'D';
+  int count = 0;
+  int parlen, n_cols, n_rows, ret, errors, inrow, ch, i;
+  long bytes;
+
+  if (!(c = calloc(1, sizeof(*c))))
+    die ("out of memory\n");
+
+  while ((ch = getopt_long (argc, argv, OPTIONS, longopts, NULL)) != -1) {
+    switch (ch) {
+      case 'f': /* --file DEVICE or a camera.c spec */
+        free (device);
+        device = xstrdup (optarg);
+        break;
+      case 'c': /* --cfgfile FILE */
+        free (cfgfile);
+        cfgfile = xstrdup (optarg);
+        break;
+      case 's': /* --setfile FILE */
+        free (setfile);
+        setfile = xstrdup (optarg);
+        break;
+      case 'n': /* --name NAME */
+        free (name);
+        name = xstrdup (optarg);
+        break;
+      case 'r': /* --slots N */
+        if ((nslots = atoi (optarg)) < 2)
+          usage ();
+        break;
+      case 'i': /* --command C */
+        if (strlen (optarg) != 1)
+          usage ();
+        cmd = optarg[0];
+        break;
+      case 'x': /* --count N */
+        if ((count = atoi (optarg)) < 0)
+          usage ();
+        break;
+      case 't': /* --threads N */
+        if ((i = atoi (optarg)) < 1)
+          usage ();
+        si_pool_init (i);
+        break;
+      case 'u': /* --socket PATH */
+        free (sockpath);
+        sockpath = xstrdup (optarg);
+        break;
+      case 'S': /* --saturation N */
+        if ((saturation = atoi (optarg)) < 1 || saturation > 65535)
+          usage ();
+        break;
+      case 'R': /* --raw */
+        raw = 1;
+        break;
+      case 'P': /* --pedestal N */
+        if ((pedestal = atoi (optarg)) < 0 || pedestal > 65535)
+          usage ();
+        break;
+      case 'h':
+      default:
+        usage ();
+    }
+  }
+  if (!name && !sockpath)
+    name = xstrdup (default_name);
+
+  if (si_load_camera_cfg( c, cfgfile ) < 0)
+    die ("%s: %s\n", cfgfile, strerror (errno));
+  if (setfile && si_setfile_readout( c, setfile ) < 0)
+    die ("%s: %s\n", setfile, strerror (errno));
+  if (si_camera_open( c, device ) < 0)
+    die ("%s: %s\n", device, strerror (errno));
+  if (setfile && si_camera_send_readout( c ) < 0)
+    die ("error sending readout params to camera: %s\n", strerror (errno));
+  if (si_camera_load_readout( c ) < 0 || si_camera_load_config( c ) < 0)
+    die ("error receiving params from camera: %s\n", strerror (errno));
+
+  /* the frame as si-bench and si-test demux it, side by side, unless
+   * the cfg file gives the camera a readout layout of its own
+   */
+  parlen = c->readout[READOUT_PARLEN_IX];
+  if (si_camera_plan( c, &plan, &n_cols, &n_rows ) < 0)
+    die ("%s: readout layout does not fit the readout\n", cfgfile);
+  bytes = (long)n_cols*n_rows*sizeof(short);
+  bzero (&cal, sizeof(cal));
+  cal.subtract = !raw;
+  cal.pedestal = pedestal;
+  if (si_calib_start( &cal, &plan, parlen, c->readout[READOUT_SERPOST_IX],
+                      c->readout[READOUT_PARPOST_IX] ) < 0)
+    die ("calib: %s\n", strerror (errno));
+  npix = si_calib_total( &cal );
+
+  if (si_camera_dma_config( c, si_camera_frame_bytes( c ), 0, 0,
+                            SI_DMA_CONFIG_WAKEUP_EACH ) < 0)
+    die ("dma config: %s\n", strerror (errno));
+  if (name && !(shm = si_shm_create( name, nslots, bytes )))
+    die ("%s: %s\n", name, strerror (errno));
+  if (sockpath && !(hand = si_handoff_listen( sockpath, bytes )))
+    die ("%s: %s\n", sockpath, strerror (errno));
+
+  /* no SA_RESTART, a signal ends the wait for the next buffer
+   */
+  bzero (&sa, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  if (shm)
+    printf ("%s: %d slots of %dx%d from %s\n", name, nslots, n_cols, n_rows,
+            c->backend->name);
+  if (hand)
+    printf ("%s: %dx%d frames from %s\n", sockpath, n_cols, n_rows,
+            c->backend->name);
+  fflush (stdout);
+
+  bzero (&meta, sizeof(meta));
+  errors = inrow = 0;
+  seq = 0;
+  handed = 0;
+  t0 = si_camera_time ();
+  while (!stopping && (count == 0 || seq < count)) {
+    if (shm)
+      out = si_shm_begin( shm );
+    else if (!(out = si_handoff_begin( hand )))
+      die ("memfd: %s\n", strerror (errno));
+    last = 0.0;
+    ret = -1;
+    si_dinter_stats_start( &meta.amps, plan.nlanes, saturation );
+    si_calib_start( &cal, &plan, parlen, cal.serpost, cal.parpost );
+    if (si_camera_start( c, cmd ) == 0) {
+      while ((ret = si_camera_next_buffer( c, &b )) > 0) {
+        if (b.last)
+          last = b.time;
+        if (b.offset/2 >= npix)
+          continue;
+        n = b.len/2;
+        if (n > npix - b.offset/2)
+          n = npix - b.offset/2;
+        si_calib_execute( &cal, b.data, out, b.offset/2, n, &meta.amps );
+      }
+    }
+    if (ret < 0 || last == 0.0) {
+      if (!stopping)
+        fprintf (stderr, "frame %d: %s\n", c->frame, strerror (errno));
+      si_camera_abort( c );
+      meta.dropped++;
+      errors++;
+      if (++inrow == DAEMON_MAXERR)
+        die ("%d readouts failed in a row\n", inrow);
+      continue;
+    }
+    inrow = 0;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+    meta.n_cols = n_cols;
+    meta.n_rows = n_rows;
+    meta.time = ts.tv_sec + ts.tv_nsec*1e-9;
+    meta.readout_time = last - c->start_time;
+    meta.status = c->dma_status.status;
+    meta.frame = c->frame;
+    memcpy (meta.readout, c->readout, sizeof(meta.readout));
+    memcpy (meta.config, c->config, sizeof(meta.config));
+    si_dinter_stats_end( &meta.amps );
+    si_calib_end( &cal );
+    meta.pedestal = cal.subtract && cal.serpost ? cal.pedestal : -1;
+    memcpy (meta.bias, cal.mean, sizeof(meta.bias));
+
+    /* into a memfd as well only for someone to take it
+     */
+    mem = NULL;
+    if (hand && shm && si_handoff_accept( hand ) > 0) {
+      if (!(mem = si_handoff_begin( hand )))
+        die ("memfd: %s\n", strerror (errno));
+      memcpy (mem, out, bytes);
+    }
+    if (shm)
+      seq = si_shm_publish( shm, &meta );
+    else
+      seq++;
+    if (hand && (mem || !shm)) {
+      if ((ret = si_handoff_publish( hand, &meta )) < 0)
+        die ("memfd: %s\n", strerror (errno));
+      handed += ret;
+    }
+  }
+  t0 = si_camera_time () - t0;
+
+  fprintf (stderr, "%lu frames, %d failed, %.2f frames/s %.1f MB/s\n",
+           seq, errors, seq/t0, seq*(double)bytes/t0*1e-6);
+  if (hand)
+    fprintf (stderr, "%ld handed over %s\n", handed, sockpath);
+
+  si_handoff_close( hand );
+  si_shm_close( shm );
+  si_camera_close( c );
+  si_calib_free( &cal );
+  free (device);
+  free (cfgfile);
+  free (setfile);
+  free (name);
+  free (sockpath);
+  exit (0);
+}
+
+static void stop ( int sig )
+{
+  stopping = 1;
+}
+
+void die (const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    vfprintf (stderr, fmt, ap);
+    va_end (ap);
+    exit (1);
+}
+
+
+void usage ( void )
+{
+  fprintf (stderr,
+"Usage: si-daemon OPTIONS\n"
+"    -f,--file=DEVICE    device or camera spec [%s]\n"
+"    -c,--cfgfile=FILE   camera config names and limits [%s]\n"
+"    -s,--setfile=FILE   camera settings to send first\n"
+"    -n,--name=NAME      shared memory ring [%s]\n"
+"    -r,--slots=N        frames in the ring [4]\n"
+"    -i,--command=C      image command, D exposed, E dark, C test [D]\n"
+"    -x,--count=N        stop after N frames [run until killed]\n"
+"    -t,--threads=N      demux threads [one per cpu]\n"
+"    -u,--socket=PATH    hand frames over a unix socket as well, or\n"
+"                        instead with no --name\n"
+"    -S,--saturation=N   count each amp's pixels from N up [65535]\n"
+"    -R,--raw            leave the bias on, only trim the overscan\n"
+"    -P,--pedestal=N     left under the image after the bias [%d]\n",
+           default_device, default_cfgfile, default_name, SI_CALIB_PEDESTAL);
+  exit (1);
+}
+
+char *xstrdup (const char *s)
+{
+  char *cpy = NULL;
+  if (s) {
+    if (!(cpy = strdup (s))) {
+      fprintf (stderr, "out of memory\n");
+      exit (1);
+    }
+  }
+  return cpy;
+}
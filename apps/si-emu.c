@@ -0,0 +1,187 @@
+/*
+
+Camera emulator on a pseudo terminal for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+#define _GNU_SOURCE /* posix_openpt and friends */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "lib.h"
+#include "emu.h"
+
+/*
+  answer the camera serial protocol on a pseudo terminal, print its
+  name and serve until killed.  Point a program at it with
+  -f tty:NAME.  The camera starts with the readout and configuration
+  of the setfile, and checks what it is sent against the cfg file.
+*/
+
+char *xstrdup (const char *s);
+void usage ( void );
+void die ( const char *fmt, ... );
+static void stop ( int sig );
+
+const char *default_cfgfile = "Test.cfg";
+
+#define OPTIONS "c:s:e:"
+static const struct option longopts[] = {
+  {"cfgfile",    required_argument,   0, 'c'},
+  {"setfile",    required_argument,   0, 's'},
+  {"emulate",    required_argument,   0, 'e'},
+  {0, 0, 0, 0},
+};
+
+int main(int argc, char *argv[] )
+{
+  struct SI_CAMERA *c;
+  struct SI_EMU e;
+  struct sigaction sa;
+  char *cfgfile = xstrdup (default_cfgfile);
+  char *setfile = NULL;
+  char *opts = NULL;
+  int master, slave, ch;
+
+  if (!(c = calloc(1, sizeof(*c))))
+    die ("out of memory\n");
+
+  while ((ch = getopt_long (argc, argv, OPTIONS, longopts, NULL)) != -1) {
+    switch (ch) {
+      case 'c': /* --cfgfile FILE */
+        free (cfgfile);
+        cfgfile = xstrdup (optarg);
+        break;
+      case 's': /* --setfile FILE */
+        free (setfile);
+        setfile = xstrdup (optarg);
+        break;
+      case 'e': /* --emulate OPTIONS */
+        free (opts);
+        opts = xstrdup (optarg);
+        break;
+      case 'h':
+      default:
+        usage ();
+    }
+  }
+
+  si_emu_init (&e);
+  if (si_emu_options (&e, opts) < 0)
+    usage ();
+
+  if (si_load_camera_cfg( c, cfgfile ) < 0)
+    die ("%s: %s\n", cfgfile, strerror (errno));
+  e.e_readout = c->e_readout;
+  e.e_config = c->e_config;
+
+  /* setfile values over the power on ones
+   */
+  if (setfile) {
+    memcpy (c->readout, e.readout, sizeof(c->readout));
+    memcpy (c->config, e.config, sizeof(c->config));
+    if (si_setfile_readout( c, setfile ) < 0 ||
+        si_setfile_config( c, setfile ) < 0)
+      die ("%s: %s\n", setfile, strerror (errno));
+    memcpy (e.readout, c->readout, sizeof(e.readout));
+    memcpy (e.config, c->config, sizeof(e.config));
+  }
+
+  /* Hold the far end open ourselves, so clients can come and go
+   */
+  if ((master = posix_openpt (O_RDWR|O_NOCTTY)) < 0 ||
+      grantpt (master) < 0 || unlockpt (master) < 0)
+    die ("pty: %s\n", strerror (errno));
+  if ((slave = open (ptsname (master), O_RDWR|O_NOCTTY)) < 0 ||
+      si_init_tty (slave, e.timeout) < 0)
+    die ("%s: %s\n", ptsname (master), strerror (errno));
+
+  /* no SA_RESTART, a signal ends si_emu_serve */
+  bzero (&sa, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  printf ("%s\n", ptsname (master));
+  fflush (stdout);
+
+  if (si_emu_serve (&e, master) < 0)
+    perror ("serve");
+
+  fprintf (stderr, "commands %d dropped %d corrupted %d cut %d nak %d "
+           "rejected %d\n", e.ncommands, e.ndropped, e.ncorrupted, e.ncut,
+           e.nnaked, e.nrejected);
+
+  close (slave);
+  close (master);
+  free (cfgfile);
+  free (setfile);
+  free (opts);
+  exit (0);
+}
+
+static void stop ( int sig )
+{
+}
+
+void die (const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start (ap, fmt);
+    vfprintf (stderr, fmt, ap);
+    va_end (ap);
+    exit (1);
+}
+
+
+void usage ( void )
+{
+  fprintf (stderr,
+"Usage: si-emu OPTIONS\n"
+"    -c,--cfgfile=FILE   camera config names and limits [%s]\n"
+"    -s,--setfile=FILE   camera settings file\n"
+"    -e,--emulate=OPTS   latency=MS,jitter=MS,baud=N,timeout=MS,\n"
+"                        drop=P,corrupt=P,cut=P,nak=P,seed=N\n",
+           default_cfgfile);
+  exit (1);
+}
+
+char *xstrdup (const char *s)
+{
+  char *cpy = NULL;
+  if (s) {
+    if (!(cpy = strdup (s))) {
+      fprintf (stderr, "out of memory\n");
+      exit (1);
+    }
+  }
+  return cpy;
+}
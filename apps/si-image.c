@@ -43,24 +43,50 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
 
 
 #include "si3097.h"
 #include "si_app.h"
 #include "lib.h"
+#include "camera.h"
 #include "demux.h"
+#include "dinter.h"
+#include "look.h"
+#include "calib.h"
+#include "scale.h"
+#include "fits.h"
+#include "writer.h"
+#include "frames.h"
+#include "ring.h"
+#include "pool.h"
+#include "load.h"
 #include "uart.h"
 
 #define BOX_PACK 0
 #define FRAME_SPACE 3
+#define ARCHIVE_BUDGET (256L*1024*1024) /* frames waiting for the disk */
+#define FRAMES 6 /* being demuxed, waiting or being scaled, on show */
+#define VIEWS 3 /* being made, waiting to be shown, on show */
+#define STAGE_DEPTH 2 /* frames a stage may fall behind before the one
+                         before it waits */
+#define LOAD_STEP 8 /* a loaded file is first shown from every 8th pixel
+                       of every 8th row */
+#define LOAD_BAND 256 /* rows loaded between looks for a newer pick */
 
 
 gboolean dma_poll( gpointer *dp );
 void destroy( GtkWidget *widget, gpointer   data );
 void do_abort( GtkWidget *widget, gpointer   data );
-void dma_done( gpointer a, gint b, GdkInputCondition condition );
-void *image_fill( void *v );
+gboolean dma_done( gpointer data );
+void dma_demux( struct SI_CAMERA *head, struct SI_BUFFER *b );
+void *stage_acquire( void *v );
+void *stage_scale( void *v );
+void *stage_save( void *v );
+void *stage_load( void *v );
+int load_file( struct SI_CAMERA *head, char *fname, void **next );
+gboolean stage_show( gpointer data );
+int stages_start( struct SI_CAMERA *head );
+void stages_stop( struct SI_CAMERA *head );
 void dma_go( struct SI_CAMERA *head, int cmd );
 void do_start( GtkWidget *widget, gpointer   data );
 void do_params( GtkWidget *widget, gpointer   data );
@@ -69,24 +95,19 @@ void do_load( GtkWidget *widget, void *dp );
 int store_filename (GtkWidget *widget, void *dp);
 void do_save( GtkWidget *widget, void *dp);
 void fun_fill( void *dp );
-void fill_pix_with_data( struct SI_CAMERA *head, unsigned short *data,
-                         int side );
-void scale_data( unsigned short *data, int n );
-
-static inline unsigned char false_color_red( unsigned short dp )
-{
-  return dp>>8;
-}
-
-static inline unsigned char false_color_green( unsigned short dp )
-{
-  return dp>>8;
-}
-
-static inline unsigned char false_color_blue( unsigned short dp )
-{
-  return dp>>8;
-}
+int view_make( struct SI_CAMERA *head, struct SI_VIEW *v,
+               struct SI_FRAME *f );
+void view_drop( struct SI_CAMERA *head, struct SI_VIEW *v );
+void do_scale( gpointer data );
+gboolean view_expose( GtkWidget *widget, GdkEventExpose *event,
+                      gpointer data );
+void view_show( struct SI_CAMERA *head, struct SI_VIEW *v );
+void view_zoom( struct SI_CAMERA *head );
+void do_zoom_in( GtkWidget *widget, gpointer data );
+void do_zoom_out( GtkWidget *widget, gpointer data );
+void do_archive( GtkWidget *widget, gpointer data );
+void archive_frame( struct SI_CAMERA *head, struct SI_FRAME *f );
+int frames_for_dma( struct SI_CAMERA *head );
 
 /*
 gboolean timeout( dp )
@@ -112,15 +133,9 @@ gboolean dma_poll( gpointer *dp )
 //  if( head->fraction > 1.0 )
 //    head->dma_active = 0;
 
-  if( head->dma_active ) {
+  if( head->running )
     gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar),head->fraction);
-    return 1;
-  } else  {
-    gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar), 0.0 );
-    gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar),"DMA not active" );
-    gtk_image_set_from_pixbuf( GTK_IMAGE(head->image), head->pix );
-    return 0;
-  }
+  return 1;
 }
 
 void destroy( GtkWidget *widget, gpointer   data )
@@ -133,90 +148,447 @@ void do_abort( GtkWidget *widget, gpointer   data )
   struct SI_CAMERA *head;
 
   head = (struct SI_CAMERA *)data;
-  head->dma_active = 0;
   head->fraction = 0.0;
-  head->dma_aborted = 1;
+  __atomic_store_n( &head->dma_aborted, 1, __ATOMIC_RELAXED );
 
-  if( ioctl( head->fd, SI_IOCTL_DMA_ABORT, NULL ))
+  if( head->backend && si_camera_abort( head ) < 0 )
     perror("dma_abort");
 
-
 }
 
-void dma_done( gpointer a, gint b, GdkInputCondition condition )
+/* the acquire thread has finished with a readout and its dma buffer,
+   so the next may be started
+*/
+
+gboolean dma_done( gpointer data )
 {
   struct SI_CAMERA *head;
 
-  if( condition != GDK_INPUT_READ )
-    return;
-
-  head = (struct SI_CAMERA *)a;
+  head = (struct SI_CAMERA *)data;
+  head->running = 0;
 
-  if( ioctl( head->fd, SI_IOCTL_DMA_NEXT, &head->dma_status )) {
-    perror("dma_next");
+  if( head->dma_aborted ) {
+    gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA Aborted" );
+    head->dma_aborted = 0;
+    return FALSE;
   }
+  gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar),1.0);
+  gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA Done" );
 
-  if( head->dma_status.status & SI_DMA_STATUS_DONE)  {
-    int serlen, parlen;
+  if( head->contin )
+     dma_go( head, head->command);
+  return FALSE;
+}
 
 
-    gdk_input_remove( head->dma_done_handle );
-    head->dma_done_handle = 0;
-    head->dma_active = 0;
+/* demux what has arrived up to the end of buffer b, so with
+   WAKEUP_EACH the image is nearly done when the dma is.  The stats
+   for scaling are taken as the rows are finished
+*/
 
-    if( head->dma_aborted ) {
-      gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA Aborted" );
-      head->dma_aborted = 0;
-      return;
-    } else {
-      gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar),1.0);
-      gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA Done" );
-   }
+void dma_demux( struct SI_CAMERA *head, struct SI_BUFFER *b )
+{
+  int serlen, parlen, serpost, parpost, n_cols, n_rows;
+  long n, total;
 
-    serlen = head->readout[READOUT_SERLEN_IX];
-    parlen = head->readout[READOUT_PARLEN_IX];
+  serlen = head->readout[READOUT_SERLEN_IX];
+  parlen = head->readout[READOUT_PARLEN_IX];
+  serpost = head->readout[READOUT_SERPOST_IX];
+  parpost = head->readout[READOUT_PARPOST_IX];
+
+  if( head->demux_pos == 0 ) {
     printf("starting demux\n");
-    if( serlen < 1025 ) {
-      head->side = 2048;
-    } else {
-      head->side = 4096;
+
+    /* four quadrants side by side, 2048 or 4096 square, unless the
+       cfg file gave a readout layout
+    */
+    if( si_camera_plan( head, &head->demux_plan, &n_cols, &n_rows ) < 0 ) {
+      perror("readout layout");
+      return;
     }
 
-    if( head->fill )
-      pthread_join( head->fill, NULL ); /* must be done before flip */
+    if( !head->demux && !(head->demux = si_frame_get( head->frames, 1 ))) {
+      perror("frame");
+      return;
+    }
+    head->demux->n_cols = n_cols;
+    head->demux->n_rows = n_rows;
+
+    /* the header is made later, on another thread, by when the
+       camera may have moved on to the next readout
+    */
+    head->demux->taken = 1;
+    head->demux->frame = head->frame;
+    memcpy( head->demux->readout, head->readout, sizeof(head->readout));
+    memcpy( head->demux->config, head->config, sizeof(head->config));
+    memcpy( head->demux->status, head->status, sizeof(head->status));
+
+    /* with overscan each line's bias comes off as it is demuxed,
+       without it the display levels are taken on the way
+    */
+    head->look.p = NULL;
+    head->calib.p = NULL;
+    head->calib.subtract = 1;
+    head->calib.pedestal = SI_CALIB_PEDESTAL;
+    if( serpost || parpost ) {
+      if( si_calib_start( &head->calib, &head->demux_plan, parlen,
+                          serpost, parpost ) < 0 ) {
+        perror("calib");
+        head->calib.p = NULL;
+      } else
+        si_dinter_stats_start( &head->amps, head->demux_plan.nlanes, 0 );
+    } else if( si_look_start( &head->look, &head->demux_plan,
+                              (long)head->demux_plan.nlanes*serlen*parlen,
+                              n_cols, n_rows, NULL, 0, 0 ) < 0 )
+      perror("look");
+  }
 
-    si_camera_demux_gen( head->flip_data, head->ptr, head->side,
-                         serlen, parlen );
+  if( !head->demux )
+    return;
+  n = (b->offset + b->len)/sizeof(short);
+  if( head->calib.p )
+    total = si_calib_total( &head->calib );
+  else
+    total = (long)head->demux_plan.nlanes*serlen*parlen;
+  if( n > total )
+    n = total;
+  n -= head->demux_pos;
+  if( n <= 0 )
+    return;
+
+  if( head->calib.p )
+    si_calib_execute( &head->calib, head->ptr + head->demux_pos,
+                      head->demux->data, head->demux_pos, n, &head->amps );
+  else if( head->look.p )
+    si_look_execute( &head->look, head->ptr + head->demux_pos,
+                     head->demux->data, head->demux_pos, n );
+  else
+    si_dinter_execute_par( &head->demux_plan, head->ptr + head->demux_pos,
+                           head->demux->data, head->demux_pos, n );
+  head->demux_pos += n;
+}
+
+/*
+  si-image runs as a pipeline of threads started once, each stage
+  handing frames to the next through a ring (ring.c) and waiting only
+  when the one after it has fallen STAGE_DEPTH behind.
+
+    acquire  each dma wakeup demuxed as it lands, then the frame to
+             scale and, with Archive ticked, to save
+    scale    the histogram, display levels and binned pyramid of the
+             frame into a free view
+    show     the gui thread takes the newest view, as an idle call
+    save     the frame to the background writer
+
+  Only the gui thread calls gtk.  A view the gui has not got round to
+  when a newer one is ready is dropped, so a slow display never holds
+  up the camera; nothing else is.  The dma buffer is read by acquire
+  alone and is done with before dma_done() lets the next readout
+  start, which is why demux is not a stage of its own.
+*/
+
+void *stage_acquire( void *v )
+{
+  struct SI_CAMERA *head;
+  struct SI_FRAME *f;
+  struct SI_BUFFER b;
+  void *p;
+  int i, ret;
+
+  head = (struct SI_CAMERA *)v;
+
+  /* dma_go() sends one for every readout it starts, NULL to end */
+
+  while( si_ring_pop( head->go, &p, 1 ) == 0 && p ) {
+    head->demux_pos = 0;
+    while( (ret = si_camera_next_buffer( head, &b )) != 0 ) {
+      if( ret < 0 ) {
+        if( (errno == EWOULDBLOCK || errno == EINTR) &&
+            !__atomic_load_n( &head->dma_aborted, __ATOMIC_RELAXED ))
+          continue; /* a long exposure */
+        perror("dma_next");
+        break;
+      }
+      dma_demux( head, &b );
+      head->fraction = (double)(b.offset + b.len) /
+                       (double)head->dma_config.total;
+    }
 
     printf("dma_done, transferred %d\n", head->dma_status.transferred );
-    pthread_create(&head->fill, NULL, image_fill, head );
+    f = head->demux;
+    head->demux = NULL;
+    if( f && head->calib.p ) {
+      si_calib_end( &head->calib );
+      si_dinter_stats_end( &head->amps );
+      f->amps = head->amps;
+      for( i=0; i<f->amps.namps; i++ )
+        printf("amp %d bias %.1f\n", i, head->calib.mean[i] );
+    } else if( f && head->look.p ) {
+      si_look_end( &head->look, f->data );
+      f->amps = head->look.amps;
+      printf("max %d\n", head->look.stats.max );
+    }
+    if( f && (head->calib.p || head->look.p )) {
+      for( i=0; i<f->amps.namps; i++ )
+        printf("amp %d mean %.1f sd %.1f min %d max %d saturated %ld\n", i,
+               f->amps.amp[i].mean, sqrt( f->amps.amp[i].var ),
+               f->amps.amp[i].min, f->amps.amp[i].max,
+               f->amps.amp[i].saturated );
+    }
+    if( __atomic_load_n( &head->dma_aborted, __ATOMIC_RELAXED )) {
+      si_frame_put( f );
+      f = NULL;
+    }
+    g_idle_add( dma_done, head );
+
+    if( !f )
+      continue;
+    if( __atomic_load_n( &head->archive, __ATOMIC_RELAXED )) {
+      si_frame_ref( f );
+      si_ring_push( head->to_save, f, 1 );
+    }
+    si_ring_push( head->to_scale, f, 1 );
+  }
+  return NULL;
+}
+
+void *stage_scale( void *v )
+{
+  struct SI_CAMERA *head;
+  struct SI_FRAME *f;
+  struct SI_VIEW *view;
+  void *p, *old;
 
-    if( head->contin )
-       dma_go( head, head->command);
+  head = (struct SI_CAMERA *)v;
+  while( si_ring_pop( head->to_scale, &p, 1 ) == 0 && p ) {
+    f = (struct SI_FRAME *)p;
+    si_ring_pop( head->views, &p, 1 );
+    view = (struct SI_VIEW *)p;
+    if( view_make( head, view, f ) < 0 ) {
+      view_drop( head, view );
+      continue;
+    }
 
-  } else   {
-    double frac;
-//    printf("dma_wakeup, so far transferred %d\n", head->dma_status.transferred);
-    frac = (double)head->dma_status.transferred /
-           (double)head->dma_config.total;
-    gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar),frac);
-    gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA Active" );
+    /* the gui is behind, what it has not shown yet never will be */
+
+    while( si_ring_push( head->to_show, view, 0 ) < 0 ) {
+      if( si_ring_pop( head->to_show, &old, 0 ) == 0 ) {
+        view_drop( head, (struct SI_VIEW *)old );
+        __atomic_add_fetch( &head->dropped, 1, __ATOMIC_RELAXED );
+      }
+    }
+    g_idle_add( stage_show, head );
   }
+  return NULL;
 }
 
+void *stage_save( void *v )
+{
+  struct SI_CAMERA *head;
+  void *p;
+
+  head = (struct SI_CAMERA *)v;
+  while( si_ring_pop( head->to_save, &p, 1 ) == 0 && p ) {
+    archive_frame( head, (struct SI_FRAME *)p );
+    si_frame_put( (struct SI_FRAME *)p );
+  }
+  return NULL;
+}
 
-void *image_fill( void *v )
+/* files picked with Load, each shown as a preview and then whole */
+
+void *stage_load( void *v )
 {
   struct SI_CAMERA *head;
+  char *fname;
+  void *p;
 
-  printf("start image fill\n");
   head = (struct SI_CAMERA *)v;
+  if( si_ring_pop( head->to_load, &p, 1 ) < 0 )
+    return NULL;
+  while( (fname = (char *)p) ) {
+    if( !load_file( head, fname, &p ) &&
+        si_ring_pop( head->to_load, &p, 1 ) < 0 )
+      p = NULL;
+    g_free( fname );
+  }
+  return NULL;
+}
+
+/* a frame from the pool for n_cols by n_rows, NULL if there is none
+   that big
+*/
+
+static struct SI_FRAME *load_frame( struct SI_FRAMES *pool, int n_cols,
+                                    int n_rows )
+{
+  struct SI_FRAME *f;
+
+  if( !(f = si_frame_get( pool, 1 )))
+    return NULL;
+  if( (long)n_cols*n_rows*sizeof(short) > f->bytes ) {
+    si_frame_put( f );
+    return NULL;
+  }
+  f->n_cols = n_cols;
+  f->n_rows = n_rows;
+  return f;
+}
+
+/* fname through the pipeline, first every LOAD_STEP'th pixel, which
+   reads only those rows of the file, then the whole image.  If
+   another file is picked meanwhile the rest is not read, and 1 is
+   returned with what was picked in *next.  On the load thread, holding
+   the frame pool so Start making a bigger one does not free it under us
+*/
+
+int load_file( struct SI_CAMERA *head, char *fname, void **next )
+{
+  struct SI_LOAD l;
+  struct SI_FRAMES *pool;
+  struct SI_FRAME *f;
+  long room;
+  int step, row, n, ret;
+
+  pthread_mutex_lock( &head->frames_lock );
+  if( (pool = head->frames))
+    si_frames_hold( pool );
+  pthread_mutex_unlock( &head->frames_lock );
+  if( !pool ) {
+    printf("no frame to load %s into\n", fname );
+    return 0;
+  }
+  room = si_frames_bytes( pool );
+
+  /* a raw file not square is as wide as the readout makes it */
+
+  if( si_load_open( &l, fname, 2*head->readout[READOUT_SERLEN_IX] ) < 0 ) {
+    printf("cant load %s: %s\n", fname, strerror(errno));
+    si_frames_free( pool );
+    return 0;
+  }
+  printf("loading %s, %d by %d\n", fname, l.n_cols, l.n_rows );
+
+  ret = 0;
+  step = LOAD_STEP;
+  if( (long)l.n_cols*l.n_rows*sizeof(short) > room ) {
+    while( (long)((l.n_cols + step - 1)/step)*((l.n_rows + step - 1)/step)*
+           sizeof(short) > room )
+      step *= 2;
+    printf("%s is too big to show whole, every %dth pixel only\n",
+           fname, step );
+  } else if( l.n_cols < 2*step || l.n_rows < 2*step )
+    step = 1;  /* too small to bother */
+
+  if( step > 1 ) {
+    if( !(f = load_frame( pool, (l.n_cols + step - 1)/step,
+                          (l.n_rows + step - 1)/step ))) {
+      printf("no frame to load %s into\n", fname );
+      goto done;
+    }
+    if( si_load_preview( &l, f->data, step ) < 0 ) {
+      printf("cant read %s: %s\n", fname, strerror(errno));
+      si_frame_put( f );
+      goto done;
+    }
+    si_ring_push( head->to_scale, f, 1 );  /* shown like any other */
+    if( step > LOAD_STEP )
+      goto done;
+  }
 
-  scale_data( head->flip_data, head->side );
-  fill_pix_with_data( head, head->flip_data, head->side );
-  gtk_image_set_from_pixbuf( GTK_IMAGE(head->image), head->pix );
-  printf("finished image fill\n");
-  pthread_exit(NULL);
+  if( !(f = load_frame( pool, l.n_cols, l.n_rows ))) {
+    printf("no frame to load %s into\n", fname );
+    goto done;
+  }
+  for( row=0; row<l.n_rows; row+=n ) {
+    if( si_ring_pop( head->to_load, next, 0 ) == 0 ) {
+      si_frame_put( f );
+      ret = 1;
+      goto done;
+    }
+    n = l.n_rows - row < LOAD_BAND ? l.n_rows - row : LOAD_BAND;
+    if( si_load_rows( &l, f->data + (long)row*l.n_cols, row, n ) < 0 ) {
+      printf("cant read %s: %s\n", fname, strerror(errno));
+      si_frame_put( f );
+      goto done;
+    }
+  }
+  si_ring_push( head->to_scale, f, 1 );
+  printf("done loading %s\n", fname );
+
+done:
+  si_load_close( &l );
+  si_frames_free( pool );
+  return ret;
+}
+
+/* on the gui thread, the newest view ready */
+
+gboolean stage_show( gpointer data )
+{
+  struct SI_CAMERA *head;
+  struct SI_VIEW *v;
+  void *p;
+
+  head = (struct SI_CAMERA *)data;
+  v = NULL;
+  while( si_ring_pop( head->to_show, &p, 0 ) == 0 ) {
+    if( v ) {
+      view_drop( head, v );
+      __atomic_add_fetch( &head->dropped, 1, __ATOMIC_RELAXED );
+    }
+    v = (struct SI_VIEW *)p;
+  }
+  if( v )
+    view_show( head, v );
+  return FALSE;
+}
+
+/* the rings, views and threads of the pipeline.  0 or -1 */
+
+int stages_start( struct SI_CAMERA *head )
+{
+  struct SI_VIEW *v;
+  int i;
+
+  head->go = si_ring_new( 2 );
+  head->to_load = si_ring_new( 2 );
+  head->to_scale = si_ring_new( STAGE_DEPTH );
+  head->to_save = si_ring_new( STAGE_DEPTH );
+  head->to_show = si_ring_new( 1 );
+  head->views = si_ring_new( VIEWS );
+  if( !head->go || !head->to_load || !head->to_scale || !head->to_save || !head->to_show ||
+      !head->views || !(v = calloc( VIEWS, sizeof(struct SI_VIEW))))
+    return -1;
+  for( i=0; i<VIEWS; i++ ) {
+    v[i].scale.clip = 0.25;
+    si_ring_push( head->views, &v[i], 1 );
+  }
+
+  if( pthread_create( &head->stage[0], NULL, stage_acquire, head ) != 0 ||
+      pthread_create( &head->stage[1], NULL, stage_scale, head ) != 0 ||
+      pthread_create( &head->stage[2], NULL, stage_save, head ) != 0 ||
+      pthread_create( &head->stage[3], NULL, stage_load, head ) != 0 )
+    return -1;
+  return 0;
+}
+
+/* end the threads, each after the one feeding it so nothing is left
+   waiting to push
+*/
+
+void stages_stop( struct SI_CAMERA *head )
+{
+  if( head->running )
+    do_abort( NULL, head );
+  si_ring_push( head->go, NULL, 1 );
+  si_ring_push( head->to_load, NULL, 1 );
+  pthread_join( head->stage[0], NULL );
+  pthread_join( head->stage[3], NULL );
+  si_ring_push( head->to_scale, NULL, 1 );
+  si_ring_push( head->to_save, NULL, 1 );
+  pthread_join( head->stage[1], NULL );
+  pthread_join( head->stage[2], NULL );
 }
 
 void dma_go( struct SI_CAMERA *head, int cmd )
@@ -224,29 +596,31 @@ void dma_go( struct SI_CAMERA *head, int cmd )
 
   head->dma_aborted = 0;
 
-  if( head->dma_active ) /* dont start if running */
+  if( head->running ) /* dont start if running */
     return;
 
   if( !head->dma_configed ) { /* dont start if dma not configed */
     return;
   }
+  if( frames_for_dma( head ) < 0 ) {
+    perror("frames");
+    return;
+  }
 
   head->command = cmd;
-  head->dma_active = 1;
+  head->running = 1;
+  head->demux_pos = 0;
   head->fraction = 0.05;
   gtk_progress_bar_set_text( GTK_PROGRESS_BAR(head->bar), "DMA active" );
   gtk_progress_bar_set_fraction( GTK_PROGRESS_BAR(head->bar),0.05);
 
-  head->dma_done_handle = gdk_input_add( head->fd, GDK_INPUT_READ,
-   (GdkInputFunction)dma_done, head );
-
-  if( ioctl( head->fd, SI_IOCTL_DMA_START, &head->dma_status )<0 ){
+  if( si_camera_start( head, cmd ) < 0 ) {
     perror("dma start");
+    head->running = 0;
     return;
   }
-  si_send_command_yn( head->fd, cmd );
 
-//  g_timeout_add( 200, dma_poll, head );
+  si_ring_push( head->go, head, 1 ); /* the acquire thread takes it */
 }
 
 void do_start( GtkWidget *widget, gpointer   data )
@@ -267,11 +641,16 @@ void do_controls( GtkWidget *widget, gpointer   data )
   uart_show_control( data );
 }
 
+/* the file picked goes to the load thread, taking the place of any
+   picked before it that is not done yet
+*/
+
 void do_load( GtkWidget *widget, void *dp )
 {
   GtkWidget *dialog;
   struct SI_CAMERA *head;
-  struct stat file_stat;
+  char *filename;
+  void *old;
 
   head = (struct SI_CAMERA *)dp;
 
@@ -281,38 +660,13 @@ void do_load( GtkWidget *widget, void *dp )
     GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT, NULL);
 
   if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
-    char *filename;
-    unsigned short *data;
-    int fd, n, side;
-
     filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
     gtk_widget_destroy (dialog);
     printf("opening %s\n", filename );
-    data = ( unsigned short *)malloc( 4096*4096*2);
-
-    stat( filename, &file_stat );
-    if( file_stat.st_size == 4096*4096*2 )
-      side = 4096;
-    else if( file_stat.st_size == 2048*2048*2 )
-      side = 2048;
-    else
-      side = 0;
-
-    if( side == 0 || (fd = open( filename, O_RDONLY, 0 ))<0 ) {
-      printf("cant open %s\n", filename );
-    } else {
-      if( (n = read(fd, data, side*side*2))< 0 ){
-        printf("cant read %s\n", filename );
-      }
-      scale_data( data, side ); /* side */
-      fill_pix_with_data( head, data, side );
-      gtk_image_set_from_pixbuf( GTK_IMAGE(head->image), head->pix );
-      printf("done loading %s\n", filename );
-    }
 
-    free(data);
-    close(fd);
-    g_free (filename);
+    while( si_ring_push( head->to_load, filename, 0 ) < 0 )
+      if( si_ring_pop( head->to_load, &old, 0 ) == 0 )
+        g_free( old );
   } else {
     gtk_widget_destroy (dialog);
   }
@@ -322,23 +676,43 @@ void do_load( GtkWidget *widget, void *dp )
 
 int store_filename (GtkWidget *widget, void *dp)
 {
-  int fd, n;
   struct SI_CAMERA *head;
+  struct SI_PYRAMID *py;
+  int err;
 
   head = (struct SI_CAMERA *)dp;
 
   head->fname = (char *)gtk_file_selection_get_filename(
     GTK_FILE_SELECTION(head->file_widget));
 
-  if((fd = open( head->fname, O_RDWR|O_CREAT, 0666))<0) {
-    printf("cant open filename: %s\n", head->fname);
+  /* the image on show, at its own size */
+
+  if( !head->shown ) {
+    printf("no image to save\n");
     return -1;
   }
-  if( (n = write(fd, head->flip_data, 4096*4096*2 ))<0) {
-    printf("failed to write\n");
+  py = &head->shown->pyramid;
+  if( head->writer ) {
+    if( si_writer_queue( head->writer, head, head->shown->frame,
+                         head->fname, 0, py->level[0],
+                         py->n_cols[0], py->n_rows[0] ) < 0 ) {
+      printf("cant write %s: %s\n", head->fname, strerror(errno));
+      return -1;
+    }
+    printf("writing %s\n", head->fname );
+    return 0;
+  }
+  if( si_fits_compressed( head->fname ))
+    err = si_fits_rice_save( head, head->shown->frame, head->fname,
+                             py->level[0], py->n_cols[0], py->n_rows[0] );
+  else
+    err = si_fits_save( head, head->shown->frame, head->fname, py->level[0],
+                        py->n_cols[0], py->n_rows[0] );
+  if( err < 0 ) {
+    printf("cant write %s: %s\n", head->fname, strerror(errno));
     return -1;
   }
-
+  printf("wrote %s\n", head->fname );
   return 0;
 }
 
@@ -373,26 +747,39 @@ void do_save( GtkWidget *widget, void *dp)
 
 int main( int argc, char *argv[] )
 {
-  int fd;
+  int i;
   GtkWidget *window, *vbox, *hbox, *image, *but;
   GtkWidget *vbox2, *align;
 
-  GdkPixbuf *pix, *logo;
+  GdkPixbuf *logo;
   GtkWidget *scroll, *bar;
   struct SI_CAMERA *head;
 
   head = (struct SI_CAMERA *)malloc(sizeof(struct SI_CAMERA));
   bzero(head, sizeof(struct SI_CAMERA));
-  head->flip_data  = ( unsigned short *)malloc( sizeof(short)*4096*4096);
+  pthread_mutex_init( &head->frames_lock, NULL );
+  head->dma_config.maxever = 4096*4096*2;
+  if( frames_for_dma( head ) < 0 )
+    perror("frames");
+
+  /* the acquire, scale and load threads all share the workers */
+  si_pool_init( 0 );
+  if( stages_start( head ) < 0 ) {
+    perror("stages");
+    exit(1);
+  }
 
   gtk_init (&argc, &argv);
 
- // fd = open("/dev/sicamera0", O_RDWR, 0 );
-  fd = -1;
-  head->fd = fd;
-  if( fd >= 0 ) {
+  /* the camera, any spec si_camera_open() takes, /dev/sicamera0 or
+     synth:ramp say.  Without one images can only be loaded
+  */
+
+  head->fd = -1;
+  if( argc > 1 ) {
     si_load_camera_cfg( head, "Test.cfg" );
-    si_init_com( fd, 57600, 0, 8, 1, 9000 ); /* setup uart for camera */
+    if( si_camera_open( head, argv[1] ) < 0 )
+      perror( argv[1] );
   }
 
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
@@ -413,18 +800,25 @@ int main( int argc, char *argv[] )
   gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scroll),
     GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
 
-  pix = gdk_pixbuf_new( GDK_COLORSPACE_RGB, 0, 8, 4096, 4096);
-  head->pix = pix;
-
-  image = gtk_image_new_from_pixbuf(pix);
+  image = gtk_drawing_area_new();
   head->image = image;
+  head->zoom = -1;
+  head->scale_mode = SI_SCALE_ZSCALE;
+  head->writer = si_writer_start( 2, ARCHIVE_BUDGET, SI_WRITER_DIRECT );
+  if( !head->writer )
+    perror("writer");
+  g_signal_connect (G_OBJECT (image), "expose-event",
+                    G_CALLBACK (view_expose), head );
 
   gtk_scrolled_window_add_with_viewport(GTK_SCROLLED_WINDOW(scroll),image);
   gtk_widget_show (image);
   gtk_widget_show (scroll);
 
   logo = gdk_pixbuf_new_from_file( "speclogo.jpg", NULL );
-  gtk_image_set_from_pixbuf( GTK_IMAGE(head->image), logo );
+  head->pix = logo;
+  if( logo )
+    gtk_widget_set_size_request( image, gdk_pixbuf_get_width( logo ),
+                                 gdk_pixbuf_get_height( logo ));
 
 
   align = gtk_alignment_new( 0, 0, 1, 0 );
@@ -480,14 +874,48 @@ int main( int argc, char *argv[] )
   gtk_box_pack_start(GTK_BOX(hbox),but,TRUE,TRUE,0);
   gtk_widget_show (but);
 
+  hbox = gtk_hbox_new(FALSE,0);
+  gtk_box_pack_start(GTK_BOX(vbox2),hbox,TRUE,TRUE,0);
+  gtk_widget_show (hbox);
+
+  but = gtk_button_new_with_label( "Zoom In" );
+  g_signal_connect (G_OBJECT (but), "clicked", G_CALLBACK (do_zoom_in), head );
+  gtk_box_pack_start(GTK_BOX(hbox),but,TRUE,TRUE,0);
+  gtk_widget_show (but);
+
+  but = gtk_button_new_with_label( "Zoom Out" );
+  g_signal_connect (G_OBJECT (but), "clicked", G_CALLBACK (do_zoom_out), head );
+  gtk_box_pack_start(GTK_BOX(hbox),but,TRUE,TRUE,0);
+  gtk_widget_show (but);
+
+  but = gtk_combo_box_new_text();
+  head->scale_c = but;
+  for( i=0; i<SI_SCALE_MODES; i++ )
+    gtk_combo_box_append_text( (GtkComboBox *)but, si_scale_name( i ));
+  gtk_combo_box_set_active ((GtkComboBox *)but, head->scale_mode );
+  g_signal_connect_swapped (G_OBJECT (but), "changed",
+                            G_CALLBACK (do_scale), head);
+  gtk_box_pack_start(GTK_BOX(hbox),but,TRUE,TRUE,0);
+  gtk_widget_show (but);
+
+  but = gtk_check_button_new_with_label( "Archive" );
+  head->archive_c = but;
+  g_signal_connect (G_OBJECT (but), "toggled", G_CALLBACK (do_archive), head );
+  gtk_box_pack_start(GTK_BOX(hbox),but,TRUE,TRUE,0);
+  gtk_widget_show (but);
+
   uart_setup_cmd_dat( head ); /* setup the parameter structures */
 
-  if( fd >= 0 ) {
+  if( head->backend ) {
     uart_param_load_all( head );
     uart_config_dma( NULL, head);
   }
 
+  g_timeout_add( 200, (GSourceFunc)dma_poll, head );
   gtk_main();
+  stages_stop( head );
+  si_writer_stop( head->writer ); /* saves still queued */
+  si_camera_close( head );
   return 0;
 }
 
@@ -502,7 +930,7 @@ void fun_fill( void *dp )
   GdkPixbuf *pix;
 
   head = (struct SI_CAMERA *)dp;
-  head->dma_active = 1;
+  head->running = 1;
   head->fraction = 0.0;
   //sleep(3); /* so its all black at startup */
   pix = head->pix;
@@ -533,65 +961,233 @@ void fun_fill( void *dp )
     }
   }
   head->fraction = (double)1.0;
-  head->dma_active = 0;
+  head->running = 0;
 }
 
 
-void fill_pix_with_data( struct SI_CAMERA *head, unsigned short *data,
-                         int side )
+/* show side by side data, binned down to fit the window unless
+   zoomed.  Nothing is drawn until it is exposed, and then only the
+   part of the level on screen.  On the gui thread only, from
+   stage_show(): the scale thread hands each view over through
+   to_show and never touches one again, so head->shown and the
+   pyramid drawn from are the gui's alone
+*/
+
+void view_show( struct SI_CAMERA *head, struct SI_VIEW *v )
 {
-  int stride;
-  int width, height, n_channels, row, col;
-  guchar *pixels, *p;
-  GdkPixbuf *pix;
-  unsigned short dp;
+  if( head->shown )
+    view_drop( head, head->shown );
+  head->shown = v;
+  view_zoom( head );
+}
 
-  head->dma_active = 1;
-  head->fraction = 0.0;
-  pix = head->pix;
+/* the levels and pyramid of frame f into v, which takes the caller's
+   reference to f.  On the scale thread.  0 or -1
+*/
 
-  n_channels = gdk_pixbuf_get_n_channels (pix);
+int view_make( struct SI_CAMERA *head, struct SI_VIEW *v,
+               struct SI_FRAME *f )
+{
+  struct SI_SCALE *s;
 
-  g_assert (gdk_pixbuf_get_colorspace (pix) == GDK_COLORSPACE_RGB);
-  g_assert (gdk_pixbuf_get_bits_per_sample (pix) == 8);
+  v->frame = f;
+  s = &v->scale;
+  s->mode = __atomic_load_n( &head->scale_mode, __ATOMIC_RELAXED );
+  if( si_scale_image( s, f->data, (long)f->n_cols*f->n_rows ) < 0 ) {
+    perror("scale");
+    return -1;
+  }
+  if( si_look_pyramid( &v->pyramid, f->data, f->n_cols, f->n_rows,
+                       SI_BIN_MEAN ) < 0 ) {
+    perror("pyramid");
+    return -1;
+  }
+  printf("%s %d to %d\n", si_scale_name( s->mode ), s->lo, s->hi );
+  return 0;
+}
 
-  width = side;
-  height = side;
+/* done with v, its frame goes back and it is free to make again */
 
-  stride = gdk_pixbuf_get_rowstride (pix);
-  pixels = gdk_pixbuf_get_pixels (pix);
+void view_drop( struct SI_CAMERA *head, struct SI_VIEW *v )
+{
+  si_frame_put( v->frame );
+  v->frame = NULL;
+  si_ring_push( head->views, v, 1 );
+}
 
-  for( row=0; row<height; row++ ) {
-    for( col=0; col<width; col++ ) {
-      p = pixels + col * stride + row * n_channels;
-      dp = *(data + col*width + row);
-      p[0] = false_color_red(dp)   & 0xff;  /* red */
-      p[1] = false_color_green(dp) & 0xff;  /* green */
-      p[2] = false_color_blue(dp)  & 0xff;  /* blue */
-    }
+/* size the drawing area to the level at head->zoom */
+
+void view_zoom( struct SI_CAMERA *head )
+{
+  struct SI_PYRAMID *py;
+  int level;
+
+  if( !head->shown )
+    return;
+  py = &head->shown->pyramid;
+
+  level = head->zoom;
+  if( level < 0 ) { /* the first level that fits the window */
+    for( level=0; level<SI_PYRAMID_LEVELS-1; level++ )
+      if( py->n_cols[level] <= 512 )
+        break;
   }
+  head->zoom = level;
+  gtk_widget_set_size_request( head->image, py->n_cols[level],
+                               py->n_rows[level] );
+  gtk_widget_queue_draw( head->image );
+}
 
-  head->fraction = (double)1.0;
-  head->dma_active = 0;
+gboolean view_expose( GtkWidget *widget, GdkEventExpose *event,
+                      gpointer data )
+{
+  struct SI_CAMERA *head;
+  GdkRectangle *r;
+  GdkPixbuf *pix;
+
+  head = (struct SI_CAMERA *)data;
+  r = &event->area;
+
+  if( !head->shown ) {
+    if( head->pix )
+      gdk_draw_pixbuf( widget->window, NULL, head->pix, 0, 0, 0, 0, -1, -1,
+                       GDK_RGB_DITHER_NONE, 0, 0 );
+    return TRUE;
+  }
+
+  pix = gdk_pixbuf_new( GDK_COLORSPACE_RGB, 0, 8, r->width, r->height );
+  if( !pix )
+    return TRUE;
+  if( si_look_tile( &head->shown->pyramid, head->zoom, r->x, r->y, r->width,
+                    r->height, gdk_pixbuf_get_pixels( pix ),
+                    gdk_pixbuf_get_rowstride( pix ),
+                    gdk_pixbuf_get_n_channels( pix ),
+                    head->shown->scale.lut ) > 0 ) {
+    gdk_draw_pixbuf( widget->window, NULL, pix, 0, 0, r->x, r->y,
+                     r->width, r->height, GDK_RGB_DITHER_NONE, 0, 0 );
+  }
+  g_object_unref( pix );
+  return TRUE;
+}
+
+void do_zoom_in( GtkWidget *widget, gpointer data )
+{
+  struct SI_CAMERA *head;
+
+  head = (struct SI_CAMERA *)data;
+  if( head->zoom > 0 && head->shown )
+    head->zoom--;
+  view_zoom( head );
+}
+
+void do_zoom_out( GtkWidget *widget, gpointer data )
+{
+  struct SI_CAMERA *head;
+
+  head = (struct SI_CAMERA *)data;
+  if( head->zoom < SI_PYRAMID_LEVELS-1 && head->shown )
+    head->zoom++;
+  view_zoom( head );
+}
 
+
+/* another stretch picked, for the frames to come and the one on
+   show, whose histogram is kept so only the table need be made again
+*/
+
+void do_scale( gpointer data )
+{
+  struct SI_CAMERA *head;
+  struct SI_SCALE *s;
+  int mode;
+
+  head = (struct SI_CAMERA *)data;
+  mode = gtk_combo_box_get_active( (GtkComboBox *)head->scale_c );
+  __atomic_store_n( &head->scale_mode, mode, __ATOMIC_RELAXED );
+  if( !head->shown )
+    return;
+  s = &head->shown->scale;
+  s->mode = mode;
+  si_scale_levels( s );
+  if( si_scale_lut( s ) < 0 ) {
+    perror("scale");
+    return;
+  }
+  printf("%s %d to %d\n", si_scale_name( s->mode ), s->lo, s->hi );
+  gtk_widget_queue_draw( head->image );
 }
 
+/* every frame after this goes to frame-RUN-NNNNNN.fits.fz as it is
+   demuxed, Rice compressed, RUN being when the first was archived
+*/
 
-void scale_data( unsigned short *data, int n )
+void do_archive( GtkWidget *widget, gpointer data )
 {
-  int tot, i;
-  unsigned short max;
+  struct SI_CAMERA *head;
 
-  tot= n*n;
+  head = (struct SI_CAMERA *)data;
+  __atomic_store_n( &head->archive, gtk_toggle_button_get_active(
+    GTK_TOGGLE_BUTTON(head->archive_c)), __ATOMIC_RELAXED );
+}
 
-  max = 0;
-  for( i=0; i<tot; i++ ) {
-    if( max < data[i] )
-      max = data[i];
+/* hand the frame to the writer, waiting only if the disk has fallen
+   a whole budget behind.  The names carry the time of this run's
+   first, and the writer never writes over a file, so one run cannot
+   lose the frames of another.  On the save thread
+*/
+
+void archive_frame( struct SI_CAMERA *head, struct SI_FRAME *f )
+{
+  struct SI_WRITER_STATS st;
+  char fname[64];
+  time_t now;
+
+  if( !head->writer )
+    return;
+  if( !head->archive_run[0] ) {
+    now = time( NULL );
+    strftime( head->archive_run, sizeof(head->archive_run),
+              "%Y%m%d-%H%M%S", localtime( &now ));
   }
-  printf("max %d\n", max );
+  sprintf( fname, "frame-%s-%06d.fits.fz", head->archive_run,
+           head->archived++ );
+  if( si_writer_queue( head->writer, head, f, fname, SI_WRITER_EXCL,
+                       f->data, f->n_cols, f->n_rows ) < 0 ) {
+    printf("cant write %s: %s\n", fname, strerror(errno));
+    return;
+  }
+  si_writer_stats( head->writer, &st );
+  printf("%s, %ld written %ld failed, %ld waits %.3fs, most queued %d\n",
+         fname, st.written, st.failed, st.waits, st.wait_time,
+         st.max_frames );
+}
 
-//  for( i=0; i<tot; i++ ) {
-//     data[i] = (unsigned short)((double)data[i] / (double)max * 65535.0);
-//  }
+/* frame buffers big enough for the largest image the dma config
+   allows, made again only if it grows.  Frames still in use, and a
+   file still loading, keep the old ones until they are done with them
+*/
+
+int frames_for_dma( struct SI_CAMERA *head )
+{
+  struct SI_FRAMES_STATS st;
+  long bytes;
+
+  bytes = head->dma_config.maxever;
+  if( bytes < head->dma_config.total )
+    bytes = head->dma_config.total;
+  if( bytes < 4096L*4096*2 )
+    bytes = 4096L*4096*2; /* a demuxed frame is 2048 or 4096 square */
+  if( head->frames && si_frames_bytes( head->frames ) >= bytes )
+    return 0;
+
+  pthread_mutex_lock( &head->frames_lock );
+  si_frames_free( head->frames );
+  head->frames = si_frames_new( FRAMES, bytes );
+  pthread_mutex_unlock( &head->frames_lock );
+  if( !head->frames )
+    return -1;
+  si_frames_stats( head->frames, &st );
+  printf("%d frames of %ldMB%s\n", st.nframes, st.bytes >> 20,
+         st.huge == 2 ? " in huge pages" : "" );
+  return 0;
 }
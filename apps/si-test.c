@@ -36,7 +36,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "si3097.h"
 #include "si_app.h"
 #include "demux.h"
+#include "calib.h"
 #include "lib.h"
+#include "camera.h"
+#include "record.h"
+#include "fits.h"
 
 /*
   low level testout of the si3097 driver
@@ -46,9 +50,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 void parse_commands( struct SI_CAMERA *c, char *buf );
 void dma_test( struct SI_CAMERA *c, int cmd, int repeat );
 void write_dma_data( void *ptr, int total );
+void write_fits_data( struct SI_CAMERA *c, unsigned short *data,
+                      int n_cols, int n_rows );
 void print_data_len( unsigned char *ptr, int buflen, int total );
 void print_mem_changes( unsigned short *ptr, int nwords );
 void expect_y( int fd );
+void print_yn( int ex );
+int need_device( struct SI_CAMERA *c );
 void print_readout( struct SI_CAMERA *c );
 void print_config( struct SI_CAMERA *c );
 void print_status( struct SI_CAMERA *c );
@@ -105,7 +113,7 @@ int main(int argc, char *argv[] )
 
   while ((ch = getopt_long (argc, argv, OPTIONS, longopts, NULL)) != -1) {
     switch (ch) {
-      case 'f': /* --device FILE */
+      case 'f': /* --file DEVICE or a camera.c spec */
         free (device);
         device = xstrdup (optarg);
         break;
@@ -142,24 +150,20 @@ int main(int argc, char *argv[] )
   /* Initiate communication with si3097 card.
    * Configure UART between card and camera.
    */
-  if((c->fd = open( device, O_RDWR, 0 ))<0 )
+  if (si_camera_open( c, device ) < 0)
     die ("%s: %s\n", device, strerror (errno));
 #if 0
   if( ioctl(c->fd, SI_IOCTL_VERBOSE, &verbose) <0 )
     die ("SI_IOCTL_VERBOSE: %s\n", device, strerror (errno));
 #endif
-  si_init_com( c->fd, 57600, 0, 8, 1, 9000 );
 
   /* Store readout settings to camera.
    * Then load readout settings from camera.
    */
-  if (send_readout( c ) < 0)
+  if (si_camera_send_readout( c ) < 0)
     die ("error sending readout params to camera: %s\n", strerror (errno));
-  if (si_send_command(c->fd, 'H') < 0)     // H    - load readout
-    die ("error sending H command: %s\n", strerror (errno));
-  if (si_receive_n_ints( c->fd, 32, c->readout ) < 0)
+  if (si_camera_load_readout( c ) < 0)     // H    - load readout
     die ("error receiving readout params from camera: %s\n", strerror (errno));
-  expect_y( c->fd );
 
   print_help();
 
@@ -193,7 +197,9 @@ void usage ( void )
 {
   fprintf (stderr,
 "Usage: test_app OPTIONS\n"
-"    -f,--file=FILE      override default device file [%s]\n",
+"    -f,--file=FILE      override default device file [%s]\n"
+"                        or replay:FILE[,RATE] or synth:PATTERN[,RATE]\n"
+"                        or emu:OPTIONS or tty:PATH\n",
            default_device);
   exit (1);
 }
@@ -219,40 +225,39 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
   if( strncasecmp( buf, "sendfile", 8 ) == 0 ) {
     if (dspfile == NULL)
       printf ("no dspfile set\n");
-    else
+    else if( need_device( c ) )
       si_sendfile( c->fd, 250, dspfile );
   } else if( buf[0] == 'A' ) {
-    si_send_command_yn(c->fd, 'A');  // A  - Open Shutter  returns Y/N
+    print_yn( si_camera_command( c, 'A', 0, NULL, 0, NULL ));
+    // A  - Open Shutter  returns Y/N
   } else if( buf[0] == 'B' ) {
-    si_send_command_yn(c->fd, 'B');  // B - Close Shutter returns Y/N
+    print_yn( si_camera_command( c, 'B', 0, NULL, 0, NULL ));
+    // B - Close Shutter returns Y/N
   } else if( buf[0] == 'I' ) {
-    si_send_command(c->fd, 'I');     // I    - Get camera status
-    si_receive_n_ints( c->fd, 16, c->status );
+    if( si_camera_load_status( c ) < 0 )   // I    - Get camera status
+      printf("ERROR loading status from uart\n");
     print_status( c );
-    expect_y( c->fd );
   } else if( buf[0] == 'J' ) {
     set_config(c);
 
   } else if( buf[0] == 'H' ) {
-    si_send_command(c->fd, 'H');     // H    - load readout
-    si_receive_n_ints( c->fd, 32, (int *)&c->readout );
+    if( si_camera_load_readout( c ) < 0 )  // H    - load readout
+      printf("ERROR loading readout from uart\n");
     print_readout( c );
-    expect_y( c->fd );
 
   } else if( buf[0] == 'L' ) {
-    si_send_command(c->fd, 'L');     // L    - load config
-    si_receive_n_ints( c->fd, 32, (int *)&c->config );
+    if( si_camera_load_config( c ) < 0 )   // L    - load config
+      printf("ERROR loading config from uart\n");
     print_config( c );
-    expect_y( c->fd );
 
   } else if( buf[0] == 'S' ) {
-    si_send_command(c->fd, 'S');     // S    - Cooler On, no response
+    si_camera_command( c, 'S', 0, NULL, 0, NULL ); // S - Cooler On
 
   } else if( buf[0] == 'T' ) {
-    si_send_command(c->fd, 'T');     // T    - Cooler Off, no response
+    si_camera_command( c, 'T', 0, NULL, 0, NULL ); // T - Cooler Off
 
   } else if( buf[0] == '0' ) {
-    si_send_command(c->fd, '0');
+    si_camera_command( c, '0', 0, NULL, 0, NULL );
     // Abort Readout, aborts an ongoing exposure (camera cannot
     // be stopped during actual readout)
   } else if( strncmp( buf, "stopdma", 7 )== 0 ) {
@@ -265,8 +270,10 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
       dma_test( c, 'C', repeat );
 
   } else if( strncmp( buf, "status", 6 )== 0 ) {
-    bzero(&c->dma_status, sizeof(struct SI_DMA_STATUS));
-    ioctl( c->fd, SI_IOCTL_DMA_STATUS, &c->dma_status );
+    if( c->fd >= 0 ) {
+      bzero(&c->dma_status, sizeof(struct SI_DMA_STATUS));
+      ioctl( c->fd, SI_IOCTL_DMA_STATUS, &c->dma_status );
+    }
     print_dma_status(c);
   } else if( strncmp( buf, "repeat", 6 )== 0 ) {
     strtok( buf, delim );
@@ -275,6 +282,8 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
     else
       repeat = 1;
   } else if( strncmp( buf, "verb", 4 )== 0 ) {
+    if( !need_device( c ) )
+      return;
     switch (verbose) {
       case 0:
         verbose = SI_VERBOSE_SERIAL | SI_VERBOSE_DMA;
@@ -288,7 +297,10 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
     }
     printf("Verbose set to 0x%x\n", verbose);
   } else if( strncmp( buf, "crash", 5 )== 0 ) {
-    crash(c);
+    if( need_device( c ) ) {
+      si_camera_dma_free( c );
+      crash(c);
+    }
   } else if( strncmp( buf, "image", 5 )== 0 ) {
     int cmd;
     strtok( buf, delim );
@@ -307,18 +319,36 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
       s = "800-299x1.set";
     si_setfile_readout( c,  s );
     send_readout( c );
-    si_send_command(c->fd, 'H');     // H    - load readout
-    si_receive_n_ints( c->fd, 32, (int *)&c->readout );
+    if( si_camera_load_readout( c ) < 0 )  // H    - load readout
+      printf("ERROR loading readout from uart\n");
     print_readout( c );
-    expect_y( c->fd );
+  } else if( strncmp( buf, "record", 6 )== 0 ) {
+    strtok( buf, delim );
+    if( (s = strtok( NULL, delim ) )) {
+      if( si_record_start( c, s ) < 0 )
+        perror( s );
+      else
+        printf("recording every dma buffer to %s\n", s );
+    } else if( c->record ) {
+      if( si_record_stop( c ) < 0 )
+        perror("record");
+      printf("recording stopped\n");
+    }
   } else if( strncmp( buf, "send_readout", 5 )== 0 ) {
     send_readout( c );
   } else if( strncmp( buf, "quit", 4 )== 0 ) {
+    si_record_stop( c );
     exit(0);
   } else if( strncmp( buf, "vmatest", 7 )== 0 ) {
-    vmatest( c );
+    if( need_device( c ) ) {
+      si_camera_dma_free( c );
+      vmatest( c );
+    }
   } else if( strncmp( buf, "timeout_test", 12 )== 0 ) {
-    timeout_test( c );
+    if( need_device( c ) ) {
+      si_camera_dma_free( c );
+      timeout_test( c );
+    }
   } else {
     print_help();
   }
@@ -373,8 +403,9 @@ void parse_commands( struct SI_CAMERA *c, char *buf )
 
 void dma_test( struct SI_CAMERA *c, int cmd, int repeat )
 {
-  int nbufs, loop, ret, rnd;
+  int loop, ret, rnd;
   unsigned char *data1, *data2;
+  struct SI_BUFFER b;
   fd_set wait;
   int sel;
 
@@ -388,42 +419,21 @@ void dma_test( struct SI_CAMERA *c, int cmd, int repeat )
   printf("starting DMA test with %c loops %d\n", cmd, repeat );
 
   for( loop = 0; loop < repeat; loop++ ) {
-    if( !c->dma_active ) {
-      c->dma_config.maxever = 32*1024*1024;
-      c->dma_config.total = 4000000*2;
-      c->dma_config.buflen = 1024*1024; /* power of 2 makes it easy to mmap */
-      c->dma_config.timeout = 5000;
-//      c->dma_config.config = SI_DMA_CONFIG_WAKEUP_EACH;
-      c->dma_config.config = SI_DMA_CONFIG_WAKEUP_ONEND;
-
-      if( ioctl( c->fd, SI_IOCTL_DMA_INIT, &c->dma_config )<0 ){
+    if( !c->dma_configed ) {
+//    SI_DMA_CONFIG_WAKEUP_EACH works here too
+      if( si_camera_dma_config( c, 4000000*2, 0, 5000,
+                                SI_DMA_CONFIG_WAKEUP_ONEND ) < 0 ) {
         perror("dma init");
         return;
       }
-     nbufs = c->dma_config.total / c->dma_config.buflen ;
-     if( c->dma_config.total % c->dma_config.buflen )
-       nbufs += 1;
-
-      if(!(c->ptr = (unsigned short *)mmap( 0,
-         c->dma_config.maxever,
-         PROT_READ, MAP_SHARED, c->fd, 0))) {
-        perror("mmap");
-        return;
-      }
       print_mem_changes( c->ptr, c->dma_config.total/sizeof(short) );
-
-      c->dma_active = 1;
     }
 
-
-  if( ioctl( c->fd, SI_IOCTL_DMA_START, &c->dma_status )<0 ){
+  if( si_camera_start( c, cmd ) < 0 ) {
     perror("dma start");
     return;
   }
 
-  bzero(&c->dma_status, sizeof(struct SI_DMA_STATUS));
-  si_send_command_yn(c->fd, cmd );
-
   /* random sleep to test driver */
 
   rnd = (int)(500000.0*(double)rand()/(double)RAND_MAX);
@@ -433,15 +443,18 @@ void dma_test( struct SI_CAMERA *c, int cmd, int repeat )
 
 /* test out driver poll function */
 
-  FD_ZERO( &wait );
-  FD_SET( c->fd, &wait );
-  sel = select( c->fd+1, &wait, NULL, NULL, NULL );
-  printf("wake up from select %d\n", sel );
+  if( c->fd >= 0 ) {
+    FD_ZERO( &wait );
+    FD_SET( c->fd, &wait );
+    sel = select( c->fd+1, &wait, NULL, NULL, NULL );
+    printf("wake up from select %d\n", sel );
+  }
 
-  ret = ioctl( c->fd, SI_IOCTL_DMA_NEXT, &c->dma_status );
+  while( (ret = si_camera_next_buffer( c, &b )) > 0 )
+    ;
 
   if( ret < 0 ) {
-    perror("ioctl dma_next");
+    perror("dma next");
   }
   if( c->dma_status.transferred != c->dma_config.total )
    printf("NEXT wakeup xfer %d bytes\n", c->dma_status.transferred );
@@ -466,7 +479,6 @@ void dma_test( struct SI_CAMERA *c, int cmd, int repeat )
   //print_data_len( c->ptr, c->dma_config.buflen, c->dma_config.total );
   //write_dma_data( c->ptr, c->dma_config.total );
   //print_mem_changes( c->ptr, c->dma_config.total/sizeof(short) );
-  //  dma_unmap(c);
   }
   free(data1);
   free(data2);
@@ -492,6 +504,24 @@ void write_dma_data( void *ptr, int total )
   printf("wrote %d bytes to %s\n", total, buf );
 }
 
+/* the demuxed image, with the readout and status it was taken with */
+
+void write_fits_data( struct SI_CAMERA *c, unsigned short *data,
+                      int n_cols, int n_rows )
+{
+  time_t tmm;
+  char buf[256];
+
+  time(&tmm);
+  sprintf( buf, "dma_%ld.fits", tmm );
+
+  if( si_fits_save( c, NULL, buf, data, n_cols, n_rows ) < 0 ) {
+    printf("cant write %s: %s\n", buf, strerror(errno));
+    return;
+  }
+  printf("wrote %dx%d image to %s\n", n_cols, n_rows, buf );
+}
+
 void print_data_len( unsigned char *ptr, int buflen, int total )
 {
   int nbufs, i, j, ix, ct;
@@ -551,6 +581,27 @@ void expect_y( int fd )
     printf("ERROR expected yes got no from uart\n");
 }
 
+void print_yn( int ex )
+{
+  if( ex < 0  )
+    printf("error expected Y/N uart\n");
+  else if (ex)
+    printf("got yes from uart\n");
+  else
+    printf("got no from uart\n");
+}
+
+/* driver specific tests need the real device */
+
+int need_device( struct SI_CAMERA *c )
+{
+  if( c->fd < 0 ) {
+    printf("needs a device, not %s\n", c->backend->name );
+    return 0;
+  }
+  return 1;
+}
+
 
 void print_readout( struct SI_CAMERA *c )
 {
@@ -642,7 +693,7 @@ void print_dma_status( struct SI_CAMERA *c )
 void stop_dma( struct SI_CAMERA *c )
 {
 
-  if( ioctl( c->fd, SI_IOCTL_DMA_ABORT, &c->dma_status )<0 ) {
+  if( si_camera_abort( c )<0 ) {
     perror("dma abort");
   }
 }
@@ -786,9 +837,9 @@ void set_config( struct SI_CAMERA *c )
 {
   printf("sending default configuration parameters\n");
   memcpy( (int *)&c->config,  config_data, sizeof(int)*32 );
-  si_send_command(c->fd, 'J'); // J    - Send Configuration Parameters
-  si_send_n_ints( c->fd, 32, (int *)&c->config );
-  expect_y( c->fd );
+  // J    - Send Configuration Parameters
+  if( si_camera_command( c, 'J', 32, c->config, 0, NULL ) != 1 )
+    printf("ERROR expected yes got no from uart\n");
 }
 
 void print_help( void )
@@ -820,13 +871,15 @@ void print_help( void )
   printf("image [cmd]  - take image based on readout params\n");
   printf("setfile_readout 'file'\n" );
   printf("send_readout\n");
+  printf("record 'file'  - record every dma buffer, replay with -f replay:file\n");
+  printf("record   - stop recording\n");
 }
 
 void camera_image( struct SI_CAMERA *c, int cmd )
 {
-  int nbufs, ret;
+  struct SI_DINTER_PLAN plan;
   unsigned short *flip;
-  int tot, serlen, parlen;
+  int n_cols, n_rows;
 
   if( cmd != 'C' && cmd != 'D' && cmd != 'E' && cmd != 'Z' ) {
     printf("camera_image needs C, D, E, Z type ? for help\n");
@@ -834,52 +887,18 @@ void camera_image( struct SI_CAMERA *c, int cmd )
   }
   printf("starting camera_image %c\n", cmd );
 
-  if( c->ptr )
-    dma_unmap(c);
-
-  serlen = c->readout[READOUT_SERLEN_IX];
-  parlen = c->readout[READOUT_PARLEN_IX];
-
-  tot = serlen*parlen*2*4; /* 2 bytes per short, 4 quadrants */
-  c->dma_config.maxever = 32*1024*1024;
-  c->dma_config.total = tot;
-  c->dma_config.buflen = 1024*1024; /* power of 2 makes it easy to mmap */
-  c->dma_config.timeout = 50000;
-//  c->dma_config.config = SI_DMA_CONFIG_WAKEUP_EACH;
-  c->dma_config.config = SI_DMA_CONFIG_WAKEUP_ONEND;
-
-  if( ioctl( c->fd, SI_IOCTL_DMA_INIT, &c->dma_config )<0 ){
+  if( si_camera_dma_config( c, si_camera_frame_bytes( c ), 0, 50000,
+                            SI_DMA_CONFIG_WAKEUP_ONEND ) < 0 ) {
     perror("dma init");
     return;
   }
-  nbufs = c->dma_config.total / c->dma_config.buflen ;
-  if( c->dma_config.total % c->dma_config.buflen )
-    nbufs += 1;
-
-  if(!(c->ptr = (unsigned short *)mmap( 0, c->dma_config.maxever,
-    PROT_READ, MAP_SHARED, c->fd, 0))) {
-        perror("mmap");
-        return;
-  }
 //      print_mem_changes( c->ptr, c->dma_config.total/sizeof(short) );
 
-  c->dma_active = 1;
-
-  if( ioctl( c->fd, SI_IOCTL_DMA_START, &c->dma_status )<0 ){
-    perror("dma start");
-    return;
-  }
-
-  bzero(&c->dma_status, sizeof(struct SI_DMA_STATUS));
-  si_send_command_yn(c->fd, cmd );
-
 /* wait for DMA done */
 
-  printf("sent command %c, waiting\n", cmd );
-  ret = ioctl( c->fd, SI_IOCTL_DMA_NEXT, &c->dma_status );
-
-  if( ret < 0 ) {
-    perror("ioctl dma_next");
+  printf("sending command %c, waiting\n", cmd );
+  if( si_camera_acquire( c, cmd ) < 0 ) {
+    perror("camera acquire");
   }
   if( c->dma_status.transferred != c->dma_config.total )
    printf("NEXT wakeup xfer %d bytes\n", c->dma_status.transferred );
@@ -889,16 +908,22 @@ void camera_image( struct SI_CAMERA *c, int cmd )
   else
     printf("timeout\n" );
 
-  flip = (unsigned short *)malloc(4096*4096*2);
-  bzero( flip, 4096*4096*2 );
-
-  if( serlen < 2047 ) {
-    si_camera_demux_gen( flip, c->ptr, 2048, serlen, parlen );
-    write_dma_data( flip, 2048*2048*2 );
-  } else {
-    si_camera_demux_gen( flip, c->ptr, 4096, serlen, parlen );
-    write_dma_data( flip, 4096*4096*2 );
+  /* quadrants side by side, or the cfg file's readout layout, with
+     any overscan trimmed off
+  */
+  if( si_camera_plan( c, &plan, &n_cols, &n_rows ) < 0 ) {
+    perror("readout layout");
+    return;
+  }
+  if( !(flip = (unsigned short *)calloc( (long)n_cols*n_rows,
+                                         sizeof(short)))) {
+    perror("image");
+    return;
   }
+  if( si_calib_camera( c, &plan, c->ptr, flip ) < 0 )
+    perror("demux");
+  else
+    write_fits_data( c, flip, n_cols, n_rows );
   free(flip);
 }
 
@@ -955,9 +980,7 @@ int change_cfg( struct SI_CAMERA *c, struct CFG_ENTRY *cfg,
 
   data[0] = cfg->index;
   data[1] = val;
-  si_send_command(c->fd, cmd );
-  si_send_n_ints( c->fd, 2, data );
-  ex = si_expect_yn( c->fd );
+  ex = si_camera_command( c, cmd, 2, data, 0, NULL );
   return ex;
 }
 
@@ -965,13 +988,7 @@ int change_cfg( struct SI_CAMERA *c, struct CFG_ENTRY *cfg,
 
 int send_readout( struct SI_CAMERA *c )
 {
-  if (si_send_command(c->fd, 'F') < 0) // F    - Send Readout Parameters
-    return -1;
-  if (si_send_n_ints( c->fd, 32, (int *)&c->readout ) < 0)
-    return -1;
-  if (si_expect_yn( c->fd ) != 1)
-    return -1;
-  return 0;
+  return si_camera_send_readout( c ); // F    - Send Readout Parameters
 }
 
 void vmatest( struct SI_CAMERA *c )
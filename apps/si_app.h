@@ -44,7 +44,9 @@ typedef void * GdkPixbuf;
 #define CFG_TYPE_BITF    3
 
 #define READOUT_SERLEN_IX  1
+#define READOUT_SERPOST_IX 3
 #define READOUT_PARLEN_IX  5
+#define READOUT_PARPOST_IX 7
 
 struct CFG_ENTRY {
   GtkWidget *widget; // gtk widget, if any
@@ -84,11 +86,416 @@ struct SI_DINTERLACE {
   int n_cols;          /* input cols */
   int n_rows;          /* input rows */
   int n_ptr_pos;       /* output words transferred */
+  int n_in_pos;        /* input words done, see si_deinterlace_more */
 };
 
+/* how si_deinterlace moves pixels for one interlace_type and size,
+   see si_dinter_plan.  Input pixel k of group g goes to
+   base[k] + dx[k]*(g % run) + rs[k]*(g / run) of the output
+*/
+
+#define SI_DINTER_MAXLANES 32
+
+struct SI_DINTER_PLAN {
+  int interlace_type;
+  int n_cols;
+  int n_rows;
+  int nlanes;                    /* pixels in a group, one per amplifier */
+  long run;                      /* groups in one output row segment */
+  long base[SI_DINTER_MAXLANES]; /* output index of the first pixel */
+  int dx[SI_DINTER_MAXLANES];    /* +1 or -1 along the segment */
+  long rs[SI_DINTER_MAXLANES];   /* output step from one segment to the next */
+  int overlap;                   /* lanes share output pixels */
+  struct SI_DINTER_PLAN *next;
+};
+
+/* what each amplifier read, gathered by si_dinter_execute_stats() on
+   the way through.  hist[b] counts the pixels from 2^b up to 2^(b+1),
+   hist[0] those below 2
+*/
+
+#define SI_STATS_BINS 16
+
+struct SI_AMP_STATS {
+  long n;                        /* pixels */
+  unsigned short min;
+  unsigned short max;
+  long saturated;                /* at or above the saturation level */
+  unsigned long long sum;
+  unsigned long long sumsq;
+  double mean;                   /* set by si_dinter_stats_end() */
+  double var;
+  long hist[SI_STATS_BINS];
+};
+
+struct SI_DINTER_STATS {
+  int namps;                     /* the plan's nlanes */
+  int saturation;                /* 1 to 65535 */
+  struct SI_AMP_STATS amp[SI_DINTER_MAXLANES];
+};
+
+/* bias subtracted and trimmed frames from a readout with overscan,
+   see calib.c.  Each line of the plan, run groups, is followed by
+   serpost groups of overscan and the image by parpost lines of it
+*/
+
+#define SI_CALIB_MAXSCAN  1024 /* overscan pixels a bias is taken from */
+#define SI_CALIB_PEDESTAL 100  /* left under the image by si-daemon */
+
+struct SI_CALIB {
+  struct SI_DINTER_PLAN *p;      /* the trimmed image */
+  long rows;                     /* lines of image */
+  int serpost;
+  int parpost;
+  int subtract;                  /* 0 only trims, set by the caller */
+  int pedestal;                  /* added back after the bias, likewise */
+  long done;                     /* input pixels used, whole lines */
+  unsigned short *bias;          /* of each line and amp */
+  long alloc;
+  double mean[SI_DINTER_MAXLANES]; /* each amp's, from si_calib_end() */
+};
+
+/* a readout layout, the image cut into across x down sections each
+   read by an amplifier from one corner along the rows, see dinter.c.
+   interlace_types from SI_LAYOUT_TYPE0 on are si_layout_register()ed
+*/
+
+#define SI_LAYOUT_TYPE0   32
+#define SI_CORNER_RIGHT   1
+#define SI_CORNER_BOTTOM  2
+
+struct SI_LAYOUT_AMP {
+  int col;             /* section it reads */
+  int row;
+  int corner;          /* SI_CORNER_ bits, 0 for top left */
+};
+
+struct SI_LAYOUT {
+  char name[64];
+  int across;          /* sections */
+  int down;
+  int trim;            /* cut the image to whole sections */
+  int namps;           /* in the order their pixels arrive */
+  struct SI_LAYOUT_AMP amp[SI_DINTER_MAXLANES];
+};
+
+/* quick look of a frame as it is demuxed, see look.c */
+
+struct SI_LOOK_PART;
+
+#define SI_LOOK_BINS 256
+
+struct SI_LOOK_STATS {
+  unsigned short min;
+  unsigned short max;
+  unsigned int hist[SI_LOOK_BINS];  /* by the top 8 bits */
+};
+
+struct SI_LOOK {
+  struct SI_DINTER_PLAN *p;
+  long total;                  /* input pixels in a frame */
+  int n_cols;                  /* of the image */
+  int n_rows;
+  unsigned char *pixels;       /* rgb display or NULL */
+  int stride;                  /* bytes in a display row */
+  int nchan;                   /* bytes in a display pixel */
+  struct SI_LOOK_STATS stats;
+  int saturation;              /* for amps, 0 for 65535 */
+  struct SI_DINTER_STATS amps;
+  unsigned short *left;        /* lanes each row still waits for */
+  int alloc_rows;
+  struct SI_LOOK_PART *part;   /* one for each band, see look.c */
+  int npart;
+};
+
+/* the image binned 2x2 again and again, for looking at it whole.
+   level[0] is the image itself, level[i] 2^i pixels to a side
+*/
+
+#define SI_PYRAMID_LEVELS 5
+#define SI_BIN_MEAN 0
+#define SI_BIN_MAX  1
+
+struct SI_PYRAMID {
+  int mode;                    /* SI_BIN_ */
+  int n_cols[SI_PYRAMID_LEVELS];
+  int n_rows[SI_PYRAMID_LEVELS];
+  unsigned short *level[SI_PYRAMID_LEVELS];
+  unsigned short *buf;         /* levels 1 on */
+  long alloc;                  /* pixels in buf */
+};
+
+/* what display byte each image value gets, see scale.c */
+
+#define SI_SCALE_LINEAR 0
+#define SI_SCALE_LOG    1
+#define SI_SCALE_ASINH  2
+#define SI_SCALE_ZSCALE 3
+#define SI_SCALE_MODES  4
+#define SI_SCALE_BINS   65536
+
+struct SI_SCALE {
+  int mode;                    /* SI_SCALE_ */
+  double clip;                 /* percent cut from each end, not zscale */
+  unsigned short lo;           /* shown black */
+  unsigned short hi;           /* shown white */
+  long npix;                   /* counted in hist */
+  unsigned int *hist;          /* SI_SCALE_BINS, one for every value */
+  unsigned char *lut;          /* SI_SCALE_BINS display bytes */
+  unsigned int *part;          /* a hist for each thread */
+  int nparts;
+};
+
+/* a FITS file being written, see fits.c */
+
+#define SI_FITS_BLOCK 2880
+#define SI_FITS_CARD  80
+#define SI_FITS_CHUNK (8*45*4096)  /* whole blocks and whole pages */
+#define SI_RICE_BLOCK 32           /* pixels coded together, see rice.c */
+
+struct SI_FITS {
+  int fd;
+  char *buf;                   /* SI_FITS_CHUNK, page aligned */
+  long size;                   /* bytes buf holds */
+  long len;                    /* bytes in buf */
+  long npix;                   /* pixels written */
+  long total;                  /* in the image */
+  int error;                   /* errno of the first failure */
+};
+
+/* an image file mapped to be read back, see load.c */
+
+#define SI_LOAD_RAW  0             /* pixels as they were in memory */
+#define SI_LOAD_FITS 1             /* a 16 bit FITS image */
+#define SI_LOAD_RICE 2             /* tile compressed a row a tile */
+
+struct SI_LOAD {
+  unsigned char *map;
+  long size;                   /* of the file and the map */
+  int type;                    /* SI_LOAD_ */
+  int n_cols;
+  int n_rows;
+  long data;                   /* the pixels or the tile table */
+  long heap;                   /* the compressed rows */
+  int bzero;                   /* 32768 for unsigned pixels */
+  int seq;                     /* madvise()d for reading in order */
+  unsigned short *row;         /* one decoded row */
+};
+
+/* frames going to disk in the background, see writer.c */
+
+#define SI_WRITER_DIRECT 1     /* O_DIRECT, past the page cache */
+#define SI_WRITER_DROP   2     /* drop a frame rather than wait for room */
+#define SI_WRITER_EXCL   4     /* fail rather than write over a file */
+
+struct SI_WRITER_STATS {
+  long queued;                 /* frames handed in */
+  long written;
+  long dropped;                /* no room and SI_WRITER_DROP */
+  long failed;                 /* could not be written */
+  long long bytes;             /* written */
+  long waits;                  /* times a frame waited for room */
+  double wait_time;            /* seconds waited in all */
+  double write_time;           /* seconds the writers spent writing */
+  long max_bytes;              /* most ever waiting */
+  int max_frames;
+  int error;                   /* errno of the last failure */
+};
+
+struct SI_WRITER;
+
+/* frame buffers shared by whoever is using them, see frames.c */
+
+struct SI_FRAMES;
+
+struct SI_FRAME {
+  unsigned short *data;
+  long bytes;                  /* data holds */
+  int n_cols;                  /* of the image in it, set by the filler */
+  int n_rows;
+  struct SI_DINTER_STATS amps; /* as it was demuxed, namps 0 if not */
+  int taken;                   /* by the camera, so the values below are */
+  int frame;                   /* since the camera was opened */
+  int readout[SI_READOUT_MAX]; /* the camera settings it was taken with */
+  int config[SI_CONFIG_MAX];
+  int status[SI_STATUS_MAX];
+  int refs;                    /* users, free again at 0 */
+  struct SI_FRAMES *pool;
+  struct SI_FRAME *next;
+};
+
+struct SI_FRAMES_STATS {
+  int nframes;
+  long bytes;                  /* each */
+  int huge;                    /* 2 huge pages, 1 asked for, 0 none */
+  long gets;
+  long waits;                  /* gets that found none free */
+  int in_use;
+  int max_in_use;
+};
+
+/* finished frames in shared memory for any process to read, see
+   shm.c.  The head is the first page, slot i starts a page later at
+   i*slot_bytes with an SI_SHM_FRAME and its pixels start on the first
+   page after that
+*/
+
+#define SI_SHM_MAGIC   0x53493937  /* "SI97" */
+#define SI_SHM_VERSION 3
+#define SI_SHM_NAME    "/si3097"
+
+struct SI_SHM_HEAD {
+  unsigned int magic;          /* set last, once the rest is */
+  int version;
+  int nslots;
+  int pid;                     /* of the writer */
+  long slot_bytes;
+  long data_bytes;             /* room for pixels in a slot */
+  unsigned long seq;           /* newest frame published, 0 none */
+  unsigned int wake;           /* futex, bumped by every publish */
+};
+
+struct SI_SHM_FRAME {
+  unsigned long seq;           /* must be first, 0 while being written */
+  long offset;                 /* of the pixels from the head */
+  int n_cols;                  /* demuxed image */
+  int n_rows;
+  double time;                 /* CLOCK_REALTIME when the dma finished */
+  double readout_time;         /* seconds from start to last buffer */
+  unsigned int status;         /* SI_DMA_STATUS_ of the last buffer */
+  int frame;                   /* since the camera was opened */
+  int dropped;                 /* frames lost before this one */
+  int readout[SI_READOUT_MAX]; /* the camera settings it was taken with */
+  int config[SI_CONFIG_MAX];
+  struct SI_DINTER_STATS amps; /* what each amplifier read */
+  int pedestal;                /* bias taken off less this, -1 if not */
+  double bias[SI_DINTER_MAXLANES]; /* each amp's mean bias taken off */
+};
+
+struct SI_SHM;
+
+/* the same frames handed over a unix socket as sealed memfds, each
+   with an SI_SHM_FRAME whose offset is 0, see handoff.c
+*/
+
+#define SI_HANDOFF_PATH "/tmp/si3097.sock"
+
+struct SI_HANDOFF;
+
+/* pointers passed between the threads of a pipeline, see ring.c */
+
+struct SI_RING;
+
+/* an image made ready to look at, its bins and its display levels,
+   handed whole to the thread that draws it
+*/
+
+struct SI_VIEW {
+  struct SI_FRAME *frame;      /* the image, held while the view is */
+  struct SI_PYRAMID pyramid;   /* level[0] is frame->data */
+  struct SI_SCALE scale;
+};
+
+
+struct SI_CAMERA;
+
+/* one completed piece of the dma image, see si_camera_next_buffer */
+
+struct SI_BUFFER {
+  unsigned short *data; /* start of the piece in the mapped image */
+  int offset;           /* byte offset of data in the image */
+  int len;              /* bytes in this piece */
+  int index;            /* dma buffer number */
+  int last;             /* true on the final piece of a frame */
+  double time;          /* monotonic seconds when it was seen complete */
+  unsigned int status;  /* SI_DMA_STATUS status word at that time */
+};
+
+/* dma stream recording, see record.c */
+
+#define SI_RECORD_MAGIC   "SI3097R1"
+#define SI_RECORD_IMAGIC  "SI3097IX"
+#define SI_RECORD_VERSION 1
+
+struct SI_RECORD_HEADER {
+  char magic[8];
+  int version;
+  int total;            /* dma config when recording started */
+  int buflen;
+  int config;
+  int readout[SI_READOUT_MAX];
+};
+
+struct SI_RECORD_ENTRY {
+  long long pos;        /* file offset of the data */
+  int frame;            /* frame number, from si_camera_start */
+  int offset;           /* byte offset of data in the image */
+  int len;
+  unsigned int status;  /* SI_DMA_STATUS status word */
+  double time;          /* seconds since si_camera_start */
+};
+
+struct SI_RECORD_TRAILER {
+  long long index;      /* file offset of the entry copies */
+  int nentries;
+  int nframes;
+  char magic[8];
+};
+
+struct SI_RECORD;
+
+/* the camera end of the uart, see emu.c */
+
+struct SI_EMU {
+  int status[SI_STATUS_MAX];   /* values held by the camera */
+  int config[SI_CONFIG_MAX];
+  int readout[SI_READOUT_MAX];
+  struct CFG_ENTRY **e_readout; /* limits from the cfg file, if any */
+  struct CFG_ENTRY **e_config;
+
+  double latency;       /* seconds before answering a command */
+  double jitter;        /* up to this much more, at random */
+  double baud;          /* pace replies at this line rate, 0 for none */
+  int timeout;          /* ms the far end waits for a byte */
+  double drop;          /* chance a command goes unanswered */
+  double corrupt;       /* chance of a bad echo */
+  double cut;           /* chance a reply stops part way */
+  double nak;           /* chance of N for a good command */
+  unsigned int seed;
+
+  int ncommands;        /* what happened so far */
+  int ndropped;
+  int ncorrupted;
+  int ncut;
+  int nnaked;
+  int nrejected;        /* out of range for the cfg file */
+};
+
+/* how a camera is reached, see camera.c */
+
+struct SI_BACKEND {
+  char *name;
+  int (*open)( struct SI_CAMERA *c, char *arg );
+  void (*close)( struct SI_CAMERA *c );
+  int (*serial)( struct SI_CAMERA *c, int cmd, int nsend, int *send,
+                 int nrecv, int *recv );
+  int (*dma_init)( struct SI_CAMERA *c );
+  void (*dma_free)( struct SI_CAMERA *c, int release );
+  int (*dma_start)( struct SI_CAMERA *c );
+  int (*dma_next)( struct SI_CAMERA *c );
+  int (*dma_abort)( struct SI_CAMERA *c );
+};
 
 struct SI_CAMERA {
   int fd;               /* open device */
+  struct SI_BACKEND *backend;
+  void *backend_data;
+  int nbufs;            /* dma buffers in one image */
+  int consumed;         /* bytes of this dma handed out so far */
+  double dma_time;      /* when the last dma wakeup returned */
+  double start_time;    /* when si_camera_start was called */
+  int frame;            /* frames started */
+  struct SI_RECORD *record; /* recording of every buffer, if any */
   int dma_active;
   unsigned short *ptr;  /* mmaped data */
   struct SI_DMA_STATUS dma_status;
@@ -98,6 +505,9 @@ struct SI_CAMERA {
   int config[SI_CONFIG_MAX];
   int readout[SI_READOUT_MAX];
   int read_speed[SI_READSPEED_MAX];
+  int layout;           /* interlace_type of the cfg file's [Readout
+                           Layout], 0 for the usual four quadrants */
+  int namps;            /* amplifiers read out, 0 for 4 */
 
   struct CFG_ENTRY *e_status[SI_STATUS_MAX]; /* parsed out cfg file */
   struct CFG_ENTRY *e_config[SI_CONFIG_MAX];
@@ -106,8 +516,8 @@ struct SI_CAMERA {
 
   GtkWidget *param_window;
   GtkWidget *control_window;
-  GtkWidget *image;
-  GdkPixbuf *pix;
+  GtkWidget *image;     /* drawing area, see view_expose */
+  GdkPixbuf *pix;       /* logo, until there is an image */
   int fill_done; /* initial fill complete */
   GtkWidget *bar; /* dma progress bar */
   double fraction;
@@ -121,6 +531,7 @@ struct SI_CAMERA {
   GtkWidget *itype_e; /* deinterlace widgets */
   GtkWidget *icols_e;
   GtkWidget *irows_e;
+  int running;          /* a readout started and not yet demuxed */
   int dma_done;
   int dma_done_handle;
   int dma_configed;
@@ -131,9 +542,31 @@ struct SI_CAMERA {
   GtkWidget *contin_c;
   GtkWidget *verbose_c;
   GtkWidget *setcmd_c;
+  GtkWidget *scale_c;   /* display stretch */
   GtkWidget *file_widget;
   char *fname;
-  unsigned short *flip_data;
-  pthread_t fill;
-  int side;
+  struct SI_FRAMES *frames; /* buffers for the images below */
+  pthread_mutex_t frames_lock; /* frames swapped by the gui, held by load */
+  struct SI_FRAME *demux; /* being filled as dma arrives */
+  pthread_t stage[4];   /* acquire, scale, save and load threads */
+  struct SI_RING *go;   /* readouts started, for the acquire thread */
+  struct SI_RING *to_load; /* file names picked, for the load thread */
+  struct SI_RING *to_scale; /* frames demuxed */
+  struct SI_RING *to_save; /* frames to archive */
+  struct SI_RING *to_show; /* views ready, for the gui */
+  struct SI_RING *views; /* views free to fill */
+  struct SI_VIEW *shown; /* drawn from by the gui */
+  int dropped;          /* views never shown, a newer being ready */
+  struct SI_DINTER_PLAN demux_plan; /* demux filled as dma arrives */
+  int demux_pos;        /* pixels of this frame demuxed so far */
+  struct SI_LOOK look;  /* stats of demux, filled with it */
+  struct SI_CALIB calib; /* or bias taken off, with overscan */
+  struct SI_DINTER_STATS amps; /* counted by calib */
+  int zoom;             /* pyramid level on screen, -1 to fit */
+  int scale_mode;       /* SI_SCALE_ for the next view */
+  struct SI_WRITER *writer; /* saves and archive, off the gui thread */
+  GtkWidget *archive_c; /* every frame to disk */
+  int archive;
+  int archived;         /* frames archived so far */
+  char archive_run[16]; /* time of the first, in every name */
 };
@@ -45,6 +45,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "si3097.h"
 #include "si_app.h"
 #include "lib.h"
+#include "camera.h"
 
 #define BOX_PACK 0
 #define FRAME_SPACE 3
@@ -87,7 +88,8 @@ static int do_setcmd( struct SI_CAMERA *head, GtkWidget *widget );
 static int do_getcmd( int command );
 static void readout_set_files( struct SI_CAMERA *head, GtkWidget *hbox );
 static int readout_file( GtkWidget *widget, void *dp );
-static void send_readout( struct SI_CAMERA *c );
+static int uart_command( struct SI_CAMERA *h, int cmd, int nsend, int *send,
+                         int nrecv, int *recv );
 //static void load_status( void );
 
 static void pwindow_dest( GtkWidget *widget, gpointer  data )
@@ -106,77 +108,72 @@ static void cwindow_dest( GtkWidget *widget, gpointer data )
   head->control_window = NULL;
 }
 
+/* the dma for a frame of the readout on the camera, overscan and all,
+   or as the dma config widgets say.  The camera library maps it
+*/
+
 void uart_config_dma( GtkWidget *widget, gpointer   data )
 {
   struct SI_CAMERA *head;
   const char *s;
-  int combo, nbufs;
+  int combo, total, buflen, timeout, config;
 
   head = (struct SI_CAMERA *)data;
   printf("config dma\n");
 
-  if( head->ptr ) {
-    nbufs = head->dma_config.total / head->dma_config.buflen ;
-    if( head->dma_config.total % head->dma_config.buflen )
-      nbufs += 1;
-    if(munmap( head->ptr, head->dma_config.buflen*nbufs ) )
-      perror("failed to unmap");
+  if( !head->backend ) {
+    printf("no camera\n");
+    return;
   }
 
   if(  !head->total_e ) {
-    int tot, serlen, parlen;
-
-    serlen = head->readout[READOUT_SERLEN_IX];
-    parlen = head->readout[READOUT_PARLEN_IX];
-    tot = serlen*parlen*2*4; /* 2 bytes per short, 4 quadrants */
-    head->dma_config.maxever = 4096*4096*2;
-    head->dma_config.total = tot;
-    head->dma_config.config = SI_DMA_CONFIG_WAKEUP_EACH;
-    head->dma_config.buflen = 1024*1024;
-    head->dma_config.timeout = 10000;
+    total = si_camera_frame_bytes( head );
+    buflen = 0;   /* the library's usual */
+    timeout = 0;
+    config = SI_DMA_CONFIG_WAKEUP_EACH;
     head->contin = 1;
     head->command = 'D';
 
   } else {
-    bzero( &head->dma_config, sizeof(struct SI_DMA_CONFIG ));
+    total = buflen = timeout = 0;
 
     if( (s = gtk_entry_get_text(GTK_ENTRY(head->total_e))))
-      head->dma_config.total = atoi(s);
-    printf("total %d\n", head->dma_config.total );
+      total = atoi(s);
+    printf("total %d\n", total );
 
     if( (s = gtk_entry_get_text(GTK_ENTRY(head->buflen_e))))
-      head->dma_config.buflen = atoi(s);
-    printf("buflen %d\n", head->dma_config.buflen );
+      buflen = atoi(s);
+    printf("buflen %d\n", buflen );
 
     if( (s = gtk_entry_get_text(GTK_ENTRY(head->timeout_e))))
-      head->dma_config.timeout = atoi(s);
-    printf("timeout %d\n", head->dma_config.timeout );
+      timeout = atoi(s);
+    printf("timeout %d\n", timeout );
 
     combo = gtk_combo_box_get_active((GtkComboBox *)head->config_c);
     if( combo )
-      head->dma_config.config = SI_DMA_CONFIG_WAKEUP_EACH;
+      config = SI_DMA_CONFIG_WAKEUP_EACH;
     else
-      head->dma_config.config = SI_DMA_CONFIG_WAKEUP_ONEND;
+      config = SI_DMA_CONFIG_WAKEUP_ONEND;
 
-    printf("config %d 0x%x\n", combo, head->dma_config.config );
+    printf("config %d 0x%x\n", combo, config );
   }
 
-  if( ioctl( head->fd, SI_IOCTL_DMA_INIT, &head->dma_config )<0 ){
+  if( si_camera_dma_config( head, total, buflen, timeout, config ) < 0 )
     perror("dma init");
-    return;
-  }
+}
 
-  nbufs = head->dma_config.total / head->dma_config.buflen ;
-  if( head->dma_config.total % head->dma_config.buflen )
-    nbufs += 1;
+/* a command to the camera through whichever backend it is on, see
+   si_camera_command().  -1 with ENODEV if there is no camera
+*/
 
-  if(!(head->ptr = (unsigned short *)mmap( 0,
-    head->dma_config.buflen*nbufs,
-      PROT_READ, MAP_SHARED, head->fd, 0))) {
-    perror("mmap");
-    return;
+static int uart_command( struct SI_CAMERA *h, int cmd, int nsend, int *send,
+                         int nrecv, int *recv )
+{
+  if( !h->backend ) {
+    errno = ENODEV;
+    return -1;
   }
-  head->dma_configed = 1;
+  return si_camera_command( h, cmd, nsend, send, nrecv, recv );
 }
 
 #if 0
@@ -223,17 +220,16 @@ static void param_load( GtkWidget *widget, struct COMMAND_DAT *cmd )
 
   printf("param_load cmd %c\n",  cmd->load );
   h = cmd->head;
-
-  if( si_send_command( h->fd, cmd->load ) < 0 ) {
-    perror("si_send_command");
-    return;
-  }
-
   len = cmd->len;
 
-  si_receive_n_ints( h->fd, len, cmd->data );
-  if( !si_expect_yn( h->fd ) )
-    printf("didnt get a y from uart\n");
+  switch( uart_command( h, cmd->load, 0, NULL, len, cmd->data )) {
+    case -1:
+      perror("si_camera_command");
+      return;
+    case 0:
+      printf("didnt get a y from uart\n");
+      break;
+  }
 
   ent = cmd->dat;
   if( !ent )
@@ -260,11 +256,8 @@ static void param_send( GtkWidget *widget, struct COMMAND_DAT *cmd)
 
   printf("param_send cmd %c\n",  cmd->send );
   h = cmd->head;
-
-  if( si_send_command( h->fd, cmd->load ) < 0 ) {
-    perror("si_send_command");
+  if( cmd->send < 0 )  /* status is only read */
     return;
-  }
 
   len = cmd->len;
   ent = cmd->dat;
@@ -281,25 +274,20 @@ static void param_send( GtkWidget *widget, struct COMMAND_DAT *cmd)
     ret++;
   }
 
-  if( si_send_n_ints( h->fd, cmd->len, cmd->data ) < 0 ) {
-    perror("si_send_n_ints");
+  if( uart_command( h, cmd->send, cmd->len, cmd->data, 0, NULL ) < 0 ) {
+    perror("si_camera_command");
     return;
   }
 }
 
 static void send_control( GtkWidget *widget, struct UART_CMD *cmd )
 {
-  int fd, yn;
+  int yn;
   char text[256];
 
-  fd = cmd->head->fd;
-  if( si_send_command( fd, cmd->cmd ) < 0 ) {
-    perror("si_send_command");
-    return;
-  }
+  if( (yn = uart_command( cmd->head, cmd->cmd, 0, NULL, 0, NULL )) < 0 )
+    perror("si_camera_command");
   if( cmd->resp ) {
-    yn = si_expect_yn( fd );
-
     if( yn == 1 )
       strcpy(text, "Y" );
     else if ( yn == 0 )
@@ -721,7 +709,9 @@ static int do_verbose( struct SI_CAMERA *head, GtkWidget *widget )
       verb = 0;
       break;
   }
-  if( head->fd >= 0 )
+  /* only the driver has anything to say */
+
+  if( head->backend && !strcmp( head->backend->name, "device" ))
     if( ioctl( head->fd, SI_IOCTL_VERBOSE, &verb ) <0 )
       perror("verbose");
 
@@ -796,7 +786,9 @@ static int readout_file( GtkWidget *widget, void *dp )
     gtk_widget_destroy (dialog);
     printf("opening %s\n", filename );
     si_setfile_readout( head,  filename ); /* load them into local array */
-    send_readout( head );               /* send to camera */
+    if( uart_command( head, 'F', SI_READOUT_MAX, head->readout, 0,
+                      NULL ) < 0 )      /* send to camera */
+      perror("send readout");
     param_load( NULL, &cmd_dat[0] );    /* readback from camera */
     uart_config_dma( NULL, head);       /* config dma using readback */
     g_free (filename);
@@ -806,13 +798,6 @@ static int readout_file( GtkWidget *widget, void *dp )
   return 0;
 }
 
-static void send_readout( struct SI_CAMERA *c )
-{
-  si_send_command(c->fd, 'F'); // F    - Send Readout Parameters
-  si_send_n_ints( c->fd, 32, (int *)&c->readout );
-  si_expect_yn( c->fd );
-}
-
 #if 0
 static void load_status( void )
 {
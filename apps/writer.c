@@ -0,0 +1,411 @@
+/*
+
+Background FITS writer for the
+Spectral Instruments 3097 Camera Interface
+
+Copyright (C) 2006  Jeffrey R Hagen
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/*
+  frames written to disk by threads of their own, so taking the next
+  one need not wait for the last to land.
+
+    si_writer_start()  threads and a memory budget
+    si_writer_queue()  make the FITS file of a frame in memory and
+                       hand it over, returns as soon as it is copied
+    si_writer_drain()  wait for everything queued to be written
+    si_writer_stop()   drain and end the threads
+
+  Each frame is copied once, byte swapped on the way, into a page
+  aligned buffer holding the whole file, which goes out with one
+  write.  A name ending .fz is Rice compressed on the way instead,
+  see si_fits_rice_image().  With SI_WRITER_DIRECT the file is
+  opened O_DIRECT and the write rounded up to a page, the tail cut
+  off afterwards; a filesystem that will not do O_DIRECT is written
+  through the page cache instead.
+
+  Buffers are kept for the next frame rather than freed, and all of
+  them together never go over the budget.  When it is used up
+  si_writer_queue() waits for a writer to finish one, or with
+  SI_WRITER_DROP gives up on the frame, and the stats say how often
+  and for how long.
+*/
+
+#define _GNU_SOURCE /* O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "si3097.h"
+#include "si_app.h"
+#include "fits.h"
+#include "writer.h"
+
+#define WRITER_ALIGN 4096      /* O_DIRECT offsets, lengths and memory */
+
+struct SI_WRITE {
+  struct SI_WRITE *next;
+  char *fname;
+  char *buf;                   /* WRITER_ALIGN aligned */
+  long size;                   /* bytes buf holds */
+  long len;                    /* of the file */
+  int flags;                   /* SI_WRITER_EXCL */
+};
+
+struct SI_WRITER {
+  int flags;                   /* SI_WRITER_ */
+  long budget;                 /* bytes of buffers there may be */
+  long alloc;                  /* bytes of buffers there are */
+  long bytes;                  /* of files waiting or being written */
+  int frames;
+  int quit;
+  struct SI_WRITE *head;       /* waiting, oldest first */
+  struct SI_WRITE *tail;
+  struct SI_WRITE *free;       /* written, to use again */
+  pthread_mutex_t lock;
+  pthread_cond_t work;         /* something queued, or quitting */
+  pthread_cond_t room;         /* something written */
+  pthread_t *threads;
+  int nthreads;
+  struct SI_WRITER_STATS stats;
+};
+
+static double writer_time( void )
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static long writer_round( long n )
+{
+  return (n + WRITER_ALIGN - 1)/WRITER_ALIGN*WRITER_ALIGN;
+}
+
+/* the whole of one file, 0 or -1 */
+
+static int writer_file( struct SI_WRITER *w, struct SI_WRITE *j )
+{
+  long len, n, done;
+  int fd, err, mode;
+
+  fd = -1;
+  len = j->len;
+  mode = O_WRONLY|O_CREAT|O_TRUNC;
+  if( j->flags & SI_WRITER_EXCL )
+    mode |= O_EXCL;
+  if( w->flags & SI_WRITER_DIRECT ) {
+    fd = open( j->fname, mode|O_DIRECT, 0666 );
+    if( fd >= 0 )
+      len = writer_round( j->len );
+    else if( errno != EINVAL )
+      return -1;
+  }
+  if( fd < 0 && (fd = open( j->fname, mode, 0666 )) < 0 )
+    return -1;
+
+  for( done=0; done<len; done+=n ) {
+    if( (n = pwrite( fd, j->buf + done, len - done, done )) < 0 ) {
+      if( errno == EINTR ) {
+        n = 0;
+        continue;
+      }
+      break;
+    }
+  }
+  if( done < len || (len != j->len && ftruncate( fd, j->len ) < 0 )) {
+    err = errno;
+    close( fd );
+    errno = err;
+    return -1;
+  }
+  return close( fd );
+}
+
+static void *writer_thread( void *v )
+{
+  struct SI_WRITER *w;
+  struct SI_WRITE *j;
+  double t;
+  int ok, err;
+
+  w = (struct SI_WRITER *)v;
+  pthread_mutex_lock( &w->lock );
+  for(;;) {
+    while( !w->head && !w->quit )
+      pthread_cond_wait( &w->work, &w->lock );
+    if( !(j = w->head))
+      break;
+    if( !(w->head = j->next))
+      w->tail = NULL;
+    pthread_mutex_unlock( &w->lock );
+
+    t = writer_time();
+    ok = writer_file( w, j ) == 0;
+    err = errno;
+    t = writer_time() - t;
+
+    pthread_mutex_lock( &w->lock );
+    w->stats.write_time += t;
+    if( ok ) {
+      w->stats.written++;
+      w->stats.bytes += j->len;
+    } else {
+      w->stats.failed++;
+      w->stats.error = err;
+      fprintf( stderr, "writer: %s: %s\n", j->fname, strerror( err ));
+    }
+    w->bytes -= j->len;
+    w->frames--;
+    free( j->fname );
+    j->fname = NULL;
+    j->next = w->free;
+    w->free = j;
+    pthread_cond_broadcast( &w->room );
+  }
+  pthread_mutex_unlock( &w->lock );
+  return NULL;
+}
+
+/* nthreads writers, at most budget bytes of frames in memory and
+   SI_WRITER_ flags.  NULL on failure
+*/
+
+struct SI_WRITER *si_writer_start( int nthreads, long budget, int flags )
+{
+  struct SI_WRITER *w;
+  int i;
+
+  if( nthreads < 1 )
+    nthreads = 1;
+
+  if( !(w = calloc( 1, sizeof(*w))))
+    return NULL;
+  if( !(w->threads = calloc( nthreads, sizeof(pthread_t)))) {
+    free( w );
+    return NULL;
+  }
+  w->flags = flags;
+  w->budget = budget;
+  pthread_mutex_init( &w->lock, NULL );
+  pthread_cond_init( &w->work, NULL );
+  pthread_cond_init( &w->room, NULL );
+
+  for( i=0; i<nthreads; i++ ) {
+    if( pthread_create( &w->threads[i], NULL, writer_thread, w ) != 0 ) {
+      perror("writer");
+      break;
+    }
+  }
+  w->nthreads = i;
+  if( i == 0 ) {
+    si_writer_stop( w );
+    return NULL;
+  }
+  return w;
+}
+
+/* a buffer of at least size bytes within the budget, called locked.
+   NULL with *fresh set means one that is to be allocated, NULL without
+   it that there is no room now
+*/
+
+static struct SI_WRITE *writer_buffer( struct SI_WRITER *w, long size,
+  int *fresh )
+{
+  struct SI_WRITE **jp, *j;
+
+  *fresh = 0;
+  for( jp=&w->free; *jp; jp=&(*jp)->next ) {
+    if( (*jp)->size >= size ) {
+      j = *jp;
+      *jp = j->next;
+      return j;
+    }
+  }
+
+  /* too small for this frame, make way for a bigger one */
+
+  while( w->alloc + size > w->budget && (j = w->free)) {
+    w->free = j->next;
+    w->alloc -= j->size;
+    free( j->buf );
+    free( j );
+  }
+
+  /* one frame bigger than the budget still goes, on its own */
+
+  if( w->alloc + size <= w->budget || w->alloc == 0 ) {
+    w->alloc += size;
+    *fresh = 1;
+  }
+  return NULL;
+}
+
+/* write the n_cols by n_rows image at data to fname as FITS, tile
+   compressed if fname ends .fz, with the header from c and the
+   settings fr was taken with, or c's now if fr is NULL.  With
+   SI_WRITER_EXCL in flags a file already called fname is left alone
+   and the write counted as failed.  0 once it is copied, -1 if it
+   could not be or with EAGAIN if it was dropped for want of room
+*/
+
+int si_writer_queue( struct SI_WRITER *w, struct SI_CAMERA *c,
+  struct SI_FRAME *fr, char *fname, int flags, unsigned short *data,
+  int n_cols, int n_rows )
+{
+  struct SI_WRITE *j;
+  long size, len;
+  double t;
+  int fresh, waited, rice;
+
+  rice = si_fits_compressed( fname );
+  size = writer_round( rice ? si_fits_rice_bound( n_cols, n_rows ) :
+                              si_fits_bound( n_cols, n_rows ));
+
+  pthread_mutex_lock( &w->lock );
+  w->stats.queued++;
+  t = 0.0;
+  waited = 0;
+  while( !(j = writer_buffer( w, size, &fresh )) && !fresh ) {
+    if( w->flags & SI_WRITER_DROP ) {
+      w->stats.dropped++;
+      pthread_mutex_unlock( &w->lock );
+      errno = EAGAIN;
+      return -1;
+    }
+    if( !waited ) {
+      waited = 1;
+      t = writer_time();
+      w->stats.waits++;
+    }
+    pthread_cond_wait( &w->room, &w->lock );
+  }
+  if( waited )
+    w->stats.wait_time += writer_time() - t;
+  pthread_mutex_unlock( &w->lock );
+
+  if( fresh ) {
+    if( (j = calloc( 1, sizeof(*j))))
+      j->size = size;
+    if( !j || posix_memalign( (void **)&j->buf, WRITER_ALIGN, size ) != 0 ) {
+      free( j );
+      j = NULL;
+    }
+  }
+  if( j ) {
+    j->fname = strdup( fname );
+    j->flags = flags;
+  }
+
+  len = -1;
+  if( j && j->fname && rice )
+    len = si_fits_rice_image( c, fr, j->buf, j->size, data, n_cols, n_rows );
+  else if( j && j->fname )
+    len = si_fits_image( c, fr, j->buf, j->size, data, n_cols, n_rows );
+
+  pthread_mutex_lock( &w->lock );
+  if( len < 0 ) {
+    w->stats.failed++;
+    w->stats.error = errno;
+    if( j ) {
+      free( j->fname );
+      j->fname = NULL;
+      j->next = w->free;
+      w->free = j;
+    } else {
+      w->alloc -= size;
+    }
+    pthread_cond_broadcast( &w->room );
+    pthread_mutex_unlock( &w->lock );
+    return -1;
+  }
+
+  /* the O_DIRECT write goes to the end of the page */
+
+  memset( j->buf + len, 0, writer_round( len ) - len );
+  j->len = len;
+  j->next = NULL;
+  if( w->tail )
+    w->tail->next = j;
+  else
+    w->head = j;
+  w->tail = j;
+  w->frames++;
+  w->bytes += len;
+  if( w->bytes > w->stats.max_bytes )
+    w->stats.max_bytes = w->bytes;
+  if( w->frames > w->stats.max_frames )
+    w->stats.max_frames = w->frames;
+  pthread_cond_signal( &w->work );
+  pthread_mutex_unlock( &w->lock );
+  return 0;
+}
+
+/* wait until everything queued is on disk */
+
+void si_writer_drain( struct SI_WRITER *w )
+{
+  pthread_mutex_lock( &w->lock );
+  while( w->frames > 0 )
+    pthread_cond_wait( &w->room, &w->lock );
+  pthread_mutex_unlock( &w->lock );
+}
+
+void si_writer_stats( struct SI_WRITER *w, struct SI_WRITER_STATS *s )
+{
+  pthread_mutex_lock( &w->lock );
+  *s = w->stats;
+  pthread_mutex_unlock( &w->lock );
+}
+
+/* write what is queued, end the threads and free everything */
+
+void si_writer_stop( struct SI_WRITER *w )
+{
+  struct SI_WRITE *j;
+  int i;
+
+  if( !w )
+    return;
+
+  pthread_mutex_lock( &w->lock );
+  w->quit = 1;
+  pthread_cond_broadcast( &w->work );
+  pthread_mutex_unlock( &w->lock );
+  for( i=0; i<w->nthreads; i++ )
+    pthread_join( w->threads[i], NULL );
+
+  while( (j = w->free)) {
+    w->free = j->next;
+    free( j->buf );
+    free( j );
+  }
+  pthread_mutex_destroy( &w->lock );
+  pthread_cond_destroy( &w->work );
+  pthread_cond_destroy( &w->room );
+  free( w->threads );
+  free( w );
+}
@@ -0,0 +1,7 @@
+struct SI_WRITER *si_writer_start( int nthreads, long budget, int flags );
+int si_writer_queue( struct SI_WRITER *w, struct SI_CAMERA *c,
+                     struct SI_FRAME *fr, char *fname, int flags,
+                     unsigned short *data, int n_cols, int n_rows );
+void si_writer_drain( struct SI_WRITER *w );
+void si_writer_stats( struct SI_WRITER *w, struct SI_WRITER_STATS *s );
+void si_writer_stop( struct SI_WRITER *w );
@@ -239,7 +239,7 @@ void si_bottom_half(struct work_struct *work)
 	}
 
 	// PCI Abort interrupt
-	if (source & INTR_TYPE_PCI_ABORT) {
+	if ((source & INTR_TYPE_PCI_ABORT) && dev->pci) {
 		// Get the PCI Command register
 		pci_read_config_dword(dev->pci, PCI9054_COMMAND, &reg);
 
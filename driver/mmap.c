@@ -309,7 +309,7 @@ int si_alloc_memory(struct SIDEVICE *dev)
 	local_addr = SI_LOCAL_BUSADDR;
 
 	dev->sgl_len = nbuf * sizeof(struct SIDMA_SGL);
-	dev->sgl = dma_alloc_coherent(&dev->pci->dev, dev->sgl_len,
+	dev->sgl = dma_alloc_coherent(dev->device, dev->sgl_len,
 				      &dev->sgl_pci, GFP_KERNEL);
 	//  dev->sgl = jeff_alloc( dev->sgl_len, &dev->sgl_pci);
 
@@ -327,7 +327,7 @@ int si_alloc_memory(struct SIDEVICE *dev)
 	dev->total_bytes += dev->sgl_len;
 
 	for (nb = nbuf - 1; nb >= 0; nb--) {
-		cpu = dma_alloc_coherent(&dev->pci->dev, sm_buflen, &dma_buf,
+		cpu = dma_alloc_coherent(dev->device, sm_buflen, &dma_buf,
 					 GFP_KERNEL);
 		//cpu = jeff_alloc( sm_buflen, &dma_buf );
 		if (!cpu) {
@@ -438,11 +438,11 @@ void si_free_sgl(struct SIDEVICE *dev)
 			page++;
 		}
 
-		dma_free_coherent(&dev->pci->dev, sm_buflen, ch->cpu, ch->padr);
+		dma_free_coherent(dev->device, sm_buflen, ch->cpu, ch->padr);
 		total_frees++;
 		total_bytes += dev->dma_cfg.buflen;
 	}
-	dma_free_coherent(&dev->pci->dev, dev->sgl_len, dchain, dev->sgl_pci);
+	dma_free_coherent(dev->device, dev->sgl_len, dchain, dev->sgl_pci);
 	total_frees++;
 	total_bytes += dev->sgl_len;
 	dev->dma_cfg.buflen = 0;
@@ -470,11 +470,6 @@ int si_start_dma(struct SIDEVICE *dev)
 
 	n_pixels = dev->dma_cfg.total / 2;
 
-	if (dev->test) {
-		si_info(dev, "start_dma test mode\n");
-		return 0;
-	}
-
 	reg = PLX_REG8_READ(dev, PCI9054_DMA_COMMAND_STAT);
 	if (reg & 1) { /* already on stop */
 		si_info(dev, "start_dma already on stopping first, dma_stat 0x%x\n",
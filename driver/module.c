@@ -18,6 +18,8 @@
 #include <linux/pci.h>
 #include <linux/delay.h>
 #include <linux/cdev.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
 #include <asm/atomic.h>
 
 #include "si3097.h"
@@ -46,8 +48,14 @@ module_param(timeout, int, 0);
 int verbose;
 module_param(verbose, int, 0);
 
+/* number of simulated cards to create in addition to real ones */
+
+int sim;
+module_param(sim, int, 0);
+
 #define SI_MAX_CARDS 3
 static struct SIDEVICE si_devices[SI_MAX_CARDS];
+static struct platform_device *si_sim_pdev[SI_MAX_CARDS];
 static int si_count;
 
 static struct pci_device_id si_pci_tbl[] __initdata = {
@@ -81,8 +89,9 @@ int si_show_proc(struct seq_file *seq, void *private)
 			pci->irq, atomic_read(&d->isopen));
 
 		} else {
-			seq_printf(seq, "SI TEST major %d minor %d\n",
-				   MAJOR(si_dev), nr);
+			seq_printf(seq, "SI SIM major %d minor %d isopen %d\n",
+				   MAJOR(si_dev), nr, atomic_read(&d->isopen));
+			si_sim_show(seq, d);
 		}
 	}
 	return 0;
@@ -112,6 +121,150 @@ const struct file_operations si_fops = {
 	.release = si_close,
 };
 
+/* register access for the real card, through the PCI BAR mappings */
+
+static __u32 si_pci_plx_read(struct SIDEVICE *dev, int offset)
+{
+	return ioread32(dev->bar[0] + offset);
+}
+
+static void si_pci_plx_write(struct SIDEVICE *dev, int offset, __u32 value)
+{
+	iowrite32(value, dev->bar[0] + offset);
+}
+
+static __u8 si_pci_plx_read8(struct SIDEVICE *dev, int offset)
+{
+	return ioread8(dev->bar[0] + offset);
+}
+
+static void si_pci_plx_write8(struct SIDEVICE *dev, int offset, __u8 value)
+{
+	iowrite8(value, dev->bar[0] + offset);
+}
+
+static __u8 si_pci_uart_read(struct SIDEVICE *dev, int offset)
+{
+	return ioread8(dev->bar[2] + offset);
+}
+
+static void si_pci_uart_write(struct SIDEVICE *dev, int offset, __u8 value)
+{
+	iowrite8(value, dev->bar[2] + offset);
+}
+
+static __u32 si_pci_local_read(struct SIDEVICE *dev, int offset)
+{
+	return ioread32(dev->bar[3] + offset * 4);
+}
+
+static void si_pci_local_write(struct SIDEVICE *dev, int offset, __u32 value)
+{
+	iowrite32(value, dev->bar[3] + offset * 4);
+}
+
+const struct SI_REGOPS si_pci_regops = {
+	.plx_read = si_pci_plx_read,
+	.plx_write = si_pci_plx_write,
+	.plx_read8 = si_pci_plx_read8,
+	.plx_write8 = si_pci_plx_write8,
+	.uart_read = si_pci_uart_read,
+	.uart_write = si_pci_uart_write,
+	.local_read = si_pci_local_read,
+	.local_write = si_pci_local_write,
+};
+
+/* setup shared by real and simulated cards once registers are reachable */
+
+static void si_init_device(struct SIDEVICE *dev, int nr)
+{
+	__u32 reg;
+
+	dev->bottom_half_wq = create_workqueue("SI3097");
+	INIT_WORK(&dev->task, si_bottom_half);
+
+	spin_lock_init(&dev->uart_lock);
+	spin_lock_init(&dev->dma_lock);
+	spin_lock_init(&dev->nopage_lock);
+
+	init_waitqueue_head(&dev->dma_block);
+	init_waitqueue_head(&dev->uart_wblock);
+	init_waitqueue_head(&dev->uart_rblock);
+	init_waitqueue_head(&dev->mmap_block);
+
+	/* turn on interrupts */
+	reg = PLX_REG_READ(dev, PCI9054_INT_CTRL_STAT);
+	PLX_REG_WRITE(dev, PCI9054_INT_CTRL_STAT, reg | (1 << 8) | (1 << 11));
+
+	/* assign verbose flag as module parameter */
+
+	dev->verbose = verbose;
+
+	/* on init, configure memory if module parameter maxever is non zero */
+
+	if (maxever > 0) {
+		if (buflen > maxever)
+			buflen = maxever;
+
+		dev->dma_cfg.total = maxever;
+		dev->dma_cfg.buflen = buflen;
+		dev->dma_cfg.timeout = timeout;
+		dev->dma_cfg.maxever = maxever;
+		dev->dma_cfg.config = SI_DMA_CONFIG_WAKEUP_ONEND;
+		si_config_dma(dev);
+	}
+	device_create(si_class, NULL, MKDEV(MAJOR(si_dev), nr), NULL,
+		      "sicamera%d", nr);
+}
+
+/* create a simulated card, see sim.c */
+
+static int si_configure_sim(void)
+{
+	struct SIDEVICE *dev;
+	struct platform_device *pdev;
+	int nr = si_count;
+	int error;
+
+	if (nr == SI_MAX_CARDS) {
+		pr_info("SI ignoring simulated card - max %d\n", SI_MAX_CARDS);
+		return -EINVAL;
+	}
+
+	pdev = platform_device_register_simple("si3097-sim", nr, NULL, 0);
+	if (IS_ERR(pdev))
+		return PTR_ERR(pdev);
+
+	error = dma_coerce_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32));
+	if (error) {
+		platform_device_unregister(pdev);
+		return error;
+	}
+
+	spin_lock(&spin_multi_devs);
+	dev = &si_devices[nr];
+	memset(dev, 0, sizeof(struct SIDEVICE));
+	si_count++;
+	spin_unlock(&spin_multi_devs);
+
+	si_sim_pdev[nr] = pdev;
+	dev->device = &pdev->dev;
+	dev->ops = &si_sim_regops;
+
+	error = si_sim_init(dev);
+	if (error) {
+		platform_device_unregister(pdev);
+		si_sim_pdev[nr] = NULL;
+		si_count--;
+		return error;
+	}
+	si_info(dev, "simulated card configured\n");
+
+	si_init_device(dev, nr);
+
+	return 0;
+}
+
 static int si_configure_device(struct pci_dev *pci,
 			       const struct pci_device_id *id)
 {
@@ -119,7 +272,6 @@ static int si_configure_device(struct pci_dev *pci,
 	unsigned char irup;
 	unsigned int error;
 	int len, i;
-	__u32 reg;
 	int nr = si_count;
 
 	if (nr == SI_MAX_CARDS) {
@@ -147,6 +299,8 @@ static int si_configure_device(struct pci_dev *pci,
 		goto out;
 
 	dev->pci = pci;
+	dev->device = &pci->dev;
+	dev->ops = &si_pci_regops;
 	pci_read_config_byte(dev->pci, PCI_INTERRUPT_LINE, &irup);
 	error = pci_request_regions(dev->pci, "SI3097");
 	if (error < 0)
@@ -183,18 +337,6 @@ static int si_configure_device(struct pci_dev *pci,
 
 	pci_set_master(dev->pci);
 
-	dev->bottom_half_wq = create_workqueue("SI3097");
-	INIT_WORK(&dev->task, si_bottom_half);
-
-	spin_lock_init(&dev->uart_lock);
-	spin_lock_init(&dev->dma_lock);
-	spin_lock_init(&dev->nopage_lock);
-
-	init_waitqueue_head(&dev->dma_block);
-	init_waitqueue_head(&dev->uart_wblock);
-	init_waitqueue_head(&dev->uart_rblock);
-	init_waitqueue_head(&dev->mmap_block);
-
 	/* do the master reset local bus */
 	//  LOCAL_REG_WRITE(dev, LOCAL_COMMAND, 0 );
 	//  UART_REG_WRITE(dev, SERIAL_IER, 0);   /* disable all serial ints */
@@ -207,49 +349,7 @@ static int si_configure_device(struct pci_dev *pci,
 	// si_stop_dma( dev, NULL );
 	// }
 
-	/* turn on interrupts */
-	reg = PLX_REG_READ(dev, PCI9054_INT_CTRL_STAT);
-	//  si_info(dev, "intr stat 0x%x\n", reg);
-	PLX_REG_WRITE(dev, PCI9054_INT_CTRL_STAT, reg | (1 << 8) | (1 << 11));
-	reg = PLX_REG_READ(dev, PCI9054_INT_CTRL_STAT);
-
-	//  si_info(dev, "LOCAL_ID_NUMBER = 0x%x 0x%x\n",
-	//    LOCAL_REG_READ(dev, LOCAL_ID_NUMBER), reg);
-
-	//  reg = PLX_REG_READ( dev, PCI9054_INT_CTRL_STAT);
-
-	//  if( reg & ( 1<<7 ) ) {
-	//    si_info(dev, "local bus parity error 0x%x\n", reg);
-	//    PLX_REG_WRITE( dev, PCI9054_INT_CTRL_STAT, reg | (1<<7) );
-	//  }
-	//  reg = PLX_REG_READ( dev, PCI9054_INT_CTRL_STAT );
-	//  si_info(dev, "LOCAL_REV_NUMBER = 0x%x 0x%x\n",
-	//    LOCAL_REG_READ(dev, LOCAL_REV_NUMBER), reg);
-
-	//  reg = PLX_REG_READ( dev, PCI9054_INT_CTRL_STAT);
-
-	//  reg = PLX_REG_READ(dev, PCI9054_DMA0_MODE );
-	//  si_info(dev, "mode 0x%x\n", reg);
-
-	/* assign verbose flag as module parameter */
-
-	dev->verbose = verbose;
-
-	/* on init, configure memory if module parameter maxever is non zero */
-
-	if (maxever > 0) {
-		if (buflen > maxever)
-			buflen = maxever;
-
-		dev->dma_cfg.total = maxever;
-		dev->dma_cfg.buflen = buflen;
-		dev->dma_cfg.timeout = timeout;
-		dev->dma_cfg.maxever = maxever;
-		dev->dma_cfg.config = SI_DMA_CONFIG_WAKEUP_ONEND;
-		si_config_dma(dev);
-	}
-	device_create(si_class, NULL, MKDEV(MAJOR(si_dev), nr), NULL,
-		      "sicamera%d", nr);
+	si_init_device(dev, nr);
 
 	return 0;
 out:
@@ -259,6 +359,8 @@ out:
 
 static int __init si_init_module(void)
 {
+	int i;
+
 	spin_lock_init(&spin_multi_devs);
 
 	memset(&si_driver, 0, sizeof(struct pci_driver));
@@ -287,27 +389,23 @@ static int __init si_init_module(void)
 		goto out_cdev;
 	}
 
-	//#define NO_HW_TEST 1
-
-#ifdef NO_HW_TEST
-	si_count = 1;
-	dev = &si_devices[0];
-	pr_info("SI TEST device configured\n");
-	memset(dev, 0, sizeof(struct SIDEVICE));
-	dev->test = 1;
-	spin_lock_init(&dev->uart_lock);
-	spin_lock_init(&dev->dma_lock);
-#else
 	if (pci_register_driver(&si_driver) < 0) {
 		pr_err("SI pci_register_driver failed\n");
 		goto out_proc;
 	}
+
+	/* module parameter sim adds cards with no hardware behind them */
+
+	for (i = 0; i < sim; i++) {
+		if (si_configure_sim() < 0)
+			pr_err("SI failed to configure simulated card %d\n", i);
+	}
+
 	if (si_count == 0) {
 		pci_unregister_driver(&si_driver);
 		pr_info("SI no cards found\n");
 		goto out_proc;
 	}
-#endif
 
 	return 0; /* succeed */
 
@@ -334,10 +432,27 @@ static void __exit si_cleanup_module(void)
 		si_stop_dma(dev, NULL);
 		si_free_sgl(dev);
 		si_cleanup_serial(dev);
-		if (dev->pci) {
-			if (dev->pci->irq)
-				free_irq(dev->pci->irq, dev);
 
+		/* no more interrupts, then wait for a bottom half one
+		 * already queued, which reads the registers, before they
+		 * go
+		 */
+		if (dev->sim)
+			si_sim_stop(dev);
+		if (dev->pci && dev->pci->irq)
+			free_irq(dev->pci->irq, dev);
+		if (dev->bottom_half_wq) {
+			flush_workqueue(dev->bottom_half_wq);
+			destroy_workqueue(dev->bottom_half_wq);
+			dev->bottom_half_wq = NULL;
+		}
+
+		if (dev->sim) {
+			si_sim_cleanup(dev);
+			platform_device_unregister(si_sim_pdev[nr]);
+			si_sim_pdev[nr] = NULL;
+		}
+		if (dev->pci) {
 			pci_release_regions(dev->pci);
 			pci_disable_device(dev->pci);
 		}
@@ -347,9 +462,7 @@ static void __exit si_cleanup_module(void)
 	class_destroy(si_class);
 	unregister_chrdev_region(si_dev, SI_MAX_CARDS);
 
-#ifndef NO_HW_TEST
 	pci_unregister_driver(&si_driver);
-#endif
 
 	if (si_proc)
 		remove_proc_entry("si3097", 0);
@@ -431,14 +544,6 @@ ssize_t si_read(struct file *filp, char __user *buf, size_t count, loff_t *off)
 	dev = filp->private_data;
 	blocking = (dev->Uart.block & SI_SERIAL_FLAGS_BLOCK) != 0;
 
-	if (dev->test) {
-		for (i = 0; i < count; i++) { // for all characters
-			if (put_user(0, (char __user *)&buf[i]))
-				return -EFAULT;
-		}
-		return count;
-	}
-
 	for (i = 0; i < count; i++) { // for all characters
 
 		while (si_receive_serial(dev, &ch) == FALSE) {
@@ -484,14 +589,6 @@ ssize_t si_write(struct file *filp, const char __user *buf, size_t count,
 
 	si_serial_dbg(dev, "write, count %lu\n", (unsigned long)count);
 
-	if (dev->test) {
-		for (i = 0; i < count; i++) { // for all characters
-			if (get_user(ch, (char __user *)&buf[i]))
-				return -EFAULT;
-		}
-		return count;
-	}
-
 	for (i = 0; i < count; i++) { // for all characters
 		if (get_user(ch, (char __user *)&buf[i]))
 			return -EFAULT;
@@ -607,7 +704,7 @@ unsigned int si_poll(struct file *filp, poll_table *table)
 			else
 				strcat(buf, ", dma not ready");
 		}
-		dev_dbg(&dev->pci->dev, "%s\n", buf);
+		dev_dbg(dev->device, "%s\n", buf);
 	}
 	return mask;
 }
@@ -26,10 +26,32 @@ struct UART {
 	int timeout; /* jiffies for write timeout */
 };
 
+struct SIDEVICE;
+struct SI_SIM;
+struct seq_file;
+
+/* register access operations, one table per kind of device
+ * (PCI card or simulated card)
+ */
+
+struct SI_REGOPS {
+	__u32 (*plx_read)(struct SIDEVICE *dev, int offset);
+	void (*plx_write)(struct SIDEVICE *dev, int offset, __u32 value);
+	__u8 (*plx_read8)(struct SIDEVICE *dev, int offset);
+	void (*plx_write8)(struct SIDEVICE *dev, int offset, __u8 value);
+	__u8 (*uart_read)(struct SIDEVICE *dev, int offset);
+	void (*uart_write)(struct SIDEVICE *dev, int offset, __u8 value);
+	__u32 (*local_read)(struct SIDEVICE *dev, int offset);
+	void (*local_write)(struct SIDEVICE *dev, int offset, __u32 value);
+};
+
 /* device structure for one SI card */
 
 struct SIDEVICE {
-	struct pci_dev *pci; /* device found by kernel        */
+	struct pci_dev *pci; /* device found by kernel (NULL if simulated) */
+	struct device *device; /* generic device for dma and messages */
+	const struct SI_REGOPS *ops; /* register access */
+	struct SI_SIM *sim; /* simulated hardware state, if any */
 	spinlock_t uart_lock; /* protection for uart registers */
 	spinlock_t dma_lock; /* protection for dma registers  */
 	spinlock_t nopage_lock; /* protection for nopage/mmap  */
@@ -60,7 +82,6 @@ struct SIDEVICE {
 	atomic_t dma_done; /* true if irup detects dma done */
 	int dma_next; /* next counter */
 	int dma_cur; /* which dma sgl is active */
-	int test; /* true if test mode (no hardware) */
 	int abort_active; /* abort sequence active */
 	__u32 irup_reg; /* hold reg from irup */
 	__u32 rb_count; /* local bus count at dma_done (must be zero) */
@@ -73,21 +94,21 @@ struct SIDEVICE {
 
 #define si_dbg(dev, fmt, arg...) do { \
 	if ((dev)->verbose) \
-		dev_dbg(&(dev)->pci->dev, fmt, ##arg); \
+		dev_dbg((dev)->device, fmt, ##arg); \
 } while (0)
 #define si_serial_dbg(dev, fmt, arg...) do { \
 	if (((dev)->verbose & SI_VERBOSE_SERIAL)) \
-		dev_dbg(&(dev)->pci->dev, fmt, ##arg); \
+		dev_dbg((dev)->device, fmt, ##arg); \
 } while (0)
 #define si_dma_dbg(dev, fmt, arg...) do { \
 	if (((dev)->verbose & SI_VERBOSE_DMA)) \
-		dev_dbg(&(dev)->pci->dev, fmt, ##arg); \
+		dev_dbg((dev)->device, fmt, ##arg); \
 } while (0)
 
 #define si_info(dev, fmt, arg...) \
-	dev_info(&(dev)->pci->dev, fmt, ##arg)
+	dev_info((dev)->device, fmt, ##arg)
 #define si_err(dev, fmt, arg...) \
-	dev_err(&(dev)->pci->dev, fmt, ##arg)
+	dev_err((dev)->device, fmt, ##arg)
 
 #define VMACLOSE_TIMEOUT (10 * HZ) /* seconds */
 
@@ -95,24 +116,24 @@ struct SIDEVICE {
 #define SI_LOCAL_BUSADDR 0x30000004
 
 // Macros for PLX chip register access
-#define PLX_REG_READ(pdx, offset) ioread32((pdx)->bar[0] + (offset))
+#define PLX_REG_READ(pdx, offset) ((pdx)->ops->plx_read((pdx), (offset)))
 #define PLX_REG_WRITE(pdx, offset, value)                                      \
-	iowrite32((value), (pdx)->bar[0] + (offset))
+	((pdx)->ops->plx_write((pdx), (offset), (value)))
 
-#define PLX_REG8_READ(pdx, offset) ioread8((pdx)->bar[0] + (offset))
+#define PLX_REG8_READ(pdx, offset) ((pdx)->ops->plx_read8((pdx), (offset)))
 #define PLX_REG8_WRITE(pdx, offset, value)                                     \
-	iowrite8((value), (pdx)->bar[0] + (offset))
+	((pdx)->ops->plx_write8((pdx), (offset), (value)))
 
 // Macros for SI UART access
-#define UART_REG_READ(pdx, offset) ioread8((pdx)->bar[2] + (offset))
+#define UART_REG_READ(pdx, offset) ((pdx)->ops->uart_read((pdx), (offset)))
 #define UART_REG_WRITE(pdx, offset, value)                                     \
-	iowrite8((value), (pdx)->bar[2] + (offset))
+	((pdx)->ops->uart_write((pdx), (offset), (value)))
 
 // Macros for SI LOCAL access
 #define LOCAL_REG_READ(pdx, offset)                                            \
-	(ioread32((pdx)->bar[3] + (offset * 4)) & 0xff)
+	((pdx)->ops->local_read((pdx), (offset)) & 0xff)
 #define LOCAL_REG_WRITE(pdx, offset, value)                                    \
-	iowrite32((value & 0xff), (pdx)->bar[3] + (offset * 4))
+	((pdx)->ops->local_write((pdx), (offset), (value) & 0xff))
 
 /*
  * This INTER_TYPE_* mask is used for the "source" word that
@@ -364,3 +385,10 @@ int si_wait_vmaclose(struct SIDEVICE *dev);
 int si_alloc_memory(struct SIDEVICE *dev);
 void si_print_memtable(struct SIDEVICE *dev);
 int si_dma_progress(struct SIDEVICE *dev);
+
+extern const struct SI_REGOPS si_pci_regops;
+extern const struct SI_REGOPS si_sim_regops;
+int si_sim_init(struct SIDEVICE *dev);
+void si_sim_stop(struct SIDEVICE *dev);
+void si_sim_cleanup(struct SIDEVICE *dev);
+void si_sim_show(struct seq_file *seq, struct SIDEVICE *dev);
@@ -0,0 +1,763 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+/*
+ * Linux Driver for the
+ * Spectral Instruments 3097 Camera Interface
+ *
+ * Copyright (C) 2006  Jeffrey R Hagen
+ */
+
+/* simulated card
+ *
+ * A software model of the PLX 9054, the SI pixel fifo and the 16550
+ * UART with a camera on the far end of the fiber.  The rest of the
+ * driver reaches it through si_sim_regops, so scatter gather DMA,
+ * interrupts, the bottom half and the UART buffering all run exactly
+ * as they do with a card.  Load the module with sim=N to add N cards.
+ *
+ * The camera echoes each command byte, answers H, L and I with blocks
+ * of big-endian ints followed by Y, takes F, G, J and K argument blocks,
+ * and after C, D, E or Z streams a synthetic image into the DMA chain
+ * at sim_rate MBytes/sec.
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include <linux/poll.h>
+#include <linux/pci.h>
+
+#include "si3097.h"
+#include "si3097_module.h"
+
+/* link rate of the simulated fiber in MBytes/sec, 0 for no delay */
+
+int sim_rate = 64;
+module_param(sim_rate, int, 0);
+
+#define SIM_FIFO_LEN 512 /* uart receive fifo and camera output queue */
+#define SIM_ARGS_MAX 128 /* largest argument block, 32 ints */
+
+#define SIM_INT_PCI_ENABLE (1 << 8)
+#define SIM_INT_LOCAL_ENABLE (1 << 11)
+#define SIM_INT_LOCAL_ACTIVE (1 << 15)
+#define SIM_INT_DMA0_ENABLE (1 << 18)
+#define SIM_INT_DMA0_ACTIVE (1 << 21)
+
+struct SI_SIM {
+	spinlock_t lock;
+	struct SIDEVICE *dev;
+	struct hrtimer dma_timer; /* one sgl buffer per expiry */
+	struct hrtimer uart_timer; /* camera bytes arriving at the uart */
+	struct hrtimer irq_timer; /* asserts the interrupt line */
+	int stopped; /* unloading, no more timers or interrupts */
+
+	__u32 plx[64]; /* BAR0 registers 0x000 - 0x0fc */
+	__u8 dma_stat; /* DMA0 byte of PCI9054_DMA_COMMAND_STAT */
+	__u8 local[16]; /* SI local registers */
+	__u32 pix_cnt; /* pixel down counter */
+	__u32 frame_pix; /* pixel counter at start of dma */
+	int dma_running;
+	int dma_desc; /* sgl index of buffer being filled */
+
+	__u8 uart[8]; /* 16550 registers */
+	__u8 dll, dlh, fcr;
+	int thre; /* transmitter empty interrupt pending */
+	__u8 rx[SIM_FIFO_LEN]; /* uart receive fifo */
+	int rxput, rxget, rxcnt;
+	__u8 out[SIM_FIFO_LEN]; /* camera bytes still on the fiber */
+	int output, outget, outcnt;
+
+	int nargs; /* argument bytes expected by current command */
+	int gotargs;
+	int cmd;
+	__u8 args[SIM_ARGS_MAX];
+	int readout[32];
+	int config[32];
+	int status[16];
+	int armed; /* camera has an image to read out */
+	ktime_t readout_at; /* end of exposure */
+
+	unsigned long frames; /* statistics for /proc/si3097 */
+	unsigned long buffers;
+	unsigned long long bytes;
+	unsigned long irqs;
+};
+
+/* defaults taken from 800-299x1.set */
+
+static const int sim_readout[32] = {
+	2, 2047, 1, 0, 1, 2046, 1, 1, 200, 0, 19, 0, 200, 200, 201, 199,
+	10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32670, 32945, 32590, 32920
+};
+
+static const int sim_config[32] = {
+	804, 299, 0, 0, 1, 2049, 0, 1, 2047, 185, 3, 20, 60, 0, 2480, 10,
+	0, 300
+};
+
+/* CCD -100C, backplate 20C, pressure 0.01 Torr */
+
+static const int sim_status[16] = { 1732, 2932, 266 };
+
+/* time on the fiber for len bytes */
+
+static u64 si_sim_xfer_ns(int len)
+{
+	if (sim_rate <= 0)
+		return 0;
+	return div_u64((u64)len * 1000, sim_rate);
+}
+
+static int si_sim_uart_pending(struct SI_SIM *s)
+{
+	__u8 ier = s->uart[SERIAL_IER];
+
+	return ((ier & RX_INT) && s->rxcnt) || ((ier & TX_INT) && s->thre);
+}
+
+static int si_sim_irq_pending(struct SI_SIM *s)
+{
+	__u32 ctrl = s->plx[PCI9054_INT_CTRL_STAT / 4];
+
+	if (!(ctrl & SIM_INT_PCI_ENABLE))
+		return 0;
+	if ((ctrl & SIM_INT_DMA0_ACTIVE) && (ctrl & SIM_INT_DMA0_ENABLE))
+		return 1;
+	return (ctrl & SIM_INT_LOCAL_ENABLE) && si_sim_uart_pending(s);
+}
+
+/* the line is level triggered, call with lock held */
+
+static void si_sim_raise(struct SI_SIM *s)
+{
+	if (!s->stopped && si_sim_irq_pending(s))
+		hrtimer_start(&s->irq_timer, ktime_set(0, 0), HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart si_sim_irq_timer(struct hrtimer *t)
+{
+	struct SI_SIM *s = container_of(t, struct SI_SIM, irq_timer);
+	unsigned long flags;
+	int pending;
+
+	spin_lock_irqsave(&s->lock, flags);
+	pending = !s->stopped && si_sim_irq_pending(s);
+	if (pending)
+		s->irqs++;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	if (pending)
+		si_interrupt(0, s->dev);
+
+	return HRTIMER_NORESTART;
+}
+
+/* synthetic image
+ * The camera interleaves one pixel from each of the four quadrants.
+ * Each quadrant carries a ramp along the readout with the quadrant
+ * number in the top two bits, so every frame is identical.
+ */
+
+static void si_sim_fill(__u16 *buf, int npix, __u32 first)
+{
+	__u32 k;
+	int i;
+
+	for (i = 0; i < npix; i++) {
+		k = first + i;
+		buf[i] = ((k & 3) << 14) | ((k >> 2) & 0x3fff);
+	}
+}
+
+/* start streaming if the camera is armed and the dma is running,
+ * call with lock held
+ */
+
+static void si_sim_dma_kick(struct SI_SIM *s)
+{
+	struct SIDEVICE *dev = s->dev;
+	s64 wait;
+	u64 ns;
+
+	if (s->stopped || !s->armed || !s->dma_running || !dev->sgl)
+		return;
+	if (hrtimer_is_queued(&s->dma_timer))
+		return;
+
+	ns = si_sim_xfer_ns(dev->sgl[s->dma_desc].siz);
+	wait = ktime_to_ns(ktime_sub(s->readout_at, ktime_get()));
+	if (wait > 0)
+		ns += wait;
+	hrtimer_start(&s->dma_timer, ns_to_ktime(ns), HRTIMER_MODE_REL);
+}
+
+/* one sgl buffer has crossed the fiber, fill it and follow the chain */
+
+static enum hrtimer_restart si_sim_dma_timer(struct hrtimer *t)
+{
+	struct SI_SIM *s = container_of(t, struct SI_SIM, dma_timer);
+	struct SIDEVICE *dev = s->dev;
+	struct SIDMA_SGL *ch;
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	__u32 npix, next;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (!s->dma_running || !dev->sgl)
+		goto out;
+
+	ch = &dev->sgl[s->dma_desc];
+	npix = ch->siz / 2;
+	if (npix > s->pix_cnt)
+		npix = s->pix_cnt;
+	si_sim_fill(ch->cpu, npix, s->frame_pix - s->pix_cnt);
+	s->pix_cnt -= npix;
+	s->plx[PCI9054_DMA0_PCI_ADDR / 4] = ch->padr;
+	s->buffers++;
+	s->bytes += ch->siz;
+
+	if (ch->dpr & SIDMA_DPR_EOC) {
+		s->dma_running = 0;
+		s->armed = 0;
+		s->dma_stat = (s->dma_stat & ~1) | SI_DMA_STATUS_DONE;
+		s->frames++;
+	} else {
+		next = ((ch->dpr & ~0xf) - (__u32)dev->sgl_pci) /
+		       sizeof(struct SIDMA_SGL);
+		if (next >= dev->dma_nbuf) {
+			si_err(dev, "sim sgl %d points outside chain\n",
+			       s->dma_desc);
+			s->dma_running = 0;
+			goto out;
+		}
+		s->dma_desc = next;
+		hrtimer_forward_now(t,
+			ns_to_ktime(si_sim_xfer_ns(dev->sgl[next].siz)));
+		ret = HRTIMER_RESTART;
+	}
+
+	if (ch->dpr & (SIDMA_DPR_IRUP | SIDMA_DPR_EOC)) {
+		s->plx[PCI9054_INT_CTRL_STAT / 4] |= SIM_INT_DMA0_ACTIVE;
+		si_sim_raise(s);
+	}
+out:
+	spin_unlock_irqrestore(&s->lock, flags);
+	return ret;
+}
+
+/* write to DMA0 command/status, call with lock held */
+
+static void si_sim_dma_cmd(struct SI_SIM *s, __u8 value)
+{
+	__u32 desc;
+
+	if (value & (1 << 3)) /* clear interrupt */
+		s->plx[PCI9054_INT_CTRL_STAT / 4] &= ~SIM_INT_DMA0_ACTIVE;
+
+	if (!(value & (1 << 0))) { /* disable pauses the channel */
+		s->dma_running = 0;
+		hrtimer_try_to_cancel(&s->dma_timer);
+		s->dma_stat &= ~1;
+	} else {
+		s->dma_stat |= 1;
+	}
+
+	if (value & (1 << 2)) { /* abort completes the channel */
+		if (!(s->dma_stat & SI_DMA_STATUS_DONE)) {
+			s->dma_stat |= SI_DMA_STATUS_DONE;
+			s->armed = 0;
+			s->plx[PCI9054_INT_CTRL_STAT / 4] |=
+				SIM_INT_DMA0_ACTIVE;
+			si_sim_raise(s);
+		}
+		return;
+	}
+
+	if ((value & 3) == 3) { /* start */
+		desc = s->plx[PCI9054_DMA0_DESC_PTR / 4] & ~0xf;
+		s->dma_desc = (desc - (__u32)s->dev->sgl_pci) /
+			      sizeof(struct SIDMA_SGL);
+		if (s->dma_desc >= s->dev->dma_nbuf)
+			s->dma_desc = 0;
+		s->dma_stat = 1;
+		s->frame_pix = s->pix_cnt;
+		s->dma_running = 1;
+		si_sim_dma_kick(s);
+	}
+}
+
+/* camera side of the fiber */
+
+static void si_sim_cam_put(struct SI_SIM *s, __u8 c)
+{
+	if (s->outcnt == SIM_FIFO_LEN)
+		return;
+	s->out[s->output++] = c;
+	if (s->output == SIM_FIFO_LEN)
+		s->output = 0;
+	s->outcnt++;
+
+	if (!s->stopped && !hrtimer_is_queued(&s->uart_timer))
+		hrtimer_start(&s->uart_timer, ktime_set(0, 0),
+			      HRTIMER_MODE_REL);
+}
+
+static void si_sim_cam_put_ints(struct SI_SIM *s, const int *data, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		si_sim_cam_put(s, (data[i] >> 24) & 0xff);
+		si_sim_cam_put(s, (data[i] >> 16) & 0xff);
+		si_sim_cam_put(s, (data[i] >> 8) & 0xff);
+		si_sim_cam_put(s, data[i] & 0xff);
+	}
+}
+
+static int si_sim_cam_arg(struct SI_SIM *s, int n)
+{
+	__u8 *a = &s->args[n * 4];
+
+	return (a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3];
+}
+
+static void si_sim_cam_args(struct SI_SIM *s)
+{
+	int i, ix, *dat;
+
+	dat = (s->cmd == 'F' || s->cmd == 'G') ? s->readout : s->config;
+
+	if (s->cmd == 'F' || s->cmd == 'J') {
+		for (i = 0; i < 32; i++)
+			dat[i] = si_sim_cam_arg(s, i);
+	} else {
+		ix = si_sim_cam_arg(s, 0);
+		if (ix < 0 || ix >= 32) {
+			si_sim_cam_put(s, 'N');
+			return;
+		}
+		dat[ix] = si_sim_cam_arg(s, 1);
+	}
+	si_sim_cam_put(s, 'Y');
+}
+
+static void si_sim_cam_expose(struct SI_SIM *s, int ms)
+{
+	s->armed = 1;
+	s->readout_at = ktime_add_ms(ktime_get(), ms);
+	si_sim_dma_kick(s);
+}
+
+/* camera receives one byte, call with lock held */
+
+static void si_sim_cam_rx(struct SI_SIM *s, __u8 c)
+{
+	if (s->nargs) {
+		s->args[s->gotargs++] = c;
+		if (s->gotargs == s->nargs) {
+			s->nargs = 0;
+			si_sim_cam_args(s);
+		}
+		return;
+	}
+
+	s->cmd = c;
+	si_sim_cam_put(s, c); /* echo */
+
+	switch (c) {
+	case 'F':
+	case 'J':
+		s->nargs = 32 * 4;
+		s->gotargs = 0;
+		break;
+	case 'G':
+	case 'K':
+		s->nargs = 2 * 4;
+		s->gotargs = 0;
+		break;
+	case 'H':
+		si_sim_cam_put_ints(s, s->readout, 32);
+		si_sim_cam_put(s, 'Y');
+		break;
+	case 'L':
+		si_sim_cam_put_ints(s, s->config, 32);
+		si_sim_cam_put(s, 'Y');
+		break;
+	case 'I':
+		si_sim_cam_put_ints(s, s->status, 16);
+		si_sim_cam_put(s, 'Y');
+		break;
+	case 'A': /* open shutter */
+	case 'B': /* close shutter */
+		s->status[8] = (c == 'A');
+		si_sim_cam_put(s, 'Y');
+		break;
+	case 'D': /* exposed image */
+	case 'E': /* dark image */
+		si_sim_cam_expose(s, s->readout[8]);
+		si_sim_cam_put(s, 'Y');
+		break;
+	case 'C': /* test image */
+	case 'Z': /* tdi image */
+		si_sim_cam_expose(s, 0);
+		si_sim_cam_put(s, 'Y');
+		break;
+	case '0': /* abort readout */
+		s->armed = 0;
+		break;
+	default: /* S, T, P, M and unknown commands have no reply */
+		break;
+	}
+}
+
+/* move camera bytes into the uart fifo at the configured baud rate */
+
+static u64 si_sim_char_ns(struct SI_SIM *s)
+{
+	int div = (s->dlh << 8) | s->dll;
+
+	if (div == 0)
+		div = 1;
+	return div_u64(10ULL * 1000000000ULL * div, 1000000);
+}
+
+static enum hrtimer_restart si_sim_uart_timer(struct hrtimer *t)
+{
+	struct SI_SIM *s = container_of(t, struct SI_SIM, uart_timer);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	int n;
+
+	spin_lock_irqsave(&s->lock, flags);
+	for (n = 0; n < 16 && s->outcnt && s->rxcnt < SIM_FIFO_LEN; n++) {
+		s->rx[s->rxput++] = s->out[s->outget++];
+		if (s->rxput == SIM_FIFO_LEN)
+			s->rxput = 0;
+		if (s->outget == SIM_FIFO_LEN)
+			s->outget = 0;
+		s->outcnt--;
+		s->rxcnt++;
+	}
+	if (n)
+		si_sim_raise(s);
+	if (s->outcnt && !s->stopped) {
+		hrtimer_forward_now(t, ns_to_ktime(16 * si_sim_char_ns(s)));
+		ret = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return ret;
+}
+
+/* register access */
+
+static __u32 si_sim_plx_read(struct SIDEVICE *dev, int offset)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	__u32 reg;
+
+	spin_lock_irqsave(&s->lock, flags);
+	reg = s->plx[(offset & 0xff) / 4];
+	if (offset == PCI9054_INT_CTRL_STAT && si_sim_uart_pending(s))
+		reg |= SIM_INT_LOCAL_ACTIVE;
+	else if (offset == PCI9054_DMA_COMMAND_STAT)
+		reg = (reg & ~0xff) | s->dma_stat;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return reg;
+}
+
+static void si_sim_plx_write(struct SIDEVICE *dev, int offset, __u32 value)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	__u32 *reg;
+
+	spin_lock_irqsave(&s->lock, flags);
+	reg = &s->plx[(offset & 0xff) / 4];
+	if (offset == PCI9054_INT_CTRL_STAT) {
+		/* active bits are status, not settable */
+		*reg = (value & ~(SIM_INT_LOCAL_ACTIVE | SIM_INT_DMA0_ACTIVE)) |
+		       (*reg & SIM_INT_DMA0_ACTIVE);
+		si_sim_raise(s);
+	} else if (offset == PCI9054_DMA_COMMAND_STAT) {
+		*reg = value & ~0xff;
+		si_sim_dma_cmd(s, value & 0xff);
+	} else {
+		*reg = value;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static __u8 si_sim_plx_read8(struct SIDEVICE *dev, int offset)
+{
+	return (si_sim_plx_read(dev, offset & ~3) >> ((offset & 3) * 8)) &
+	       0xff;
+}
+
+static void si_sim_plx_write8(struct SIDEVICE *dev, int offset, __u8 value)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	__u32 *reg;
+	int shift;
+
+	if (offset == PCI9054_DMA_COMMAND_STAT) {
+		spin_lock_irqsave(&s->lock, flags);
+		si_sim_dma_cmd(s, value);
+		spin_unlock_irqrestore(&s->lock, flags);
+		return;
+	}
+
+	spin_lock_irqsave(&s->lock, flags);
+	reg = &s->plx[(offset & 0xff) / 4];
+	shift = (offset & 3) * 8;
+	*reg = (*reg & ~(0xff << shift)) | (value << shift);
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static __u8 si_sim_uart_read(struct SIDEVICE *dev, int offset)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	int dlab;
+	__u8 reg;
+
+	spin_lock_irqsave(&s->lock, flags);
+	dlab = s->uart[SERIAL_LCR] & 0x80;
+	switch (offset) {
+	case SERIAL_RX:
+		if (dlab) {
+			reg = s->dll;
+		} else if (s->rxcnt) {
+			reg = s->rx[s->rxget++];
+			if (s->rxget == SIM_FIFO_LEN)
+				s->rxget = 0;
+			s->rxcnt--;
+		} else {
+			reg = 0;
+		}
+		break;
+	case SERIAL_IER:
+		reg = dlab ? s->dlh : s->uart[SERIAL_IER];
+		break;
+	case SERIAL_IIR:
+		if ((s->uart[SERIAL_IER] & RX_INT) && s->rxcnt) {
+			reg = 0x4;
+		} else if ((s->uart[SERIAL_IER] & TX_INT) && s->thre) {
+			s->thre = 0; /* reading IIR clears THRE */
+			reg = 0x2;
+		} else {
+			reg = 0x1;
+		}
+		if (s->fcr & 1)
+			reg |= 0xc0;
+		break;
+	case SERIAL_LSR:
+		reg = 0x60 | (s->rxcnt ? 1 : 0);
+		break;
+	case SERIAL_MSR:
+		reg = 0xb0; /* DCD, DSR, CTS */
+		break;
+	default:
+		reg = s->uart[offset & 7];
+		break;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return reg;
+}
+
+static void si_sim_uart_write(struct SIDEVICE *dev, int offset, __u8 value)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	int dlab;
+
+	spin_lock_irqsave(&s->lock, flags);
+	dlab = s->uart[SERIAL_LCR] & 0x80;
+	switch (offset) {
+	case SERIAL_TX:
+		if (dlab) {
+			s->dll = value;
+		} else {
+			si_sim_cam_rx(s, value);
+			s->thre = 1;
+			si_sim_raise(s);
+		}
+		break;
+	case SERIAL_IER:
+		if (dlab) {
+			s->dlh = value;
+		} else {
+			s->uart[SERIAL_IER] = value;
+			if (value & TX_INT)
+				s->thre = 1;
+			si_sim_raise(s);
+		}
+		break;
+	case SERIAL_FCR:
+		s->fcr = value;
+		if (value & 2) { /* clear receive fifo */
+			s->rxput = 0;
+			s->rxget = 0;
+			s->rxcnt = 0;
+		}
+		break;
+	case SERIAL_LCR:
+		if ((value & 0x40) && !(s->uart[SERIAL_LCR] & 0x40))
+			s->nargs = 0; /* break resets the camera parser */
+		s->uart[SERIAL_LCR] = value;
+		break;
+	default:
+		s->uart[offset & 7] = value;
+		break;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static __u32 si_sim_local_read(struct SIDEVICE *dev, int offset)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	__u32 reg;
+
+	spin_lock_irqsave(&s->lock, flags);
+	switch (offset) {
+	case LOCAL_PIX_CNT_LL:
+	case LOCAL_PIX_CNT_ML:
+	case LOCAL_PIX_CNT_MH:
+	case LOCAL_PIX_CNT_HH:
+		reg = s->pix_cnt >> ((offset - LOCAL_PIX_CNT_LL) * 8);
+		break;
+	case LOCAL_STATUS: /* signal detect, fifo empty */
+		reg = LS_HL_SD | LS_FIFO_HF_L | LS_FIFO_FF_L;
+		break;
+	default:
+		reg = s->local[offset & 0xf];
+		break;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return reg & 0xff;
+}
+
+static void si_sim_local_write(struct SIDEVICE *dev, int offset, __u32 value)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+	int shift;
+
+	spin_lock_irqsave(&s->lock, flags);
+	switch (offset) {
+	case LOCAL_PIX_CNT_LL:
+	case LOCAL_PIX_CNT_ML:
+	case LOCAL_PIX_CNT_MH:
+	case LOCAL_PIX_CNT_HH:
+		shift = (offset - LOCAL_PIX_CNT_LL) * 8;
+		s->pix_cnt = (s->pix_cnt & ~(0xff << shift)) |
+			     ((value & 0xff) << shift);
+		break;
+	default:
+		s->local[offset & 0xf] = value;
+		break;
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+const struct SI_REGOPS si_sim_regops = {
+	.plx_read = si_sim_plx_read,
+	.plx_write = si_sim_plx_write,
+	.plx_read8 = si_sim_plx_read8,
+	.plx_write8 = si_sim_plx_write8,
+	.uart_read = si_sim_uart_read,
+	.uart_write = si_sim_uart_write,
+	.local_read = si_sim_local_read,
+	.local_write = si_sim_local_write,
+};
+
+int si_sim_init(struct SIDEVICE *dev)
+{
+	struct SI_SIM *s;
+
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	spin_lock_init(&s->lock);
+	s->dev = dev;
+
+	hrtimer_init(&s->dma_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->dma_timer.function = si_sim_dma_timer;
+	hrtimer_init(&s->uart_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->uart_timer.function = si_sim_uart_timer;
+	hrtimer_init(&s->irq_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	s->irq_timer.function = si_sim_irq_timer;
+
+	s->dma_stat = SI_DMA_STATUS_DONE;
+	s->local[LOCAL_ID_NUMBER] = 97;
+	s->local[LOCAL_REV_NUMBER] = 1;
+	memcpy(s->readout, sim_readout, sizeof(s->readout));
+	memcpy(s->config, sim_config, sizeof(s->config));
+	memcpy(s->status, sim_status, sizeof(s->status));
+
+	dev->sim = s;
+	return 0;
+}
+
+/* no more interrupts or timers.  The registers still answer, so a
+ * bottom half an interrupt already queued can finish; its writes do
+ * not start the timers again
+ */
+
+void si_sim_stop(struct SIDEVICE *dev)
+{
+	struct SI_SIM *s = dev->sim;
+	unsigned long flags;
+
+	if (!s)
+		return;
+
+	spin_lock_irqsave(&s->lock, flags);
+	s->stopped = 1;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	hrtimer_cancel(&s->dma_timer);
+	hrtimer_cancel(&s->uart_timer);
+	hrtimer_cancel(&s->irq_timer);
+}
+
+/* after si_sim_stop() and once the bottom half workqueue is gone */
+
+void si_sim_cleanup(struct SIDEVICE *dev)
+{
+	struct SI_SIM *s = dev->sim;
+
+	if (!s)
+		return;
+
+	hrtimer_cancel(&s->dma_timer);
+	hrtimer_cancel(&s->uart_timer);
+	hrtimer_cancel(&s->irq_timer);
+	dev->sim = NULL;
+	kfree(s);
+}
+
+void si_sim_show(struct seq_file *seq, struct SIDEVICE *dev)
+{
+	struct SI_SIM *s = dev->sim;
+
+	if (!s)
+		return;
+
+	seq_printf(seq,
+		   "  rate %d MB/s frames %lu buffers %lu bytes %llu irqs %lu\n",
+		   sim_rate, s->frames, s->buffers, s->bytes, s->irqs);
+}
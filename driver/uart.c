@@ -221,11 +221,6 @@ void si_cleanup_serial(struct SIDEVICE *dev)
 	unsigned long flags;
 	__u32 reg;
 
-	if (dev->test) {
-		si_info(dev, "cleanup_serial TEST\n");
-		return;
-	}
-
 	spin_lock_irqsave(&dev->uart_lock, flags);
 	UART_REG_WRITE(dev, SERIAL_FCR, 0); // disable rx and tx fifos
 	UART_REG_WRITE(dev, SERIAL_IER, 0); // disable all ints
@@ -251,11 +246,6 @@ int si_transmit_serial(struct SIDEVICE *dev, __u8 data)
 	unsigned long flags;
 	__u8 reg;
 
-	if (dev->test) {
-		si_info(dev, "transmit_serial TEST\n");
-		return 0;
-	}
-
 	spin_lock_irqsave(&dev->uart_lock, flags);
 	//  print_UART_stat(dev);
 	reg = 0;
@@ -297,11 +287,6 @@ int si_receive_serial(struct SIDEVICE *dev, __u8 *pdata)
 	unsigned long flags;
 	__u8 reg;
 
-	if (dev->test) {
-		si_info(dev, "receive_serial TEST\n");
-		return 0;
-	}
-
 	spin_lock_irqsave(&dev->uart_lock, flags);
 	reg = UART_REG_READ(dev, SERIAL_LSR);
 
@@ -353,11 +338,6 @@ int si_uart_break(struct SIDEVICE *dev, int break_time)
 	unsigned char uc;
 	unsigned long flags;
 
-	if (dev->test) {
-		si_info(dev, "uart_break TEST\n");
-		return 0;
-	}
-
 	spin_lock_irqsave(&dev->uart_lock, flags);
 	uc = UART_REG_READ(dev, SERIAL_LCR); // assert break (signal low)
 	UART_REG_WRITE(dev, SERIAL_LCR, (__u8)(uc | 0x40));